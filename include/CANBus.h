@@ -47,14 +47,54 @@ public:
     bool sendSensors(int16_t indoorTemp, int16_t pressure1, int16_t pressure2);
     bool sendHeartbeat(CANNodeId node);
 
-    // Receive callback — called from poll task on main loop
+    // Receive handlers, per standard (11-bit) ID or inclusive ID range.
+    // They are called on the RX task as soon as a frame arrives, so they
+    // must be quick and must not touch state owned by the main loop
+    // (thermostat, relays): hand such work over to the loop instead. Every
+    // handler whose range holds the ID is called, in registration order.
+    //
+    // begin() derives the hardware acceptance filter from the registered
+    // ranges, so handlers are added before it; false once the bus is
+    // running, if the table is full or the range is not 11-bit.
     typedef std::function<void(uint32_t id, const uint8_t* data, uint8_t len)> RxCallback;
-    void onReceive(RxCallback cb) { _rxCallback = cb; }
+    static const uint8_t MAX_HANDLERS = 8;
+    bool onReceive(uint32_t id, RxCallback cb) { return onReceive(id, id, cb); }
+    bool onReceive(uint32_t first, uint32_t last, RxCallback cb);
+
+    // The RX task blocks in twai_read_alerts() and wakes on RX_DATA to
+    // drain the driver queue, and on bus state alerts: bus-off starts
+    // recovery, and the bus is started again once it has recovered.
+    // RX_ALERT_WAIT_MS only bounds how long stop() waits for the task.
+    static const uint32_t RX_TASK_STACK = 4096;
+    static const UBaseType_t RX_TASK_PRIORITY = 5;
+    static const uint32_t RX_ALERT_WAIT_MS = 1000;
+    // RX latency histogram upper bounds, µs; the last bucket is open
+    static const uint8_t LATENCY_BUCKETS = 8;
+    static constexpr uint32_t LATENCY_BOUNDS_US[LATENCY_BUCKETS - 1] = {20, 50, 100, 250, 1000, 2500, 10000};
 
     // Stats
     uint32_t getTxCount() const { return _txCount; }
     uint32_t getRxCount() const { return _rxCount; }
     uint32_t getErrorCount() const { return _errCount; }
+    uint32_t getBusOffCount() const { return _busOffCount; }
+    uint32_t getRxOverruns() const { return _rxOverruns; }
+    // RX task wakeups and the time spent awake
+    uint32_t getWakeups() const { return _wakeups; }
+    uint64_t getBusyUs() const { return _busyUs; }
+    // Alert wakeup to handler call, per frame. The hardware does not stamp
+    // frames, so the ISR-to-task wakeup is not included.
+    uint32_t getLatencyMaxUs() const { return _latencyMaxUs; }
+    uint32_t getLatencyAvgUs() const { return _rxCount ? (uint32_t)(_latencySumUs / _rxCount) : 0; }
+    uint32_t getLatencyBucket(uint8_t i) const { return i < LATENCY_BUCKETS ? _latencyHist[i] : 0; }
+    // Acceptance filter: "single", "dual", or "all" with no handlers, and
+    // how many of the 2048 standard IDs it lets through. Frames the
+    // controller rejects are not seen by software and are not counted.
+    const char* getFilterMode() const { return _filterMode; }
+    uint16_t getFilterIds() const { return _filterIds; }
+    // Frames past the hardware filter that reached a handler, and those
+    // only the software check rejected
+    uint32_t getDeliveredCount() const { return _deliveredCount; }
+    uint32_t getSwFilteredCount() const { return _swFilteredCount; }
     twai_status_info_t getStatus();
 
 private:
@@ -63,17 +103,38 @@ private:
     gpio_num_t _rxPin;
     bool _running = false;
 
-    Task* _tPoll = nullptr;
     Task* _tHeartbeat = nullptr;
-
-    RxCallback _rxCallback = nullptr;
+    TaskHandle_t _rxTask = nullptr;
+    volatile bool _rxStop = false;
+
+    struct Handler {
+        uint32_t first;
+        uint32_t last;
+        RxCallback cb;
+    };
+    Handler _handlers[MAX_HANDLERS];
+    uint8_t _handlerCount = 0;
+    const char* _filterMode = "all";
+    uint16_t _filterIds = 2048;
 
     uint32_t _txCount = 0;
     uint32_t _rxCount = 0;
     uint32_t _errCount = 0;
-
-    void poll();
-    void recoverBus();
+    uint32_t _busOffCount = 0;
+    uint32_t _rxOverruns = 0;
+    uint32_t _wakeups = 0;
+    uint64_t _busyUs = 0;
+    uint32_t _latencyMaxUs = 0;
+    uint64_t _latencySumUs = 0;
+    uint32_t _latencyHist[LATENCY_BUCKETS] = {};
+    uint32_t _deliveredCount = 0;
+    uint32_t _swFilteredCount = 0;
+
+    twai_filter_config_t buildFilter();
+
+    static void rxTask(void* arg);
+    void receiveFrames(int64_t wokeUs);
+    void handleAlerts(uint32_t alerts);
 };
 
 #endif
@@ -15,7 +15,7 @@ struct ProjectInfo {
     String encrypt;
     bool encrypted;
     uint32_t maxLogSize;
-    uint8_t maxOldLogCount;
+    uint32_t logArchiveBytes;  // gzipped rotated logs kept on flash
     String timezone;
 
     // Thermostat set points and mode
@@ -66,6 +66,34 @@ struct ProjectInfo {
 
     // Safe mode
     bool forceSafeMode;
+
+    // Pressure capture (buffers sized at boot — changes need a reboot)
+    bool captureEnabled;
+    uint32_t capturePreMs;
+    uint32_t capturePostMs;
+    uint8_t captureSlots;
+    String captureTriggers;  // comma-separated OutPin names
+
+    // Log history ring in PSRAM (bytes, resized live)
+    uint32_t logHistoryBytes;
+
+    // Remote syslog over UDP (empty host = off, applied live)
+    String syslogHost;
+    uint16_t syslogPort;
+    uint16_t syslogRate;   // lines/s, 0 = unlimited
+
+    // MQTT store-and-forward replay after a reconnect (applied live)
+    uint16_t mqttReplayRate;   // messages/s
+
+    // QoS 1 in-flight window (1-16) and QoS of snapshots/replays (applied live)
+    uint8_t mqttInflightWindow;
+    uint8_t mqttEventQos;
+
+    // Binary telemetry frame interval, 0 = off (applied live)
+    uint16_t mqttTelemetryMs;
+
+    // Accept partial configs on <prefix>/config/set (applied live)
+    bool mqttConfigEnabled;
 };
 
 class Config {
@@ -0,0 +1,168 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <Arduino.h>
+#include <functional>
+#include <stdio.h>
+#include <esp_partition.h>
+
+// Circular log in a raw flash partition, written without a filesystem.
+// Every sector starts with a SectorHeader and holds CRC-checked records
+// appended back to back; a record never spans sectors. The sector after
+// the head is always erased, so the oldest data goes one sector at a time
+// and wear is spread evenly over the partition.
+//
+// At boot the head is found by binary search over the sector headers
+// (their seq rises along the ring and drops past the erased gap), then the
+// head sector is scanned for the write offset. A record torn by a reset
+// fails its CRC and is skipped.
+class FlashLog {
+public:
+    // Flash access. Writes can only clear bits; erase sets a sector to 0xFF.
+    // Recovery and the record format only go through this interface, so
+    // they also run against a flash image in a file on a PC.
+    class Storage {
+    public:
+        virtual ~Storage() {}
+        virtual size_t size() const = 0;
+        virtual bool read(size_t offset, void* dst, size_t len) = 0;
+        virtual bool write(size_t offset, const void* src, size_t len) = 0;
+        virtual bool erase(size_t offset, size_t len) = 0;
+    };
+
+    class PartitionStorage : public Storage {
+    public:
+        explicit PartitionStorage(const esp_partition_t* part) : _part(part) {}
+        size_t size() const override { return _part->size; }
+        bool read(size_t offset, void* dst, size_t len) override;
+        bool write(size_t offset, const void* src, size_t len) override;
+        bool erase(size_t offset, size_t len) override;
+    private:
+        const esp_partition_t* _part;
+    };
+
+    // Flash image in a file, for the host tests. A missing or short file
+    // is extended with erased (0xFF) bytes. Writes AND into what is there
+    // and erase takes whole sectors, as on the chip.
+    class FileStorage : public Storage {
+    public:
+        FileStorage(const char* path, size_t size);
+        ~FileStorage() override;
+        bool isOpen() const { return _file != nullptr; }
+        size_t size() const override { return _size; }
+        bool read(size_t offset, void* dst, size_t len) override;
+        bool write(size_t offset, const void* src, size_t len) override;
+        bool erase(size_t offset, size_t len) override;
+    private:
+        bool fill(size_t offset, size_t len);
+        FILE* _file;
+        size_t _size;
+    };
+
+    struct SectorHeader {
+        uint32_t magic;         // SECTOR_MAGIC
+        uint32_t seq;           // rises by one per opened sector
+        uint32_t firstLine;     // line seq of the sector's first record
+        uint32_t reserved;      // 0xFFFFFFFF
+    };
+
+    // Followed by len payload bytes: lines separated by '\n'. Records are
+    // padded to 4 bytes. crc covers line, lines and the payload.
+    struct RecordHeader {
+        uint16_t len;
+        uint16_t lenInv;        // ~len, tells a written header from a torn one
+        uint32_t line;          // seq of the first line
+        uint16_t lines;
+        uint16_t reserved;      // 0xFFFF
+        uint32_t crc;
+    };
+
+    static const size_t SECTOR_SIZE = 4096;
+    static const uint32_t SECTOR_MAGIC = 0x31474C46;   // "FLG1"
+    static const size_t MAX_PAYLOAD = SECTOR_SIZE - sizeof(SectorHeader) - sizeof(RecordHeader);
+    static const uint32_t MIN_SECTORS = 4;
+
+    // Called oldest first with each line (NUL terminated); return false to stop
+    typedef std::function<bool(uint32_t seq, const char* line, size_t len)> LineFn;
+
+    FlashLog();
+    ~FlashLog();
+
+    // Partition found by label (data type, any subtype). False if it is
+    // missing or too small; the caller keeps the LittleFS log then.
+    bool begin(const char* label);
+    // Takes ownership of storage
+    bool begin(Storage* storage);
+    bool isReady() const { return _storage != nullptr; }
+
+    // One record with up to MAX_PAYLOAD bytes of '\n' separated lines
+    bool append(const char* data, size_t len, uint16_t lines);
+
+    // Lines with seq >= since, oldest first. Only data written before the
+    // call is visited; the sector being erased ahead may lose records while
+    // it is read. Returns the seq after the last line visited.
+    uint32_t readLines(uint32_t since, const LineFn& fn);
+
+    // Whole log as text, a buffer at a time (HTTP chunked downloads)
+    class Reader {
+    public:
+        explicit Reader(FlashLog& log);
+        ~Reader();
+        // Bytes written to buf; 0 at the end
+        size_t fill(char* buf, size_t maxLen);
+    private:
+        bool nextRecord();
+        FlashLog& _log;
+        char* _rec;
+        size_t _recLen = 0;
+        size_t _recOff = 0;
+        uint32_t _step = 0;     // sectors visited, oldest first
+        uint32_t _sector = 0;
+        size_t _offset = 0;
+        uint32_t _endSector;
+        size_t _endOffset;
+        bool _done = false;
+    };
+
+    size_t getCapacity() const { return _storage ? (size_t)_sectors * SECTOR_SIZE : 0; }
+    uint32_t getSectors() const { return _sectors; }
+    uint32_t getHeadSector() const { return _head; }
+    size_t getHeadOffset() const { return _offset; }
+    uint32_t getNextLine() const { return _nextLine; }
+    uint32_t getOldestLine();
+    uint32_t getRecords() const { return _records; }
+    uint32_t getBytesWritten() const { return _bytesWritten; }
+    uint32_t getErases() const { return _erases; }
+    uint32_t getCrcErrors() const { return _crcErrors; }
+    uint32_t getWriteErrors() const { return _writeErrors; }
+    uint32_t getRecoverProbes() const { return _recoverProbes; }
+    uint32_t getRecoverUs() const { return _recoverUs; }
+
+private:
+    bool sectorHeader(uint32_t sector, SectorHeader& h);
+    bool recover();
+    bool openSector(uint32_t sector);
+    // Record at offset of sector: 1 = valid (payload in buf), 0 = end of
+    // sector data, -1 = bad CRC (len still set so the caller can skip it)
+    int readRecord(uint32_t sector, size_t offset, RecordHeader& h, char* buf);
+    static size_t recordSize(size_t len) { return (sizeof(RecordHeader) + len + 3) & ~(size_t)3; }
+    static uint32_t recordCrc(const RecordHeader& h, const char* payload);
+
+    Storage* _storage;
+    uint32_t _sectors;
+    volatile uint32_t _head;    // sector being filled
+    volatile size_t _offset;    // write offset inside it
+    uint32_t _sectorSeq;
+    uint32_t _nextLine;
+    char* _buf;                 // append staging, SECTOR_SIZE
+
+    uint32_t _records;
+    uint32_t _bytesWritten;
+    uint32_t _erases;
+    uint32_t _crcErrors;
+    uint32_t _writeErrors;
+    uint32_t _recoverProbes;
+    uint32_t _recoverUs;
+};
+
+#endif
@@ -15,6 +15,11 @@ public:
     // Two-point linear calibration: value = slope * raw + offset
     void setCalibration(int32_t raw1, float val1, int32_t raw2, float val2);
 
+    // Convert a raw reading with the current calibration (no sensor access)
+    float toCalibrated(int32_t raw) const { return _slope * (float)raw + _offset; }
+    float getSlope() const { return _slope; }
+    float getOffset() const { return _offset; }
+
     float getLastValue() const { return _lastValue; }
     int32_t getLastRaw() const { return _lastRaw; }
     bool isValid() const { return _valid; }
@@ -13,6 +13,9 @@ class Scheduler;
 class Task;
 class SessionManager;
 class HX710;
+class MQTTHandler;
+class ReconnectPolicy;
+class CANBus;
 
 struct HttpsContext {
     Config* config;
@@ -23,6 +26,9 @@ struct HttpsContext {
     String* timezone;
     HX710* pressure1;
     HX710* pressure2;
+    MQTTHandler* mqtt;
+    ReconnectPolicy* wifiBackoff;
+    CANBus* can;
     // WiFi test state (shared with WebHandler)
     String* wifiTestState;
     String* wifiTestMessage;
@@ -0,0 +1,85 @@
+#ifndef JSONSTREAM_H
+#define JSONSTREAM_H
+
+#include <Arduino.h>
+#include <functional>
+#include "Logger.h"
+
+// Fixed-buffer writer for large JSON responses, usable as an ArduinoJson
+// Print target. Peak memory is the buffer, not the document.
+//  - Push mode: the buffer goes to sink() whenever it fills and on end()
+//    (httpd_resp_send_chunk).
+//  - Window mode: only bytes [skip, skip + size) are kept, for fillers that
+//    are called again with a growing offset (AsyncWebServer responses).
+class JsonStream : public Print {
+public:
+    typedef std::function<bool(const char* data, size_t len)> SinkFn;
+
+    JsonStream(char* buf, size_t size, const SinkFn& sink);
+    JsonStream(char* buf, size_t size, size_t skip);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t len) override;
+    using Print::write;
+
+    // Quoted, escaped JSON string
+    void string(const char* s);
+    // Push mode: send what is left. False if any sink call failed.
+    bool end();
+
+    size_t length() const { return _len; }      // bytes currently in buf
+    size_t total() const { return _total; }     // bytes produced so far
+    bool failed() const { return _failed; }
+
+    // Quoted, escaped copy of s in dst. Returns the length, 0 if it doesn't fit.
+    static size_t escape(char* dst, size_t room, const char* s);
+
+private:
+    char* _buf;
+    size_t _size;
+    size_t _len = 0;
+    size_t _skip = 0;
+    size_t _total = 0;
+    bool _failed = false;
+    SinkFn _sink;
+};
+
+// /log response body {"entries":["...",...],<tail>} produced a chunk at a
+// time. Each fill() renders entries straight from the history ring into the
+// caller's buffer and releases the history lock before returning, so a slow
+// client never holds up the logger. tail() supplies the members after the
+// entries once the cursor is known.
+class LogJsonSource {
+public:
+    typedef std::function<String(const Logger::HistoryCursor& cur)> TailFn;
+
+    // flash: read the flash log (Logger::queryFlash) instead of the history ring
+    LogJsonSource(const Logger::HistoryQuery& q, const String& contains, const TailFn& tail,
+                  bool flash = false);
+
+    // Bytes written to buf; 0 once the whole body has been produced
+    size_t fill(char* buf, size_t maxLen);
+    bool done() const { return _stage == DONE && _pendingOff >= _pending.length(); }
+    size_t total() const { return _total; }
+    const Logger::HistoryCursor& cursor() const { return _cur; }
+
+private:
+    enum Stage : uint8_t { HEAD, ENTRIES, TAIL, DONE };
+
+    void start();
+    Logger::HistoryCursor query(const Logger::HistoryQuery& q, const Logger::HistoryFn& fn);
+
+    Logger::HistoryQuery _q;
+    String _contains;           // owned copy, _q.contains points here
+    TailFn _tail;
+    bool _flash;
+    Logger::HistoryCursor _cur;
+    Stage _stage = HEAD;
+    bool _queried = false;      // lost/reset come from the first walk
+    size_t _remaining = 0;      // entries still allowed by limit/tail
+    String _pending;            // part of an entry (or the tail) that didn't fit
+    size_t _pendingOff = 0;
+    size_t _total = 0;
+};
+
+#endif
@@ -3,40 +3,266 @@
 
 #include <Arduino.h>
 #include <AsyncMqttClient.h>
-class AsyncWebSocket;  // forward declaration — full include in Logger.cpp
+class AsyncWebSocket;  // forward declarations — full include in Logger.cpp
+class FlashLog;
+class MqttQueue;
 #include <LittleFS.h>
 #include <ESP32-targz.h>
 #include <vector>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <esp_timer.h>
+#include <esp_system.h>
+
+// Compile-time minimum: calls above this level (0=ERROR .. 3=DEBUG) are
+// dead code. Set with -D LOG_COMPILE_LEVEL=n in platformio.ini.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 3
+#endif
 
 class Logger {
 public:
     enum Level { LOG_ERROR = 0, LOG_WARN = 1, LOG_INFO = 2, LOG_DEBUG = 3 };
 
     static const uint32_t DEFAULT_MAX_FILE_SIZE = 512 * 1024;  // 512KB (LittleFS is smaller than SD)
-    static const uint8_t DEFAULT_MAX_ROTATED_FILES = 3;
-    static const size_t DEFAULT_RING_BUFFER_SIZE = 500;
+    static const uint32_t DEFAULT_ARCHIVE_BYTES = 256 * 1024;  // compressed rotated logs kept on flash
+    static const uint32_t ARCHIVE_TASK_STACK = 8192;
+    static const size_t DEFAULT_HISTORY_BYTES = 256 * 1024;   // PSRAM, several thousand lines
+    static const size_t MIN_HISTORY_BYTES = 8 * 1024;
+
+    // Record queue between log() and the sink task
+    static const uint32_t QUEUE_SLOTS = 64;          // power of two
+    static const size_t MSG_SIZE = 384;
+    static const uint32_t SINK_TASK_STACK = 6144;
+    static const uint32_t SINK_RETRY_MS = 100;       // re-drain interval for stalled sinks
+
+    // File sink write-behind buffer
+    static const size_t FILE_BUFFER_SIZE = 4096;
+    static const uint32_t FILE_FLUSH_MS = 5000;      // max age of buffered lines
+    static const uint32_t FLUSH_WAIT_MS = 200;       // flush() wait for the sink task
+
+    // WebSocket sink: lines are coalesced for WS_BATCH_MS into one JSON frame
+    // per client. A client whose send queue is backed up is skipped and told
+    // how many lines it missed in its next frame. The queue bound is
+    // WS_MAX_QUEUED_MESSAGES (platformio.ini).
+    static const size_t WS_BATCH_SIZE = 8192;
+    static const size_t WS_HEADER_ROOM = 64;         // frame header written in front of the lines
+    static const uint32_t WS_BATCH_MS = 100;
+    static const uint8_t WS_MAX_CLIENTS = 8;
+
+    // Crash tail in RTC no-init RAM (survives panic and watchdog resets)
+    static const size_t CRASH_LOG_BYTES = 3072;
+    static const size_t CRASH_LINE_MAX = 192;       // longer lines are cut
+
+    // UDP syslog sink (RFC 5424): lines are packed into one datagram of up to
+    // SYSLOG_DATAGRAM bytes (Ethernet MTU minus IP/UDP headers), sent when the
+    // next line won't fit or SYSLOG_BATCH_MS after the first line.
+    static const size_t SYSLOG_DATAGRAM = 1472;
+    static const size_t SYSLOG_HEADER_ROOM = 192;    // message header written in front of the lines
+    static const uint32_t SYSLOG_BATCH_MS = 500;
+    static const uint16_t SYSLOG_DEFAULT_PORT = 514;
+    static const uint16_t SYSLOG_DEFAULT_RATE = 50;  // lines per second, bursts up to one second's worth
+    static const uint32_t SYSLOG_RESOLVE_RETRY_MS = 30000;
+
+    enum Sink { SINK_HISTORY = 0, SINK_SERIAL, SINK_MQTT, SINK_FILE, SINK_WEBSOCKET, SINK_SYSLOG, SINK_COUNT };
+
+    // Per-tag levels. Tags are interned on first use; lookups hash the
+    // literal's address, so no string compares on the logging path.
+    static const uint8_t MAX_TAGS = 32;
+    static const uint8_t TAG_NAME_LEN = 12;
+    static const uint8_t TAG_HASH_SLOTS = 128;       // power of two
+    static const int8_t TAG_LEVEL_GLOBAL = -1;        // tag follows setLevel()
+
+    // Repeat suppression: a line identical to one seen within the window
+    // (same tag, format and arguments) is only counted; "last message
+    // repeated N times: <line>" follows when the window closes. Slots are
+    // keyed by the format literal's address and a hash of the packed
+    // arguments, of which the first REPEAT_ARGS bytes are compared. WARN
+    // and ERROR lines are never suppressed.
+    static const uint8_t REPEAT_SLOTS = 64;          // power of two
+    static const size_t REPEAT_ARGS = 48;
+    static const uint32_t DEFAULT_REPEAT_WINDOW_MS = 10000;
+    static const uint32_t SUPPRESS_SWEEP_MS = 1000;  // sink task emits due summaries
 
     Logger();
 
+    // Start the sink task. Until then log() writes to the sinks synchronously.
+    void begin();
+
+    // Drain the queue and write buffered file lines. Also runs from the
+    // esp_restart() shutdown hook so ESP.restart() doesn't lose the tail.
+    void flush();
+
     void setLevel(Level level);
     Level getLevel();
     const char* getLevelName(Level level);
 
-    void error(const char* tag, const char* format, ...);
-    void warn(const char* tag, const char* format, ...);
-    void info(const char* tag, const char* format, ...);
-    void debug(const char* tag, const char* format, ...);
+    // tag and format must be string literals: in binary mode only the
+    // pointers are stored and the text is rendered when a sink consumes it.
+    // Levels above LOG_COMPILE_LEVEL fold to nothing; argument expressions
+    // without side effects are dropped along with the call.
+    template<typename... Args>
+    void error(const char* tag, const char* format, Args... args) {
+        if (LOG_COMPILE_LEVEL >= LOG_ERROR && isEnabled(LOG_ERROR, tag) && admit(LOG_ERROR, tag, format, args...)) emit(LOG_ERROR, tag, format, args...);
+    }
+    template<typename... Args>
+    void warn(const char* tag, const char* format, Args... args) {
+        if (LOG_COMPILE_LEVEL >= LOG_WARN && isEnabled(LOG_WARN, tag) && admit(LOG_WARN, tag, format, args...)) emit(LOG_WARN, tag, format, args...);
+    }
+    template<typename... Args>
+    void info(const char* tag, const char* format, Args... args) {
+        if (LOG_COMPILE_LEVEL >= LOG_INFO && isEnabled(LOG_INFO, tag) && admit(LOG_INFO, tag, format, args...)) emit(LOG_INFO, tag, format, args...);
+    }
+    template<typename... Args>
+    void debug(const char* tag, const char* format, Args... args) {
+        if (LOG_COMPILE_LEVEL >= LOG_DEBUG && isEnabled(LOG_DEBUG, tag) && admit(LOG_DEBUG, tag, format, args...)) emit(LOG_DEBUG, tag, format, args...);
+    }
+
+    // Cheap global check first; the tag table is consulted only when some
+    // tag has an override.
+    bool isEnabled(Level level, const char* tag) {
+        if (level > _maxLevel) return false;
+        if (_tagOverrides == 0) return level <= _level;
+        int8_t tagLevel = _tags[tagId(tag)].level;
+        return level <= (tagLevel >= 0 ? tagLevel : _level);
+    }
+
+    // level TAG_LEVEL_GLOBAL clears the override. Returns false if the tag table is full.
+    bool setTagLevel(const char* tag, int8_t level);
+    int8_t getTagLevel(const char* tag);
+    uint8_t getTagCount() const { return _tagCount; }
+    const char* getTagName(uint8_t id) const { return id < _tagCount ? _tags[id].name : ""; }
+    int8_t getTagLevelById(uint8_t id) const { return id < _tagCount ? _tags[id].level : TAG_LEVEL_GLOBAL; }
+    uint8_t tagId(const char* tag);
+
+    // 0 turns repeat suppression off
+    void setRepeatWindow(uint32_t ms) { _repeatWindow = ms; }
+    uint32_t getRepeatWindow() const { return _repeatWindow; }
+    // Token bucket per tag: rate lines/s, bursts up to burst lines (0 = rate).
+    // rate 0 removes the limit. Returns false if the tag table is full.
+    bool setTagRate(const char* tag, uint16_t rate, uint16_t burst = 0);
+    uint16_t getTagRateById(uint8_t id) const { return id < _tagCount ? _tags[id].rate : 0; }
+    uint16_t getTagBurstById(uint8_t id) const { return id < _tagCount ? _tags[id].burst : 0; }
+    uint32_t getTagRepeatsById(uint8_t id) const { return id < _tagCount ? _tags[id].repeats : 0; }
+    uint32_t getTagRateLimitedById(uint8_t id) const { return id < _tagCount ? _tags[id].rateLimited : 0; }
+
+    // WARN/ERROR, plus INFO of tags marked here, are also copied as text into
+    // the crash tail by the logging task itself, so nothing depends on the
+    // sink task or flash having caught up when the chip resets.
+    bool setCrashTag(const char* tag, bool enable);
+    // Call once at boot, before begin(). After a panic/watchdog reset the
+    // tail is replayed into the log prefixed with the reset reason; the ring
+    // then starts empty. Returns the number of lines recovered.
+    size_t recoverCrashLog(esp_reset_reason_t reason);
+    static const char* getResetReasonName(esp_reset_reason_t reason);
+    size_t getCrashBytesUsed() const;
+    uint32_t getCrashLinesRecovered() const { return _crashRecovered; }
+
+    // Binary mode: capture the format pointer and raw args, render on the sink side
+    void setBinaryMode(bool enable) { _binaryMode = enable; }
+    bool isBinaryMode() const { return _binaryMode; }
 
     void setMqttClient(AsyncMqttClient* client, const char* topic);
+    // Lines written while the broker is away (or older lines are still
+    // being replayed) are stored there instead of dropped. After
+    // setMqttClient(): the queue keeps a pointer to the topic.
+    void setMqttQueue(MqttQueue* queue);
     void setLogFile(const char* filename,
                     uint32_t maxFileSize = DEFAULT_MAX_FILE_SIZE,
-                    uint8_t maxRotatedFiles = DEFAULT_MAX_ROTATED_FILES);
+                    uint32_t archiveBytes = DEFAULT_ARCHIVE_BYTES);
+
+    // Rotated logs are gzipped by a background task; the oldest archives are
+    // deleted once their total size exceeds the archive budget.
+    const String& getLogFilename() const { return _logFilename; }
+
+    // Raw flash partition instead of the LittleFS log file: buffered lines
+    // are appended as records, and rotation/archiving no longer apply.
+    void setFlashLog(FlashLog* flash);
+    FlashLog* getFlashLog() const { return _flashLog; }
+
+    typedef std::function<void(uint32_t index, size_t bytes, bool compressed)> ArchiveFn;
+    void listArchives(const ArchiveFn& fn);
+    String getArchiveFilename(uint32_t index, bool compressed = true);
+    uint32_t getArchiveBudget() const { return _archiveBytes; }
+    uint32_t getArchivedFiles() const { return _gzFiles; }
+    uint32_t getArchiveFailures() const { return _gzFailures; }
+    float getArchiveRatio() const { return _gzOutBytes ? (float)_gzInBytes / _gzOutBytes : 0.0f; }
+    uint32_t getArchiveMsAvg() const { return _gzFiles ? _gzMsTotal / _gzFiles : 0; }
+    uint32_t getArchiveMsLast() const { return _gzMsLast; }
 
     void setWebSocket(AsyncWebSocket* ws);
-    void setRingBufferSize(size_t maxEntries);
-    const std::vector<String>& getRingBuffer() const;
-    size_t getRingBufferHead() const;
-    size_t getRingBufferCount() const;
+    // From the server's connect/disconnect events: only opened clients get
+    // log frames
+    void openWebSocket(uint32_t clientId);
+    void closeWebSocket(uint32_t clientId);
+    // Replay history from seq since to a client, then continue live. The
+    // replay is paced by the client's send queue and replaces its live frames
+    // until it catches up.
+    void resumeWebSocket(uint32_t clientId, uint32_t since);
+    uint32_t getWsFrames() const { return _wsFrames; }
+    uint32_t getWsBytes() const { return _wsBytes; }
+    uint32_t getWsSkipped() const { return _wsSkipped; }   // lines not sent to backed-up clients
+
+    // Empty host disables the sink. host may be an IP or a name (resolved on
+    // the sink task, retried every SYSLOG_RESOLVE_RETRY_MS). rate 0 = unlimited.
+    void setSyslog(const char* host, uint16_t port = SYSLOG_DEFAULT_PORT,
+                   uint16_t rate = SYSLOG_DEFAULT_RATE, const char* hostname = nullptr);
+    bool isSyslogEnabled() const { return _syslogEnabled; }
+    const String& getSyslogHost() const { return _syslogHost; }
+    uint16_t getSyslogPort() const { return _syslogPort; }
+    uint16_t getSyslogRate() const { return _syslogRate; }
+    bool isSyslogResolved() const { return _syslogAddr != 0; }
+    uint32_t getSyslogDatagrams() const { return _syslogDatagrams; }
+    uint32_t getSyslogBytes() const { return _syslogBytes; }
+    uint32_t getSyslogLines() const { return _syslogLinesSent; }
+    uint32_t getSyslogRateDropped() const { return _syslogRateDropped; }
+    uint32_t getSyslogSendErrors() const { return _syslogSendErrors; }
+    uint32_t getSyslogSeq() const { return _syslogSeq; }   // sequenceId of the last datagram
+
+    // History ring: raw records in one PSRAM buffer, rendered only when read.
+    // Resizing keeps the newest entries that fit.
+    void setHistorySize(size_t bytes);
+    size_t getHistoryCapacity() const { return _histCap; }
+    size_t getHistoryBytesUsed() const { return _histUsed; }
+    size_t getHistoryCount() const { return _histCount; }
+
+    // Called oldest first with the rendered line; return false to stop.
+    typedef std::function<bool(uint32_t seq, Level level, const char* tag, const char* line)> HistoryFn;
+    // Visit entries with seq >= since; tail > 0 limits to the newest tail of them.
+    size_t readHistory(uint32_t since, size_t tail, const HistoryFn& fn);
+
+    // Incremental query. Level and tag filters are checked on the entry
+    // header; only candidates are rendered, and contains is matched on the
+    // rendered line.
+    struct HistoryQuery {
+        uint32_t since = 0;
+        size_t tail = 0;                // > 0: newest tail matches only
+        size_t limit = 0;               // > 0: oldest limit matches, then stop (more = true)
+        Level level = LOG_DEBUG;        // most verbose level included
+        uint32_t tagMask = 0xFFFFFFFF;  // bit per tag id
+        const char* contains = nullptr;
+    };
+    struct HistoryCursor {
+        size_t count = 0;               // entries passed to fn
+        uint32_t next = 0;              // since for the following poll
+        uint32_t lost = 0;              // entries after since already evicted
+        bool more = false;              // limit reached before the newest entry
+        bool reset = false;             // since was ahead of the log (device restarted), read from 0
+    };
+    HistoryCursor queryHistory(const HistoryQuery& q, const HistoryFn& fn);
+    // Same query over the flash log (this and earlier boots). seq is the
+    // flash line number; level and tag are parsed from the stored text.
+    HistoryCursor queryFlash(const HistoryQuery& q, const HistoryFn& fn);
+    // Tag id for a name already seen by the logger, or -1
+    int findTag(const char* name);
+    // Bit mask for a comma separated tag list; unknown names match nothing
+    uint32_t tagMask(const char* csv);
+
+    // Response bytes of log polls, for comparing full and incremental fetches
+    void countPoll(size_t bytes, bool incremental);
+    uint32_t getPollCount(bool incremental) const { return _polls[incremental]; }
+    uint32_t getPollBytesAvg(bool incremental) const { return _polls[incremental] ? _pollBytes[incremental] / _polls[incremental] : 0; }
 
     void enableSerial(bool enable);
     void enableMqtt(bool enable);
@@ -48,17 +274,210 @@ public:
     bool isFileLogEnabled();
     bool isWebSocketEnabled();
 
+    // Records a sink lost because the queue lapped it
+    uint32_t getDropped(Sink sink) const;
+    const char* getSinkName(Sink sink) const;
+    uint32_t getRecordCount() const { return _head.load(std::memory_order_relaxed); }
+    uint32_t getRecordsPerSec() const { return _recordsPerSec; }
+
+    // Producer-side cost per mode (false = vsnprintf text, true = binary capture)
+    uint32_t getCaptureRecords(bool binary) const { return _capture[binary].records.load(std::memory_order_relaxed); }
+    uint32_t getCaptureBytes(bool binary) const { return _capture[binary].bytes.load(std::memory_order_relaxed); }
+    uint32_t getCaptureUs(bool binary) const { return _capture[binary].us.load(std::memory_order_relaxed); }
+
+    // File sink
+    uint32_t getFlashBytes() const { return _flashBytes; }
+    uint32_t getFileFlushes() const { return _fileFlushes; }
+    uint32_t getFlushUsAvg() const { return _fileFlushes ? (uint32_t)(_flushUsTotal / _fileFlushes) : 0; }
+    uint32_t getFlushUsMax() const { return _flushUsMax; }
+
 private:
+    // Binary argument encoding: one type byte followed by the value
+    enum ArgType : uint8_t { ARG_END = 0, ARG_I32, ARG_I64, ARG_F64, ARG_PTR, ARG_STR };
+
+    struct Record {
+        uint32_t epoch;
+        uint8_t level;
+        uint8_t binary;         // msg holds packed args instead of text
+        uint16_t len;           // bytes used in msg
+        const char* tag;
+        const char* format;
+        char msg[MSG_SIZE];
+    };
+
+    // History entry header, followed by len payload bytes (text incl. NUL, or packed args)
+    struct HistoryEntry {
+        uint32_t seq;
+        uint32_t epoch;
+        const char* tag;
+        const char* format;
+        uint16_t len;           // HISTORY_WRAP marks unused space at the end of the buffer
+        uint8_t level;
+        uint8_t binary;
+    };
+    static const uint16_t HISTORY_WRAP = 0xFFFF;
+
+    struct TagInfo {
+        char name[TAG_NAME_LEN];
+        int8_t level;
+        bool crash;             // INFO lines also go to the crash tail
+        uint16_t rate;          // lines/s, 0 = unlimited
+        uint16_t burst;
+        uint32_t tokens;        // in 1/1000 lines
+        uint32_t refill;        // millis() of the last refill
+        uint32_t limitedPending;    // rate-dropped lines not yet summarized
+        uint32_t repeats;       // lines folded into repeat summaries
+        uint32_t rateLimited;   // lines dropped by the rate limit
+    };
+
+    struct RepeatSlot {
+        const char* tag;
+        const char* format;     // nullptr = free
+        uint32_t start;         // millis() of the line that opened the window
+        uint32_t count;         // repeats suppressed since
+        uint8_t level;
+        uint8_t argLen;
+        uint8_t args[REPEAT_ARGS];  // packed, to match and to render the summary
+    };
+
+    struct WsClient {
+        uint32_t id;            // 0 = free
+        uint32_t dropped;       // lines skipped since its last frame
+        uint32_t resumeSeq;     // next seq to replay
+        bool resume;
+    };
+
+    struct CaptureStats {
+        std::atomic<uint32_t> records;
+        std::atomic<uint32_t> bytes;
+        std::atomic<uint32_t> us;
+    };
+
+    // Seqlock slot: seq is 0 while a producer writes, record seq + 1 once committed
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        Record rec;
+    };
+
+    template<typename... Args>
+    void emit(Level level, const char* tag, const char* format, Args... args) {
+        if (!_binaryMode) {
+            logText(level, tag, format, args...);
+            return;
+        }
+        int64_t t0 = esp_timer_get_time();
+        uint32_t seq;
+        Record* rec = claim(level, tag, format, true, seq);
+        size_t off = 0;
+        uint8_t* buf = (uint8_t*)rec->msg;
+        int packed[] = {0, (off += packArg(buf + off, MSG_SIZE - off, args), 0)...};
+        (void)packed;
+        rec->len = off;
+        commit(seq, rec, t0);
+    }
+
+    template<typename V>
+    static size_t packScalar(uint8_t* dst, size_t room, ArgType type, V v) {
+        if (room < 1 + sizeof(V)) {
+            // Out of space: terminate so later (smaller) args don't shift position
+            if (room) dst[0] = ARG_END;
+            return room;
+        }
+        dst[0] = type;
+        memcpy(dst + 1, &v, sizeof(V));
+        return 1 + sizeof(V);
+    }
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+    packArg(uint8_t* dst, size_t room, T v) {
+        if (sizeof(T) > 4) return packScalar(dst, room, ARG_I64, (int64_t)v);
+        return packScalar(dst, room, ARG_I32, (int32_t)v);
+    }
+    template<typename T>
+    static size_t packArg(uint8_t* dst, size_t room, T* p) {
+        return packScalar(dst, room, ARG_PTR, (uint32_t)(uintptr_t)p);
+    }
+    static size_t packArg(uint8_t* dst, size_t room, double v) { return packScalar(dst, room, ARG_F64, v); }
+    static size_t packArg(uint8_t* dst, size_t room, const char* s);
+    static size_t packArg(uint8_t* dst, size_t room, char* s) { return packArg(dst, room, (const char*)s); }
+
+    // Arguments are packed only while repeat suppression can apply
+    template<typename... Args>
+    bool admit(Level level, const char* tag, const char* format, Args... args) {
+        if (_repeatWindow == 0 && _rateTags == 0) return true;
+        uint8_t packed[REPEAT_ARGS];
+        packed[0] = ARG_END;
+        size_t len = 0;
+        if (_repeatWindow && level > LOG_WARN) {
+            int dummy[] = {0, (len += packArg(packed + len, REPEAT_ARGS - len, args), 0)...};
+            (void)dummy;
+        }
+        return admitPacked(level, tag, format, packed, len);
+    }
+    bool admitPacked(Level level, const char* tag, const char* format, const uint8_t* args, size_t len);
+    void logRepeated(const RepeatSlot& r);
+    void sweepSuppressed();
+    void logText(Level level, const char* tag, const char* format, ...);
     void log(Level level, const char* tag, const char* format, va_list args);
+    uint8_t internTag(const char* name);
+    void updateMaxLevel();
+    Record* claim(Level level, const char* tag, const char* format, bool binary, uint32_t& seq);
+    void commit(uint32_t seq, Record* rec, int64_t t0);
+    void crashAppend(const Record& rec);
+    static void sinkTask(void* arg);
+    void drain();
+    int fetch(uint32_t seq);
+    void formatLine(const Record& rec);
+    static size_t formatEntry(uint32_t epoch, uint8_t level, const char* tag, const char* format,
+                              bool binary, const char* payload, size_t len, char* out, size_t outSize);
+    static size_t renderArgs(const char* format, const uint8_t* args, size_t len, char* out, size_t outSize);
+    bool historyFilter(const HistoryEntry* e, const HistoryQuery& q);
+    static size_t historyEntrySize(const HistoryEntry* e) { return (sizeof(HistoryEntry) + e->len + 3) & ~(size_t)3; }
+    void historyAppend(const HistoryEntry& hdr, const void* payload);
+    void historyEvict();
+    bool isSinkEnabled(Sink sink) const;
+    bool writeToSink(Sink sink, const char* msg);
     void writeToSerial(const char* msg);
-    void writeToMqtt(const char* msg);
+    bool writeToMqtt(const char* msg);
     void writeToFile(const char* msg);
-    void writeToWebSocket(const char* msg);
-    void addToRingBuffer(const char* msg);
+    void flushFileBuffer();
+    void flushToFlash();
+    static void shutdownHandler();
+    bool writeToWebSocket(const char* msg);
+    bool wsAppend(uint32_t seq, const char* line);
+    bool wsSend(uint32_t clientId, uint32_t dropped);
+    void flushWebSocket(bool timed);
+    void wsReplay(WsClient& wc);
+    WsClient* wsClient(uint32_t id);
+    bool writeToSyslog(const char* msg);
+    void flushSyslog();
+    bool syslogSocket();
+    void addToHistory();
     void rotateLogFiles();
-    String getRotatedFilename(uint8_t index);
+    static void archiveTask(void* arg);
+    void compressRotated();
+    bool compressFile(uint32_t index);
+    void enforceArchiveBudget();
+    // Index parsed from "<base>.<N>.txt" / "<base>.<N>.gz"; 0 if the name doesn't match
+    uint32_t parseArchiveIndex(const char* name, bool& compressed);
 
     Level _level;
+    volatile Level _maxLevel;                   // max of _level and all tag overrides
+    volatile uint8_t _tagOverrides;
+    TagInfo _tags[MAX_TAGS];
+    uint8_t _tagCount;
+    const char* _tagPtrs[TAG_HASH_SLOTS];      // literal address -> tag id
+    uint8_t _tagPtrIds[TAG_HASH_SLOTS];
+    portMUX_TYPE _tagMux;
+    uint32_t _repeatWindow;
+    RepeatSlot _repeats[REPEAT_SLOTS];
+    volatile uint8_t _rateTags;     // tags with a rate limit
+    uint32_t _lastSweep;
+    portMUX_TYPE _repeatMux;
+    uint8_t _crashTags;         // tags with the crash flag set
+    bool _crashCapture;         // off while recovered lines are replayed
+    uint32_t _crashRecovered;
+    portMUX_TYPE _crashMux;
     bool _serialEnabled;
     bool _mqttEnabled;
     bool _fileLogEnabled;
@@ -66,19 +485,95 @@ private:
 
     AsyncMqttClient* _mqttClient;
     String _mqttTopic;
+    MqttQueue* _mqttQueue;
+    uint8_t _mqttQueueTopic;
 
     AsyncWebSocket* _ws;
+    char* _wsBatch;             // WS_HEADER_ROOM, then the lines of the pending frame
+    size_t _wsBatchLen;
+    uint16_t _wsLines;
+    uint32_t _wsNext;           // seq after the last line seen by the WebSocket sink
+    uint32_t _wsLastFlush;
+    WsClient _wsClients[WS_MAX_CLIENTS];
+    portMUX_TYPE _wsMux;
+    uint32_t _wsFrames;
+    uint32_t _wsBytes;
+    uint32_t _wsSkipped;
+
+    bool _syslogEnabled;
+    String _syslogHost;
+    String _syslogHostname;     // HOSTNAME field, spaces replaced
+    uint16_t _syslogPort;
+    uint16_t _syslogRate;
+    size_t _syslogRoom;         // line bytes that fit next to the longest header
+    int _syslogSock;
+    uint32_t _syslogAddr;       // IPv4, network order; 0 = not resolved
+    uint32_t _syslogResolveMs;
+    char* _syslogBuf;           // SYSLOG_HEADER_ROOM, then the lines of the pending datagram
+    size_t _syslogLen;
+    uint16_t _syslogLines;
+    uint8_t _syslogSeverity;    // most severe level in the pending datagram
+    uint32_t _syslogFirst;      // log seq of its first line
+    uint32_t _syslogStart;      // millis() of its first line
+    uint32_t _syslogTokens;     // rate limit bucket, in 1/1000 lines
+    uint32_t _syslogRefill;
+    uint32_t _syslogPendingDrops;   // rate-dropped lines not yet reported in a datagram
+    uint32_t _syslogSeq;
+    uint32_t _syslogDatagrams;
+    uint32_t _syslogBytes;
+    uint32_t _syslogLinesSent;
+    uint32_t _syslogRateDropped;
+    uint32_t _syslogSendErrors;
 
     bool _fsReady;
+    FlashLog* _flashLog;
     String _logFilename;
     uint32_t _maxFileSize;
-    uint8_t _maxRotatedFiles;
+    uint32_t _archiveBytes;
+    uint32_t _archiveIndex;     // next rotation index (0 = scan flash first)
+    TaskHandle_t _archiveTask;
+    uint32_t _gzFiles;
+    uint32_t _gzFailures;
+    uint32_t _gzInBytes;
+    uint32_t _gzOutBytes;
+    uint32_t _gzMsTotal;
+    uint32_t _gzMsLast;
+    fs::File _logHandle;        // kept open between flushes
+    char* _fileBuf;
+    size_t _fileBufLen;
+    uint32_t _fileSize;         // tracked in memory, read once when the handle opens
+    uint32_t _lastFileFlush;
+    uint32_t _flashBytes;
+    uint32_t _fileFlushes;
+    uint64_t _flushUsTotal;
+    uint32_t _flushUsMax;
+
+    uint8_t* _hist;
+    size_t _histCap;
+    size_t _histHead;           // write offset
+    size_t _histTail;           // oldest entry offset
+    size_t _histCount;
+    size_t _histUsed;
+    SemaphoreHandle_t _histLock;
+
+    Slot* _slots;
+    TaskHandle_t _sinkTask;
+    SemaphoreHandle_t _sinkLock;    // serializes drain() between the sink task and flush()
+    std::atomic<uint32_t> _head;
+    uint32_t _cursor[SINK_COUNT];
+    uint32_t _dropped[SINK_COUNT];
 
-    std::vector<String> _ringBuffer;
-    size_t _ringBufferMax;
-    size_t _ringBufferHead;
-    size_t _ringBufferCount;
+    bool _binaryMode;
+    CaptureStats _capture[2];
+    uint32_t _polls[2];
+    uint32_t _pollBytes[2];
+    uint32_t _rateHead;
+    uint32_t _rateStart;
+    uint32_t _recordsPerSec;
 
+    // Sink-side scratch (only touched by the sink task, or by log() before begin())
+    Record _scratch;
+    uint32_t _scratchSeq;
     char _buffer[512];
 };
 
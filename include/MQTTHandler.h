@@ -2,13 +2,18 @@
 #define MQTTHANDLER_H
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
 #include <AsyncMqttClient.h>
 #include <WiFi.h>
 #include <TaskSchedulerDeclarations.h>
 #include "Logger.h"
+#include "MqttQueue.h"
+#include "MqttRouter.h"
+#include "ReconnectPolicy.h"
 #include "Thermostat.h"
 
 class HX710;
+class PressureCapture;
 
 class MQTTHandler {
   public:
@@ -19,24 +24,315 @@ class MQTTHandler {
     bool connected() const { return _client.connected(); }
     void setThermostat(Thermostat* thermostat);
     void setPressureSensors(HX710* sensor1, HX710* sensor2);
+    // Telemetry leaves the sensors alone while a capture is sampling them
+    void setPressureCapture(PressureCapture* capture) { _capture = capture; }
+    // Heartbeat: full JSON snapshot on <prefix>/state, plus any field whose
+    // value moved without a state version change (pressures)
     void publishState();
-    void setTopicPrefix(const String& prefix) { _topicPrefix = prefix; }
+    // Builds every topic string once; call before begin() (the LWT points
+    // into the topic pool)
+    void setTopicPrefix(const String& prefix);
     void setTempTopic(const String& topic) { _tempTopic = topic; }
+    void setDeviceName(const String& name) { if (name.length()) _deviceName = name; }
+    // Connect attempts are spaced by RECONNECT_* backoff with full jitter
     void startReconnect();
     void stopReconnect();
     void disconnect();
+    static const uint32_t RECONNECT_INITIAL_MS = 2000;
+    static const uint32_t RECONNECT_CAP_MS = 120000;
+    static const uint32_t RECONNECT_STABLE_MS = 60000;
+    static const uint32_t RECONNECT_MIN_MS = 1000;
+    const ReconnectPolicy& getBackoff() const { return _backoff; }
+
+    // Change-driven publishing: each field has a retained QoS 1 topic
+    // <prefix>/state/<field>. When the thermostat state version moves, the
+    // fields whose value changed are published once the version has been
+    // still for DEBOUNCE_MS, or MAX_DEBOUNCE_MS after the first change.
+    static const uint32_t POLL_MS = 50;
+    static const uint32_t DEBOUNCE_MS = 250;
+    static const uint32_t MAX_DEBOUNCE_MS = 1000;
+    static const uint32_t HEARTBEAT_S = 300;
+    static const uint8_t FIELD_COUNT = 10 + OUT_COUNT + IN_COUNT + 4;
+    static const uint8_t FIELD_VALUE_SIZE = 16;
+    static const uint8_t MAX_PREFIX = 64;
+    // Heartbeat snapshot, written straight from the field values. The size
+    // is checked against the field list at compile time (MQTTHandler.cpp).
+    static const uint16_t STATE_JSON_SIZE = 928;
+
+    uint32_t getPublishedVersion() const { return _publishedVersion; }
+    uint32_t getChangePublishes() const { return _changePublishes; }
+    uint32_t getFieldPublishes() const { return _fieldPublishes; }
+    uint32_t getHeartbeats() const { return _heartbeats; }
+    uint32_t getPublishErrors() const { return _publishErrors; }
+    uint32_t getAcks() const { return _acks; }
+    // State change to PUBACK, over acked change publishes
+    uint32_t getLatencyLastMs() const { return _latencyLastMs; }
+    uint32_t getLatencyMaxMs() const { return _latencyMaxMs; }
+    uint32_t getLatencyAvgMs() const { return _acks ? (uint32_t)(_latencySumMs / _acks) : 0; }
+
+    // Home Assistant: discovery configs under DISCOVERY_PREFIX for a climate
+    // entity, stage/pressure/CPU sensors and the force switches, published
+    // on connect and when HA announces itself on <DISCOVERY_PREFIX>/status.
+    // Commands arrive on <prefix>/set/<mode|heat_setpoint|cool_setpoint|
+    // force_furnace|force_no_hp> and go through the Thermostat command API.
+    // The client task only queues them; applyCommands(), called from
+    // loop(), hands them to the thermostat.
+    static constexpr const char* DISCOVERY_PREFIX = "homeassistant";
+    // Incoming topics: commands, HA status and the temperature topic are
+    // registered by begin(); more can be added any time and are subscribed
+    // right away if connected, and again on every connect
+    bool subscribe(const char* filter, uint8_t qos, MqttRouter::Handler handler);
+    const MqttRouter& getRouter() const { return _router; }
+
+    // Remote config: a partial /api/config/save document on
+    // <prefix>/config/set (reassembled by the router, up to
+    // MqttRouter::MAX_MESSAGE) goes through the same checks and is applied
+    // by the ConfigFn only if every key passes. The outcome goes to
+    // <prefix>/config/result, echoing the document's "id" so a sender can
+    // match answers from many devices. Off unless enabled.
+    typedef std::function<bool(JsonDocument& doc, bool& needsReboot, String& error)> ConfigFn;
+    void onConfig(ConfigFn fn) { _configFn = fn; }
+    void setConfigEnabled(bool enabled) { _configEnabled = enabled; }
+    bool getConfigEnabled() const { return _configEnabled; }
+    uint32_t getConfigRequests() const { return _configRequests; }
+    uint32_t getConfigErrors() const { return _configErrors; }
+    uint32_t getDiscoveryPublishes() const { return _discoveryPublishes; }
+    void applyCommands();
+    uint32_t getCommands() const { return _commands; }
+    uint32_t getCommandErrors() const { return _commandErrors; }
+
+    // Store-and-forward: while the broker is away, state snapshots (changes
+    // and heartbeats, with their "ts") and log lines go to the queue. After
+    // a reconnect they are replayed to their original topics at the replay
+    // rate, and live snapshots queue behind them so the order holds.
+    static constexpr const char* QUEUE_PATH = "/mqtt_queue.bin";
+    MqttQueue* getQueue() { return &_queue; }
+    void setReplayRate(uint16_t perSecond) { _replayRate = perSecond ? perSecond : 1; }
+    uint16_t getReplayRate() const { return _replayRate; }
+    bool isReplaying() const { return _replaying; }
+    uint32_t getSnapshotsQueued() const { return _snapshotsQueued; }
+    // Since the last reconnect
+    uint32_t getReplaySent() const { return _replaySent; }
+    // Age of the last replayed entry when it went out
+    uint32_t getReplayLagS() const { return _replayLagS; }
+
+    // QoS 1 in-flight window. Field, snapshot and replayed publishes hold a
+    // slot, keyed by packetId, until their PUBACK; at most the window size
+    // are outstanding. When it is full producers coalesce instead of
+    // queueing: unsent fields go out later with their latest value, a
+    // heartbeat snapshot is rebuilt when a slot frees up, and replay waits.
+    // Snapshots and replayed entries keep a copy of the payload, so after a
+    // reconnect they are sent again; fields are covered by the full
+    // republish on connect. A publish still unacked after ACK_TIMEOUT_RTTS
+    // average round trips (at least ACK_TIMEOUT_MIN_MS) is sent again the
+    // same way, a field with its latest value. Event QoS 0 sends snapshots
+    // and replays untracked.
+    static const uint8_t MAX_INFLIGHT = 16;
+    static const uint16_t INFLIGHT_PAYLOAD = 1024;
+    static const uint8_t ACK_TIMEOUT_RTTS = 4;
+    static const uint32_t ACK_TIMEOUT_MIN_MS = 2000;
+    void setInflightWindow(uint8_t window);
+    // After begin(): QoS 1 needs the payload pool
+    void setEventQos(uint8_t qos) { _eventQos = (qos && _inflightPool) ? 1 : 0; }
+    uint8_t getInflightWindow() const { return _window; }
+    uint8_t getEventQos() const { return _eventQos; }
+    uint8_t getInFlight() const;
+    uint32_t getWindowFull() const { return _windowFull; }
+    uint32_t getRetransmits() const { return _retransmits; }
+    uint32_t getSnapshotsCoalesced() const { return _snapshotsCoalesced; }
+    // Publish to PUBACK, over every tracked publish
+    uint32_t getRttLastMs() const { return _rttLastMs; }
+    uint32_t getRttMaxMs() const { return _rttMaxMs; }
+    uint32_t getRttAvgMs() const { return _rttCount ? (uint32_t)(_rttSumMs / _rttCount) : 0; }
+
+    // Binary telemetry: a TelemetryFrame on <prefix>/telemetry every
+    // interval, QoS 0, not retained and not queued while offline. Carries
+    // the snapshot fields plus the raw HX710 counts, which are read fresh
+    // for each frame. Little-endian; a decoder checks version and takes
+    // size bytes, newer versions only append members.
+    struct __attribute__((packed)) TelemetryFrame {
+        uint8_t version;        // TELEMETRY_VERSION
+        uint8_t size;           // sizeof(TelemetryFrame)
+        uint16_t seq;           // +1 per frame, a gap is a lost frame
+        uint32_t epoch;         // 0 if the clock is not set
+        uint32_t ms;            // millis()
+        uint8_t mode;           // ThermostatMode
+        uint8_t action;         // ThermostatAction
+        uint8_t heatLevel;      // HeatLevel
+        uint8_t coolLevel;      // CoolLevel
+        uint8_t flags;          // TF_* bits
+        uint8_t outputs;        // bit n: OutputIdx n on
+        uint8_t inputs;         // bit n: InputIdx n active
+        uint8_t cpuLoad;        // %
+        int16_t currentTemp;    // °F x10, valid if TF_TEMP_VALID
+        int16_t heatSetpoint;   // °F x10
+        int16_t coolSetpoint;   // °F x10
+        int16_t cpuTemp;        // °F x10
+        int32_t pressure1;      // calibrated x100, valid if TF_PRESSURE1_VALID
+        int32_t pressure2;
+        int32_t raw1;           // HX710 counts, 24 bits sign-extended
+        int32_t raw2;
+    };
+    static const uint8_t TELEMETRY_VERSION = 1;
+    enum TelemetryFlag : uint8_t {
+        TF_TEMP_VALID = 0x01,
+        TF_PRESSURE1_VALID = 0x02,
+        TF_PRESSURE2_VALID = 0x04,
+        TF_FORCE_FURNACE = 0x08,
+        TF_FORCE_NO_HP = 0x10,
+        TF_DEFROST = 0x20
+    };
+    static const uint16_t TELEMETRY_MIN_MS = 100;
+    // 0 = off, otherwise at least TELEMETRY_MIN_MS. Call after begin().
+    void setTelemetryInterval(uint16_t ms);
+    uint16_t getTelemetryInterval() const { return _telemetryMs; }
+    uint32_t getTelemetryFrames() const { return _telemetryFrames; }
+    // Bytes per message of each format; the snapshot's is the last one built
+    static size_t getTelemetryBytes() { return sizeof(TelemetryFrame); }
+    size_t getStateJsonBytes() const { return _stateJsonLen; }
 
   private:
     AsyncMqttClient _client;
     Scheduler* _ts;
     Task* _tReconnect;
+    ReconnectPolicy _backoff;
     Thermostat* _thermostat;
     HX710* _pressure1;
     HX710* _pressure2;
+    PressureCapture* _capture;
     String _topicPrefix = "thermostat";
     String _tempTopic = "homeassistant/sensor/average_home_temperature/state";
     String _user;
     String _password;
+    String _deviceName = "AThermostat";
+    // "<prefix>/state/<field>", "<prefix>/state", ... back to back; built
+    // by setTopicPrefix so publishing never formats or allocates a topic
+    char* _topicPool;
+    uint16_t _fieldTopic[FIELD_COUNT];
+    uint16_t _stateTopic;
+    uint16_t _statusTopic;      // LWT; AsyncMqttClient keeps the pointer
+    uint16_t _setTopic;         // "<prefix>/set/+"
+    uint16_t _telemetryTopic;
+    uint16_t _configSetTopic;
+    uint16_t _configResultTopic;
+    const char* topic(uint16_t offset) const { return _topicPool + offset; }
+    char _stateJson[STATE_JSON_SIZE];
+    size_t _stateJsonLen;
+
+    Task* _tTelemetry;
+    uint16_t _telemetryMs;
+    uint16_t _telemetrySeq;
+    uint32_t _telemetryFrames;
+
+    MqttRouter _router;
+    ConfigFn _configFn;
+    bool _configEnabled;
+    uint32_t _configRequests;
+    uint32_t _configErrors;
+
+    MqttQueue _queue;
+    int _queueStateTopic;       // queue topic id of <prefix>/state
+    uint16_t _replayRate;
+    uint32_t _replayCredit;     // messages x 1000 allowed to go out now
+    unsigned long _replayLastMs;
+    bool _replaying;
+    uint32_t _snapshotsQueued;
+    uint32_t _replaySent;
+    uint32_t _replayLagS;
+
+    enum SlotState : uint8_t { SLOT_FREE, SLOT_RESERVED, SLOT_SENT, SLOT_RESEND };
+    enum PubResult : uint8_t { PUB_OK, PUB_FAILED, PUB_WINDOW_FULL };
+
+    struct InFlight {
+        uint16_t packetId;
+        SlotState state;
+        uint8_t field;          // FIELD_COUNT: payload holds the message
+        bool retain;
+        uint16_t len;
+        const char* topic;      // topic pool or queue topic, never freed
+        unsigned long sentMs;
+        unsigned long changedMs;    // state change it carries, 0 = none
+        char* payload;          // INFLIGHT_PAYLOAD bytes in _inflightPool
+    };
+    static const uint8_t EARLY_ACKS = 4;
+    // <prefix>/set/<name> waiting for applyCommands()
+    struct Command {
+        char name[16];
+        char value[16];
+    };
+    static const uint8_t COMMAND_QUEUE = 8;
+
+    Task* _tStatePoll;
+    char _fieldValue[FIELD_COUNT][FIELD_VALUE_SIZE];
+    bool _fieldSent[FIELD_COUNT];
+    bool _changePending;
+    bool _forceAll;             // next poll publishes every field (connect)
+    bool _discoveryPending;
+    uint32_t _seenVersion;
+    uint32_t _publishedVersion;
+    unsigned long _firstChangeMs;
+    unsigned long _lastChangeMs;
+    unsigned long _changedMs;   // Thermostat::stateChangedMs() of the first change
+    bool _syncing;              // republishing every field after _forceAll
+    bool _snapshotPending;      // heartbeat waiting for a free slot
+    bool _resendPending;        // reconnected, RESEND slots go out again
+    InFlight _inflight[MAX_INFLIGHT];
+    char* _inflightPool;
+    // PUBACKs that arrived while a slot was reserved, before publish()
+    // returned and the slot got its id; cleared by commitSlot()
+    uint16_t _earlyAcks[EARLY_ACKS];
+    uint8_t _earlyAckNext;
+    uint8_t _window;
+    uint8_t _eventQos;
+    portMUX_TYPE _ackMux = portMUX_INITIALIZER_UNLOCKED;
+    Command _commandQueue[COMMAND_QUEUE];
+    uint8_t _commandHead;
+    uint8_t _commandCount;
+    portMUX_TYPE _commandMux = portMUX_INITIALIZER_UNLOCKED;
+
+    uint32_t _changePublishes;
+    uint32_t _fieldPublishes;
+    uint32_t _heartbeats;
+    uint32_t _publishErrors;
+    uint32_t _acks;
+    uint32_t _latencyLastMs;
+    uint32_t _latencyMaxMs;
+    uint64_t _latencySumMs;
+    uint32_t _discoveryPublishes;
+    uint32_t _commands;
+    uint32_t _commandErrors;
+    uint32_t _windowFull;
+    uint32_t _retransmits;
+    uint32_t _snapshotsCoalesced;
+    uint32_t _rttLastMs;
+    uint32_t _rttMaxMs;
+    uint64_t _rttSumMs;
+    uint32_t _rttCount;
+
+    void pollState();
+    void renderField(uint8_t field, char* out, size_t size);
+    size_t buildStateJson();
+    void queueSnapshot();
+    void publishTelemetry();
+    void replayQueue(unsigned long now);
+    // Publishes fields that differ from the last sent value. changedMs != 0
+    // tracks PUBACK latency. False if any failed or the window filled up.
+    bool publishFields(unsigned long changedMs);
+    // QoS 1 through an in-flight slot. field < FIELD_COUNT: a field value,
+    // not kept; otherwise the payload is copied for a resend.
+    PubResult publishTracked(const char* topic, const char* payload, size_t len,
+                             bool retain, uint8_t field, unsigned long changedMs);
+    void commitSlot(uint8_t slot, uint16_t packetId);
+    void recordAck(unsigned long sentMs, unsigned long changedMs, unsigned long now);
+    // Heartbeat snapshot, QoS per _eventQos. False if the window is full.
+    bool publishSnapshot();
+    bool resendInFlight();
+    // Marks SENT slots past the ack timeout for resending
+    void expireInFlight(unsigned long now);
+    bool publishDiscovery();
+    void queueCommand(const char* name, const char* value);
+    void handleCommand(const char* name, const char* value);
+    void handleConfig(const char* payload, size_t len);
 
     void onConnect(bool sessionPresent);
     void onDisconnect(AsyncMqttClientDisconnectReason reason);
@@ -0,0 +1,104 @@
+#ifndef MQTTQUEUE_H
+#define MQTTQUEUE_H
+
+#include <Arduino.h>
+
+// Store-and-forward queue for publishes made while the broker is away.
+// Entries go into a PSRAM ring; when it is full the oldest entries are
+// moved to a LittleFS segment file in SPILL_CHUNK batches, so the file
+// always holds older entries than the ring and the order is kept. Once the
+// file reaches SPILL_MAX_BYTES the oldest RAM entry is dropped instead.
+// Replay reads the file first, then the ring; the file is deleted once it
+// has been read to the end. A file left by a reboot is replayed too.
+//
+// Entries name their topic by the id addTopic() returned, so topics have
+// to be registered in the same order at every boot.
+class MqttQueue {
+public:
+    struct EntryHeader {
+        uint16_t len;           // payload bytes
+        uint8_t topic;
+        uint8_t magic;          // ENTRY_MAGIC, tells a spilled header from garbage
+        uint32_t epoch;         // time() when queued, 0 if the clock was not set
+    };
+
+    static const size_t RAM_BYTES = 64 * 1024;
+    static const size_t SPILL_MAX_BYTES = 256 * 1024;
+    static const size_t SPILL_CHUNK = 8 * 1024;
+    static const size_t MAX_PAYLOAD = 1024;
+    static const uint8_t MAX_TOPICS = 4;
+    static const uint8_t ENTRY_MAGIC = 0xA5;
+
+    MqttQueue();
+    ~MqttQueue();
+
+    // Allocates the ring and counts what a previous boot left in the file.
+    // LittleFS must be mounted.
+    bool begin(const char* spillPath);
+    bool isReady() const { return _ring != nullptr; }
+
+    // The pointer is kept; the string must outlive the queue. Returns the
+    // id for push(), or -1 when MAX_TOPICS are taken.
+    int addTopic(const char* topic);
+
+    // False if the entry was not queued (too long, unknown topic, no ring)
+    bool push(uint8_t topic, const char* payload, size_t len);
+    bool push(uint8_t topic, const char* payload) { return push(topic, payload, strlen(payload)); }
+
+    // Oldest entry, copied to an internal buffer that stays valid until
+    // pop(). payload is NUL terminated. False when the queue is empty.
+    bool peek(const char*& topic, const char*& payload, size_t& len, uint32_t& epoch);
+    void pop();
+
+    bool empty() const { return _ramEntries + _fileEntries == 0; }
+    uint32_t getDepth() const { return _ramEntries + _fileEntries; }
+    uint32_t getRamEntries() const { return _ramEntries; }
+    uint32_t getFileEntries() const { return _fileEntries; }
+    size_t getRamBytes() const { return _used; }
+    // Unread bytes in the segment file
+    size_t getFileBytes() const { return _fileSize - _fileRead; }
+    uint32_t getQueued() const { return _queued; }
+    uint32_t getReplayed() const { return _replayed; }
+    uint32_t getDropped() const { return _dropped; }
+    uint32_t getBytesSpilled() const { return _bytesSpilled; }
+    uint32_t getSpillErrors() const { return _spillErrors; }
+
+private:
+    void lock() { xSemaphoreTake(_lock, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(_lock); }
+    void ringWrite(const void* src, size_t len);
+    void ringRead(size_t offset, void* dst, size_t len) const;
+    bool spill();
+    void dropOldest();
+    bool readFileEntry();
+    void resetFile();
+
+    uint8_t* _ring;
+    size_t _head;               // write offset
+    size_t _tail;               // oldest entry
+    size_t _used;
+    uint32_t _ramEntries;
+
+    String _path;
+    size_t _fileSize;
+    size_t _fileRead;           // offset of the oldest unread entry
+    uint32_t _fileEntries;
+
+    const char* _topics[MAX_TOPICS];
+    uint8_t _topicCount;
+
+    char* _buf;                 // peek/spill staging, header + MAX_PAYLOAD + 1
+    bool _peeked;               // _buf holds the oldest entry
+    bool _peekedFile;
+    size_t _peekedSize;
+
+    SemaphoreHandle_t _lock;
+
+    uint32_t _queued;
+    uint32_t _replayed;
+    uint32_t _dropped;
+    uint32_t _bytesSpilled;
+    uint32_t _spillErrors;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef MQTTROUTER_H
+#define MQTTROUTER_H
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+#include <functional>
+
+// Subscription table for incoming MQTT messages. Handlers register topic
+// filters with + and # wildcards; the filters are compiled into a trie of
+// topic levels when they are added, so routing a message walks the topic
+// once, level by level, instead of comparing it against every filter.
+// Literal children are found by level hash, so the cost depends on the
+// topic depth and not on how many filters are registered. Every matching
+// handler is called, as a broker would deliver to each subscription.
+//
+// AsyncMqttClient hands over a large payload in fragments (index/total).
+// They are reassembled into one buffer, allocated once in PSRAM, before
+// dispatch; a message longer than MAX_MESSAGE is dropped. Handlers get a
+// NUL terminated payload that is valid until they return.
+//
+// Handlers are registered during setup; routing runs on the MQTT client's
+// task and does not allocate.
+class MqttRouter {
+public:
+    typedef std::function<void(const char* topic, const char* payload, size_t len)> Handler;
+
+    static const uint8_t MAX_NODES = 48;
+    static const uint8_t MAX_HANDLERS = 16;
+    static const uint8_t MAX_LEVELS = 16;
+    static const size_t MAX_MESSAGE = 8 * 1024;
+
+    MqttRouter();
+    ~MqttRouter();
+
+    // Allocates the reassembly buffer
+    bool begin();
+
+    // False if the filter is malformed ('+' or '#' not a whole level, '#'
+    // not last) or the table is full
+    bool add(const char* filter, uint8_t qos, Handler handler);
+    // Subscribes every registered filter; call on each connect
+    void subscribeAll(AsyncMqttClient& client);
+
+    // AsyncMqttClient onMessage arguments
+    void route(const char* topic, const char* payload, size_t len, size_t index, size_t total);
+
+    uint8_t getFilterCount() const { return _handlerCount; }
+    uint8_t getNodeCount() const { return _nodeCount; }
+    uint32_t getMessages() const { return _messages; }
+    uint32_t getDispatched() const { return _dispatched; }
+    uint32_t getUnmatched() const { return _unmatched; }
+    // Messages that arrived in more than one fragment
+    uint32_t getReassembled() const { return _reassembled; }
+    // Too long, or a fragment out of order
+    uint32_t getDropped() const { return _dropped; }
+
+private:
+    struct Node {
+        String level;
+        uint32_t hash;          // of level
+        int8_t child;           // first literal child
+        int8_t next;            // next literal sibling
+        int8_t plus;            // '+' child
+        int8_t multi;           // '#' child
+        int8_t handlers;        // first handler whose filter ends here
+    };
+    struct Entry {
+        String filter;
+        uint8_t qos;
+        int8_t next;            // next handler on the same node
+        Handler handler;
+    };
+
+    static uint32_t levelHash(const char* s, size_t len);
+    int8_t newNode(const char* level, size_t len);
+    void collect(int8_t node, const char* level, uint8_t depth);
+    void collectHandlers(int8_t node);
+    void dispatch(const char* topic, const char* payload, size_t len);
+
+    Node _nodes[MAX_NODES];
+    uint8_t _nodeCount;
+    Entry _handlers[MAX_HANDLERS];
+    uint8_t _handlerCount;
+
+    // Handlers matched by the message being routed
+    int8_t _matched[MAX_HANDLERS];
+    uint8_t _matchedCount;
+
+    char* _buf;                 // MAX_MESSAGE + 1
+    bool _assembling;           // fragments of a matched message pending
+    size_t _expected;           // index of the next fragment
+
+    uint32_t _messages;
+    uint32_t _dispatched;
+    uint32_t _unmatched;
+    uint32_t _reassembled;
+    uint32_t _dropped;
+};
+
+#endif
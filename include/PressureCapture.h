@@ -0,0 +1,139 @@
+#ifndef PRESSURECAPTURE_H
+#define PRESSURECAPTURE_H
+
+#include <Arduino.h>
+#include <TaskSchedulerDeclarations.h>
+
+class HX710;
+
+// Event-triggered high-rate capture of both HX710 channels.
+// A pre-trigger ring is filled continuously at the sensors' conversion rate
+// (40Hz in mode 3). An OutPin transition freezes the last preMs of samples
+// into a capture slot and keeps recording until postMs after the trigger.
+// All buffers are allocated once in PSRAM by begin(); the oldest capture is
+// recycled when all slots are used.
+class PressureCapture {
+public:
+    struct __attribute__((packed)) Sample {
+        uint32_t ms;      // millis() when the sample was taken
+        int32_t raw1;     // latest raw reading, sensor 1
+        int32_t raw2;     // latest raw reading, sensor 2
+    };
+
+    struct Capture {
+        uint32_t id;            // 0 = slot never used
+        uint32_t triggerMs;     // millis() of the arming transition
+        uint32_t triggerEpoch;  // wall clock (0 if NTP not synced)
+        char source[16];        // OutPin name (or "manual")
+        bool sourceOn;          // transition direction
+        uint8_t extraTriggers;  // further transitions inside the post-window
+        uint16_t preCount;      // samples before the trigger
+        uint16_t count;         // total samples
+        bool complete;          // post-window elapsed
+        Sample* samples;
+    };
+
+    // Binary export header (little-endian, followed by count Samples)
+    struct __attribute__((packed)) BinaryHeader {
+        char magic[4];          // "HXC1"
+        uint8_t version;        // 1
+        uint8_t sampleSize;     // sizeof(Sample)
+        uint16_t preCount;
+        uint16_t count;
+        uint8_t sourceOn;
+        uint8_t extraTriggers;
+        uint32_t id;
+        uint32_t triggerMs;
+        uint32_t triggerEpoch;
+        char source[16];
+        float slope1, offset1;
+        float slope2, offset2;
+    };
+
+    static constexpr uint32_t DEFAULT_PRE_MS = 2000;
+    static constexpr uint32_t DEFAULT_POST_MS = 10000;
+    static constexpr uint8_t DEFAULT_SLOTS = 8;
+    static constexpr uint32_t MAX_WINDOW_MS = 60000;
+    static constexpr uint8_t MAX_SLOTS = 32;
+
+    PressureCapture(Scheduler* ts);
+
+    bool begin(HX710* sensor1, HX710* sensor2,
+               uint32_t preMs = DEFAULT_PRE_MS, uint32_t postMs = DEFAULT_POST_MS,
+               uint8_t slots = DEFAULT_SLOTS);
+    bool isSampling() const { return _running; }
+
+    // Arm a capture; ignored (counted) while a capture is already recording.
+    // Safe from any task: the request is taken up by the sampler on the
+    // loop, which alone touches the recording slot.
+    void trigger(const char* source, bool on);
+
+    uint8_t getSlotCount() const { return _slotCount; }
+    const Capture* getSlot(uint8_t slot) const;
+    const Capture* findCapture(uint32_t id) const;
+    // Copies capture id and up to maxSamples of its samples into out while
+    // holding the slot lock, so a trigger can't recycle the slot midway.
+    // copy.samples points to out. False if there is no such capture.
+    bool copyCapture(uint32_t id, Capture& copy, Sample* out, uint16_t maxSamples);
+    HX710* getSensor1() const { return _sensor1; }
+    HX710* getSensor2() const { return _sensor2; }
+
+    // Cost reporting
+    size_t getMemoryBytes() const { return _memoryBytes; }
+    uint32_t getCpuUsPerSec() const { return _cpuUsPerSec; }
+    uint16_t getSampleRateHz() const { return _sampleRateHz; }
+    uint32_t getPreMs() const { return _preMs; }
+    uint32_t getPostMs() const { return _postMs; }
+    uint16_t getSlotCapacity() const { return _slotCapacity; }
+    uint32_t getMissedTriggers() const { return _missedTriggers; }
+    uint32_t getTruncatedCaptures() const { return _truncated; }
+
+private:
+    void sample();
+    void arm();
+    void pushPre(const Sample& s);
+
+    Scheduler* _ts;
+    Task* _tSample = nullptr;
+    SemaphoreHandle_t _slotLock = nullptr;  // held by arm() and copyCapture()
+    HX710* _sensor1 = nullptr;
+    HX710* _sensor2 = nullptr;
+    bool _running = false;
+
+    uint32_t _preMs = DEFAULT_PRE_MS;
+    uint32_t _postMs = DEFAULT_POST_MS;
+
+    // Pre-trigger ring
+    Sample* _pre = nullptr;
+    uint16_t _preCapacity = 0;
+    uint16_t _preHead = 0;
+    uint16_t _preCount = 0;
+
+    // Capture slots
+    Capture _slots[MAX_SLOTS] = {};
+    uint8_t _slotCount = 0;
+    uint16_t _slotCapacity = 0;
+    int8_t _active = -1;        // slot currently recording
+    uint8_t _nextSlot = 0;
+    uint32_t _nextId = 1;
+
+    // Trigger request handed from trigger() to the sampler
+    portMUX_TYPE _triggerMux = portMUX_INITIALIZER_UNLOCKED;
+    bool _pending = false;
+    uint32_t _pendingMs = 0;
+    char _pendingSource[16] = {};
+    bool _pendingOn = false;
+    uint8_t _pendingExtra = 0;  // further triggers before it was taken up
+
+    // Stats
+    size_t _memoryBytes = 0;
+    uint32_t _busyUs = 0;
+    uint16_t _windowSamples = 0;
+    uint32_t _windowStart = 0;
+    uint32_t _cpuUsPerSec = 0;
+    uint16_t _sampleRateHz = 0;
+    uint32_t _missedTriggers = 0;
+    uint32_t _truncated = 0;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RECONNECTPOLICY_H
+#define RECONNECTPOLICY_H
+
+#include <Arduino.h>
+
+// Delays between reconnect attempts: exponential backoff with full jitter.
+// Attempt n waits a random time in [minMs, min(capMs, initialMs * multiplier^n)],
+// so devices that lost the same router or broker spread their retries
+// instead of coming back in lockstep. The step only returns to 0 once the
+// link has stayed up for stableMs; a link that flaps keeps backing off.
+//
+// Not locked: lost()/up() may come from an event task while the scheduler
+// asks for delays, which at worst skews one delay or one statistic.
+class ReconnectPolicy {
+public:
+    ReconnectPolicy(uint32_t initialMs, uint32_t capMs, float multiplier,
+                    uint32_t stableMs, uint32_t minMs = 0);
+
+    // Link lost; starts an outage unless one is already running
+    void lost(uint32_t now);
+    // Link up; ends the outage and records how long it took
+    void up(uint32_t now);
+    // Delay before the next attempt. Advances the backoff step.
+    uint32_t nextDelay();
+    // An attempt was started
+    void attempted();
+
+    bool inOutage() const { return _inOutage; }
+    // Time since the outage started, 0 while up
+    uint32_t outageMs(uint32_t now) const { return _inOutage ? now - _lostAt : 0; }
+
+    uint32_t getInitialMs() const { return _initialMs; }
+    uint32_t getCapMs() const { return _capMs; }
+    uint8_t getStep() const { return _step; }
+    uint32_t getLastDelayMs() const { return _lastDelayMs; }
+    uint32_t getAttempts() const { return _attempts; }
+    uint32_t getOutageAttempts() const { return _outageAttempts; }
+    uint32_t getOutages() const { return _outages; }
+    uint32_t getReconnects() const { return _reconnects; }
+    // Lost again before stableMs
+    uint32_t getFlaps() const { return _flaps; }
+    // Time to reconnect: outage start to link up
+    uint32_t getTtrLastMs() const { return _ttrLastMs; }
+    uint32_t getTtrMaxMs() const { return _ttrMaxMs; }
+    uint32_t getTtrAvgMs() const { return _reconnects ? (uint32_t)(_ttrSumMs / _reconnects) : 0; }
+
+private:
+    uint32_t _initialMs;
+    uint32_t _capMs;
+    float _multiplier;
+    uint32_t _stableMs;
+    uint32_t _minMs;
+
+    bool _inOutage;
+    bool _up;
+    uint32_t _lostAt;
+    uint32_t _upAt;
+    uint8_t _step;
+    uint32_t _lastDelayMs;
+
+    uint32_t _attempts;
+    uint32_t _outageAttempts;   // in the running (or last) outage
+    uint32_t _outages;
+    uint32_t _reconnects;
+    uint32_t _flaps;
+    uint32_t _ttrLastMs;
+    uint32_t _ttrMaxMs;
+    uint64_t _ttrSumMs;
+};
+
+#endif
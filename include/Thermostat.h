@@ -61,6 +61,13 @@ enum InputIdx : uint8_t {
     IN_COUNT
 };
 
+// Where a command came from, for latency stats
+enum class CommandSource : uint8_t {
+    REST = 0,
+    MQTT,
+    COUNT
+};
+
 struct ThermostatConfig {
     // Temperature deadbands
     float heatDeadband = 0.5f;        // Degrees below setpoint to start heating
@@ -116,6 +123,38 @@ public:
     bool isForceNoHP() const { return _forceNoHP; }
     bool isDefrostActive() const { return _defrostActive; }
 
+    // Bumped when anything reported to clients changes (mode, action,
+    // levels, setpoints, temperature to 0.1, flags, relay and input pins).
+    // Checked after every update and on each call, so relays switched
+    // outside the thermostat are caught too.
+    uint32_t stateVersion();
+    unsigned long stateChangedMs() const { return _stateChangedMs; }
+
+    // Validated user commands, shared by the REST API and MQTT. Mode and
+    // setpoint commands return nullptr when applied, else the reason they
+    // were rejected. NAN leaves a setpoint unchanged.
+    static constexpr float HEAT_SETPOINT_MIN = 50.0f;
+    static constexpr float HEAT_SETPOINT_MAX = 90.0f;
+    static constexpr float COOL_SETPOINT_MIN = 60.0f;
+    static constexpr float COOL_SETPOINT_MAX = 95.0f;
+    const char* commandMode(const char* mode, CommandSource src);
+    const char* commandSetpoints(float heat, float cool, CommandSource src);
+    void commandForceFurnace(bool force, CommandSource src);
+    void commandForceNoHP(bool noHP, CommandSource src);
+
+    // Command to first relay change, when one follows within
+    // COMMAND_RELAY_WINDOW_MS (resolution: the state version checks)
+    static const uint32_t COMMAND_RELAY_WINDOW_MS = 10000;
+    struct CommandStats {
+        uint32_t commands;
+        uint32_t rejected;
+        uint32_t relaySamples;
+        uint32_t relayLastMs;
+        uint32_t relayMaxMs;
+        uint64_t relaySumMs;
+    };
+    const CommandStats& commandStats(CommandSource src) const { return _commandStats[(uint8_t)src]; }
+
     // Config
     ThermostatConfig& config() { return _config; }
     const ThermostatConfig& config() const { return _config; }
@@ -132,8 +171,25 @@ public:
     static const char* heatLevelToString(HeatLevel level);
     static const char* coolLevelToString(CoolLevel level);
     static ThermostatMode stringToMode(const char* str);
+    // False for anything but the modeToString() names
+    static bool parseMode(const char* str, ThermostatMode& mode);
 
 private:
+    struct StateSnapshot {
+        uint8_t mode;
+        uint8_t action;
+        uint8_t heatLevel;
+        uint8_t coolLevel;
+        uint8_t flags;          // tempValid, forceFurnace, forceNoHP, defrost
+        uint8_t outputs;        // bit per OutputIdx
+        uint8_t inputs;         // bit per InputIdx
+        int16_t temp10;         // tenths of a degree
+        int16_t heat10;
+        int16_t cool10;
+    };
+    void captureState(StateSnapshot& s) const;
+    void noteCommand(CommandSource src);
+
     void updateHeating();
     void updateCooling();
     void updateFanOnly();
@@ -186,6 +242,15 @@ private:
     bool _fanIdleRunning = false;
 
     ThermostatConfig _config;
+
+    StateSnapshot _lastState = {};
+    uint32_t _stateVersion = 0;
+    unsigned long _stateChangedMs = 0;
+
+    CommandStats _commandStats[(uint8_t)CommandSource::COUNT] = {};
+    bool _commandPending = false;
+    CommandSource _commandSource = CommandSource::REST;
+    unsigned long _commandMs = 0;
 };
 
 #endif
@@ -16,6 +16,10 @@
 #include "SessionManager.h"
 
 class HX710;
+class PressureCapture;
+class MQTTHandler;
+class ReconnectPolicy;
+class CANBus;
 
 class WebHandler {
   public:
@@ -30,8 +34,18 @@ class WebHandler {
     void setRebootRateLimited(bool* flag) { _rebootRateLimited = flag; }
     void setSafeMode(bool* flag, uint32_t* crashCount) { _safeMode = flag; _crashBootCount = crashCount; }
     void setPressureSensors(HX710* s1, HX710* s2) { _pressure1 = s1; _pressure2 = s2; }
+    void setPressureCapture(PressureCapture* capture) { _capture = capture; }
+    void setMqttHandler(MQTTHandler* mqtt) { _mqtt = mqtt; }
+    void setWifiBackoff(ReconnectPolicy* backoff) { _wifiBackoff = backoff; }
+    void setCanBus(CANBus* can) { _can = can; }
     const char* getWiFiIP();
 
+    // /api/config/save: checks every key, then applies the document to the
+    // config and the running objects and saves it. False with error set if
+    // a key has the wrong type or range, or with remote set (MQTT) is one
+    // only the web UI may change; nothing is changed then.
+    bool applyConfig(JsonDocument& doc, bool remote, bool& needsReboot, String& error);
+
     typedef std::function<String()> APStartCallback;
     typedef std::function<void()> APStopCallback;
     void setAPCallbacks(APStartCallback startCb, APStopCallback stopCb);
@@ -54,6 +68,10 @@ class WebHandler {
     Config* _config;
     HX710* _pressure1 = nullptr;
     HX710* _pressure2 = nullptr;
+    PressureCapture* _capture = nullptr;
+    MQTTHandler* _mqtt = nullptr;
+    ReconnectPolicy* _wifiBackoff = nullptr;
+    CANBus* _can = nullptr;
 
     bool _shouldReboot;
     bool* _rebootRateLimited = nullptr;
@@ -101,7 +119,9 @@ class WebHandler {
     void redirectToLogin(AsyncWebServerRequest* request, bool expired);
     void syncNtpTime();
     void setupRoutes();
+    void setupCaptureRoutes();
     void serveFile(AsyncWebServerRequest* request, const String& path);
+    void sendJson(AsyncWebServerRequest* request, JsonDocument& doc);
     static const char* getContentType(const String& path);
     void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
                    AwsEventType type, void* arg, uint8_t* data, size_t len);
@@ -1,5 +1,8 @@
 #include "CANBus.h"
 #include "Logger.h"
+#include "esp_timer.h"
+
+constexpr uint32_t CANBus::LATENCY_BOUNDS_US[];
 
 CANBus::CANBus(Scheduler* ts, gpio_num_t txPin, gpio_num_t rxPin)
     : _ts(ts), _txPin(txPin), _rxPin(rxPin) {}
@@ -8,8 +11,11 @@ bool CANBus::begin(twai_timing_config_t timing) {
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(_txPin, _rxPin, TWAI_MODE_NORMAL);
     g_config.rx_queue_len = 16;
     g_config.tx_queue_len = 8;
+    g_config.alerts_enabled = TWAI_ALERT_RX_DATA | TWAI_ALERT_RX_QUEUE_FULL |
+                              TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED |
+                              TWAI_ALERT_ERR_PASS | TWAI_ALERT_ERR_ACTIVE;
 
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    twai_filter_config_t f_config = buildFilter();
 
     esp_err_t err = twai_driver_install(&g_config, &timing, &f_config);
     if (err != ESP_OK) {
@@ -26,22 +32,36 @@ bool CANBus::begin(twai_timing_config_t timing) {
 
     _running = true;
 
-    // Poll for received messages every 10ms on main loop
-    _tPoll = new Task(10, TASK_FOREVER, [this]() { poll(); }, _ts, true);
+    // Same core as the main loop, above it: frames are handled on arrival
+    _rxStop = false;
+    if (xTaskCreatePinnedToCore(rxTask, "canRx", RX_TASK_STACK, this, RX_TASK_PRIORITY,
+                                &_rxTask, ARDUINO_RUNNING_CORE) != pdPASS) {
+        Log.error("CAN", "RX task create failed");
+        _rxTask = nullptr;
+        twai_stop();
+        twai_driver_uninstall();
+        _running = false;
+        return false;
+    }
 
     // Send heartbeat every 5 seconds
     _tHeartbeat = new Task(5000, TASK_FOREVER, [this]() {
         sendHeartbeat(CANNodeId::THERMOSTAT);
     }, _ts, true);
 
-    Log.info("CAN", "Bus started (TX=GPIO%d RX=GPIO%d)", _txPin, _rxPin);
+    Log.info("CAN", "Bus started (TX=GPIO%d RX=GPIO%d, %s filter code=0x%08X mask=0x%08X, %u IDs)",
+             _txPin, _rxPin, _filterMode, f_config.acceptance_code, f_config.acceptance_mask, _filterIds);
     return true;
 }
 
 void CANBus::stop() {
     if (!_running) return;
 
-    if (_tPoll) { _tPoll->disable(); delete _tPoll; _tPoll = nullptr; }
+    // The RX task sees the flag within RX_ALERT_WAIT_MS and exits
+    _rxStop = true;
+    for (uint32_t waited = 0; _rxTask && waited < 2 * RX_ALERT_WAIT_MS; waited += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
     if (_tHeartbeat) { _tHeartbeat->disable(); delete _tHeartbeat; _tHeartbeat = nullptr; }
 
     twai_stop();
@@ -50,6 +70,103 @@ void CANBus::stop() {
     Log.info("CAN", "Bus stopped");
 }
 
+bool CANBus::onReceive(uint32_t first, uint32_t last, RxCallback cb) {
+    if (_running || _handlerCount >= MAX_HANDLERS || first > last || last > 0x7FF) return false;
+    Handler& h = _handlers[_handlerCount++];
+    h.first = first;
+    h.last = last;
+    h.cb = cb;
+    return true;
+}
+
+// Smallest aligned block of IDs holding first..last: the ID bits that vary
+// within the range and everything below them become don't-care
+static void coverRange(uint32_t first, uint32_t last, uint32_t& code, uint32_t& mask) {
+    uint32_t m = first ^ last;
+    m |= m >> 1;
+    m |= m >> 2;
+    m |= m >> 4;
+    m |= m >> 8;
+    mask = m;
+    code = first & ~m;
+}
+
+// Tightest single or dual filter over the handler ranges. Each filter is
+// one code/mask block; with at most MAX_HANDLERS ranges every split into
+// two groups is tried, and the one letting the fewest IDs through wins.
+// The software check in receiveFrames() drops what the blocks add.
+twai_filter_config_t CANBus::buildFilter() {
+    if (_handlerCount == 0) {
+        _filterMode = "all";
+        _filterIds = 2048;
+        return TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    }
+
+    uint32_t codes[MAX_HANDLERS], masks[MAX_HANDLERS];
+    for (uint8_t i = 0; i < _handlerCount; i++) {
+        coverRange(_handlers[i].first, _handlers[i].last, codes[i], masks[i]);
+    }
+
+    // Handler 0 is always in group A, so each split is seen once; the
+    // last split (all in A) is the single filter
+    uint32_t bestCa = 0, bestMa = 0, bestCb = 0, bestMb = 0;
+    bool bestDual = false;
+    uint32_t bestIds = UINT32_MAX;
+    uint32_t splits = 1u << (_handlerCount - 1);
+    for (uint32_t s = 0; s < splits; s++) {
+        uint32_t inA = (s << 1) | 1;
+        bool haveB = false;
+        uint32_t ca = codes[0], ma = masks[0], cb = 0, mb = 0;
+        for (uint8_t i = 1; i < _handlerCount; i++) {
+            if (inA & (1u << i)) {
+                ma |= masks[i] | (ca ^ codes[i]);
+                ca &= ~ma;
+            } else if (!haveB) {
+                cb = codes[i];
+                mb = masks[i];
+                haveB = true;
+            } else {
+                mb |= masks[i] | (cb ^ codes[i]);
+                cb &= ~mb;
+            }
+        }
+        uint32_t ids = 1u << __builtin_popcount(ma);
+        if (haveB) {
+            ids += 1u << __builtin_popcount(mb);
+            // Blocks overlap when they agree on every bit both care about
+            if (((ca ^ cb) & ~(ma | mb)) == 0) ids -= 1u << __builtin_popcount(ma & mb);
+        }
+        // Ties go to the later split, so a single filter wins them
+        if (ids <= bestIds) {
+            bestIds = ids;
+            bestCa = ca;
+            bestMa = ma;
+            bestCb = cb;
+            bestMb = mb;
+            bestDual = haveB;
+        }
+    }
+
+    // Standard frame layout, mask bits set = don't care. Single: ID in
+    // bits 31-21, RTR and the first two data bytes below. Dual: filter 1
+    // has the ID in bits 31-21 (RTR and data byte 1 below), filter 2 in
+    // bits 15-5 (RTR in bit 4). RTR and data are always don't care.
+    twai_filter_config_t f = {};
+    if (!bestDual) {
+        f.acceptance_code = bestCa << 21;
+        f.acceptance_mask = (bestMa << 21) | 0x001FFFFF;
+        f.single_filter = true;
+        _filterMode = "single";
+    } else {
+        f.acceptance_code = (bestCa << 21) | (bestCb << 5);
+        f.acceptance_mask = (bestMa << 21) | (bestMb << 5) | 0x001F001F;
+        f.single_filter = false;
+        _filterMode = "dual";
+    }
+    _filterIds = bestIds;
+    return f;
+}
+
 bool CANBus::send(uint32_t id, const uint8_t* data, uint8_t len) {
     if (!_running || len > 8) return false;
 
@@ -117,30 +234,80 @@ bool CANBus::sendHeartbeat(CANNodeId node) {
     return send(CAN_ID_HEARTBEAT, data, 5);
 }
 
-void CANBus::poll() {
+void CANBus::rxTask(void* arg) {
+    CANBus* self = (CANBus*)arg;
+    while (!self->_rxStop) {
+        uint32_t alerts = 0;
+        if (twai_read_alerts(&alerts, pdMS_TO_TICKS(RX_ALERT_WAIT_MS)) != ESP_OK) continue;
+        int64_t woke = esp_timer_get_time();
+        self->_wakeups++;
+        if (alerts & TWAI_ALERT_RX_DATA) self->receiveFrames(woke);
+        self->handleAlerts(alerts);
+        self->_busyUs += esp_timer_get_time() - woke;
+    }
+    self->_rxTask = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void CANBus::receiveFrames(int64_t wokeUs) {
     twai_message_t msg;
     while (twai_receive(&msg, 0) == ESP_OK) {
+        uint32_t latency = (uint32_t)(esp_timer_get_time() - wokeUs);
+        uint8_t b = 0;
+        while (b < LATENCY_BUCKETS - 1 && latency > LATENCY_BOUNDS_US[b]) b++;
+        _latencyHist[b]++;
+        _latencySumUs += latency;
+        if (latency > _latencyMaxUs) _latencyMaxUs = latency;
         _rxCount++;
-        if (_rxCallback) {
-            _rxCallback(msg.identifier, msg.data, msg.data_length_code);
-        }
-    }
 
-    // Check for bus-off and recover
-    twai_status_info_t status;
-    if (twai_get_status_info(&status) == ESP_OK) {
-        if (status.state == TWAI_STATE_BUS_OFF) {
-            recoverBus();
+        // Second stage: the hardware blocks may pass IDs nobody handles,
+        // and an extended frame is checked against the filter bits as a
+        // 29-bit ID, so it can get through too
+        bool delivered = false;
+        if (!(msg.flags & TWAI_MSG_FLAG_EXTD)) {
+            for (uint8_t i = 0; i < _handlerCount; i++) {
+                const Handler& h = _handlers[i];
+                if (msg.identifier >= h.first && msg.identifier <= h.last) {
+                    h.cb(msg.identifier, msg.data, msg.data_length_code);
+                    delivered = true;
+                }
+            }
+        }
+        if (delivered) {
+            _deliveredCount++;
+        } else {
+            _swFilteredCount++;
         }
     }
 }
 
-void CANBus::recoverBus() {
-    Log.warn("CAN", "Bus-off detected, initiating recovery");
-    _errCount++;
-    esp_err_t err = twai_initiate_recovery();
-    if (err != ESP_OK) {
-        Log.error("CAN", "Recovery failed: %s", esp_err_to_name(err));
+void CANBus::handleAlerts(uint32_t alerts) {
+    if (alerts & TWAI_ALERT_RX_QUEUE_FULL) {
+        _rxOverruns++;
+    }
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+        Log.warn("CAN", "Error passive");
+    }
+    if (alerts & TWAI_ALERT_ERR_ACTIVE) {
+        Log.info("CAN", "Error active");
+    }
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        Log.warn("CAN", "Bus-off detected, initiating recovery");
+        _busOffCount++;
+        _errCount++;
+        esp_err_t err = twai_initiate_recovery();
+        if (err != ESP_OK) {
+            Log.error("CAN", "Recovery failed: %s", esp_err_to_name(err));
+        }
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        // Recovery leaves the driver stopped
+        esp_err_t err = twai_start();
+        if (err == ESP_OK) {
+            Log.info("CAN", "Bus recovered");
+        } else {
+            Log.error("CAN", "Restart after recovery failed: %s", esp_err_to_name(err));
+        }
     }
 }
 
@@ -1,4 +1,5 @@
 #include "Config.h"
+#include "PressureCapture.h"
 #include "esp_hmac.h"
 #include "esp_random.h"
 #include "mbedtls/x509_crt.h"
@@ -291,12 +292,21 @@ bool Config::loadConfig(const char* filename, ProjectInfo& proj) {
     _mqttHost.fromString(mqtt_host != nullptr ? mqtt_host : "192.168.1.2");
     const char* tempTopic = mqtt["tempTopic"];
     proj.mqttTempTopic = (tempTopic != nullptr) ? String(tempTopic) : "homeassistant/sensor/average_home_temperature/state";
+    proj.mqttReplayRate = mqtt["replayRate"] | 20;
+    proj.mqttInflightWindow = mqtt["inflightWindow"] | 8;
+    proj.mqttEventQos = mqtt["eventQos"] | 1;
+    proj.mqttTelemetryMs = mqtt["telemetryMs"] | 0;
+    proj.mqttConfigEnabled = mqtt["configEnabled"] | false;
     Serial.printf("Read MQTT Host:%s tempTopic:%s\n", _mqttHost.toString().c_str(), proj.mqttTempTopic.c_str());
 
     // Logging
     JsonObject logging = doc["logging"];
     proj.maxLogSize = logging["maxLogSize"] | (512 * 1024);
-    proj.maxOldLogCount = logging["maxOldLogCount"] | 3;
+    proj.logArchiveBytes = logging["archiveBytes"] | (256 * 1024);
+    proj.logHistoryBytes = logging["historyBytes"] | (256 * 1024);
+    proj.syslogHost = logging["syslogHost"] | String("");
+    proj.syslogPort = logging["syslogPort"] | 514;
+    proj.syslogRate = logging["syslogRate"] | 50;
 
     // Timezone
     JsonObject timezone = doc["timezone"];
@@ -362,6 +372,16 @@ bool Config::loadConfig(const char* filename, ProjectInfo& proj) {
     // Safe mode
     proj.forceSafeMode = doc["safeMode"]["force"] | false;
 
+    // Pressure capture
+    JsonObject capture = doc["capture"];
+    proj.captureEnabled = capture["enabled"] | true;
+    // Range-checked before narrowing: a hand-edited slots of 256 would wrap to 0
+    proj.capturePreMs = constrain((long)(capture["preMs"] | 2000L), 0L, (long)PressureCapture::MAX_WINDOW_MS);
+    proj.capturePostMs = constrain((long)(capture["postMs"] | 10000L), 0L, (long)PressureCapture::MAX_WINDOW_MS);
+    proj.captureSlots = constrain((long)(capture["slots"] | 8L), 1L, (long)PressureCapture::MAX_SLOTS);
+    const char* capTriggers = capture["triggers"];
+    proj.captureTriggers = (capTriggers != nullptr) ? String(capTriggers) : "fan1,w1,comp1";
+
     // System identity
     JsonObject systemObj = doc["system"];
     const char* sysName = systemObj["name"];
@@ -412,10 +432,19 @@ bool Config::saveConfiguration(const char* filename, ProjectInfo& proj) {
     mqtt["host"] = "192.168.1.1";
     mqtt["port"] = 1883;
     mqtt["tempTopic"] = proj.mqttTempTopic.length() > 0 ? proj.mqttTempTopic : "homeassistant/sensor/average_home_temperature/state";
+    mqtt["replayRate"] = proj.mqttReplayRate;
+    mqtt["inflightWindow"] = proj.mqttInflightWindow;
+    mqtt["eventQos"] = proj.mqttEventQos;
+    mqtt["telemetryMs"] = proj.mqttTelemetryMs;
+    mqtt["configEnabled"] = proj.mqttConfigEnabled;
 
     JsonObject logging = doc["logging"].to<JsonObject>();
     logging["maxLogSize"] = proj.maxLogSize;
-    logging["maxOldLogCount"] = proj.maxOldLogCount;
+    logging["archiveBytes"] = proj.logArchiveBytes;
+    logging["historyBytes"] = proj.logHistoryBytes;
+    logging["syslogHost"] = proj.syslogHost;
+    logging["syslogPort"] = proj.syslogPort;
+    logging["syslogRate"] = proj.syslogRate;
 
     JsonObject timezone = doc["timezone"].to<JsonObject>();
     timezone["posix"] = proj.timezone.length() > 0 ? proj.timezone : "CST6CDT,M3.2.0,M11.1.0";
@@ -466,6 +495,13 @@ bool Config::saveConfiguration(const char* filename, ProjectInfo& proj) {
     JsonObject safeModeObj = doc["safeMode"].to<JsonObject>();
     safeModeObj["force"] = proj.forceSafeMode;
 
+    JsonObject capture = doc["capture"].to<JsonObject>();
+    capture["enabled"] = proj.captureEnabled;
+    capture["preMs"] = proj.capturePreMs;
+    capture["postMs"] = proj.capturePostMs;
+    capture["slots"] = proj.captureSlots;
+    capture["triggers"] = proj.captureTriggers;
+
     JsonObject systemObj = doc["system"].to<JsonObject>();
     systemObj["name"] = proj.systemName.length() > 0 ? proj.systemName : "AThermostat";
     systemObj["mqttPrefix"] = proj.mqttPrefix.length() > 0 ? proj.mqttPrefix : "thermostat";
@@ -521,10 +557,19 @@ bool Config::updateConfig(const char* filename, ProjectInfo& proj) {
     mqtt["host"] = _mqttHost.toString();
     mqtt["port"] = _mqttPort;
     mqtt["tempTopic"] = proj.mqttTempTopic;
+    mqtt["replayRate"] = proj.mqttReplayRate;
+    mqtt["inflightWindow"] = proj.mqttInflightWindow;
+    mqtt["eventQos"] = proj.mqttEventQos;
+    mqtt["telemetryMs"] = proj.mqttTelemetryMs;
+    mqtt["configEnabled"] = proj.mqttConfigEnabled;
 
     JsonObject logging = doc["logging"].to<JsonObject>();
     logging["maxLogSize"] = proj.maxLogSize;
-    logging["maxOldLogCount"] = proj.maxOldLogCount;
+    logging["archiveBytes"] = proj.logArchiveBytes;
+    logging["historyBytes"] = proj.logHistoryBytes;
+    logging["syslogHost"] = proj.syslogHost;
+    logging["syslogPort"] = proj.syslogPort;
+    logging["syslogRate"] = proj.syslogRate;
 
     JsonObject timezone = doc["timezone"].to<JsonObject>();
     timezone["posix"] = proj.timezone.length() > 0 ? proj.timezone : "CST6CDT,M3.2.0,M11.1.0";
@@ -575,6 +620,13 @@ bool Config::updateConfig(const char* filename, ProjectInfo& proj) {
     JsonObject safeModeUpd = doc["safeMode"].to<JsonObject>();
     safeModeUpd["force"] = proj.forceSafeMode;
 
+    JsonObject capture = doc["capture"].to<JsonObject>();
+    capture["enabled"] = proj.captureEnabled;
+    capture["preMs"] = proj.capturePreMs;
+    capture["postMs"] = proj.capturePostMs;
+    capture["slots"] = proj.captureSlots;
+    capture["triggers"] = proj.captureTriggers;
+
     JsonObject systemObj = doc["system"].to<JsonObject>();
     systemObj["name"] = proj.systemName.length() > 0 ? proj.systemName : "AThermostat";
     systemObj["mqttPrefix"] = proj.mqttPrefix.length() > 0 ? proj.mqttPrefix : "thermostat";
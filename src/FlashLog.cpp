@@ -0,0 +1,403 @@
+#include "FlashLog.h"
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+bool FlashLog::PartitionStorage::read(size_t offset, void* dst, size_t len) {
+    return esp_partition_read(_part, offset, dst, len) == ESP_OK;
+}
+
+bool FlashLog::PartitionStorage::write(size_t offset, const void* src, size_t len) {
+    return esp_partition_write(_part, offset, src, len) == ESP_OK;
+}
+
+bool FlashLog::PartitionStorage::erase(size_t offset, size_t len) {
+    return esp_partition_erase_range(_part, offset, len) == ESP_OK;
+}
+
+FlashLog::FileStorage::FileStorage(const char* path, size_t size)
+    : _file(fopen(path, "r+b"))
+    , _size(size)
+{
+    if (!_file) _file = fopen(path, "w+b");
+    if (!_file) return;
+    fseek(_file, 0, SEEK_END);
+    long have = ftell(_file);
+    if (have < 0 || ((size_t)have < size && !fill(have, size - have))) {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+FlashLog::FileStorage::~FileStorage() {
+    if (_file) fclose(_file);
+}
+
+bool FlashLog::FileStorage::fill(size_t offset, size_t len) {
+    uint8_t ff[256];
+    memset(ff, 0xFF, sizeof(ff));
+    if (fseek(_file, offset, SEEK_SET) != 0) return false;
+    while (len > 0) {
+        size_t n = len < sizeof(ff) ? len : sizeof(ff);
+        if (fwrite(ff, 1, n, _file) != n) return false;
+        len -= n;
+    }
+    return fflush(_file) == 0;
+}
+
+bool FlashLog::FileStorage::read(size_t offset, void* dst, size_t len) {
+    if (!_file || offset + len > _size) return false;
+    return fseek(_file, offset, SEEK_SET) == 0 && fread(dst, 1, len, _file) == len;
+}
+
+// Programming clears bits only: the result is old & new
+bool FlashLog::FileStorage::write(size_t offset, const void* src, size_t len) {
+    if (!_file || offset + len > _size) return false;
+    const uint8_t* in = (const uint8_t*)src;
+    uint8_t cur[256];
+    while (len > 0) {
+        size_t n = len < sizeof(cur) ? len : sizeof(cur);
+        if (!read(offset, cur, n)) return false;
+        for (size_t i = 0; i < n; i++) cur[i] &= in[i];
+        if (fseek(_file, offset, SEEK_SET) != 0 || fwrite(cur, 1, n, _file) != n) return false;
+        offset += n;
+        in += n;
+        len -= n;
+    }
+    return fflush(_file) == 0;
+}
+
+bool FlashLog::FileStorage::erase(size_t offset, size_t len) {
+    if (!_file || offset % SECTOR_SIZE || len % SECTOR_SIZE || offset + len > _size) return false;
+    return fill(offset, len);
+}
+
+FlashLog::FlashLog()
+    : _storage(nullptr)
+    , _sectors(0)
+    , _head(0)
+    , _offset(0)
+    , _sectorSeq(0)
+    , _nextLine(0)
+    , _buf(nullptr)
+    , _records(0)
+    , _bytesWritten(0)
+    , _erases(0)
+    , _crcErrors(0)
+    , _writeErrors(0)
+    , _recoverProbes(0)
+    , _recoverUs(0)
+{
+}
+
+FlashLog::~FlashLog() {
+    delete _storage;
+    free(_buf);
+}
+
+bool FlashLog::begin(const char* label) {
+    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                           ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part) {
+        return false;
+    }
+    return begin(new PartitionStorage(part));
+}
+
+bool FlashLog::begin(Storage* storage) {
+    if (_storage) {
+        delete storage;
+        return true;
+    }
+    uint32_t sectors = storage->size() / SECTOR_SIZE;
+    _buf = (char*)malloc(SECTOR_SIZE);
+    if (sectors < MIN_SECTORS || !_buf) {
+        delete storage;
+        free(_buf);
+        _buf = nullptr;
+        return false;
+    }
+    _storage = storage;
+    _sectors = sectors;
+    if (!recover()) {
+        delete _storage;
+        _storage = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool FlashLog::sectorHeader(uint32_t sector, SectorHeader& h) {
+    if (!_storage->read((size_t)sector * SECTOR_SIZE, &h, sizeof(h))) return false;
+    return h.magic == SECTOR_MAGIC && h.seq != 0xFFFFFFFF;
+}
+
+// Sector seqs rise from the oldest sector to the head, then the erased gap
+// follows. Taking the first valid sector as reference, "valid and seq >=
+// reference" holds for a prefix of [reference, end] and fails after the
+// head, so the head is the last sector where it holds.
+bool FlashLog::recover() {
+    int64_t t0 = esp_timer_get_time();
+    _recoverProbes = 0;
+
+    // The gap is one erased sector, two if a reset hit between erasing a
+    // sector and writing its header
+    SectorHeader ref;
+    uint32_t lo = _sectors;
+    for (uint32_t i = 0; i < 3; i++) {
+        _recoverProbes++;
+        if (sectorHeader(i, ref)) {
+            lo = i;
+            break;
+        }
+    }
+    if (lo == _sectors) {
+        // Blank or foreign partition
+        _sectorSeq = 0;
+        _nextLine = 0;
+        if (!_storage->erase(0, SECTOR_SIZE)) return false;
+        _erases++;
+        bool ok = openSector(0);
+        _recoverUs = (uint32_t)(esp_timer_get_time() - t0);
+        return ok;
+    }
+
+    uint32_t hi = _sectors - 1;
+    SectorHeader h;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        _recoverProbes++;
+        if (sectorHeader(mid, h) && h.seq >= ref.seq) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    sectorHeader(lo, h);
+    _head = lo;
+    _sectorSeq = h.seq;
+    _nextLine = h.firstLine;
+
+    // Write offset: first erased header in the head sector
+    size_t off = sizeof(SectorHeader);
+    while (off + sizeof(RecordHeader) <= SECTOR_SIZE) {
+        RecordHeader rh;
+        int r = readRecord(_head, off, rh, _buf);
+        if (r == 0) break;
+        if (r == -2) {
+            // Torn header: its length is unknown, so the sector is closed
+            off = SECTOR_SIZE;
+            break;
+        }
+        if (r > 0) _nextLine = rh.line + rh.lines;
+        off += recordSize(rh.len);
+    }
+    _offset = off;
+
+    // Erase ahead again in case the reset interrupted it
+    uint32_t ahead = (_head + 1) % _sectors;
+    if (_storage->erase((size_t)ahead * SECTOR_SIZE, SECTOR_SIZE)) _erases++;
+
+    _recoverUs = (uint32_t)(esp_timer_get_time() - t0);
+    return true;
+}
+
+// The sector was erased ahead when its predecessor was opened. Opening it
+// erases the next one, which drops the oldest sector once the ring is full.
+bool FlashLog::openSector(uint32_t sector) {
+    size_t base = (size_t)sector * SECTOR_SIZE;
+    SectorHeader h = {SECTOR_MAGIC, _sectorSeq + 1, _nextLine, 0xFFFFFFFF};
+    if (!_storage->write(base, &h, sizeof(h))) {
+        _writeErrors++;
+        return false;
+    }
+    _sectorSeq = h.seq;
+    _head = sector;
+    _offset = sizeof(SectorHeader);
+
+    uint32_t ahead = (sector + 1) % _sectors;
+    if (_storage->erase((size_t)ahead * SECTOR_SIZE, SECTOR_SIZE)) {
+        _erases++;
+    } else {
+        _writeErrors++;
+    }
+    return true;
+}
+
+uint32_t FlashLog::recordCrc(const RecordHeader& h, const char* payload) {
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&h.line, sizeof(h.line));
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)&h.lines, sizeof(h.lines));
+    return esp_rom_crc32_le(crc, (const uint8_t*)payload, h.len);
+}
+
+int FlashLog::readRecord(uint32_t sector, size_t offset, RecordHeader& h, char* buf) {
+    size_t base = (size_t)sector * SECTOR_SIZE;
+    if (!_storage->read(base + offset, &h, sizeof(h))) return 0;
+    if (h.len == 0xFFFF && h.lenInv == 0xFFFF) return 0;
+    if ((uint16_t)~h.len != h.lenInv || h.len > MAX_PAYLOAD ||
+        offset + recordSize(h.len) > SECTOR_SIZE) {
+        return -2;
+    }
+    if (!_storage->read(base + offset + sizeof(h), buf, h.len) || recordCrc(h, buf) != h.crc) {
+        _crcErrors++;
+        return -1;
+    }
+    return 1;
+}
+
+bool FlashLog::append(const char* data, size_t len, uint16_t lines) {
+    if (!_storage || len == 0) {
+        return false;
+    }
+    if (len > MAX_PAYLOAD) len = MAX_PAYLOAD;
+    size_t size = recordSize(len);
+    if (_offset + size > SECTOR_SIZE) {
+        if (!openSector((_head + 1) % _sectors)) return false;
+    }
+
+    RecordHeader h;
+    h.len = len;
+    h.lenInv = ~h.len;
+    h.line = _nextLine;
+    h.lines = lines;
+    h.reserved = 0xFFFF;
+    h.crc = recordCrc(h, data);
+    // Header and payload in one write: a reset tears the payload, not the
+    // header, and the CRC catches it
+    memcpy(_buf, &h, sizeof(h));
+    memcpy(_buf + sizeof(h), data, len);
+    memset(_buf + sizeof(h) + len, 0xFF, size - sizeof(h) - len);
+    if (!_storage->write((size_t)_head * SECTOR_SIZE + _offset, _buf, size)) {
+        _writeErrors++;
+        // The space may be partly programmed; never write over it
+        _offset += size;
+        return false;
+    }
+    _offset += size;
+    _nextLine += lines;
+    _records++;
+    _bytesWritten += size;
+    return true;
+}
+
+uint32_t FlashLog::getOldestLine() {
+    if (!_storage) return 0;
+    for (uint32_t step = 1; step <= _sectors; step++) {
+        SectorHeader h;
+        if (sectorHeader((_head + step) % _sectors, h)) return h.firstLine;
+    }
+    return _nextLine;
+}
+
+uint32_t FlashLog::readLines(uint32_t since, const LineFn& fn) {
+    if (!_storage) {
+        return since;
+    }
+    char* buf = (char*)malloc(MAX_PAYLOAD + 1);
+    if (!buf) {
+        return since;
+    }
+    uint32_t head = _head;
+    size_t end = _offset;
+    uint32_t next = since;
+    bool stop = false;
+
+    for (uint32_t step = 1; step <= _sectors && !stop; step++) {
+        uint32_t sector = (head + step) % _sectors;
+        SectorHeader h, nh;
+        if (!sectorHeader(sector, h)) continue;
+        // Whole sector before since: the next one starts at or below it
+        if (step < _sectors && sectorHeader((sector + 1) % _sectors, nh) &&
+            nh.seq == h.seq + 1 && nh.firstLine <= since) {
+            continue;
+        }
+        size_t limit = (sector == head) ? end : SECTOR_SIZE;
+        size_t off = sizeof(SectorHeader);
+        while (!stop && off + sizeof(RecordHeader) <= limit) {
+            RecordHeader rh;
+            int r = readRecord(sector, off, rh, buf);
+            if (r == 0 || r == -2) break;
+            off += recordSize(rh.len);
+            if (r < 0 || rh.line + rh.lines <= since) continue;
+
+            buf[rh.len] = '\0';
+            char* line = buf;
+            for (uint16_t i = 0; i < rh.lines && line <= buf + rh.len; i++) {
+                char* nl = strchr(line, '\n');
+                if (nl) *nl = '\0';
+                uint32_t seq = rh.line + i;
+                if ((int32_t)(seq - since) >= 0) {
+                    if (!fn(seq, line, strlen(line))) {
+                        stop = true;
+                        break;
+                    }
+                    next = seq + 1;
+                }
+                if (!nl) break;
+                line = nl + 1;
+            }
+        }
+    }
+    free(buf);
+    return next;
+}
+
+FlashLog::Reader::Reader(FlashLog& log)
+    : _log(log)
+    , _rec((char*)malloc(MAX_PAYLOAD + 1))
+    , _endSector(log._head)
+    , _endOffset(log._offset)
+{
+    _done = !_rec || !log._storage;
+}
+
+FlashLog::Reader::~Reader() {
+    free(_rec);
+}
+
+// Next valid record into _rec, walking from the sector after the head
+// (oldest) to the head, up to the write offset seen when the reader was made
+bool FlashLog::Reader::nextRecord() {
+    while (!_done) {
+        if (_offset == 0) {
+            if (++_step > _log._sectors) {
+                _done = true;
+                break;
+            }
+            _sector = (_endSector + _step) % _log._sectors;
+            SectorHeader h;
+            if (!_log.sectorHeader(_sector, h)) continue;
+            _offset = sizeof(SectorHeader);
+        }
+        size_t limit = (_sector == _endSector) ? _endOffset : SECTOR_SIZE;
+        if (_offset + sizeof(RecordHeader) > limit) {
+            _offset = 0;
+            continue;
+        }
+        RecordHeader rh;
+        int r = _log.readRecord(_sector, _offset, rh, _rec);
+        if (r == 0 || r == -2) {
+            _offset = 0;
+            continue;
+        }
+        _offset += recordSize(rh.len);
+        if (r < 0) continue;
+        _rec[rh.len] = '\n';
+        _recLen = rh.len + 1;
+        _recOff = 0;
+        return true;
+    }
+    return false;
+}
+
+size_t FlashLog::Reader::fill(char* buf, size_t maxLen) {
+    size_t n = 0;
+    while (n < maxLen) {
+        if (_recOff >= _recLen && !nextRecord()) break;
+        size_t k = _recLen - _recOff;
+        if (k > maxLen - n) k = maxLen - n;
+        memcpy(buf + n, _rec + _recOff, k);
+        n += k;
+        _recOff += k;
+    }
+    return n;
+}
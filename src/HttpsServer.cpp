@@ -17,6 +17,12 @@
 #include "Thermostat.h"
 #include "HX710.h"
 #include "Logger.h"
+#include "JsonStream.h"
+#include "FlashLog.h"
+#include "MQTTHandler.h"
+#include "ReconnectPolicy.h"
+#include "PressureCapture.h"
+#include "CANBus.h"
 #include "SessionManager.h"
 #include <lwip/sockets.h>
 
@@ -184,6 +190,21 @@ static esp_err_t serveFileHttps(httpd_req_t* req, const char* fsPath) {
     return ESP_OK;
 }
 
+// Response staging for chunked replies. httpd runs every handler on its
+// one task, so a single buffer is enough.
+static char s_chunk[1024];
+
+// ArduinoJson straight into httpd chunks; no String copy of the document
+static esp_err_t sendJsonChunked(httpd_req_t* req, JsonDocument& doc) {
+    httpd_resp_set_type(req, "application/json");
+    JsonStream out(s_chunk, sizeof(s_chunk), [req](const char* data, size_t len) {
+        return httpd_resp_send_chunk(req, data, len) == ESP_OK;
+    });
+    serializeJson(doc, out);
+    if (!out.end()) return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 // --- ESP-IDF httpd handler callbacks ---
 
 static esp_err_t configGetHandler(httpd_req_t* req) {
@@ -256,21 +277,31 @@ static esp_err_t configGetHandler(httpd_req_t* req) {
         doc["apFallbackMinutes"] = proj->apFallbackSeconds / 60;
         doc["apPassword"] = proj->apPassword;
         doc["maxLogSize"] = proj->maxLogSize;
-        doc["maxOldLogCount"] = proj->maxOldLogCount;
+        doc["logArchiveBytes"] = proj->logArchiveBytes;
+        doc["logHistoryBytes"] = proj->logHistoryBytes;
+        doc["syslogHost"] = proj->syslogHost;
+        doc["syslogPort"] = proj->syslogPort;
+        doc["syslogRate"] = proj->syslogRate;
         doc["adminPasswordSet"] = ctx->config->hasAdminPassword();
         doc["theme"] = proj->theme.length() > 0 ? proj->theme : "dark";
         doc["systemName"] = proj->systemName.length() > 0 ? proj->systemName : "AThermostat";
         doc["mqttPrefix"] = proj->mqttPrefix.length() > 0 ? proj->mqttPrefix : "thermostat";
         doc["mqttTempTopic"] = proj->mqttTempTopic;
+        doc["mqttReplayRate"] = proj->mqttReplayRate;
+        doc["mqttInflightWindow"] = proj->mqttInflightWindow;
+        doc["mqttEventQos"] = proj->mqttEventQos;
+        doc["mqttTelemetryMs"] = proj->mqttTelemetryMs;
+        doc["mqttConfigEnabled"] = proj->mqttConfigEnabled;
         doc["forceSafeMode"] = proj->forceSafeMode;
         doc["safeMode"] = ctx->safeMode ? *(ctx->safeMode) : false;
         doc["sessionTimeoutMinutes"] = proj->sessionTimeoutMinutes;
         doc["pollIntervalSec"] = proj->pollIntervalSec;
-        String json;
-        serializeJson(doc, json);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send(req, json.c_str(), json.length());
-        return ESP_OK;
+        doc["captureEnabled"] = proj->captureEnabled;
+        doc["capturePreMs"] = proj->capturePreMs;
+        doc["capturePostMs"] = proj->capturePostMs;
+        doc["captureSlots"] = proj->captureSlots;
+        doc["captureTriggers"] = proj->captureTriggers;
+        return sendJsonChunked(req, doc);
     }
 
     return serveFileHttps(req, "/www/config.html");
@@ -546,9 +577,27 @@ static esp_err_t configPostHandler(httpd_req_t* req) {
 
     // Logging (live)
     uint32_t maxLogSize = data["maxLogSize"] | proj->maxLogSize;
-    uint8_t maxOldLogCount = data["maxOldLogCount"] | proj->maxOldLogCount;
+    uint32_t logArchiveBytes = data["logArchiveBytes"] | proj->logArchiveBytes;
     proj->maxLogSize = maxLogSize;
-    proj->maxOldLogCount = maxOldLogCount;
+    proj->logArchiveBytes = logArchiveBytes;
+    if (data["logHistoryBytes"].is<int>()) {
+        uint32_t v = data["logHistoryBytes"];
+        if (v != proj->logHistoryBytes) {
+            proj->logHistoryBytes = v;
+            Log.setHistorySize(v);
+        }
+    }
+    if (data["syslogHost"].is<const char*>() || data["syslogPort"].is<int>() || data["syslogRate"].is<int>()) {
+        String host = data["syslogHost"] | proj->syslogHost;
+        uint16_t port = data["syslogPort"] | proj->syslogPort;
+        uint16_t rate = data["syslogRate"] | proj->syslogRate;
+        if (host != proj->syslogHost || port != proj->syslogPort || rate != proj->syslogRate) {
+            proj->syslogHost = host;
+            proj->syslogPort = port ? port : 514;
+            proj->syslogRate = rate;
+            Log.setSyslog(host.c_str(), proj->syslogPort, rate, proj->systemName.c_str());
+        }
+    }
 
     // UI theme
     String theme = data["theme"] | proj->theme;
@@ -565,6 +614,33 @@ static esp_err_t configPostHandler(httpd_req_t* req) {
         }
     }
 
+    // MQTT replay rate (live)
+    if (data["mqttReplayRate"].is<int>()) {
+        uint16_t v = data["mqttReplayRate"];
+        if (v > 0 && v != proj->mqttReplayRate) {
+            proj->mqttReplayRate = v;
+            if (ctx->mqtt) ctx->mqtt->setReplayRate(v);
+        }
+    }
+    if (data["mqttInflightWindow"].is<int>()) {
+        uint8_t v = constrain(data["mqttInflightWindow"].as<int>(), 1, (int)MQTTHandler::MAX_INFLIGHT);
+        proj->mqttInflightWindow = v;
+        if (ctx->mqtt) ctx->mqtt->setInflightWindow(v);
+    }
+    if (data["mqttEventQos"].is<int>()) {
+        proj->mqttEventQos = data["mqttEventQos"].as<int>() ? 1 : 0;
+        if (ctx->mqtt) ctx->mqtt->setEventQos(proj->mqttEventQos);
+    }
+    if (data["mqttTelemetryMs"].is<int>()) {
+        int v = data["mqttTelemetryMs"].as<int>();
+        proj->mqttTelemetryMs = v <= 0 ? 0 : constrain(v, (int)MQTTHandler::TELEMETRY_MIN_MS, 60000);
+        if (ctx->mqtt) ctx->mqtt->setTelemetryInterval(proj->mqttTelemetryMs);
+    }
+    if (data["mqttConfigEnabled"].is<bool>()) {
+        proj->mqttConfigEnabled = data["mqttConfigEnabled"];
+        if (ctx->mqtt) ctx->mqtt->setConfigEnabled(proj->mqttConfigEnabled);
+    }
+
     // System name (requires reboot)
     if (data["systemName"].is<const char*>()) {
         String newName = data["systemName"] | proj->systemName;
@@ -589,6 +665,28 @@ static esp_err_t configPostHandler(httpd_req_t* req) {
         }
     }
 
+    // Pressure capture (requires reboot — buffers are sized at boot)
+    if (data["captureEnabled"].is<bool>()) {
+        bool v = data["captureEnabled"];
+        if (v != proj->captureEnabled) { proj->captureEnabled = v; needsReboot = true; }
+    }
+    if (data["capturePreMs"].is<int>()) {
+        uint32_t v = constrain(data["capturePreMs"].as<int>(), 0, (int)PressureCapture::MAX_WINDOW_MS);
+        if (v != proj->capturePreMs) { proj->capturePreMs = v; needsReboot = true; }
+    }
+    if (data["capturePostMs"].is<int>()) {
+        uint32_t v = constrain(data["capturePostMs"].as<int>(), 0, (int)PressureCapture::MAX_WINDOW_MS);
+        if (v != proj->capturePostMs) { proj->capturePostMs = v; needsReboot = true; }
+    }
+    if (data["captureSlots"].is<int>()) {
+        uint8_t v = constrain(data["captureSlots"].as<int>(), 1, (int)PressureCapture::MAX_SLOTS);
+        if (v != proj->captureSlots) { proj->captureSlots = v; needsReboot = true; }
+    }
+    if (data["captureTriggers"].is<const char*>()) {
+        String v = data["captureTriggers"] | proj->captureTriggers;
+        if (v != proj->captureTriggers) { proj->captureTriggers = v; needsReboot = true; }
+    }
+
     // Force safe mode on next boot (one-shot)
     if (data["forceSafeMode"].is<bool>()) {
         proj->forceSafeMode = data["forceSafeMode"] | false;
@@ -756,6 +854,40 @@ static esp_err_t heapGetHandler(httpd_req_t* req) {
 
 // --- State handler ---
 
+static void backoffJson(JsonObject o, const ReconnectPolicy& p) {
+    o["inOutage"] = p.inOutage();
+    o["outageMs"] = p.outageMs(millis());
+    o["step"] = p.getStep();
+    o["nextDelayMs"] = p.getLastDelayMs();
+    o["attempts"] = p.getAttempts();
+    o["outageAttempts"] = p.getOutageAttempts();
+    o["outages"] = p.getOutages();
+    o["reconnects"] = p.getReconnects();
+    o["flaps"] = p.getFlaps();
+    o["ttrLastMs"] = p.getTtrLastMs();
+    o["ttrAvgMs"] = p.getTtrAvgMs();
+    o["ttrMaxMs"] = p.getTtrMaxMs();
+}
+
+static void canJson(JsonObject o, const CANBus& c) {
+    o["running"] = c.isRunning();
+    o["tx"] = c.getTxCount();
+    o["rx"] = c.getRxCount();
+    o["errors"] = c.getErrorCount();
+    o["busOff"] = c.getBusOffCount();
+    o["filter"] = c.getFilterMode();
+    o["filterIds"] = c.getFilterIds();
+    o["delivered"] = c.getDeliveredCount();
+    o["swFiltered"] = c.getSwFilteredCount();
+    o["rxOverruns"] = c.getRxOverruns();
+    o["wakeups"] = c.getWakeups();
+    o["busyUs"] = c.getBusyUs();
+    o["latencyAvgUs"] = c.getLatencyAvgUs();
+    o["latencyMaxUs"] = c.getLatencyMaxUs();
+    JsonArray hist = o["latencyHist"].to<JsonArray>();
+    for (uint8_t i = 0; i < CANBus::LATENCY_BUCKETS; i++) hist.add(c.getLatencyBucket(i));
+}
+
 static esp_err_t stateGetHandler(httpd_req_t* req) {
     HttpsContext* ctx = (HttpsContext*)req->user_ctx;
     JsonDocument doc;
@@ -815,6 +947,86 @@ static esp_err_t stateGetHandler(httpd_req_t* req) {
         doc["datetime"] = buf;
     }
 
+    if (ctx->mqtt) {
+        JsonObject mqtt = doc["mqtt"].to<JsonObject>();
+        mqtt["connected"] = ctx->mqtt->connected();
+        mqtt["publishedVersion"] = ctx->mqtt->getPublishedVersion();
+        mqtt["changePublishes"] = ctx->mqtt->getChangePublishes();
+        mqtt["fieldPublishes"] = ctx->mqtt->getFieldPublishes();
+        mqtt["heartbeats"] = ctx->mqtt->getHeartbeats();
+        mqtt["publishErrors"] = ctx->mqtt->getPublishErrors();
+        mqtt["acks"] = ctx->mqtt->getAcks();
+        mqtt["latencyLastMs"] = ctx->mqtt->getLatencyLastMs();
+        mqtt["latencyAvgMs"] = ctx->mqtt->getLatencyAvgMs();
+        mqtt["latencyMaxMs"] = ctx->mqtt->getLatencyMaxMs();
+        mqtt["discoveryPublishes"] = ctx->mqtt->getDiscoveryPublishes();
+        mqtt["commands"] = ctx->mqtt->getCommands();
+        mqtt["commandErrors"] = ctx->mqtt->getCommandErrors();
+        mqtt["eventQos"] = ctx->mqtt->getEventQos();
+        mqtt["inflight"] = ctx->mqtt->getInFlight();
+        mqtt["inflightWindow"] = ctx->mqtt->getInflightWindow();
+        mqtt["windowFull"] = ctx->mqtt->getWindowFull();
+        mqtt["retransmits"] = ctx->mqtt->getRetransmits();
+        mqtt["snapshotsCoalesced"] = ctx->mqtt->getSnapshotsCoalesced();
+        mqtt["ackRttLastMs"] = ctx->mqtt->getRttLastMs();
+        mqtt["ackRttAvgMs"] = ctx->mqtt->getRttAvgMs();
+        mqtt["ackRttMaxMs"] = ctx->mqtt->getRttMaxMs();
+        mqtt["telemetryMs"] = ctx->mqtt->getTelemetryInterval();
+        mqtt["telemetryFrames"] = ctx->mqtt->getTelemetryFrames();
+        mqtt["telemetryBytes"] = MQTTHandler::getTelemetryBytes();
+        mqtt["stateJsonBytes"] = ctx->mqtt->getStateJsonBytes();
+        mqtt["configRequests"] = ctx->mqtt->getConfigRequests();
+        mqtt["configErrors"] = ctx->mqtt->getConfigErrors();
+
+        const MqttQueue* q = ctx->mqtt->getQueue();
+        JsonObject queue = mqtt["queue"].to<JsonObject>();
+        queue["depth"] = q->getDepth();
+        queue["ramEntries"] = q->getRamEntries();
+        queue["ramBytes"] = q->getRamBytes();
+        queue["fileEntries"] = q->getFileEntries();
+        queue["fileBytes"] = q->getFileBytes();
+        queue["bytesSpilled"] = q->getBytesSpilled();
+        queue["spillErrors"] = q->getSpillErrors();
+        queue["queued"] = q->getQueued();
+        queue["dropped"] = q->getDropped();
+        queue["snapshotsQueued"] = ctx->mqtt->getSnapshotsQueued();
+        queue["replaying"] = ctx->mqtt->isReplaying();
+        queue["replayRate"] = ctx->mqtt->getReplayRate();
+        queue["replaySent"] = ctx->mqtt->getReplaySent();
+        queue["replayLagS"] = ctx->mqtt->getReplayLagS();
+        queue["replayedTotal"] = q->getReplayed();
+
+        const MqttRouter& r = ctx->mqtt->getRouter();
+        JsonObject router = mqtt["router"].to<JsonObject>();
+        router["filters"] = r.getFilterCount();
+        router["nodes"] = r.getNodeCount();
+        router["messages"] = r.getMessages();
+        router["dispatched"] = r.getDispatched();
+        router["unmatched"] = r.getUnmatched();
+        router["reassembled"] = r.getReassembled();
+        router["dropped"] = r.getDropped();
+    }
+
+    JsonObject reconnect = doc["reconnect"].to<JsonObject>();
+    if (ctx->wifiBackoff) backoffJson(reconnect["wifi"].to<JsonObject>(), *ctx->wifiBackoff);
+    if (ctx->mqtt) backoffJson(reconnect["mqtt"].to<JsonObject>(), ctx->mqtt->getBackoff());
+
+    if (ctx->can) canJson(doc["can"].to<JsonObject>(), *ctx->can);
+
+    // Command to relay change, per path
+    JsonObject commands = doc["commands"].to<JsonObject>();
+    static const char* srcNames[] = {"rest", "mqtt"};
+    for (uint8_t i = 0; i < (uint8_t)CommandSource::COUNT; i++) {
+        const Thermostat::CommandStats& st = ts->commandStats((CommandSource)i);
+        JsonObject o = commands[srcNames[i]].to<JsonObject>();
+        o["commands"] = st.commands;
+        o["rejected"] = st.rejected;
+        o["relaySamples"] = st.relaySamples;
+        o["relayLastMs"] = st.relayLastMs;
+        o["relayAvgMs"] = st.relaySamples ? (uint32_t)(st.relaySumMs / st.relaySamples) : 0;
+        o["relayMaxMs"] = st.relayMaxMs;
+    }
+
     String json;
     serializeJson(doc, json);
     httpd_resp_set_type(req, "application/json");
@@ -890,11 +1102,7 @@ static esp_err_t pinsGetHandler(httpd_req_t* req) {
             p2["raw"] = ctx->pressure2->getLastRaw();
         }
 
-        String json;
-        serializeJson(doc, json);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send(req, json.c_str(), json.length());
-        return ESP_OK;
+        return sendJsonChunked(req, doc);
     }
 
     return serveFileHttps(req, "/www/pins.html");
@@ -939,10 +1147,15 @@ static esp_err_t pinsPostHandler(httpd_req_t* req) {
 
     // Set thermostat mode
     if (data["mode"].is<const char*>()) {
-        String modeStr = data["mode"] | String("OFF");
-        ThermostatMode mode = Thermostat::stringToMode(modeStr.c_str());
-        ctx->thermostat->setMode(mode);
+        const char* err = ctx->thermostat->commandMode(data["mode"], CommandSource::REST);
         JsonDocument resp;
+        if (err) {
+            resp["error"] = err;
+            String json;
+            serializeJson(resp, json);
+            httpd_resp_send(req, json.c_str(), json.length());
+            return ESP_OK;
+        }
         resp["status"] = "ok";
         resp["mode"] = Thermostat::modeToString(ctx->thermostat->getMode());
         String json;
@@ -954,8 +1167,15 @@ static esp_err_t pinsPostHandler(httpd_req_t* req) {
     // Set heat setpoint
     if (data["heatSetpoint"].is<float>()) {
         float sp = data["heatSetpoint"];
-        ctx->thermostat->setHeatSetpoint(sp);
+        const char* err = ctx->thermostat->commandSetpoints(sp, NAN, CommandSource::REST);
         JsonDocument resp;
+        if (err) {
+            resp["error"] = err;
+            String json;
+            serializeJson(resp, json);
+            httpd_resp_send(req, json.c_str(), json.length());
+            return ESP_OK;
+        }
         resp["status"] = "ok";
         resp["heatSetpoint"] = sp;
         String json;
@@ -967,8 +1187,15 @@ static esp_err_t pinsPostHandler(httpd_req_t* req) {
     // Set cool setpoint
     if (data["coolSetpoint"].is<float>()) {
         float sp = data["coolSetpoint"];
-        ctx->thermostat->setCoolSetpoint(sp);
+        const char* err = ctx->thermostat->commandSetpoints(NAN, sp, CommandSource::REST);
         JsonDocument resp;
+        if (err) {
+            resp["error"] = err;
+            String json;
+            serializeJson(resp, json);
+            httpd_resp_send(req, json.c_str(), json.length());
+            return ESP_OK;
+        }
         resp["status"] = "ok";
         resp["coolSetpoint"] = sp;
         String json;
@@ -980,7 +1207,7 @@ static esp_err_t pinsPostHandler(httpd_req_t* req) {
     // Force furnace
     if (data["forceFurnace"].is<bool>()) {
         bool ff = data["forceFurnace"];
-        ctx->thermostat->setForceFurnace(ff);
+        ctx->thermostat->commandForceFurnace(ff, CommandSource::REST);
         JsonDocument resp;
         resp["status"] = "ok";
         resp["forceFurnace"] = ff;
@@ -993,7 +1220,7 @@ static esp_err_t pinsPostHandler(httpd_req_t* req) {
     // Force no HP
     if (data["forceNoHP"].is<bool>()) {
         bool fnh = data["forceNoHP"];
-        ctx->thermostat->setForceNoHP(fnh);
+        ctx->thermostat->commandForceNoHP(fnh, CommandSource::REST);
         JsonDocument resp;
         resp["status"] = "ok";
         resp["forceNoHP"] = fnh;
@@ -1224,9 +1451,32 @@ static esp_err_t rootGetHandler(httpd_req_t* req) {
 
 // --- Log handler (proxy to ring buffer) ---
 
+// Query values from httpd_query_key_value are still percent-encoded
+static void urlDecodeInPlace(char* s) {
+    char* out = s;
+    for (char* p = s; *p; p++) {
+        if (*p == '+') {
+            *out++ = ' ';
+        } else if (*p == '%' && isxdigit((uint8_t)p[1]) && isxdigit((uint8_t)p[2])) {
+            char hex[3] = {p[1], p[2], 0};
+            *out++ = (char)strtol(hex, nullptr, 16);
+            p += 2;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// GET /log?limit=N returns the newest N lines. With since=<seq> only newer
+// lines come back (oldest first, at most limit) plus the cursor for the next
+// poll. level=0-3, tags=A,B and contains=text filter on the device.
 static esp_err_t logGetHandler(httpd_req_t* req) {
-    size_t count = Log.getRingBufferCount();
-    size_t limit = count;
+    Logger::HistoryQuery q;
+    size_t limit = 0;
+    bool incremental = false;
+    bool flash = false;
+    String contains;
 
     size_t qLen = httpd_req_get_url_query_len(req);
     if (qLen > 0) {
@@ -1234,49 +1484,77 @@ static esp_err_t logGetHandler(httpd_req_t* req) {
         if (qBuf && httpd_req_get_url_query_str(req, qBuf, qLen + 1) == ESP_OK) {
             char val[16] = {};
             if (httpd_query_key_value(qBuf, "limit", val, sizeof(val)) == ESP_OK) {
-                size_t l = atoi(val);
-                if (l < limit) limit = l;
+                limit = atoi(val);
+            }
+            if (httpd_query_key_value(qBuf, "since", val, sizeof(val)) == ESP_OK) {
+                q.since = strtoul(val, nullptr, 10);
+                incremental = true;
+            }
+            if (httpd_query_key_value(qBuf, "level", val, sizeof(val)) == ESP_OK) {
+                q.level = (Logger::Level)constrain(atoi(val), 0, 3);
+            }
+            char tags[128] = {};
+            if (httpd_query_key_value(qBuf, "tags", tags, sizeof(tags)) == ESP_OK && tags[0]) {
+                urlDecodeInPlace(tags);
+                q.tagMask = Log.tagMask(tags);
+            }
+            char text[48] = {};
+            if (httpd_query_key_value(qBuf, "contains", text, sizeof(text)) == ESP_OK) {
+                urlDecodeInPlace(text);
+                contains = text;
+            }
+            // source=flash reads the flash log partition (earlier boots too)
+            if (httpd_query_key_value(qBuf, "source", val, sizeof(val)) == ESP_OK) {
+                flash = strcmp(val, "flash") == 0 && Log.getFlashLog();
             }
         }
         free(qBuf);
     }
-
-    const auto& buffer = Log.getRingBuffer();
-    size_t head = Log.getRingBufferHead();
-    size_t bufSize = buffer.size();
-    size_t startOffset = count - limit;
-
-    String json = "{\"count\":" + String(limit) + ",\"entries\":[";
-    for (size_t i = 0; i < limit; i++) {
-        size_t idx = (head + bufSize - count + startOffset + i) % bufSize;
-        if (i > 0) json += ",";
-        json += "\"";
-        const String& entry = buffer[idx];
-        for (size_t j = 0; j < entry.length(); j++) {
-            char c = entry[j];
-            switch (c) {
-                case '"':  json += "\\\""; break;
-                case '\\': json += "\\\\"; break;
-                case '\n': json += "\\n"; break;
-                case '\r': json += "\\r"; break;
-                case '\t': json += "\\t"; break;
-                default:   json += c; break;
-            }
-        }
-        json += "\"";
+    if (incremental) {
+        q.limit = limit ? limit : 200;
+    } else {
+        q.tail = limit;
     }
-    json += "]}";
 
+    LogJsonSource src(q, contains, [flash](const Logger::HistoryCursor& cur) -> String {
+        return String(flash ? "\"source\":\"flash\"," : "") +
+               "\"count\":" + String(cur.count) +
+               ",\"next\":" + String(cur.next) +
+               ",\"more\":" + String(cur.more ? "true" : "false") +
+               ",\"lost\":" + String(cur.lost) +
+               ",\"reset\":" + String(cur.reset ? "true" : "false");
+    }, flash);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json.c_str(), json.length());
-    return ESP_OK;
+    size_t n;
+    while ((n = src.fill(s_chunk, sizeof(s_chunk))) > 0) {
+        if (httpd_resp_send_chunk(req, s_chunk, n) != ESP_OK) return ESP_FAIL;
+    }
+    Log.countPoll(src.total(), incremental);
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 // --- Log level/config handlers ---
 
 static esp_err_t logLevelGetHandler(httpd_req_t* req) {
     String json = "{\"level\":" + String(Log.getLevel()) +
-                  ",\"levelName\":\"" + String(Log.getLevelName(Log.getLevel())) + "\"}";
+                  ",\"levelName\":\"" + String(Log.getLevelName(Log.getLevel())) +
+                  "\",\"compileLevel\":" + String(LOG_COMPILE_LEVEL) + ",\"tags\":{";
+    for (uint8_t i = 0; i < Log.getTagCount(); i++) {
+        if (i > 0) json += ",";
+        json += "\"" + String(Log.getTagName(i)) + "\":" + String(Log.getTagLevelById(i));
+    }
+    json += "},\"repeatWindowMs\":" + String(Log.getRepeatWindow()) + ",\"suppressed\":{";
+    bool first = true;
+    for (uint8_t i = 0; i < Log.getTagCount(); i++) {
+        if (!Log.getTagRepeatsById(i) && !Log.getTagRateLimitedById(i) && !Log.getTagRateById(i)) continue;
+        if (!first) json += ",";
+        first = false;
+        json += "\"" + String(Log.getTagName(i)) + "\":{\"repeats\":" + String(Log.getTagRepeatsById(i)) +
+                ",\"rateLimited\":" + String(Log.getTagRateLimitedById(i)) +
+                ",\"rate\":" + String(Log.getTagRateById(i)) +
+                ",\"burst\":" + String(Log.getTagBurstById(i)) + "}";
+    }
+    json += "}}";
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json.c_str(), json.length());
     return ESP_OK;
@@ -1295,9 +1573,43 @@ static esp_err_t logLevelPostHandler(httpd_req_t* req) {
     }
     httpd_req_get_url_query_str(req, qBuf, qLen + 1);
     char val[16] = {};
+    char tag[Logger::TAG_NAME_LEN] = {};
+    bool hasTag = httpd_query_key_value(qBuf, "tag", tag, sizeof(tag)) == ESP_OK && tag[0];
+    bool other = false;
+    if (httpd_query_key_value(qBuf, "repeat_window", val, sizeof(val)) == ESP_OK) {
+        Log.setRepeatWindow(strtoul(val, nullptr, 10));
+        other = true;
+    }
+    if (httpd_query_key_value(qBuf, "rate", val, sizeof(val)) == ESP_OK) {
+        // Per-tag token bucket; rate=0 removes it
+        long rate = atol(val);
+        long burst = 0;
+        if (httpd_query_key_value(qBuf, "burst", val, sizeof(val)) == ESP_OK) burst = atol(val);
+        if (!hasTag || rate < 0 || rate > 65535 || burst < 0 || burst > 65535) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid tag or rate");
+            free(qBuf);
+            return ESP_OK;
+        }
+        if (!Log.setTagRate(tag, rate, burst)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "tag table full");
+            free(qBuf);
+            return ESP_OK;
+        }
+        Log.info("HTTPS", "Rate limit for %s set to %ld/s", tag, rate);
+        other = true;
+    }
     if (httpd_query_key_value(qBuf, "level", val, sizeof(val)) == ESP_OK) {
         int level = atoi(val);
-        if (level >= 0 && level <= 3) {
+        if (hasTag && level >= Logger::TAG_LEVEL_GLOBAL && level <= 3) {
+            // Per-tag override; -1 returns the tag to the global level
+            if (Log.setTagLevel(tag, level)) {
+                Log.info("HTTPS", "Log level for %s changed to %d", tag, level);
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{\"status\":\"ok\"}", HTTPD_RESP_USE_STRLEN);
+            } else {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "tag table full");
+            }
+        } else if (!hasTag && level >= 0 && level <= 3) {
             Log.setLevel((Logger::Level)level);
             Log.info("HTTPS", "Log level changed to %d", level);
             httpd_resp_set_type(req, "application/json");
@@ -1305,6 +1617,9 @@ static esp_err_t logLevelPostHandler(httpd_req_t* req) {
         } else {
             httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "level must be 0-3");
         }
+    } else if (other) {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, "{\"status\":\"ok\"}", HTTPD_RESP_USE_STRLEN);
     } else {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "missing level param");
     }
@@ -1318,7 +1633,66 @@ static esp_err_t logConfigGetHandler(httpd_req_t* req) {
                   "\",\"serial\":" + String(Log.isSerialEnabled() ? "true" : "false") +
                   ",\"mqtt\":" + String(Log.isMqttEnabled() ? "true" : "false") +
                   ",\"sdcard\":" + String(Log.isFileLogEnabled() ? "true" : "false") +
-                  ",\"websocket\":" + String(Log.isWebSocketEnabled() ? "true" : "false") + "}";
+                  ",\"websocket\":" + String(Log.isWebSocketEnabled() ? "true" : "false") +
+                  ",\"binary\":" + String(Log.isBinaryMode() ? "true" : "false") +
+                  ",\"records\":" + String(Log.getRecordCount()) +
+                  ",\"recordsPerSec\":" + String(Log.getRecordsPerSec());
+    for (int b = 0; b < 2; b++) {
+        uint32_t n = Log.getCaptureRecords(b);
+        json += String(b ? ",\"binaryCapture\":{" : ",\"textCapture\":{") +
+                "\"records\":" + String(n) +
+                ",\"bytesPerRecord\":" + String(n ? (float)Log.getCaptureBytes(b) / n : 0.0f) +
+                ",\"usPerRecord\":" + String(n ? (float)Log.getCaptureUs(b) / n : 0.0f) + "}";
+    }
+    json += ",\"history\":{\"capacityBytes\":" + String(Log.getHistoryCapacity()) +
+            ",\"usedBytes\":" + String(Log.getHistoryBytesUsed()) +
+            ",\"entries\":" + String(Log.getHistoryCount()) + "}";
+    json += ",\"file\":{\"flashBytes\":" + String(Log.getFlashBytes()) +
+            ",\"flushes\":" + String(Log.getFileFlushes()) +
+            ",\"flushUsAvg\":" + String(Log.getFlushUsAvg()) +
+            ",\"flushUsMax\":" + String(Log.getFlushUsMax()) + "}";
+    json += ",\"poll\":{\"fullPolls\":" + String(Log.getPollCount(false)) +
+            ",\"fullBytesAvg\":" + String(Log.getPollBytesAvg(false)) +
+            ",\"incrementalPolls\":" + String(Log.getPollCount(true)) +
+            ",\"incrementalBytesAvg\":" + String(Log.getPollBytesAvg(true)) + "}";
+    json += ",\"crash\":{\"capacityBytes\":" + String(Logger::CRASH_LOG_BYTES) +
+            ",\"usedBytes\":" + String(Log.getCrashBytesUsed()) +
+            ",\"recoveredLines\":" + String(Log.getCrashLinesRecovered()) +
+            ",\"resetReason\":\"" + String(Logger::getResetReasonName(esp_reset_reason())) + "\"}";
+    json += ",\"websocket\":{\"frames\":" + String(Log.getWsFrames()) +
+            ",\"bytes\":" + String(Log.getWsBytes()) +
+            ",\"skippedLines\":" + String(Log.getWsSkipped()) + "}";
+    json += ",\"syslog\":{\"enabled\":" + String(Log.isSyslogEnabled() ? "true" : "false") +
+            ",\"host\":\"" + Log.getSyslogHost() + "\"" +
+            ",\"port\":" + String(Log.getSyslogPort()) +
+            ",\"resolved\":" + String(Log.isSyslogResolved() ? "true" : "false") +
+            ",\"datagrams\":" + String(Log.getSyslogDatagrams()) +
+            ",\"bytes\":" + String(Log.getSyslogBytes()) +
+            ",\"lines\":" + String(Log.getSyslogLines()) +
+            ",\"rateDropped\":" + String(Log.getSyslogRateDropped()) +
+            ",\"sendErrors\":" + String(Log.getSyslogSendErrors()) +
+            ",\"sequenceId\":" + String(Log.getSyslogSeq()) + "}";
+    if (FlashLog* fl = Log.getFlashLog()) {
+        json += ",\"flashLog\":{\"capacityBytes\":" + String(fl->getCapacity()) +
+                ",\"sectors\":" + String(fl->getSectors()) +
+                ",\"headSector\":" + String(fl->getHeadSector()) +
+                ",\"headOffset\":" + String(fl->getHeadOffset()) +
+                ",\"oldestLine\":" + String(fl->getOldestLine()) +
+                ",\"nextLine\":" + String(fl->getNextLine()) +
+                ",\"records\":" + String(fl->getRecords()) +
+                ",\"bytesWritten\":" + String(fl->getBytesWritten()) +
+                ",\"erases\":" + String(fl->getErases()) +
+                ",\"crcErrors\":" + String(fl->getCrcErrors()) +
+                ",\"writeErrors\":" + String(fl->getWriteErrors()) +
+                ",\"recoverProbes\":" + String(fl->getRecoverProbes()) +
+                ",\"recoverUs\":" + String(fl->getRecoverUs()) + "}";
+    }
+    json += ",\"dropped\":{";
+    for (int s = 0; s < Logger::SINK_COUNT; s++) {
+        if (s > 0) json += ",";
+        json += "\"" + String(Log.getSinkName((Logger::Sink)s)) + "\":" + String(Log.getDropped((Logger::Sink)s));
+    }
+    json += "}}";
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json.c_str(), json.length());
     return ESP_OK;
@@ -1345,6 +1719,8 @@ static esp_err_t logConfigPostHandler(httpd_req_t* req) {
         Log.enableFileLog(strcmp(val, "true") == 0);
     if (httpd_query_key_value(qBuf, "websocket", val, sizeof(val)) == ESP_OK)
         Log.enableWebSocket(strcmp(val, "true") == 0);
+    if (httpd_query_key_value(qBuf, "binary", val, sizeof(val)) == ESP_OK)
+        Log.setBinaryMode(strcmp(val, "true") == 0);
     free(qBuf);
     Log.info("HTTPS", "Log config updated");
     httpd_resp_set_type(req, "application/json");
@@ -1352,6 +1728,97 @@ static esp_err_t logConfigPostHandler(httpd_req_t* req) {
     return ESP_OK;
 }
 
+// --- Log archive handler: list, or ?index=N streams one .gz ---
+
+static esp_err_t logArchiveGetHandler(httpd_req_t* req) {
+    if (!checkHttpsAuth(req)) return ESP_OK;
+
+    uint32_t index = 0;
+    size_t qLen = httpd_req_get_url_query_len(req);
+    if (qLen > 0) {
+        char* qBuf = (char*)malloc(qLen + 1);
+        if (qBuf && httpd_req_get_url_query_str(req, qBuf, qLen + 1) == ESP_OK) {
+            char val[16] = {};
+            if (httpd_query_key_value(qBuf, "index", val, sizeof(val)) == ESP_OK) {
+                index = strtoul(val, nullptr, 10);
+            }
+        }
+        free(qBuf);
+    }
+
+    if (index == 0) {
+        JsonDocument doc;
+        doc["budgetBytes"] = Log.getArchiveBudget();
+        doc["compressed"] = Log.getArchivedFiles();
+        doc["failures"] = Log.getArchiveFailures();
+        doc["ratio"] = Log.getArchiveRatio();
+        doc["msAvg"] = Log.getArchiveMsAvg();
+        doc["msLast"] = Log.getArchiveMsLast();
+        JsonArray files = doc["files"].to<JsonArray>();
+        Log.listArchives([&files](uint32_t idx, size_t bytes, bool compressed) {
+            JsonObject f = files.add<JsonObject>();
+            f["index"] = idx;
+            f["bytes"] = bytes;
+            f["gz"] = compressed;
+        });
+        String json;
+        serializeJson(doc, json);
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, json.c_str(), json.length());
+        return ESP_OK;
+    }
+
+    String path = Log.getArchiveFilename(index, true);
+    fs::File file = LittleFS.open(path.c_str(), FILE_READ);
+    if (!file) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    // Sent as-is; the browser inflates it
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    char buf[1024];
+    size_t n;
+    while ((n = file.read((uint8_t*)buf, sizeof(buf))) > 0) {
+        if (httpd_resp_send_chunk(req, buf, n) != ESP_OK) {
+            file.close();
+            return ESP_FAIL;
+        }
+    }
+    file.close();
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Whole flash log partition as text, or the current LittleFS log file
+static esp_err_t logDownloadGetHandler(httpd_req_t* req) {
+    if (!checkHttpsAuth(req)) return ESP_OK;
+    Log.flush();
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"log.txt\"");
+    size_t n;
+    if (FlashLog* fl = Log.getFlashLog()) {
+        FlashLog::Reader reader(*fl);
+        while ((n = reader.fill(s_chunk, sizeof(s_chunk))) > 0) {
+            if (httpd_resp_send_chunk(req, s_chunk, n) != ESP_OK) return ESP_FAIL;
+        }
+        return httpd_resp_send_chunk(req, NULL, 0);
+    }
+    fs::File file = LittleFS.open(Log.getLogFilename().c_str(), FILE_READ);
+    if (!file) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    while ((n = file.read((uint8_t*)s_chunk, sizeof(s_chunk))) > 0) {
+        if (httpd_resp_send_chunk(req, s_chunk, n) != ESP_OK) {
+            file.close();
+            return ESP_FAIL;
+        }
+    }
+    file.close();
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 // --- Revert handlers ---
 
 static esp_err_t revertGetHandler(httpd_req_t* req) {
@@ -2075,6 +2542,22 @@ HttpsServerHandle httpsStart(const uint8_t* cert, size_t certLen,
     };
     httpd_register_uri_handler(server, &logConfigPost);
 
+    httpd_uri_t logArchiveGet = {
+        .uri = "/log/archive",
+        .method = HTTP_GET,
+        .handler = logArchiveGetHandler,
+        .user_ctx = ctx
+    };
+    httpd_register_uri_handler(server, &logArchiveGet);
+
+    httpd_uri_t logDownloadGet = {
+        .uri = "/log/download",
+        .method = HTTP_GET,
+        .handler = logDownloadGetHandler,
+        .user_ctx = ctx
+    };
+    httpd_register_uri_handler(server, &logDownloadGet);
+
     httpd_uri_t heapGet = {
         .uri = "/heap",
         .method = HTTP_GET,
@@ -0,0 +1,196 @@
+#include "JsonStream.h"
+
+JsonStream::JsonStream(char* buf, size_t size, const SinkFn& sink)
+    : _buf(buf), _size(size), _sink(sink) {}
+
+JsonStream::JsonStream(char* buf, size_t size, size_t skip)
+    : _buf(buf), _size(size), _skip(skip) {}
+
+size_t JsonStream::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t JsonStream::write(const uint8_t* data, size_t len) {
+    size_t in = len;
+    if (!_sink) {
+        // Window mode: drop what the previous calls already delivered
+        if (_total < _skip) {
+            size_t drop = _skip - _total;
+            if (drop > len) drop = len;
+            data += drop;
+            len -= drop;
+            _total += drop;
+        }
+        size_t n = _size - _len;
+        if (n > len) n = len;
+        memcpy(_buf + _len, data, n);
+        _len += n;
+        _total += len;
+        return in;
+    }
+    while (len > 0 && !_failed) {
+        size_t n = _size - _len;
+        if (n > len) n = len;
+        memcpy(_buf + _len, data, n);
+        _len += n;
+        _total += n;
+        data += n;
+        len -= n;
+        if (_len == _size) {
+            if (!_sink(_buf, _len)) _failed = true;
+            _len = 0;
+        }
+    }
+    return in;
+}
+
+void JsonStream::string(const char* s) {
+    print('"');
+    for (const char* p = s; *p; p++) {
+        switch (*p) {
+            case '"':  print("\\\""); break;
+            case '\\': print("\\\\"); break;
+            case '\n': print("\\n"); break;
+            case '\r': print("\\r"); break;
+            case '\t': print("\\t"); break;
+            default:   write((uint8_t)((uint8_t)*p < 0x20 ? ' ' : *p)); break;
+        }
+    }
+    print('"');
+}
+
+bool JsonStream::end() {
+    if (_sink && _len > 0 && !_failed) {
+        if (!_sink(_buf, _len)) _failed = true;
+        _len = 0;
+    }
+    return !_failed;
+}
+
+size_t JsonStream::escape(char* dst, size_t room, const char* s) {
+    size_t n = 0;
+    if (room < 2) return 0;
+    dst[n++] = '"';
+    for (const char* p = s; *p; p++) {
+        if (n + 3 > room) return 0;
+        switch (*p) {
+            case '"':  dst[n++] = '\\'; dst[n++] = '"'; break;
+            case '\\': dst[n++] = '\\'; dst[n++] = '\\'; break;
+            case '\n': dst[n++] = '\\'; dst[n++] = 'n'; break;
+            case '\r': dst[n++] = '\\'; dst[n++] = 'r'; break;
+            case '\t': dst[n++] = '\\'; dst[n++] = 't'; break;
+            default:   dst[n++] = ((uint8_t)*p < 0x20) ? ' ' : *p; break;
+        }
+    }
+    dst[n++] = '"';
+    return n;
+}
+
+LogJsonSource::LogJsonSource(const Logger::HistoryQuery& q, const String& contains, const TailFn& tail,
+                             bool flash)
+    : _q(q), _contains(contains), _tail(tail), _flash(flash) {}
+
+Logger::HistoryCursor LogJsonSource::query(const Logger::HistoryQuery& q, const Logger::HistoryFn& fn) {
+    return _flash ? Log.queryFlash(q, fn) : Log.queryHistory(q, fn);
+}
+
+// Tail queries become a since/limit walk from the first of the newest
+// matches, so every fill() can continue from a plain seq cursor.
+void LogJsonSource::start() {
+    _q.contains = _contains.length() ? _contains.c_str() : nullptr;
+    if (_q.tail > 0) {
+        uint32_t first = 0;
+        bool any = false;
+        Logger::HistoryCursor c = query(_q, [&](uint32_t seq, Logger::Level, const char*, const char*) {
+            first = seq;
+            any = true;
+            return false;
+        });
+        _remaining = any ? _q.tail : 0;
+        _cur.next = any ? first : c.next;
+        _cur.reset = c.reset;
+        _q.tail = 0;
+    } else {
+        _remaining = _q.limit ? _q.limit : SIZE_MAX;
+        _cur.next = _q.since;
+    }
+}
+
+size_t LogJsonSource::fill(char* buf, size_t maxLen) {
+    size_t n = 0;
+    while (n < maxLen) {
+        if (_pendingOff < _pending.length()) {
+            size_t k = _pending.length() - _pendingOff;
+            if (k > maxLen - n) k = maxLen - n;
+            memcpy(buf + n, _pending.c_str() + _pendingOff, k);
+            n += k;
+            _pendingOff += k;
+            continue;
+        }
+        _pending = "";
+        _pendingOff = 0;
+
+        if (_stage == HEAD) {
+            start();
+            _pending = "{\"entries\":[";
+            _stage = ENTRIES;
+        } else if (_stage == ENTRIES) {
+            Logger::HistoryQuery q = _q;
+            q.since = _cur.next;
+            bool probe = (_remaining == 0);
+            // limit = 1 with nothing left only checks whether more would follow
+            q.limit = probe ? 1 : _remaining;
+            bool stopped = false;
+            Logger::HistoryCursor c = query(q, [&](uint32_t seq, Logger::Level, const char*, const char* line) {
+                if (probe) {
+                    stopped = true;
+                    return false;
+                }
+                char esc[Logger::MSG_SIZE * 3];
+                size_t len = 0;
+                if (_cur.count) esc[len++] = ',';
+                len += JsonStream::escape(esc + len, sizeof(esc) - len, line);
+                size_t k = len;
+                if (k > maxLen - n) k = maxLen - n;
+                memcpy(buf + n, esc, k);
+                n += k;
+                if (k < len) _pending.concat(esc + k, len - k);
+                _cur.count++;
+                _remaining--;
+                _cur.next = seq + 1;
+                if (n >= maxLen) {
+                    stopped = true;
+                    return false;
+                }
+                return true;
+            });
+            if (!_queried) {
+                _cur.lost = c.lost;
+                _cur.reset = _cur.reset || c.reset;
+                _queried = true;
+            }
+            if (probe) {
+                _cur.more = stopped;
+                if (!stopped) _cur.next = c.next;
+                _stage = TAIL;
+            } else if (!stopped) {
+                _cur.next = c.next;
+                _cur.more = c.more;
+                _stage = TAIL;
+            }
+        } else if (_stage == TAIL) {
+            String tail = _tail ? _tail(_cur) : String();
+            _pending = "]";
+            if (tail.length()) {
+                _pending += ",";
+                _pending += tail;
+            }
+            _pending += "}";
+            _stage = DONE;
+        } else {
+            break;
+        }
+    }
+    _total += n;
+    return n;
+}
@@ -1,35 +1,393 @@
 #include "Logger.h"
+#include "FlashLog.h"
+#include "MqttQueue.h"
 #include <ESPAsyncWebServer.h>
 #include <stdarg.h>
 #include <time.h>
-#include <WiFi.h>
+#include <stddef.h>
+#include <esp_system.h>
+#include <algorithm>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
 
 Logger Log;
 
 static const char* LEVEL_NAMES[] = {"ERROR", "WARN ", "INFO ", "DEBUG"};
+static const char* SINK_NAMES[] = {"history", "serial", "mqtt", "file", "websocket", "syslog"};
+
+// Crash tail: '\n' separated lines in a byte ring. RTC no-init RAM keeps its
+// contents across panic, watchdog and software resets; magic tells a
+// surviving ring from power-on garbage.
+struct CrashRing {
+    uint32_t magic;
+    uint32_t head;          // next write offset
+    uint32_t used;
+    char data[Logger::CRASH_LOG_BYTES];
+};
+static const uint32_t CRASH_MAGIC = 0x4C4F4743;  // "LOGC"
+RTC_NOINIT_ATTR static CrashRing s_crash;
 
 Logger::Logger()
     : _level(LOG_INFO)
+    , _maxLevel(LOG_INFO)
+    , _tagOverrides(0)
+    , _tagCount(0)
+    , _repeatWindow(DEFAULT_REPEAT_WINDOW_MS)
+    , _rateTags(0)
+    , _lastSweep(0)
+    , _crashTags(0)
+    , _crashCapture(true)
+    , _crashRecovered(0)
     , _serialEnabled(true)
     , _mqttEnabled(false)
     , _fileLogEnabled(false)
     , _wsEnabled(false)
     , _mqttClient(nullptr)
     , _mqttTopic("thermostat/log")
+    , _mqttQueue(nullptr)
+    , _mqttQueueTopic(0)
     , _ws(nullptr)
+    , _wsBatch(nullptr)
+    , _wsBatchLen(0)
+    , _wsLines(0)
+    , _wsNext(0)
+    , _wsLastFlush(0)
+    , _wsFrames(0)
+    , _wsBytes(0)
+    , _wsSkipped(0)
+    , _syslogEnabled(false)
+    , _syslogPort(SYSLOG_DEFAULT_PORT)
+    , _syslogRate(SYSLOG_DEFAULT_RATE)
+    , _syslogRoom(0)
+    , _syslogSock(-1)
+    , _syslogAddr(0)
+    , _syslogResolveMs(0)
+    , _syslogBuf(nullptr)
+    , _syslogLen(0)
+    , _syslogLines(0)
+    , _syslogSeverity(7)
+    , _syslogFirst(0)
+    , _syslogStart(0)
+    , _syslogTokens(0)
+    , _syslogRefill(0)
+    , _syslogPendingDrops(0)
+    , _syslogSeq(0)
+    , _syslogDatagrams(0)
+    , _syslogBytes(0)
+    , _syslogLinesSent(0)
+    , _syslogRateDropped(0)
+    , _syslogSendErrors(0)
     , _fsReady(false)
+    , _flashLog(nullptr)
     , _logFilename("/log.txt")
     , _maxFileSize(DEFAULT_MAX_FILE_SIZE)
-    , _maxRotatedFiles(DEFAULT_MAX_ROTATED_FILES)
-    , _ringBufferMax(DEFAULT_RING_BUFFER_SIZE)
-    , _ringBufferHead(0)
-    , _ringBufferCount(0)
+    , _archiveBytes(DEFAULT_ARCHIVE_BYTES)
+    , _archiveIndex(0)
+    , _archiveTask(nullptr)
+    , _gzFiles(0)
+    , _gzFailures(0)
+    , _gzInBytes(0)
+    , _gzOutBytes(0)
+    , _gzMsTotal(0)
+    , _gzMsLast(0)
+    , _fileBuf(nullptr)
+    , _fileBufLen(0)
+    , _fileSize(0)
+    , _lastFileFlush(0)
+    , _flashBytes(0)
+    , _fileFlushes(0)
+    , _flushUsTotal(0)
+    , _flushUsMax(0)
+    , _hist(nullptr)
+    , _histCap(0)
+    , _histHead(0)
+    , _histTail(0)
+    , _histCount(0)
+    , _histUsed(0)
+    , _histLock(nullptr)
+    , _slots(nullptr)
+    , _sinkTask(nullptr)
+    , _sinkLock(nullptr)
+    , _head(0)
+    , _binaryMode(true)
+    , _rateHead(0)
+    , _rateStart(0)
+    , _recordsPerSec(0)
+    , _scratchSeq(0)
 {
-    _ringBuffer.resize(_ringBufferMax);
+    memset(_cursor, 0, sizeof(_cursor));
+    memset(_tags, 0, sizeof(_tags));
+    memset(_tagPtrs, 0, sizeof(_tagPtrs));
+    memset(_tagPtrIds, 0, sizeof(_tagPtrIds));
+    memset(_repeats, 0, sizeof(_repeats));
+    _tagMux = portMUX_INITIALIZER_UNLOCKED;
+    _repeatMux = portMUX_INITIALIZER_UNLOCKED;
+    _crashMux = portMUX_INITIALIZER_UNLOCKED;
+    memset(_dropped, 0, sizeof(_dropped));
+    memset(_polls, 0, sizeof(_polls));
+    memset(_pollBytes, 0, sizeof(_pollBytes));
+    memset(_wsClients, 0, sizeof(_wsClients));
+    _wsMux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+void Logger::begin() {
+    if (_sinkTask) return;
+    // Records logged synchronously so far are already delivered
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    for (int s = 0; s < SINK_COUNT; s++) _cursor[s] = head;
+
+    _slots = (Slot*)ps_calloc(QUEUE_SLOTS, sizeof(Slot));
+    if (!_slots) {
+        Serial.println("[Logger] Queue alloc failed, staying synchronous");
+        return;
+    }
+    _sinkLock = xSemaphoreCreateMutex();
+    if (!_sinkLock ||
+        xTaskCreate(sinkTask, "logSink", SINK_TASK_STACK, this, 1, &_sinkTask) != pdPASS) {
+        free(_slots);
+        _slots = nullptr;
+        _sinkTask = nullptr;
+        Serial.println("[Logger] Sink task create failed, staying synchronous");
+        return;
+    }
+    esp_register_shutdown_handler(shutdownHandler);
+}
+
+void Logger::shutdownHandler() {
+    Log.flush();
+}
+
+void Logger::flush() {
+    if (_sinkTask) {
+        if (xSemaphoreTake(_sinkLock, pdMS_TO_TICKS(FLUSH_WAIT_MS)) != pdTRUE) {
+            return;
+        }
+        drain();
+    }
+    flushFileBuffer();
+    flushSyslog();
+    if (_sinkTask) {
+        xSemaphoreGive(_sinkLock);
+    }
+}
+
+uint32_t Logger::getDropped(Sink sink) const {
+    return (sink < SINK_COUNT) ? _dropped[sink] : 0;
+}
+
+const char* Logger::getSinkName(Sink sink) const {
+    return (sink < SINK_COUNT) ? SINK_NAMES[sink] : "?";
 }
 
 void Logger::setLevel(Level level) {
     _level = level;
+    updateMaxLevel();
+}
+
+void Logger::updateMaxLevel() {
+    Level max = _level;
+    uint8_t overrides = 0;
+    for (uint8_t i = 0; i < _tagCount; i++) {
+        if (_tags[i].level < 0) continue;
+        overrides++;
+        if (_tags[i].level > max) max = (Level)_tags[i].level;
+    }
+    _tagOverrides = overrides;
+    _maxLevel = max;
+}
+
+// Fast path: open-addressed table keyed by the literal's address. The same
+// tag text at another address (another translation unit) maps to the same id.
+uint8_t Logger::tagId(const char* tag) {
+    uint32_t h = ((uint32_t)(uintptr_t)tag >> 2) * 2654435761u;
+    for (uint8_t probe = 0; probe < TAG_HASH_SLOTS; probe++) {
+        uint8_t slot = (h + probe) & (TAG_HASH_SLOTS - 1);
+        const char* p = __atomic_load_n(&_tagPtrs[slot], __ATOMIC_ACQUIRE);
+        if (p == tag) return _tagPtrIds[slot];
+        if (p == nullptr) break;
+    }
+
+    // Slow path, once per call-site literal
+    portENTER_CRITICAL(&_tagMux);
+    uint8_t id = internTag(tag);
+    for (uint8_t probe = 0; probe < TAG_HASH_SLOTS; probe++) {
+        uint8_t slot = (h + probe) & (TAG_HASH_SLOTS - 1);
+        if (_tagPtrs[slot] == tag) break;
+        if (_tagPtrs[slot] == nullptr) {
+            _tagPtrIds[slot] = id;
+            __atomic_store_n(&_tagPtrs[slot], tag, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_tagMux);
+    return id;
+}
+
+// Caller holds _tagMux. Falls back to the last id when the table is full.
+uint8_t Logger::internTag(const char* name) {
+    for (uint8_t i = 0; i < _tagCount; i++) {
+        if (strncmp(_tags[i].name, name, TAG_NAME_LEN - 1) == 0) return i;
+    }
+    if (_tagCount >= MAX_TAGS) return MAX_TAGS - 1;
+    TagInfo& t = _tags[_tagCount];
+    memset(&t, 0, sizeof(t));
+    strlcpy(t.name, name, sizeof(t.name));
+    t.level = TAG_LEVEL_GLOBAL;
+    return _tagCount++;
+}
+
+bool Logger::setCrashTag(const char* tag, bool enable) {
+    portENTER_CRITICAL(&_tagMux);
+    bool full = (_tagCount >= MAX_TAGS);
+    uint8_t id = internTag(tag);
+    bool ok = !full || strncmp(_tags[id].name, tag, TAG_NAME_LEN - 1) == 0;
+    if (ok && _tags[id].crash != enable) {
+        _tags[id].crash = enable;
+        if (enable) _crashTags++; else _crashTags--;
+    }
+    portEXIT_CRITICAL(&_tagMux);
+    return ok;
+}
+
+bool Logger::setTagLevel(const char* tag, int8_t level) {
+    if (level > LOG_DEBUG) level = LOG_DEBUG;
+    if (level < TAG_LEVEL_GLOBAL) level = TAG_LEVEL_GLOBAL;
+    portENTER_CRITICAL(&_tagMux);
+    bool full = (_tagCount >= MAX_TAGS);
+    uint8_t id = internTag(tag);
+    bool ok = !full || strncmp(_tags[id].name, tag, TAG_NAME_LEN - 1) == 0;
+    if (ok) _tags[id].level = level;
+    portEXIT_CRITICAL(&_tagMux);
+    updateMaxLevel();
+    return ok;
+}
+
+bool Logger::setTagRate(const char* tag, uint16_t rate, uint16_t burst) {
+    portENTER_CRITICAL(&_tagMux);
+    bool full = (_tagCount >= MAX_TAGS);
+    uint8_t id = internTag(tag);
+    bool ok = !full || strncmp(_tags[id].name, tag, TAG_NAME_LEN - 1) == 0;
+    portEXIT_CRITICAL(&_tagMux);
+    if (!ok) return false;
+
+    portENTER_CRITICAL(&_repeatMux);
+    TagInfo& t = _tags[id];
+    if ((t.rate != 0) != (rate != 0)) {
+        if (rate) _rateTags++; else _rateTags--;
+    }
+    t.rate = rate;
+    t.burst = burst ? burst : rate;
+    t.tokens = (uint32_t)t.burst * 1000;
+    t.refill = millis();
+    portEXIT_CRITICAL(&_repeatMux);
+    return true;
+}
+
+// Called before a line is captured. Returns false to drop it. Summaries
+// owed by an evicted repeat slot or a rate-limited tag are logged first, so
+// they land just before the line that ends the run. len is 0 for lines that
+// can't be suppressed as repeats.
+bool Logger::admitPacked(Level level, const char* tag, const char* format,
+                         const uint8_t* args, size_t len) {
+    uint8_t id = tagId(tag);
+    uint32_t now = millis();
+    bool pass = true;
+    bool repeatable = _repeatWindow && level > LOG_WARN;
+    uint32_t limited = 0;
+    RepeatSlot evicted = {};
+
+    // FNV-1a over the arguments, mixed with the format address
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= args[i];
+        h *= 16777619u;
+    }
+    h ^= ((uint32_t)(uintptr_t)format >> 2) * 2654435761u;
+    RepeatSlot& r = _repeats[(h >> 24) & (REPEAT_SLOTS - 1)];
+    portENTER_CRITICAL(&_repeatMux);
+    TagInfo& t = _tags[id];
+    if (repeatable && r.format == format && r.tag == tag && now - r.start < _repeatWindow &&
+        r.argLen == len && memcmp(r.args, args, len) == 0) {
+        // Repeats are only counted, they don't use up the tag's tokens
+        r.count++;
+        t.repeats++;
+        pass = false;
+    } else if (t.rate) {
+        uint32_t cap = (uint32_t)t.burst * 1000;
+        uint64_t tokens = t.tokens + (uint64_t)(now - t.refill) * t.rate;
+        t.tokens = tokens > cap ? cap : (uint32_t)tokens;
+        t.refill = now;
+        if (t.tokens < 1000) {
+            t.limitedPending++;
+            t.rateLimited++;
+            pass = false;
+        } else {
+            t.tokens -= 1000;
+            limited = t.limitedPending;
+            t.limitedPending = 0;
+        }
+    }
+    if (pass && repeatable) {
+        // New line, hash collision or expired window: the slot's run ends here
+        evicted = r;
+        r.tag = tag;
+        r.format = format;
+        r.start = now;
+        r.count = 0;
+        r.level = level;
+        r.argLen = len;
+        memcpy(r.args, args, len);
+    }
+    portEXIT_CRITICAL(&_repeatMux);
+
+    if (limited) {
+        logText(level, tag, "rate limit: %lu messages dropped", (unsigned long)limited);
+    }
+    if (evicted.format && evicted.count) logRepeated(evicted);
+    return pass;
+}
+
+// The summary shows the suppressed line itself, rendered from the slot
+void Logger::logRepeated(const RepeatSlot& r) {
+    char line[MSG_SIZE / 2];
+    renderArgs(r.format, r.args, r.argLen, line, sizeof(line));
+    logText((Level)r.level, r.tag, "last message repeated %lu times: %s",
+            (unsigned long)r.count, line);
+}
+
+// Summaries for runs that ended quietly: repeat windows that closed with a
+// count, and rate-limited tags that have gone idle.
+void Logger::sweepSuppressed() {
+    uint32_t now = millis();
+    _lastSweep = now;
+    for (uint8_t i = 0; i < REPEAT_SLOTS; i++) {
+        RepeatSlot due = {};
+        portENTER_CRITICAL(&_repeatMux);
+        RepeatSlot& r = _repeats[i];
+        if (r.format && now - r.start >= _repeatWindow) {
+            due = r;
+            r.format = nullptr;
+        }
+        portEXIT_CRITICAL(&_repeatMux);
+        if (due.count) logRepeated(due);
+    }
+    if (_rateTags == 0) return;
+    for (uint8_t id = 0; id < _tagCount; id++) {
+        portENTER_CRITICAL(&_repeatMux);
+        uint32_t limited = _tags[id].limitedPending;
+        _tags[id].limitedPending = 0;
+        portEXIT_CRITICAL(&_repeatMux);
+        if (limited) {
+            logText(LOG_WARN, _tags[id].name, "rate limit: %lu messages dropped", (unsigned long)limited);
+        }
+    }
+}
+
+int8_t Logger::getTagLevel(const char* tag) {
+    for (uint8_t i = 0; i < _tagCount; i++) {
+        if (strncmp(_tags[i].name, tag, TAG_NAME_LEN - 1) == 0) return _tags[i].level;
+    }
+    return TAG_LEVEL_GLOBAL;
 }
 
 Logger::Level Logger::getLevel() {
@@ -49,10 +407,23 @@ void Logger::setMqttClient(AsyncMqttClient* client, const char* topic) {
     _mqttEnabled = (client != nullptr);
 }
 
-void Logger::setLogFile(const char* filename, uint32_t maxFileSize, uint8_t maxRotatedFiles) {
+void Logger::setMqttQueue(MqttQueue* queue) {
+    int id = queue ? queue->addTopic(_mqttTopic.c_str()) : -1;
+    _mqttQueueTopic = id >= 0 ? id : 0;
+    _mqttQueue = id >= 0 ? queue : nullptr;
+}
+
+void Logger::setLogFile(const char* filename, uint32_t maxFileSize, uint32_t archiveBytes) {
     _logFilename = filename;
     _maxFileSize = maxFileSize;
-    _maxRotatedFiles = maxRotatedFiles;
+    _archiveBytes = archiveBytes;
+    if (!_fileBuf) {
+        _fileBuf = (char*)ps_malloc(FILE_BUFFER_SIZE);
+    }
+    if (!_fileBuf) {
+        Serial.println("[Logger] File buffer alloc failed, file log disabled");
+        return;
+    }
     _fsReady = true;
     _fileLogEnabled = true;
 }
@@ -82,10 +453,56 @@ bool Logger::isFileLogEnabled() {
 }
 
 void Logger::setWebSocket(AsyncWebSocket* ws) {
+    if (ws && !_wsBatch) {
+        _wsBatch = (char*)ps_malloc(WS_BATCH_SIZE);
+        if (!_wsBatch) {
+            Serial.println("[Logger] WebSocket batch alloc failed");
+            ws = nullptr;
+        }
+    }
     _ws = ws;
     _wsEnabled = (ws != nullptr);
 }
 
+void Logger::openWebSocket(uint32_t clientId) {
+    wsClient(clientId);
+}
+
+void Logger::closeWebSocket(uint32_t clientId) {
+    portENTER_CRITICAL(&_wsMux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (_wsClients[i].id == clientId) _wsClients[i].id = 0;
+    }
+    portEXIT_CRITICAL(&_wsMux);
+}
+
+void Logger::resumeWebSocket(uint32_t clientId, uint32_t since) {
+    WsClient* wc = wsClient(clientId);
+    if (!wc) return;
+    portENTER_CRITICAL(&_wsMux);
+    wc->resumeSeq = since;
+    wc->resume = true;
+    portEXIT_CRITICAL(&_wsMux);
+}
+
+// Find the client's entry, claiming a free one on first use
+Logger::WsClient* Logger::wsClient(uint32_t id) {
+    WsClient* found = nullptr;
+    portENTER_CRITICAL(&_wsMux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS && !found; i++) {
+        if (_wsClients[i].id == id) found = &_wsClients[i];
+    }
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS && !found; i++) {
+        if (_wsClients[i].id == 0) {
+            found = &_wsClients[i];
+            *found = {};
+            found->id = id;
+        }
+    }
+    portEXIT_CRITICAL(&_wsMux);
+    return found;
+}
+
 void Logger::enableWebSocket(bool enable) {
     _wsEnabled = enable && (_ws != nullptr);
 }
@@ -94,115 +511,1050 @@ bool Logger::isWebSocketEnabled() {
     return _wsEnabled;
 }
 
-void Logger::setRingBufferSize(size_t maxEntries) {
-    _ringBufferMax = maxEntries;
-    _ringBuffer.resize(_ringBufferMax);
-    _ringBufferHead = 0;
-    _ringBufferCount = 0;
+void Logger::setHistorySize(size_t bytes) {
+    if (bytes < MIN_HISTORY_BYTES) bytes = MIN_HISTORY_BYTES;
+    if (!_histLock) {
+        _histLock = xSemaphoreCreateMutex();
+        if (!_histLock) return;
+    }
+    uint8_t* buf = (uint8_t*)ps_malloc(bytes);
+    if (!buf) {
+        Serial.printf("[Logger] History alloc of %u bytes failed\n", (unsigned)bytes);
+        return;
+    }
+
+    xSemaphoreTake(_histLock, portMAX_DELAY);
+    uint8_t* old = _hist;
+    size_t oldCap = _histCap;
+    size_t off = _histTail;
+    size_t count = _histCount;
+    _hist = buf;
+    _histCap = bytes;
+    _histHead = _histTail = _histCount = _histUsed = 0;
+    // Re-append the old entries oldest first; the new ring evicts what doesn't fit
+    for (size_t i = 0; i < count; i++) {
+        const HistoryEntry* e = (const HistoryEntry*)(old + off);
+        if (off + sizeof(HistoryEntry) > oldCap || e->len == HISTORY_WRAP) {
+            off = 0;
+            e = (const HistoryEntry*)old;
+        }
+        historyAppend(*e, e + 1);
+        off += historyEntrySize(e);
+    }
+    xSemaphoreGive(_histLock);
+    free(old);
+}
+
+// Entries are stored whole (never split across the end of the buffer).
+// When the next entry doesn't fit before the end, the rest is marked
+// HISTORY_WRAP and writing restarts at offset 0, evicting oldest entries.
+void Logger::historyAppend(const HistoryEntry& hdr, const void* payload) {
+    size_t need = historyEntrySize(&hdr);
+    if (need > _histCap) return;
+
+    if (_histHead + need > _histCap) {
+        while (_histCount && _histTail >= _histHead) historyEvict();
+        if (_histHead + sizeof(HistoryEntry) <= _histCap) {
+            ((HistoryEntry*)(_hist + _histHead))->len = HISTORY_WRAP;
+        }
+        _histHead = 0;
+        if (!_histCount) _histTail = 0;
+    }
+    while (_histCount && _histTail >= _histHead && _histTail < _histHead + need) historyEvict();
+
+    if (!_histCount) _histTail = _histHead;
+    HistoryEntry* e = (HistoryEntry*)(_hist + _histHead);
+    *e = hdr;
+    memcpy(e + 1, payload, hdr.len);
+    _histHead += need;
+    _histCount++;
+    _histUsed += need;
+}
+
+void Logger::historyEvict() {
+    size_t sz = historyEntrySize((const HistoryEntry*)(_hist + _histTail));
+    _histTail += sz;
+    _histUsed -= sz;
+    _histCount--;
+    if (!_histCount) {
+        _histTail = _histHead;
+    } else if (_histTail + sizeof(HistoryEntry) > _histCap ||
+               ((const HistoryEntry*)(_hist + _histTail))->len == HISTORY_WRAP) {
+        _histTail = 0;
+    }
 }
 
-const std::vector<String>& Logger::getRingBuffer() const {
-    return _ringBuffer;
+void Logger::addToHistory() {
+    if (!_hist) {
+        setHistorySize(DEFAULT_HISTORY_BYTES);
+        if (!_hist) return;
+    }
+    HistoryEntry hdr;
+    hdr.seq = _scratchSeq;
+    hdr.epoch = _scratch.epoch;
+    hdr.tag = _scratch.tag;
+    hdr.format = _scratch.format;
+    hdr.len = _scratch.len + (_scratch.binary ? 0 : 1);
+    hdr.level = _scratch.level;
+    hdr.binary = _scratch.binary;
+    // Intern here so every logged tag can be named in a query or level override
+    tagId(_scratch.tag);
+    xSemaphoreTake(_histLock, portMAX_DELAY);
+    historyAppend(hdr, _scratch.msg);
+    xSemaphoreGive(_histLock);
 }
 
-size_t Logger::getRingBufferHead() const {
-    return _ringBufferHead;
+size_t Logger::readHistory(uint32_t since, size_t tail, const HistoryFn& fn) {
+    HistoryQuery q;
+    q.since = since;
+    q.tail = tail;
+    return queryHistory(q, fn).count;
+}
+
+// Header-only checks, before anything is rendered
+bool Logger::historyFilter(const HistoryEntry* e, const HistoryQuery& q) {
+    if ((int32_t)(e->seq - q.since) < 0) return false;
+    if (e->level > q.level) return false;
+    if (q.tagMask != 0xFFFFFFFF && !(q.tagMask & (1u << tagId(e->tag)))) return false;
+    return true;
+}
+
+Logger::HistoryCursor Logger::queryHistory(const HistoryQuery& query, const HistoryFn& fn) {
+    HistoryCursor cur;
+    HistoryQuery q = query;
+    if ((int32_t)(q.since - _head.load(std::memory_order_relaxed)) > 0) {
+        q.since = 0;
+        cur.reset = true;
+    }
+    cur.next = q.since;
+    if (!_histLock || !_hist) return cur;
+    char line[sizeof(_buffer)];
+
+    xSemaphoreTake(_histLock, portMAX_DELAY);
+    if (_histCount) {
+        uint32_t oldest = ((const HistoryEntry*)(_hist + _histTail))->seq;
+        if ((int32_t)(oldest - q.since) > 0 && q.since != 0) cur.lost = oldest - q.since;
+    }
+
+    // Count the matches first so tail can skip without rendering (the
+    // substring filter needs the rendered line, so only then render twice)
+    size_t skip = 0;
+    if (q.tail > 0) {
+        size_t matches = 0;
+        size_t off = _histTail;
+        for (size_t i = 0; i < _histCount; i++) {
+            if (off + sizeof(HistoryEntry) > _histCap || ((HistoryEntry*)(_hist + off))->len == HISTORY_WRAP) off = 0;
+            const HistoryEntry* e = (const HistoryEntry*)(_hist + off);
+            off += historyEntrySize(e);
+            if (!historyFilter(e, q)) continue;
+            if (q.contains && *q.contains) {
+                formatEntry(e->epoch, e->level, e->tag, e->format, e->binary,
+                            (const char*)(e + 1), e->len, line, sizeof(line));
+                if (!strstr(line, q.contains)) continue;
+            }
+            matches++;
+        }
+        if (matches > q.tail) skip = matches - q.tail;
+    }
+
+    size_t off = _histTail;
+    for (size_t i = 0; i < _histCount; i++) {
+        if (off + sizeof(HistoryEntry) > _histCap || ((HistoryEntry*)(_hist + off))->len == HISTORY_WRAP) off = 0;
+        const HistoryEntry* e = (const HistoryEntry*)(_hist + off);
+        off += historyEntrySize(e);
+        if ((int32_t)(e->seq - q.since) < 0) continue;
+        if (q.limit && cur.count >= q.limit) {
+            cur.more = true;
+            break;
+        }
+        cur.next = e->seq + 1;
+        if (!historyFilter(e, q)) continue;
+        bool search = q.contains && *q.contains;
+        if (skip && !search) { skip--; continue; }
+        formatEntry(e->epoch, e->level, e->tag, e->format, e->binary,
+                    (const char*)(e + 1), e->len, line, sizeof(line));
+        if (search) {
+            if (!strstr(line, q.contains)) continue;
+            if (skip) { skip--; continue; }
+        }
+        if (!fn(e->seq, (Level)e->level, e->tag, line)) {
+            cur.next = e->seq;
+            cur.more = true;
+            break;
+        }
+        cur.count++;
+    }
+    xSemaphoreGive(_histLock);
+    return cur;
+}
+
+// Flash lines are stored as rendered text: "[time] [LEVEL] [tag] message"
+static bool parseLogLine(const char* line, uint8_t& level, char* tag, size_t tagSize) {
+    const char* l = strstr(line, "] [");
+    if (!l) return false;
+    l += 3;
+    level = Logger::LOG_DEBUG;
+    for (uint8_t i = 0; i <= Logger::LOG_DEBUG; i++) {
+        if (strncmp(l, LEVEL_NAMES[i], 5) == 0) level = i;
+    }
+    const char* t = strstr(l, "] [");
+    if (!t) return false;
+    t += 3;
+    const char* e = strchr(t, ']');
+    size_t n = e ? (size_t)(e - t) : 0;
+    if (n >= tagSize) n = tagSize - 1;
+    memcpy(tag, t, n);
+    tag[n] = '\0';
+    return true;
+}
+
+Logger::HistoryCursor Logger::queryFlash(const HistoryQuery& query, const HistoryFn& fn) {
+    HistoryCursor cur;
+    HistoryQuery q = query;
+    if (!_flashLog) return cur;
+    uint32_t newest = _flashLog->getNextLine();
+    if ((int32_t)(q.since - newest) > 0) {
+        q.since = 0;
+        cur.reset = true;
+    }
+    cur.next = q.since;
+    uint32_t oldest = _flashLog->getOldestLine();
+    if ((int32_t)(oldest - q.since) > 0 && q.since != 0) cur.lost = oldest - q.since;
+
+    char tag[TAG_NAME_LEN];
+    uint8_t level;
+    auto match = [&](const char* line) {
+        if (!parseLogLine(line, level, tag, sizeof(tag))) {
+            level = LOG_INFO;
+            tag[0] = '\0';
+        }
+        if (level > q.level) return false;
+        if (q.tagMask != 0xFFFFFFFF) {
+            int id = findTag(tag);
+            if (id < 0 || !(q.tagMask & (1UL << id))) return false;
+        }
+        return !(q.contains && *q.contains && !strstr(line, q.contains));
+    };
+
+    // Flash is read twice for tail; records are small and reads cheap
+    size_t skip = 0;
+    if (q.tail > 0) {
+        size_t matches = 0;
+        _flashLog->readLines(q.since, [&](uint32_t, const char* line, size_t) {
+            if (match(line)) matches++;
+            return true;
+        });
+        if (matches > q.tail) skip = matches - q.tail;
+    }
+
+    _flashLog->readLines(q.since, [&](uint32_t seq, const char* line, size_t) {
+        if (q.limit && cur.count >= q.limit) {
+            cur.more = true;
+            return false;
+        }
+        cur.next = seq + 1;
+        if (!match(line)) return true;
+        if (skip) { skip--; return true; }
+        if (!fn(seq, (Level)level, tag, line)) {
+            cur.next = seq;
+            cur.more = true;
+            return false;
+        }
+        cur.count++;
+        return true;
+    });
+    return cur;
 }
 
-size_t Logger::getRingBufferCount() const {
-    return _ringBufferCount;
+int Logger::findTag(const char* name) {
+    for (uint8_t i = 0; i < _tagCount; i++) {
+        if (strncmp(_tags[i].name, name, TAG_NAME_LEN - 1) == 0) return i;
+    }
+    return -1;
 }
 
-void Logger::addToRingBuffer(const char* msg) {
-    _ringBuffer[_ringBufferHead] = String(msg);
-    _ringBufferHead = (_ringBufferHead + 1) % _ringBufferMax;
-    if (_ringBufferCount < _ringBufferMax) {
-        _ringBufferCount++;
+uint32_t Logger::tagMask(const char* csv) {
+    uint32_t mask = 0;
+    char name[TAG_NAME_LEN];
+    while (csv && *csv) {
+        const char* comma = strchr(csv, ',');
+        size_t n = comma ? (size_t)(comma - csv) : strlen(csv);
+        if (n > 0) {
+            strlcpy(name, csv, std::min(n + 1, sizeof(name)));
+            int id = findTag(name);
+            if (id >= 0) mask |= 1u << id;
+        }
+        csv = comma ? comma + 1 : nullptr;
     }
+    return mask;
+}
+
+void Logger::countPoll(size_t bytes, bool incremental) {
+    _polls[incremental]++;
+    _pollBytes[incremental] += bytes;
 }
 
-void Logger::writeToWebSocket(const char* msg) {
+// Lines are appended to the pending frame; the sink task sends it every
+// WS_BATCH_MS, or sooner when the buffer fills. Never stalls the queue.
+bool Logger::writeToWebSocket(const char* msg) {
+    _wsNext = _scratchSeq + 1;
     if (_ws == nullptr || _ws->count() == 0) {
+        return true;
+    }
+    if (!wsAppend(_scratchSeq, msg)) {
+        flushWebSocket(false);
+        wsAppend(_scratchSeq, msg);
+    }
+    return true;
+}
+
+// Append [seq,"line"] to the pending frame. False if it doesn't fit.
+bool Logger::wsAppend(uint32_t seq, const char* line) {
+    size_t len = strnlen(line, sizeof(_buffer));
+    // Worst case every char is escaped, plus the seq, separators and the closing "]}"
+    if (WS_HEADER_ROOM + _wsBatchLen + len * 2 + 20 > WS_BATCH_SIZE) {
+        return false;
+    }
+    char* out = _wsBatch + WS_HEADER_ROOM + _wsBatchLen;
+    char* p = out;
+    if (_wsLines) *p++ = ',';
+    p += sprintf(p, "[%lu,\"", (unsigned long)seq);
+    for (size_t i = 0; i < len; i++) {
+        char c = line[i];
+        switch (c) {
+            case '"':  *p++ = '\\'; *p++ = '"'; break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\n': *p++ = '\\'; *p++ = 'n'; break;
+            case '\r': *p++ = '\\'; *p++ = 'r'; break;
+            case '\t': *p++ = '\\'; *p++ = 't'; break;
+            default:   *p++ = ((uint8_t)c < 0x20) ? ' ' : c; break;
+        }
+    }
+    *p++ = '"';
+    *p++ = ']';
+    _wsBatchLen += p - out;
+    _wsLines++;
+    return true;
+}
+
+// Frame: {"type":"log","dropped":N,"lines":[[seq,"line"],...]}
+// The header is written just in front of the lines so the body is shared
+// by every client and only the dropped count differs. Sent by id: the
+// server looks the client up under its own lock, so the sink task never
+// holds a client the async_tcp task may free. False if it is gone.
+bool Logger::wsSend(uint32_t clientId, uint32_t dropped) {
+    char header[WS_HEADER_ROOM];
+    int hl = snprintf(header, sizeof(header), "{\"type\":\"log\",\"dropped\":%lu,\"lines\":[",
+                      (unsigned long)dropped);
+    char* frame = _wsBatch + WS_HEADER_ROOM - hl;
+    memcpy(frame, header, hl);
+    char* end = _wsBatch + WS_HEADER_ROOM + _wsBatchLen;
+    end[0] = ']';
+    end[1] = '}';
+    size_t len = hl + _wsBatchLen + 2;
+    if (!_ws->text(clientId, frame, len)) {
+        return false;
+    }
+    _wsFrames++;
+    _wsBytes += len;
+    return true;
+}
+
+// Send the pending frame to every caught-up client. timed also advances
+// replays and releases entries of clients that went away unannounced.
+void Logger::flushWebSocket(bool timed) {
+    if (_ws == nullptr || _wsBatch == nullptr) {
+        return;
+    }
+    if (_wsLines) {
+        for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+            WsClient& wc = _wsClients[i];
+            portENTER_CRITICAL(&_wsMux);
+            uint32_t id = wc.id;
+            bool resume = wc.resume;
+            uint32_t dropped = wc.dropped;
+            portEXIT_CRITICAL(&_wsMux);
+            if (id == 0 || resume) continue;    // replaying: gets these lines from history
+            if (!_ws->availableForWrite(id) || !wsSend(id, dropped)) {
+                dropped += _wsLines;
+                _wsSkipped += _wsLines;
+            } else {
+                dropped = 0;
+            }
+            portENTER_CRITICAL(&_wsMux);
+            if (wc.id == id) wc.dropped = dropped;
+            portEXIT_CRITICAL(&_wsMux);
+        }
+        _wsBatchLen = 0;
+        _wsLines = 0;
+    }
+    if (!timed) {
+        return;
+    }
+    _wsLastFlush = millis();
+
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        WsClient& wc = _wsClients[i];
+        portENTER_CRITICAL(&_wsMux);
+        uint32_t id = wc.id;
+        bool resume = wc.resume;
+        portEXIT_CRITICAL(&_wsMux);
+        if (id == 0) continue;
+        if (!_ws->hasClient(id)) {
+            closeWebSocket(id);
+            continue;
+        }
+        if (resume) {
+            wsReplay(wc);
+        }
+    }
+}
+
+// Send history [resumeSeq, _wsNext) to one client, stopping when its send
+// queue backs up. Lines already evicted from the history count as dropped.
+// Once caught up the client goes back to live frames.
+void Logger::wsReplay(WsClient& wc) {
+    portENTER_CRITICAL(&_wsMux);
+    uint32_t id = wc.id;
+    uint32_t start = wc.resumeSeq;
+    uint32_t dropped = wc.dropped;
+    portEXIT_CRITICAL(&_wsMux);
+    uint32_t next = start;
+    if ((int32_t)(next - _wsNext) > 0) next = _wsNext;
+    bool paused = false;
+    // Where to pick up again if the pending frame can't be sent
+    uint32_t batchNext = next;
+    uint32_t batchDropped = dropped;
+
+    auto send = [&]() {
+        bool sent = _ws->availableForWrite(id) && wsSend(id, dropped);
+        _wsBatchLen = 0;
+        _wsLines = 0;
+        if (sent) {
+            dropped = 0;
+            batchNext = next;
+            batchDropped = 0;
+        } else {
+            next = batchNext;
+            dropped = batchDropped;
+            paused = true;
+        }
+        return sent;
+    };
+    readHistory(next, 0, [&](uint32_t seq, Level, const char*, const char* line) {
+        if ((int32_t)(seq - _wsNext) >= 0) return false;
+        if (!wsAppend(seq, line)) {
+            if (!send()) return false;
+            wsAppend(seq, line);
+        }
+        dropped += seq - next;
+        next = seq + 1;
+        return true;
+    });
+    if (_wsLines) {
+        send();
+    }
+    if (!paused) {
+        dropped += _wsNext - next;
+        next = _wsNext;
+    }
+
+    // A resume request or reconnect that arrived meanwhile takes precedence
+    portENTER_CRITICAL(&_wsMux);
+    if (wc.id == id && wc.resumeSeq == start) {
+        wc.dropped = dropped;
+        wc.resumeSeq = next;
+        if (!paused) wc.resume = false;
+    }
+    portEXIT_CRITICAL(&_wsMux);
+}
+
+// Takes the sink lock so the sink task never sees a half-updated host.
+void Logger::setSyslog(const char* host, uint16_t port, uint16_t rate, const char* hostname) {
+    bool locked = _sinkTask && xSemaphoreTake(_sinkLock, pdMS_TO_TICKS(FLUSH_WAIT_MS)) == pdTRUE;
+    if (_sinkTask && !locked) {
         return;
     }
-    String json = "{\"type\":\"log\",\"message\":\"";
-    for (const char* p = msg; *p; p++) {
-        switch (*p) {
-            case '"':  json += "\\\""; break;
-            case '\\': json += "\\\\"; break;
-            case '\n': json += "\\n"; break;
-            case '\r': json += "\\r"; break;
-            case '\t': json += "\\t"; break;
-            default:   json += *p; break;
+    flushSyslog();
+
+    _syslogHost = host ? host : "";
+    _syslogHost.trim();
+    _syslogPort = port ? port : SYSLOG_DEFAULT_PORT;
+    _syslogRate = rate;
+    if (hostname) {
+        // HOSTNAME is PRINTUSASCII without spaces, at most 255 chars
+        _syslogHostname = "";
+        for (const char* p = hostname; *p && _syslogHostname.length() < 48; p++) {
+            _syslogHostname += (*p > ' ' && *p < 127) ? *p : '_';
         }
     }
-    json += "\"}";
-    _ws->textAll(json);
+    if (_syslogHostname.length() == 0) _syslogHostname = "-";
+
+    if (_syslogSock >= 0) {
+        close(_syslogSock);
+        _syslogSock = -1;
+    }
+    _syslogAddr = 0;
+    _syslogResolveMs = 0;
+    _syslogTokens = (uint32_t)_syslogRate * 1000;
+    _syslogRefill = millis();
+
+    if (_syslogHost.length() && !_syslogBuf) {
+        _syslogBuf = (char*)ps_malloc(SYSLOG_HEADER_ROOM + SYSLOG_DATAGRAM);
+        if (!_syslogBuf) Serial.println("[Logger] Syslog buffer alloc failed");
+    }
+    // Lines get whatever the longest possible header leaves of the datagram
+    char header[SYSLOG_HEADER_ROOM];
+    int hl = snprintf(header, sizeof(header),
+                      "<191>1 2000-01-01T00:00:00Z %s athermostat - log "
+                      "[meta sequenceId=\"2147483647\"]"
+                      "[log@32473 first=\"4294967295\" lines=\"65535\" dropped=\"4294967295\"] ",
+                      _syslogHostname.c_str());
+    _syslogRoom = SYSLOG_DATAGRAM - hl;
+    _syslogEnabled = _syslogHost.length() > 0 && _syslogBuf != nullptr;
+    _cursor[SINK_SYSLOG] = _head.load(std::memory_order_relaxed);
+
+    if (locked) {
+        xSemaphoreGive(_sinkLock);
+    }
 }
 
-void Logger::error(const char* tag, const char* format, ...) {
-    if (_level >= LOG_ERROR) {
-        va_list args;
-        va_start(args, format);
-        log(LOG_ERROR, tag, format, args);
-        va_end(args);
+// Open the socket and resolve the host. Done lazily on the sink task, once
+// the network stack is up; a failed lookup is retried after
+// SYSLOG_RESOLVE_RETRY_MS instead of blocking every flush.
+bool Logger::syslogSocket() {
+    if (_syslogAddr && _syslogSock >= 0) {
+        return true;
+    }
+    if (_syslogResolveMs && millis() - _syslogResolveMs < SYSLOG_RESOLVE_RETRY_MS) {
+        return false;
+    }
+    _syslogResolveMs = millis();
+    if (_syslogResolveMs == 0) _syslogResolveMs = 1;
+
+    if (!_syslogAddr) {
+        struct in_addr ip;
+        if (inet_aton(_syslogHost.c_str(), &ip)) {
+            _syslogAddr = ip.s_addr;
+        } else {
+            struct addrinfo hints = {};
+            struct addrinfo* res = nullptr;
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            if (getaddrinfo(_syslogHost.c_str(), nullptr, &hints, &res) == 0 && res) {
+                _syslogAddr = ((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
+            }
+            if (res) freeaddrinfo(res);
+        }
+        if (!_syslogAddr) return false;
+    }
+    if (_syslogSock < 0) {
+        _syslogSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (_syslogSock < 0) return false;
     }
+    return true;
 }
 
-void Logger::warn(const char* tag, const char* format, ...) {
-    if (_level >= LOG_WARN) {
-        va_list args;
-        va_start(args, format);
-        log(LOG_WARN, tag, format, args);
-        va_end(args);
+// Token bucket in 1/1000 lines: refilled at _syslogRate lines per second,
+// capped at one second's worth. Lines over the rate are counted, and the
+// count goes out in the next datagram's dropped= parameter.
+bool Logger::writeToSyslog(const char* msg) {
+    if (!_syslogBuf) {
+        return true;
+    }
+    if (_syslogRate) {
+        uint32_t now = millis();
+        uint32_t cap = (uint32_t)_syslogRate * 1000;
+        uint64_t tokens = _syslogTokens + (uint64_t)(now - _syslogRefill) * _syslogRate;
+        _syslogTokens = tokens > cap ? cap : (uint32_t)tokens;
+        _syslogRefill = now;
+        if (_syslogTokens < 1000) {
+            _syslogRateDropped++;
+            _syslogPendingDrops++;
+            return true;
+        }
+        _syslogTokens -= 1000;
+    }
+
+    size_t len = strnlen(msg, sizeof(_buffer));
+    if (len > _syslogRoom - 1) len = _syslogRoom - 1;
+    if (_syslogLen + len + (_syslogLines ? 1 : 0) > _syslogRoom) {
+        flushSyslog();
+    }
+    char* out = _syslogBuf + SYSLOG_HEADER_ROOM + _syslogLen;
+    if (_syslogLines) {
+        *out++ = '\n';
+        _syslogLen++;
+    } else {
+        _syslogFirst = _scratchSeq;
+        _syslogStart = millis();
+        _syslogSeverity = 7;
+    }
+    memcpy(out, msg, len);
+    _syslogLen += len;
+    _syslogLines++;
+
+    static const uint8_t SEVERITY[] = {3, 4, 6, 7};  // err, warning, info, debug
+    uint8_t sev = _scratch.level <= LOG_DEBUG ? SEVERITY[_scratch.level] : 7;
+    if (sev < _syslogSeverity) _syslogSeverity = sev;
+    return true;
+}
+
+// One RFC 5424 message per datagram, facility local0, severity of the worst
+// line. MSG holds the batched lines separated by '\n'. sequenceId (meta SD)
+// counts datagrams so a receiver can spot losses; first/lines give the log
+// seq range, dropped the lines skipped by the rate limit since the last one.
+void Logger::flushSyslog() {
+    if (_syslogLines == 0 || !_syslogBuf) {
+        return;
+    }
+    _syslogSeq = (_syslogSeq >= 2147483647) ? 1 : _syslogSeq + 1;
+
+    char ts[24] = "-";
+    time_t now = time(nullptr);
+    if (now > 1600000000) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    }
+    char header[SYSLOG_HEADER_ROOM];
+    int hl = snprintf(header, sizeof(header),
+                      "<%u>1 %s %s athermostat - log [meta sequenceId=\"%lu\"]"
+                      "[log@32473 first=\"%lu\" lines=\"%u\" dropped=\"%lu\"] ",
+                      16 * 8 + _syslogSeverity, ts, _syslogHostname.c_str(),
+                      (unsigned long)_syslogSeq, (unsigned long)_syslogFirst, _syslogLines,
+                      (unsigned long)_syslogPendingDrops);
+    if (hl >= (int)sizeof(header)) hl = sizeof(header) - 1;
+    char* frame = _syslogBuf + SYSLOG_HEADER_ROOM - hl;
+    memcpy(frame, header, hl);
+    size_t len = hl + _syslogLen;
+    uint16_t lines = _syslogLines;
+    _syslogLen = 0;
+    _syslogLines = 0;
+
+    if (!syslogSocket()) {
+        _syslogSendErrors++;
+        return;
+    }
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(_syslogPort);
+    to.sin_addr.s_addr = _syslogAddr;
+    // Non-blocking: a full lwip send buffer drops the datagram, it never stalls the sink task
+    if (sendto(_syslogSock, frame, len, MSG_DONTWAIT, (struct sockaddr*)&to, sizeof(to)) != (ssize_t)len) {
+        _syslogSendErrors++;
+        return;
+    }
+    _syslogPendingDrops = 0;
+    _syslogDatagrams++;
+    _syslogBytes += len;
+    _syslogLinesSent += lines;
+}
+
+// Runs on the logging task before the record is published, so the line is
+// in RTC RAM even if the chip resets before the sink task gets to it.
+void Logger::crashAppend(const Record& rec) {
+    char line[CRASH_LINE_MAX];
+    size_t n = formatEntry(rec.epoch, rec.level, rec.tag, rec.format, rec.binary,
+                           rec.msg, rec.len, line, sizeof(line) - 1);
+    line[n++] = '\n';
+
+    portENTER_CRITICAL(&_crashMux);
+    if (s_crash.magic != CRASH_MAGIC || s_crash.head >= CRASH_LOG_BYTES || s_crash.used > CRASH_LOG_BYTES) {
+        s_crash.head = 0;
+        s_crash.used = 0;
+        s_crash.magic = CRASH_MAGIC;
     }
+    size_t first = CRASH_LOG_BYTES - s_crash.head;
+    if (first > n) first = n;
+    memcpy(s_crash.data + s_crash.head, line, first);
+    memcpy(s_crash.data, line + first, n - first);
+    s_crash.head = (s_crash.head + n) % CRASH_LOG_BYTES;
+    s_crash.used += n;
+    if (s_crash.used > CRASH_LOG_BYTES) s_crash.used = CRASH_LOG_BYTES;
+    portEXIT_CRITICAL(&_crashMux);
 }
 
-void Logger::info(const char* tag, const char* format, ...) {
-    if (_level >= LOG_INFO) {
-        va_list args;
-        va_start(args, format);
-        log(LOG_INFO, tag, format, args);
-        va_end(args);
+size_t Logger::getCrashBytesUsed() const {
+    return s_crash.magic == CRASH_MAGIC ? s_crash.used : 0;
+}
+
+const char* Logger::getResetReasonName(esp_reset_reason_t reason) {
+    switch (reason) {
+        case ESP_RST_POWERON:   return "POWERON";
+        case ESP_RST_EXT:       return "EXT";
+        case ESP_RST_SW:        return "SW";
+        case ESP_RST_PANIC:     return "PANIC";
+        case ESP_RST_INT_WDT:   return "INT_WDT";
+        case ESP_RST_TASK_WDT:  return "TASK_WDT";
+        case ESP_RST_WDT:       return "WDT";
+        case ESP_RST_DEEPSLEEP: return "DEEPSLEEP";
+        case ESP_RST_BROWNOUT:  return "BROWNOUT";
+        case ESP_RST_SDIO:      return "SDIO";
+        default:                return "UNKNOWN";
     }
 }
 
-void Logger::debug(const char* tag, const char* format, ...) {
-    if (_level >= LOG_DEBUG) {
-        va_list args;
-        va_start(args, format);
-        log(LOG_DEBUG, tag, format, args);
-        va_end(args);
+size_t Logger::recoverCrashLog(esp_reset_reason_t reason) {
+    bool valid = s_crash.magic == CRASH_MAGIC && s_crash.head < CRASH_LOG_BYTES &&
+                 s_crash.used <= CRASH_LOG_BYTES;
+    bool crashed = reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+                   reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT ||
+                   reason == ESP_RST_BROWNOUT;
+    size_t lines = 0;
+
+    if (valid && crashed && s_crash.used > 0) {
+        // Copy out first: the replayed lines go through the logger again
+        char* tail = (char*)ps_malloc(s_crash.used + 1);
+        if (tail) {
+            size_t start = (s_crash.head + CRASH_LOG_BYTES - s_crash.used) % CRASH_LOG_BYTES;
+            for (size_t i = 0; i < s_crash.used; i++) {
+                char c = s_crash.data[(start + i) % CRASH_LOG_BYTES];
+                tail[i] = (c == '\n' || (c >= 0x20 && c < 0x7F)) ? c : '?';
+            }
+            tail[s_crash.used] = '\0';
+            // A full ring starts mid-line
+            char* p = tail;
+            if (s_crash.used == CRASH_LOG_BYTES) {
+                char* nl = strchr(p, '\n');
+                p = nl ? nl + 1 : p + s_crash.used;
+            }
+
+            // Replayed past admit(): each line must come through, whatever
+            // the repeat window or a rate limit on the tag says
+            const char* why = getResetReasonName(reason);
+            bool enabled = isEnabled(LOG_WARN, "CRASH");
+            _crashCapture = false;
+            if (enabled) emit(LOG_WARN, "CRASH", "Reset by %s, log tail before it follows", why);
+            while (*p) {
+                char* nl = strchr(p, '\n');
+                if (nl) *nl = '\0';
+                if (*p) {
+                    if (enabled) emit(LOG_WARN, "CRASH", "[%s] %s", why, p);
+                    lines++;
+                }
+                if (!nl) break;
+                p = nl + 1;
+            }
+            _crashCapture = true;
+            free(tail);
+        }
     }
+
+    portENTER_CRITICAL(&_crashMux);
+    s_crash.magic = CRASH_MAGIC;
+    s_crash.head = 0;
+    s_crash.used = 0;
+    portEXIT_CRITICAL(&_crashMux);
+    _crashRecovered = lines;
+    return lines;
+}
+
+void Logger::logText(Level level, const char* tag, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log(level, tag, format, args);
+    va_end(args);
 }
 
+// Text mode: vsnprintf into the slot on the caller's task
 void Logger::log(Level level, const char* tag, const char* format, va_list args) {
-    char msgBuffer[384];
-    vsnprintf(msgBuffer, sizeof(msgBuffer), format, args);
+    int64_t t0 = esp_timer_get_time();
+    uint32_t seq;
+    Record* rec = claim(level, tag, format, false, seq);
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), format, args);
+    rec->len = (n < 0) ? 0 : ((size_t)n < MSG_SIZE ? n : MSG_SIZE - 1);
+    commit(seq, rec, t0);
+}
 
-    struct tm timeinfo;
-    char timeStr[20] = "----/--/-- --:--:--";
-    if(WiFi.isConnected()){
-        if (getLocalTime(&timeinfo)) {
-            strftime(timeStr, sizeof(timeStr), "%Y/%m/%d %H:%M:%S", &timeinfo);
+// Hot path: claim a queue slot (or the scratch record before begin()). No heap, no I/O.
+Logger::Record* Logger::claim(Level level, const char* tag, const char* format,
+                              bool binary, uint32_t& seq) {
+    Record* rec;
+    seq = _head.fetch_add(1, std::memory_order_acq_rel);
+    if (!_sinkTask) {
+        _scratchSeq = seq;
+        rec = &_scratch;
+    } else {
+        Slot& slot = _slots[seq & (QUEUE_SLOTS - 1)];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        rec = &slot.rec;
+    }
+    rec->epoch = (uint32_t)time(nullptr);
+    rec->level = level;
+    rec->binary = binary;
+    rec->tag = tag;
+    rec->format = format;
+    return rec;
+}
+
+void Logger::commit(uint32_t seq, Record* rec, int64_t t0) {
+    bool binary = rec->binary;
+    uint16_t len = rec->len;
+
+    if (_crashCapture && (rec->level <= LOG_WARN ||
+                          (rec->level == LOG_INFO && _crashTags && _tags[tagId(rec->tag)].crash))) {
+        crashAppend(*rec);
+    }
+
+    if (!_sinkTask) {
+        // Before begin() (setup, single task): deliver inline
+        formatLine(_scratch);
+        for (int s = 0; s < SINK_COUNT; s++) {
+            if (isSinkEnabled((Sink)s)) writeToSink((Sink)s, _buffer);
+        }
+    } else {
+        _slots[seq & (QUEUE_SLOTS - 1)].seq.store(seq + 1, std::memory_order_release);
+        xTaskNotifyGive(_sinkTask);
+    }
+
+    CaptureStats& st = _capture[binary];
+    st.records.fetch_add(1, std::memory_order_relaxed);
+    st.bytes.fetch_add(len, std::memory_order_relaxed);
+    st.us.fetch_add((uint32_t)(esp_timer_get_time() - t0), std::memory_order_relaxed);
+}
+
+size_t Logger::packArg(uint8_t* dst, size_t room, const char* s) {
+    if (room < 2) {
+        if (room) dst[0] = ARG_END;
+        return room;
+    }
+    if (!s) s = "(null)";
+    size_t n = strnlen(s, room - 2);
+    dst[0] = ARG_STR;
+    memcpy(dst + 1, s, n);
+    dst[1 + n] = '\0';
+    return n + 2;
+}
+
+void Logger::sinkTask(void* arg) {
+    Logger* self = (Logger*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SINK_RETRY_MS));
+        xSemaphoreTake(self->_sinkLock, portMAX_DELAY);
+        self->drain();
+        if (millis() - self->_wsLastFlush >= WS_BATCH_MS) {
+            self->flushWebSocket(true);
+        }
+        if (self->_fileBufLen && millis() - self->_lastFileFlush >= FILE_FLUSH_MS) {
+            self->flushFileBuffer();
+        }
+        if (millis() - self->_lastSweep >= SUPPRESS_SWEEP_MS) {
+            self->sweepSuppressed();
+        }
+        if (self->_syslogLines && millis() - self->_syslogStart >= SYSLOG_BATCH_MS) {
+            self->flushSyslog();
+        }
+        xSemaphoreGive(self->_sinkLock);
+    }
+}
+
+// Copy record seq into _scratch.
+// Returns 1 on success, 0 if not committed yet, -1 if it was overwritten.
+int Logger::fetch(uint32_t seq) {
+    Slot& slot = _slots[seq & (QUEUE_SLOTS - 1)];
+    uint32_t tag = slot.seq.load(std::memory_order_acquire);
+    if (tag != seq + 1) {
+        return (tag == 0 || (int32_t)(tag - (seq + 1)) < 0) ? 0 : -1;
+    }
+    // Copy the header plus only the used part of the payload
+    size_t len = slot.rec.len;
+    size_t cap = slot.rec.binary ? MSG_SIZE : MSG_SIZE - 1;
+    if (len > cap) len = cap;
+    memcpy(&_scratch, &slot.rec, offsetof(Record, msg) + len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != tag) {
+        return -1;
+    }
+    _scratch.len = len;
+    if (!_scratch.binary) _scratch.msg[len] = '\0';
+    _scratchSeq = seq;
+    return 1;
+}
+
+// Each sink has its own cursor so a stalled sink (MQTT/WebSocket send queue
+// full) holds only itself back. A sink that falls more than QUEUE_SLOTS
+// behind loses the overwritten records, counted in _dropped.
+void Logger::drain() {
+    uint32_t head = _head.load(std::memory_order_acquire);
+    bool stalled[SINK_COUNT] = {};
+
+    uint32_t now = millis();
+    if (now - _rateStart >= 1000) {
+        _recordsPerSec = (uint32_t)((uint64_t)(head - _rateHead) * 1000 / (now - _rateStart));
+        _rateHead = head;
+        _rateStart = now;
+    }
+
+    uint32_t start = head;
+    for (int s = 0; s < SINK_COUNT; s++) {
+        uint32_t behind = head - _cursor[s];
+        if (behind > QUEUE_SLOTS) {
+            if (isSinkEnabled((Sink)s)) _dropped[s] += behind - QUEUE_SLOTS;
+            _cursor[s] = head - QUEUE_SLOTS;
+            behind = QUEUE_SLOTS;
         }
+        if (behind > head - start) start = _cursor[s];
     }
-    snprintf(_buffer, sizeof(_buffer), "[%s] [%s] [%s] %s",
-             timeStr, getLevelName(level), tag, msgBuffer);
 
-    addToRingBuffer(_buffer);
+    for (uint32_t seq = start; seq != head; seq++) {
+        int got = fetch(seq);
+        if (got == 0) break;
+        bool formatted = false;
+        for (int s = 0; s < SINK_COUNT; s++) {
+            if (_cursor[s] != seq || stalled[s]) continue;
+            if (got < 0) {
+                if (isSinkEnabled((Sink)s)) _dropped[s]++;
+                _cursor[s]++;
+                continue;
+            }
+            // The history keeps the raw record; render text only for the others
+            if (s != SINK_HISTORY && !formatted && isSinkEnabled((Sink)s)) {
+                formatLine(_scratch);
+                formatted = true;
+            }
+            if (!isSinkEnabled((Sink)s) || writeToSink((Sink)s, _buffer)) {
+                _cursor[s]++;
+            } else {
+                stalled[s] = true;
+            }
+        }
+    }
+}
+
+void Logger::formatLine(const Record& rec) {
+    formatEntry(rec.epoch, rec.level, rec.tag, rec.format, rec.binary,
+                rec.msg, rec.len, _buffer, sizeof(_buffer));
+}
 
-    if (_serialEnabled) {
-        writeToSerial(_buffer);
+size_t Logger::formatEntry(uint32_t epoch, uint8_t level, const char* tag, const char* format,
+                           bool binary, const char* payload, size_t len, char* out, size_t outSize) {
+    char timeStr[20] = "----/--/-- --:--:--";
+    if (epoch > 1600000000) {
+        time_t t = epoch;
+        struct tm timeinfo;
+        localtime_r(&t, &timeinfo);
+        strftime(timeStr, sizeof(timeStr), "%Y/%m/%d %H:%M:%S", &timeinfo);
     }
-    if (_mqttEnabled) {
-        writeToMqtt(_buffer);
+    const char* levelName = (level <= LOG_DEBUG) ? LEVEL_NAMES[level] : "UNKN ";
+    int n;
+    if (!binary) {
+        n = snprintf(out, outSize, "[%s] [%s] [%s] %s", timeStr, levelName, tag, payload);
+    } else {
+        n = snprintf(out, outSize, "[%s] [%s] [%s] ", timeStr, levelName, tag);
+        if (n >= 0 && (size_t)n < outSize) {
+            n += renderArgs(format, (const uint8_t*)payload, len, out + n, outSize - n);
+        }
     }
-    if (_fileLogEnabled) {
-        writeToFile(_buffer);
+    if (n < 0) return 0;
+    return ((size_t)n < outSize) ? n : outSize - 1;
+}
+
+// printf over packed args: each conversion spec is handed to snprintf with
+// the next captured value. '*' width/precision consume an int arg.
+size_t Logger::renderArgs(const char* format, const uint8_t* args, size_t len, char* out, size_t outSize) {
+    const uint8_t* arg = args;
+    const uint8_t* argEnd = args + len;
+    const char* f = format;
+    size_t o = 0;
+
+    auto nextArg = [&](uint8_t& type, const uint8_t*& val) {
+        if (arg >= argEnd || *arg == ARG_END) { type = ARG_END; return; }
+        type = *arg++;
+        val = arg;
+        switch (type) {
+            case ARG_I32: case ARG_PTR: arg += 4; break;
+            case ARG_I64: case ARG_F64: arg += 8; break;
+            case ARG_STR: arg += strnlen((const char*)arg, argEnd - arg) + 1; break;
+            default:      arg = argEnd; type = ARG_END; break;
+        }
+    };
+    auto intValue = [](uint8_t type, const uint8_t* val) -> int64_t {
+        int32_t i32; int64_t i64; double d;
+        switch (type) {
+            case ARG_I32: case ARG_PTR: memcpy(&i32, val, 4); return i32;
+            case ARG_I64: memcpy(&i64, val, 8); return i64;
+            case ARG_F64: memcpy(&d, val, 8); return (int64_t)d;
+            default:      return 0;
+        }
+    };
+
+    while (*f && o + 1 < outSize) {
+        if (*f != '%') { out[o++] = *f++; continue; }
+        if (f[1] == '%') { out[o++] = '%'; f += 2; continue; }
+
+        char spec[32];
+        size_t sl = 0;
+        spec[sl++] = *f++;
+        bool longLong = false;
+        while (*f && !strchr("diouxXeEfFgGaAcspn", *f)) {
+            if (*f == '*') {
+                uint8_t t; const uint8_t* v = nullptr;
+                nextArg(t, v);
+                sl += snprintf(spec + sl, sizeof(spec) - sl - 2, "%d", (int)intValue(t, v));
+                if (sl > sizeof(spec) - 3) sl = sizeof(spec) - 3;
+            } else if (sl < sizeof(spec) - 2) {
+                if (*f == 'l' && f[-1] == 'l') longLong = true;
+                if (*f == 'j') longLong = true;
+                spec[sl++] = *f;
+            }
+            f++;
+        }
+        if (!*f) break;
+        char conv = *f++;
+        spec[sl++] = conv;
+        spec[sl] = '\0';
+
+        uint8_t type; const uint8_t* val = nullptr;
+        nextArg(type, val);
+        size_t room = outSize - o;
+        int n = 0;
+        if (type == ARG_END) {
+            n = snprintf(out + o, room, "?");
+        } else if (conv == 's') {
+            n = snprintf(out + o, room, spec, type == ARG_STR ? (const char*)val : "?");
+        } else if (conv == 'n') {
+            n = 0;
+        } else if (strchr("eEfFgGaA", conv)) {
+            double d;
+            if (type == ARG_F64) memcpy(&d, val, 8); else d = (double)intValue(type, val);
+            n = snprintf(out + o, room, spec, d);
+        } else if (conv == 'p') {
+            n = snprintf(out + o, room, spec, (void*)(uintptr_t)intValue(type, val));
+        } else if (longLong) {
+            n = snprintf(out + o, room, spec, (long long)intValue(type, val));
+        } else {
+            n = snprintf(out + o, room, spec, (int)intValue(type, val));
+        }
+        if (n > 0) o += ((size_t)n < room) ? n : room - 1;
     }
-    if (_wsEnabled) {
-        writeToWebSocket(_buffer);
+    out[o] = '\0';
+    return o;
+}
+
+bool Logger::isSinkEnabled(Sink sink) const {
+    switch (sink) {
+        case SINK_HISTORY:   return true;
+        case SINK_SERIAL:    return _serialEnabled;
+        case SINK_MQTT:      return _mqttEnabled;
+        case SINK_FILE:      return _fileLogEnabled;
+        case SINK_WEBSOCKET: return _wsEnabled;
+        case SINK_SYSLOG:    return _syslogEnabled;
+        default:             return false;
+    }
+}
+
+// Returns false if the sink cannot take the line right now (retry later)
+bool Logger::writeToSink(Sink sink, const char* msg) {
+    switch (sink) {
+        case SINK_HISTORY:   addToHistory(); return true;
+        case SINK_SERIAL:    writeToSerial(msg); return true;
+        case SINK_MQTT:      return writeToMqtt(msg);
+        case SINK_FILE:      writeToFile(msg); return true;
+        case SINK_WEBSOCKET: return writeToWebSocket(msg);
+        case SINK_SYSLOG:    return writeToSyslog(msg);
+        default:             return true;
     }
 }
 
@@ -210,75 +1562,255 @@ void Logger::writeToSerial(const char* msg) {
     Serial.println(msg);
 }
 
-void Logger::writeToMqtt(const char* msg) {
-    if (_mqttClient == nullptr || !_mqttClient->connected()) {
-        return;
+bool Logger::writeToMqtt(const char* msg) {
+    if (_mqttClient == nullptr) {
+        return true;
     }
-    _mqttClient->publish(_mqttTopic.c_str(), 0, false, msg);
+    if (_mqttQueue && (!_mqttClient->connected() || !_mqttQueue->empty())) {
+        // The line carries its own timestamp; MQTTHandler replays it in order
+        _mqttQueue->push(_mqttQueueTopic, msg);
+        return true;
+    }
+    if (!_mqttClient->connected()) {
+        return true;
+    }
+    // publish() returns 0 when the TCP send buffer is full
+    return _mqttClient->publish(_mqttTopic.c_str(), 0, false, msg) != 0;
 }
 
+// Lines collect in RAM and go to flash in one write: when the buffer can't
+// take another full line, when FILE_FLUSH_MS passes, or right away for WARN
+// and ERROR so problems reach flash promptly.
 void Logger::writeToFile(const char* msg) {
-    if (!_fsReady) {
+    if (!_fsReady && !_flashLog) {
         return;
     }
+    size_t len = strnlen(msg, sizeof(_buffer));
+    if (_fileBufLen + len + 1 > FILE_BUFFER_SIZE) {
+        flushFileBuffer();
+    }
+    memcpy(_fileBuf + _fileBufLen, msg, len);
+    _fileBufLen += len;
+    _fileBuf[_fileBufLen++] = '\n';
+
+    if (_scratch.level <= LOG_WARN || _fileBufLen > FILE_BUFFER_SIZE - sizeof(_buffer)) {
+        flushFileBuffer();
+    }
+}
+
+void Logger::flushFileBuffer() {
+    if (_fileBufLen == 0) {
+        return;
+    }
+    int64_t t0 = esp_timer_get_time();
+
+    if (_flashLog) {
+        flushToFlash();
+    } else {
+        if (!_logHandle) {
+            _logHandle = LittleFS.open(_logFilename.c_str(), FILE_APPEND);
+            if (!_logHandle) {
+                _fileBufLen = 0;
+                return;
+            }
+            _fileSize = _logHandle.size();
+        }
+
+        size_t written = _logHandle.write((const uint8_t*)_fileBuf, _fileBufLen);
+        _logHandle.flush();
+        _fileBufLen = 0;
+        _fileSize += written;
+        _flashBytes += written;
 
-    // Check file size first
-    fs::File logFile = LittleFS.open(_logFilename.c_str(), FILE_READ);
-    if (logFile) {
-        size_t sz = logFile.size();
-        logFile.close();
-        if (sz > _maxFileSize) {
+        if (_fileSize > _maxFileSize) {
+            _logHandle.close();
             rotateLogFiles();
+            _fileSize = 0;
         }
     }
+    _lastFileFlush = millis();
 
-    logFile = LittleFS.open(_logFilename.c_str(), FILE_APPEND);
-    if (!logFile) {
-        return;
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    _fileFlushes++;
+    _flushUsTotal += us;
+    if (us > _flushUsMax) _flushUsMax = us;
+}
+
+// Whole lines are packed into records of up to MAX_PAYLOAD bytes; each
+// record is one flash write.
+void Logger::flushToFlash() {
+    size_t pos = 0;
+    while (pos < _fileBufLen) {
+        size_t start = pos;
+        size_t end = start;
+        uint16_t lines = 0;
+        while (pos < _fileBufLen) {
+            const char* nl = (const char*)memchr(_fileBuf + pos, '\n', _fileBufLen - pos);
+            size_t lineEnd = nl ? (size_t)(nl - _fileBuf) : _fileBufLen;
+            if (lines && lineEnd - start > FlashLog::MAX_PAYLOAD) break;
+            end = lineEnd;
+            pos = lineEnd + 1;
+            lines++;
+        }
+        if (_flashLog->append(_fileBuf + start, end - start, lines)) {
+            _flashBytes += end - start;
+        }
     }
+    _fileBufLen = 0;
+}
 
-    logFile.println(msg);
-    logFile.close();
+void Logger::setFlashLog(FlashLog* flash) {
+    flush();
+    _flashLog = (flash && flash->isReady()) ? flash : nullptr;
+    if (_flashLog && _logHandle) {
+        _logHandle.close();
+    }
 }
 
-String Logger::getRotatedFilename(uint8_t index) {
+String Logger::getArchiveFilename(uint32_t index, bool compressed) {
     int dotIndex = _logFilename.lastIndexOf('.');
     String baseName = (dotIndex > 0) ? _logFilename.substring(0, dotIndex) : _logFilename;
-    return baseName + "." + String(index) + ".txt";
+    return baseName + "." + String(index) + (compressed ? ".gz" : ".txt");
 }
 
-void Logger::rotateLogFiles() {
-    if (!_fsReady) {
-        return;
-    }
+uint32_t Logger::parseArchiveIndex(const char* name, bool& compressed) {
+    // Directory entries come back without the leading '/'
+    const char* base = _logFilename.c_str();
+    if (*base == '/') base++;
+    const char* dot = strrchr(base, '.');
+    size_t baseLen = dot ? (size_t)(dot - base) : strlen(base);
+    if (*name == '/') name++;
+    if (strncmp(name, base, baseLen) != 0 || name[baseLen] != '.') return 0;
 
-    Serial.println("[Logger] Starting log rotation...");
+    char* end;
+    unsigned long index = strtoul(name + baseLen + 1, &end, 10);
+    if (end == name + baseLen + 1 || index == 0) return 0;
+    if (strcmp(end, ".gz") == 0) compressed = true;
+    else if (strcmp(end, ".txt") == 0) compressed = false;
+    else return 0;
+    return (uint32_t)index;
+}
 
-    // Delete the oldest rotated file if it exists
-    String oldestFile = getRotatedFilename(_maxRotatedFiles);
-    if (LittleFS.exists(oldestFile.c_str())) {
-        LittleFS.remove(oldestFile.c_str());
-        Serial.printf("[Logger] Deleted oldest: %s\n", oldestFile.c_str());
+void Logger::listArchives(const ArchiveFn& fn) {
+    fs::File root = LittleFS.open("/");
+    if (!root) return;
+    for (fs::File f = root.openNextFile(); f; f = root.openNextFile()) {
+        bool compressed;
+        uint32_t index = parseArchiveIndex(f.name(), compressed);
+        if (index) fn(index, f.size(), compressed);
     }
+}
 
-    // Shift existing rotated files
-    for (int i = _maxRotatedFiles - 1; i >= 1; i--) {
-        String oldName = getRotatedFilename(i);
-        String newName = getRotatedFilename(i + 1);
+// Rename the closed log to the next index and wake the archive task.
+// Indexes only grow, so nothing is renamed twice and the oldest is the lowest.
+void Logger::rotateLogFiles() {
+    if (!_fsReady) {
+        return;
+    }
 
-        if (LittleFS.exists(oldName.c_str())) {
-            LittleFS.rename(oldName.c_str(), newName.c_str());
-            Serial.printf("[Logger] Renamed %s -> %s\n", oldName.c_str(), newName.c_str());
-        }
+    if (_archiveIndex == 0) {
+        uint32_t last = 0;
+        listArchives([&last](uint32_t index, size_t, bool) {
+            if (index > last) last = index;
+        });
+        _archiveIndex = last + 1;
     }
 
-    // Rename current log to .1.txt (no compression on LittleFS to save flash wear)
-    String rotatedName = getRotatedFilename(1);
+    String rotatedName = getArchiveFilename(_archiveIndex, false);
     if (LittleFS.rename(_logFilename.c_str(), rotatedName.c_str())) {
+        _archiveIndex++;
         Serial.printf("[Logger] Rotated %s -> %s\n", _logFilename.c_str(), rotatedName.c_str());
     } else {
         Serial.printf("[Logger] CRITICAL: Failed to rotate %s\n", _logFilename.c_str());
+        return;
     }
 
-    Serial.println("[Logger] Log rotation complete");
+    if (!_archiveTask &&
+        xTaskCreate(archiveTask, "logGzip", ARCHIVE_TASK_STACK, this, 1, &_archiveTask) != pdPASS) {
+        _archiveTask = nullptr;
+        Serial.println("[Logger] Archive task create failed, rotated log left uncompressed");
+        return;
+    }
+    xTaskNotifyGive(_archiveTask);
+}
+
+void Logger::archiveTask(void* arg) {
+    Logger* self = (Logger*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->compressRotated();
+        self->enforceArchiveBudget();
+    }
+}
+
+void Logger::compressRotated() {
+    // Oldest first; also picks up files left behind by a reboot mid-compression
+    std::vector<uint32_t> pending;
+    listArchives([&pending](uint32_t index, size_t, bool compressed) {
+        if (!compressed) pending.push_back(index);
+    });
+    std::sort(pending.begin(), pending.end());
+    for (uint32_t index : pending) {
+        compressFile(index);
+    }
+}
+
+bool Logger::compressFile(uint32_t index) {
+    String src = getArchiveFilename(index, false);
+    String dst = getArchiveFilename(index, true);
+    String tmp = dst + ".tmp";
+    uint32_t t0 = millis();
+
+    fs::File in = LittleFS.open(src.c_str(), FILE_READ);
+    if (!in) return false;
+    fs::File out = LittleFS.open(tmp.c_str(), FILE_WRITE);
+    if (!out) {
+        in.close();
+        return false;
+    }
+    size_t inLen = in.size();
+    size_t outLen = LZPacker::compress(&in, inLen, &out);
+    in.close();
+    out.close();
+
+    if (outLen == 0 || !LittleFS.rename(tmp.c_str(), dst.c_str())) {
+        LittleFS.remove(tmp.c_str());
+        _gzFailures++;
+        Serial.printf("[Logger] Compress %s failed, keeping plain text\n", src.c_str());
+        return false;
+    }
+    LittleFS.remove(src.c_str());
+
+    uint32_t ms = millis() - t0;
+    _gzFiles++;
+    _gzInBytes += inLen;
+    _gzOutBytes += outLen;
+    _gzMsTotal += ms;
+    _gzMsLast = ms;
+    Serial.printf("[Logger] Compressed %s: %u -> %u bytes (%.1fx) in %lums\n",
+                  dst.c_str(), (unsigned)inLen, (unsigned)outLen,
+                  outLen ? (float)inLen / outLen : 0.0f, (unsigned long)ms);
+    return true;
+}
+
+// Delete the oldest archives until the rest fit the byte budget. The newest
+// archive is always kept.
+void Logger::enforceArchiveBudget() {
+    struct Entry { uint32_t index; size_t bytes; bool compressed; };
+    std::vector<Entry> archives;
+    size_t total = 0;
+    listArchives([&archives, &total](uint32_t index, size_t bytes, bool compressed) {
+        archives.push_back({index, bytes, compressed});
+        total += bytes;
+    });
+    std::sort(archives.begin(), archives.end(),
+              [](const Entry& a, const Entry& b) { return a.index < b.index; });
+
+    for (size_t i = 0; i + 1 < archives.size() && total > _archiveBytes; i++) {
+        String name = getArchiveFilename(archives[i].index, archives[i].compressed);
+        if (LittleFS.remove(name.c_str())) {
+            total -= archives[i].bytes;
+            Serial.printf("[Logger] Deleted oldest: %s\n", name.c_str());
+        }
+    }
 }
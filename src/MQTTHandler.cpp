@@ -1,10 +1,216 @@
 #include "MQTTHandler.h"
 #include "HX710.h"
+#include "PressureCapture.h"
 #include <ArduinoJson.h>
+#include <time.h>
+
+extern uint8_t getCpuLoadCore0();
+extern uint8_t getCpuLoadCore1();
+extern const char compile_date[];
+
+// Per-field state topics, <prefix>/state/<name>
+enum StateField : uint8_t {
+    F_MODE = 0,
+    F_ACTION,
+    F_HEAT_LEVEL,
+    F_COOL_LEVEL,
+    F_CURRENT_TEMP,
+    F_HEAT_SETPOINT,
+    F_COOL_SETPOINT,
+    F_FORCE_FURNACE,
+    F_FORCE_NO_HP,
+    F_DEFROST,
+    F_OUTPUTS,
+    F_INPUTS = F_OUTPUTS + OUT_COUNT,
+    F_PRESSURE1 = F_INPUTS + IN_COUNT,
+    F_PRESSURE2,
+    F_CPU_TEMP,
+    F_CPU_LOAD
+};
+
+constexpr const char* FIELD_NAMES[MQTTHandler::FIELD_COUNT] = {
+    "mode", "action", "heat_level", "cool_level", "current_temp",
+    "heat_setpoint", "cool_setpoint", "force_furnace", "force_no_hp", "defrost",
+    "outputs/fan1", "outputs/rev", "outputs/furn_cool_low", "outputs/furn_cool_high",
+    "outputs/w1", "outputs/w2", "outputs/comp1", "outputs/comp2",
+    "inputs/out_temp_ok", "inputs/defrost_mode",
+    "pressure1", "pressure2", "cpu_temp", "cpu_load"
+};
+
+// Worst case of one "name":"value", member per field, plus the braces of
+// its group ("outputs/fan1" goes into "outputs":{...}), the outer braces
+// and "ts":<epoch>,
+static const size_t TS_MEMBER_SIZE = 16;
+static constexpr size_t cstrlen(const char* s) { return *s ? 1 + cstrlen(s + 1) : 0; }
+static constexpr size_t stateJsonBound(size_t i) {
+    return i == MQTTHandler::FIELD_COUNT ? 2 + TS_MEMBER_SIZE :
+        cstrlen(FIELD_NAMES[i]) + 3 + (MQTTHandler::FIELD_VALUE_SIZE - 1) + 2 + 1 + 4 + stateJsonBound(i + 1);
+}
+static_assert(stateJsonBound(0) <= MQTTHandler::STATE_JSON_SIZE, "STATE_JSON_SIZE too small for FIELD_NAMES");
+static_assert(sizeof(MQTTHandler::TelemetryFrame) == 44, "TelemetryFrame layout is part of the topic format");
+static_assert(OUT_COUNT <= 8 && IN_COUNT <= 8, "TelemetryFrame pin bitmasks are 8 bits");
+static_assert(MQTTHandler::STATE_JSON_SIZE <= MQTTHandler::INFLIGHT_PAYLOAD &&
+              MqttQueue::MAX_PAYLOAD <= MQTTHandler::INFLIGHT_PAYLOAD,
+              "in-flight slots must hold a snapshot and a queue entry");
+
+enum FieldKind : uint8_t { K_STRING, K_NUMBER, K_BOOL };
+
+static FieldKind fieldKind(uint8_t field) {
+    if (field <= F_COOL_LEVEL) return K_STRING;
+    if (field >= F_FORCE_FURNACE && field < F_PRESSURE1) return K_BOOL;
+    return K_NUMBER;
+}
+
+// value / 10^decimals, e.g. (-5, 1) -> "-0.5". No float formatting, so no
+// _dtoa and no heap. out needs 13 bytes.
+static size_t formatFixed(char* out, int32_t value, uint8_t decimals) {
+    char tmp[12];
+    uint32_t v = value < 0 ? (uint32_t)(-(int64_t)value) : (uint32_t)value;
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0 || n <= decimals);
+    size_t len = 0;
+    if (value < 0) out[len++] = '-';
+    while (n > 0) {
+        if (n == decimals) out[len++] = '.';
+        out[len++] = tmp[--n];
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static int32_t scaled(float value, int32_t scale) {
+    float v = value * scale;
+    if (v > 2147483000.0f) return 2147483000;
+    if (v < -2147483000.0f) return -2147483000;
+    return (int32_t)lroundf(v);
+}
+
+// Appends to a fixed buffer; once something does not fit, nothing more is
+// written and overflow stays set
+struct BufWriter {
+    char* buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+
+    void put(const char* s, size_t n) {
+        if (overflow || len + n > size) {
+            overflow = true;
+            return;
+        }
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+    void put(const char* s) { put(s, strlen(s)); }
+    void put(char c) { put(&c, 1); }
+};
+
+// Discovery entities besides the climate one, all on this device
+struct DiscoveryEntity {
+    const char* component;
+    const char* object;         // unique_id suffix and config topic node
+    const char* name;
+    uint8_t field;              // state topic
+    const char* deviceClass;
+    const char* unit;
+    bool command;               // switch: ~/set/<field name>
+};
+
+static const DiscoveryEntity DISCOVERY_ENTITIES[] = {
+    {"sensor",        "heat_stage",    "Heat Stage",         F_HEAT_LEVEL,    nullptr,       nullptr, false},
+    {"sensor",        "cool_stage",    "Cool Stage",         F_COOL_LEVEL,    nullptr,       nullptr, false},
+    {"sensor",        "pressure1",     "Pressure 1",         F_PRESSURE1,     nullptr,       nullptr, false},
+    {"sensor",        "pressure2",     "Pressure 2",         F_PRESSURE2,     nullptr,       nullptr, false},
+    {"sensor",        "cpu_temp",      "CPU Temperature",    F_CPU_TEMP,      "temperature", "°F",    false},
+    {"sensor",        "cpu_load",      "CPU Load",           F_CPU_LOAD,      nullptr,       "%",     false},
+    {"binary_sensor", "defrost",       "Defrost",            F_DEFROST,       nullptr,       nullptr, false},
+    {"switch",        "force_furnace", "Force Furnace",      F_FORCE_FURNACE, nullptr,       nullptr, true},
+    {"switch",        "force_no_hp",   "Force No Heat Pump", F_FORCE_NO_HP,   nullptr,       nullptr, true},
+};
 
 MQTTHandler::MQTTHandler(Scheduler* ts)
-    : _ts(ts), _tReconnect(nullptr), _thermostat(nullptr),
-      _pressure1(nullptr), _pressure2(nullptr) {}
+    : _ts(ts), _tReconnect(nullptr),
+      _backoff(RECONNECT_INITIAL_MS, RECONNECT_CAP_MS, 2.0f, RECONNECT_STABLE_MS, RECONNECT_MIN_MS),
+      _thermostat(nullptr),
+      _pressure1(nullptr), _pressure2(nullptr), _capture(nullptr), _topicPool(nullptr),
+      _stateJsonLen(0), _tTelemetry(nullptr), _telemetryMs(0), _telemetrySeq(0), _telemetryFrames(0),
+      _configEnabled(false), _configRequests(0), _configErrors(0),
+      _queueStateTopic(-1), _replayRate(20), _replayCredit(0), _replayLastMs(0),
+      _replaying(false), _snapshotsQueued(0), _replaySent(0), _replayLagS(0),
+      _tStatePoll(nullptr), _changePending(false), _forceAll(true), _discoveryPending(true),
+      _seenVersion(0), _publishedVersion(0),
+      _firstChangeMs(0), _lastChangeMs(0), _changedMs(0),
+      _syncing(false), _snapshotPending(false), _resendPending(false),
+      _inflightPool(nullptr), _earlyAckNext(0), _window(8), _eventQos(1),
+      _commandHead(0), _commandCount(0),
+      _changePublishes(0), _fieldPublishes(0), _heartbeats(0), _publishErrors(0),
+      _acks(0), _latencyLastMs(0), _latencyMaxMs(0), _latencySumMs(0),
+      _discoveryPublishes(0), _commands(0), _commandErrors(0),
+      _windowFull(0), _retransmits(0), _snapshotsCoalesced(0),
+      _rttLastMs(0), _rttMaxMs(0), _rttSumMs(0), _rttCount(0) {
+    memset(_fieldValue, 0, sizeof(_fieldValue));
+    memset(_fieldSent, 0, sizeof(_fieldSent));
+    memset(_inflight, 0, sizeof(_inflight));
+    memset(_earlyAcks, 0, sizeof(_earlyAcks));
+    setTopicPrefix(_topicPrefix);
+}
+
+void MQTTHandler::setTopicPrefix(const String& prefix) {
+    _topicPrefix = prefix;
+    if (_topicPrefix.length() == 0) {
+        _topicPrefix = "thermostat";
+    } else if (_topicPrefix.length() > MAX_PREFIX) {
+        Log.warn("MQTT", "Topic prefix longer than %u chars, truncated", MAX_PREFIX);
+        _topicPrefix = _topicPrefix.substring(0, MAX_PREFIX);
+    }
+    const char* p = _topicPrefix.c_str();
+    size_t plen = _topicPrefix.length();
+
+    size_t size = 0;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        size += plen + 7 + strlen(FIELD_NAMES[f]) + 1;   // "/state/"
+    }
+    size += (plen + 7) + (plen + 8) + (plen + 7);        // "/state", "/status", "/set/+"
+    size += plen + 11;                                   // "/telemetry"
+    size += (plen + 12) + (plen + 15);                   // "/config/set", "/config/result"
+
+    char* pool = (char*)malloc(size);
+    if (!pool) {
+        Log.error("MQTT", "No memory for %u bytes of topics", size);
+        return;
+    }
+    size_t off = 0;
+    auto add = [&](const char* suffix, const char* name) -> uint16_t {
+        uint16_t start = off;
+        memcpy(pool + off, p, plen);
+        off += plen;
+        size_t n = strlen(suffix);
+        memcpy(pool + off, suffix, n);
+        off += n;
+        if (name) {
+            n = strlen(name);
+            memcpy(pool + off, name, n);
+            off += n;
+        }
+        pool[off++] = '\0';
+        return start;
+    };
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        _fieldTopic[f] = add("/state/", FIELD_NAMES[f]);
+    }
+    _stateTopic = add("/state", nullptr);
+    _statusTopic = add("/status", nullptr);
+    _setTopic = add("/set/+", nullptr);
+    _telemetryTopic = add("/telemetry", nullptr);
+    _configSetTopic = add("/config/set", nullptr);
+    _configResultTopic = add("/config/result", nullptr);
+
+    free(_topicPool);
+    _topicPool = pool;
+}
 
 void MQTTHandler::begin(const IPAddress& host, uint16_t port,
                          const String& user, const String& password) {
@@ -34,10 +240,60 @@ void MQTTHandler::begin(const IPAddress& host, uint16_t port,
     _password = password;
     _client.setServer(host, port);
     _client.setCredentials(_user.c_str(), _password.c_str());
+    _client.setWill(topic(_statusTopic), 1, true, "offline");
+    if (!_router.begin()) {
+        Log.error("MQTT", "No PSRAM for the message buffer, incoming messages dropped");
+    }
+    subscribe(topic(_setTopic), 1, [this](const char* t, const char* payload, size_t) {
+        // "<prefix>/set/+" without the '+'
+        if (_thermostat) queueCommand(t + strlen(topic(_setTopic)) - 1, payload);
+    });
+    // Home Assistant's birth message: resend discovery
+    String haStatus = String(DISCOVERY_PREFIX) + "/status";
+    subscribe(haStatus.c_str(), 0, [this](const char*, const char* payload, size_t) {
+        if (strcmp(payload, "online") == 0) {
+            // HA restarted: it drops entities whose config it has not seen
+            Log.info("MQTT", "Home Assistant online, resending discovery");
+            _discoveryPending = true;
+            _forceAll = true;
+        }
+    });
+    subscribe(topic(_configSetTopic), 1, [this](const char*, const char* payload, size_t len) {
+        handleConfig(payload, len);
+    });
+    if (_tempTopic.length() > 0) {
+        subscribe(_tempTopic.c_str(), 0, [this](const char*, const char* payload, size_t) {
+            if (!_thermostat) return;
+            float temp = atof(payload);
+            if (temp > -50.0f && temp < 150.0f) {
+                _thermostat->setCurrentTemperature(temp);
+                Log.debug("MQTT", "Temperature update: %.1f°F", temp);
+            } else {
+                Log.warn("MQTT", "Invalid temperature value: %.31s", payload);
+            }
+        });
+    }
+    if (_queue.begin(QUEUE_PATH)) {
+        _queueStateTopic = _queue.addTopic(topic(_stateTopic));
+        if (!_queue.empty()) {
+            Log.info("MQTT", "Queue: %u entries left from before the reboot", _queue.getDepth());
+        }
+    } else {
+        Log.error("MQTT", "No PSRAM for the store-and-forward queue");
+    }
+    _inflightPool = (char*)ps_malloc(MAX_INFLIGHT * INFLIGHT_PAYLOAD);
+    if (_inflightPool) {
+        for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+            _inflight[i].payload = _inflightPool + i * INFLIGHT_PAYLOAD;
+        }
+    } else {
+        Log.error("MQTT", "No PSRAM for in-flight payloads, events use QoS 0");
+        _eventQos = 0;
+    }
     Log.info("MQTT", "Config: host=%s port=%u user='%s'",
              host.toString().c_str(), port, _user.c_str());
 
-    _tReconnect = new Task(10 * TASK_SECOND, TASK_FOREVER, [this]() {
+    _tReconnect = new Task(RECONNECT_INITIAL_MS * TASK_MILLISECOND, TASK_FOREVER, [this]() {
         if (_client.connected()) {
             _tReconnect->disable();
             return;
@@ -45,13 +301,25 @@ void MQTTHandler::begin(const IPAddress& host, uint16_t port,
         if (!WiFi.isConnected()) {
             return;
         }
-        Log.info("MQTT", "Connecting to MQTT...");
+        _backoff.attempted();
+        Log.info("MQTT", "Connecting to MQTT (attempt %u)...", _backoff.getOutageAttempts());
         _client.connect();
+        _tReconnect->setInterval(_backoff.nextDelay() * TASK_MILLISECOND);
+    }, _ts, false);
+
+    _tStatePoll = new Task(POLL_MS * TASK_MILLISECOND, TASK_FOREVER, [this]() {
+        this->pollState();
+    }, _ts, true);
+
+    _tTelemetry = new Task(TASK_SECOND, TASK_FOREVER, [this]() {
+        this->publishTelemetry();
     }, _ts, false);
 }
 
 void MQTTHandler::startReconnect() {
-    if (_tReconnect) {
+    _backoff.lost(millis());
+    if (_tReconnect && !_tReconnect->isEnabled()) {
+        _tReconnect->setInterval(_backoff.nextDelay() * TASK_MILLISECOND);
         _tReconnect->enableDelayed();
     }
 }
@@ -66,6 +334,15 @@ void MQTTHandler::disconnect() {
     _client.disconnect();
 }
 
+bool MQTTHandler::subscribe(const char* filter, uint8_t qos, MqttRouter::Handler handler) {
+    if (!_router.add(filter, qos, handler)) {
+        Log.error("MQTT", "Cannot subscribe to '%s' (bad filter or table full)", filter);
+        return false;
+    }
+    if (_client.connected()) _client.subscribe(filter, qos);
+    return true;
+}
+
 void MQTTHandler::setThermostat(Thermostat* thermostat) {
     _thermostat = thermostat;
 }
@@ -75,54 +352,727 @@ void MQTTHandler::setPressureSensors(HX710* sensor1, HX710* sensor2) {
     _pressure2 = sensor2;
 }
 
+void MQTTHandler::setInflightWindow(uint8_t window) {
+    if (window < 1) window = 1;
+    if (window > MAX_INFLIGHT) window = MAX_INFLIGHT;
+    _window = window;
+}
+
+void MQTTHandler::setTelemetryInterval(uint16_t ms) {
+    if (ms && ms < TELEMETRY_MIN_MS) ms = TELEMETRY_MIN_MS;
+    _telemetryMs = ms;
+    if (!_tTelemetry) return;
+    if (ms) {
+        _tTelemetry->setInterval(ms * TASK_MILLISECOND);
+        _tTelemetry->enableIfNot();
+    } else {
+        _tTelemetry->disable();
+    }
+}
+
+uint8_t MQTTHandler::getInFlight() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (_inflight[i].state != SLOT_FREE) n++;
+    }
+    return n;
+}
+
 void MQTTHandler::publishState() {
-    if (!_client.connected() || _thermostat == nullptr) return;
+    if (_thermostat == nullptr) return;
 
-    JsonDocument doc;
-    doc["mode"] = Thermostat::modeToString(_thermostat->getMode());
-    doc["action"] = Thermostat::actionToString(_thermostat->getAction());
-    doc["heat_level"] = Thermostat::heatLevelToString(_thermostat->getHeatLevel());
-    doc["cool_level"] = Thermostat::coolLevelToString(_thermostat->getCoolLevel());
+    if (!_client.connected() || !_queue.empty()) {
+        // Offline, or replay still running: goes out behind the queued entries
+        queueSnapshot();
+    } else {
+        // A snapshot still waiting for the window is replaced by this one
+        if (_snapshotPending) _snapshotsCoalesced++;
+        _snapshotPending = !publishSnapshot();
+    }
 
-    if (_thermostat->hasValidTemperature()) {
-        doc["current_temp"] = serialized(String(_thermostat->getCurrentTemperature(), 1));
+    publishFields(0);
+}
+
+bool MQTTHandler::publishSnapshot() {
+    size_t len = buildStateJson();
+    PubResult r;
+    if (len == 0) {
+        r = PUB_FAILED;
+        _publishErrors++;
+    } else if (_eventQos) {
+        r = publishTracked(topic(_stateTopic), _stateJson, len, false, FIELD_COUNT, 0);
+    } else {
+        r = _client.publish(topic(_stateTopic), 0, false, _stateJson, len) ? PUB_OK : PUB_FAILED;
+        if (r == PUB_FAILED) _publishErrors++;
     }
-    doc["heat_setpoint"] = serialized(String(_thermostat->getHeatSetpoint(), 1));
-    doc["cool_setpoint"] = serialized(String(_thermostat->getCoolSetpoint(), 1));
+    if (r == PUB_WINDOW_FULL) return false;
+    if (r == PUB_OK) _heartbeats++;
+    return true;
+}
 
-    doc["force_furnace"] = _thermostat->isForceFurnace();
-    doc["force_no_hp"] = _thermostat->isForceNoHP();
-    doc["defrost"] = _thermostat->isDefrostActive();
+void MQTTHandler::queueSnapshot() {
+    if (_queueStateTopic < 0) return;
+    size_t len = buildStateJson();
+    if (len > 0 && _queue.push(_queueStateTopic, _stateJson, len)) {
+        _snapshotsQueued++;
+    }
+}
 
-    // I/O states
-    JsonObject outputs = doc["outputs"].to<JsonObject>();
-    static const char* outNames[] = {"fan1","rev","furn_cool_low","furn_cool_high","w1","w2","comp1","comp2"};
-    for (int i = 0; i < OUT_COUNT; i++) {
-        if (_thermostat->getOutput((OutputIdx)i)) {
-            outputs[outNames[i]] = _thermostat->getOutput((OutputIdx)i)->isPinOn();
-        }
+// Same keys and value types as before: strings quoted, numbers bare,
+// ON/OFF as true/false, outputs/ and inputs/ fields as nested objects.
+// Fields without a value are left out. "ts" is the epoch of the snapshot
+// once the clock is set, so replayed ones keep the time they were taken.
+size_t MQTTHandler::buildStateJson() {
+    BufWriter w = {_stateJson, sizeof(_stateJson), 0, false};
+    char value[FIELD_VALUE_SIZE];
+    const char* group = nullptr;
+    size_t groupLen = 0;
+    bool first = true;          // no member yet in the current object
+
+    w.put('{');
+    time_t now = time(nullptr);
+    if (now > 1600000000) {
+        formatFixed(value, (int32_t)now, 0);
+        w.put("\"ts\":");
+        w.put(value);
+        first = false;
     }
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        renderField(f, value, sizeof(value));
+        if (!value[0]) continue;
+
+        const char* name = FIELD_NAMES[f];
+        const char* slash = strchr(name, '/');
+        size_t len = slash ? (size_t)(slash - name) : 0;
+        if (group && (len != groupLen || strncmp(name, group, len) != 0)) {
+            w.put('}');
+            group = nullptr;
+        }
+        if (slash && !group) {
+            if (!first) w.put(',');
+            w.put('"');
+            w.put(name, len);
+            w.put("\":{");
+            group = name;
+            groupLen = len;
+            first = true;
+        }
+        if (!first) w.put(',');
+        first = false;
 
-    JsonObject inputs = doc["inputs"].to<JsonObject>();
-    static const char* inNames[] = {"out_temp_ok","defrost_mode"};
-    for (int i = 0; i < IN_COUNT; i++) {
-        if (_thermostat->getInput((InputIdx)i)) {
-            inputs[inNames[i]] = _thermostat->getInput((InputIdx)i)->isActive();
+        w.put('"');
+        w.put(slash ? slash + 1 : name);
+        w.put("\":");
+        switch (fieldKind(f)) {
+            case K_STRING:
+                w.put('"');
+                w.put(value);
+                w.put('"');
+                break;
+            case K_BOOL:
+                w.put(strcmp(value, "ON") == 0 ? "true" : "false");
+                break;
+            case K_NUMBER:
+                w.put(value);
+                break;
         }
     }
+    if (group) w.put('}');
+    w.put('}');
+    _stateJsonLen = w.overflow ? 0 : w.len;
+    return _stateJsonLen;
+}
+
+// Not tracked or queued: a newer frame follows within the interval
+void MQTTHandler::publishTelemetry() {
+    if (_thermostat == nullptr || !_client.connected()) return;
+    Thermostat* t = _thermostat;
 
-    // Pressure sensors
+    // The capture sampler reads every conversion while it runs
+    if (!_capture || !_capture->isSampling()) {
+        if (_pressure1) _pressure1->readCalibrated();
+        if (_pressure2) _pressure2->readCalibrated();
+    }
+
+    TelemetryFrame f;
+    memset(&f, 0, sizeof(f));
+    f.version = TELEMETRY_VERSION;
+    f.size = sizeof(f);
+    f.seq = _telemetrySeq++;
+    time_t now = time(nullptr);
+    f.epoch = now > 1600000000 ? (uint32_t)now : 0;
+    f.ms = millis();
+    f.mode = (uint8_t)t->getMode();
+    f.action = (uint8_t)t->getAction();
+    f.heatLevel = (uint8_t)t->getHeatLevel();
+    f.coolLevel = (uint8_t)t->getCoolLevel();
+    if (t->hasValidTemperature()) {
+        f.flags |= TF_TEMP_VALID;
+        f.currentTemp = scaled(t->getCurrentTemperature(), 10);
+    }
+    if (t->isForceFurnace()) f.flags |= TF_FORCE_FURNACE;
+    if (t->isForceNoHP()) f.flags |= TF_FORCE_NO_HP;
+    if (t->isDefrostActive()) f.flags |= TF_DEFROST;
+    for (uint8_t i = 0; i < OUT_COUNT; i++) {
+        OutPin* p = t->getOutput((OutputIdx)i);
+        if (p && p->isPinOn()) f.outputs |= 1 << i;
+    }
+    for (uint8_t i = 0; i < IN_COUNT; i++) {
+        InputPin* p = t->getInput((InputIdx)i);
+        if (p && p->isActive()) f.inputs |= 1 << i;
+    }
+    f.cpuLoad = (getCpuLoadCore0() + getCpuLoadCore1()) / 2;
+    f.heatSetpoint = scaled(t->getHeatSetpoint(), 10);
+    f.coolSetpoint = scaled(t->getCoolSetpoint(), 10);
+    f.cpuTemp = scaled(temperatureRead() * 9.0f / 5.0f + 32.0f, 10);
     if (_pressure1 && _pressure1->isValid()) {
-        doc["pressure1"] = serialized(String(_pressure1->getLastValue(), 2));
+        f.flags |= TF_PRESSURE1_VALID;
+        f.pressure1 = scaled(_pressure1->getLastValue(), 100);
+        f.raw1 = _pressure1->getLastRaw();
     }
     if (_pressure2 && _pressure2->isValid()) {
-        doc["pressure2"] = serialized(String(_pressure2->getLastValue(), 2));
+        f.flags |= TF_PRESSURE2_VALID;
+        f.pressure2 = scaled(_pressure2->getLastValue(), 100);
+        f.raw2 = _pressure2->getLastRaw();
+    }
+
+    if (_client.publish(topic(_telemetryTopic), 0, false, (const char*)&f, sizeof(f))) {
+        _telemetryFrames++;
+    } else {
+        _publishErrors++;
     }
+}
+
+// out holds FIELD_VALUE_SIZE bytes; formatFixed needs at most 13
+void MQTTHandler::renderField(uint8_t field, char* out, size_t size) {
+    Thermostat* t = _thermostat;
+    out[0] = '\0';
+    if (field >= F_OUTPUTS && field < F_INPUTS) {
+        OutPin* p = t->getOutput((OutputIdx)(field - F_OUTPUTS));
+        if (p) strlcpy(out, p->isPinOn() ? "ON" : "OFF", size);
+        return;
+    }
+    if (field >= F_INPUTS && field < F_PRESSURE1) {
+        InputPin* p = t->getInput((InputIdx)(field - F_INPUTS));
+        if (p) strlcpy(out, p->isActive() ? "ON" : "OFF", size);
+        return;
+    }
+    switch (field) {
+        case F_MODE:          strlcpy(out, Thermostat::modeToString(t->getMode()), size); break;
+        case F_ACTION:        strlcpy(out, Thermostat::actionToString(t->getAction()), size); break;
+        case F_HEAT_LEVEL:    strlcpy(out, Thermostat::heatLevelToString(t->getHeatLevel()), size); break;
+        case F_COOL_LEVEL:    strlcpy(out, Thermostat::coolLevelToString(t->getCoolLevel()), size); break;
+        case F_CURRENT_TEMP:
+            if (t->hasValidTemperature()) formatFixed(out, scaled(t->getCurrentTemperature(), 10), 1);
+            break;
+        case F_HEAT_SETPOINT: formatFixed(out, scaled(t->getHeatSetpoint(), 10), 1); break;
+        case F_COOL_SETPOINT: formatFixed(out, scaled(t->getCoolSetpoint(), 10), 1); break;
+        case F_FORCE_FURNACE: strlcpy(out, t->isForceFurnace() ? "ON" : "OFF", size); break;
+        case F_FORCE_NO_HP:   strlcpy(out, t->isForceNoHP() ? "ON" : "OFF", size); break;
+        case F_DEFROST:       strlcpy(out, t->isDefrostActive() ? "ON" : "OFF", size); break;
+        case F_PRESSURE1:
+            if (_pressure1 && _pressure1->isValid()) formatFixed(out, scaled(_pressure1->getLastValue(), 100), 2);
+            break;
+        case F_PRESSURE2:
+            if (_pressure2 && _pressure2->isValid()) formatFixed(out, scaled(_pressure2->getLastValue(), 100), 2);
+            break;
+        case F_CPU_TEMP:
+            formatFixed(out, scaled(temperatureRead() * 9.0f / 5.0f + 32.0f, 10), 1);
+            break;
+        case F_CPU_LOAD:      formatFixed(out, (getCpuLoadCore0() + getCpuLoadCore1()) / 2, 0); break;
+    }
+}
+
+bool MQTTHandler::publishFields(unsigned long changedMs) {
+    if (!_client.connected() || _thermostat == nullptr) return false;
+
+    char value[FIELD_VALUE_SIZE];
+    bool ok = true;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        renderField(f, value, sizeof(value));
+        // No value (sensor not valid yet): keep the retained one
+        if (!value[0]) continue;
+        if (_fieldSent[f] && strcmp(value, _fieldValue[f]) == 0) continue;
+
+        PubResult r = publishTracked(topic(_fieldTopic[f]), value, strlen(value), true, f, changedMs);
+        // Window full: the rest go out with their latest value once acks
+        // free a slot
+        if (r == PUB_WINDOW_FULL) return false;
+        if (r == PUB_FAILED) {
+            // Not queued; the value stays unsent and the next pass retries
+            ok = false;
+            continue;
+        }
+        strlcpy(_fieldValue[f], value, FIELD_VALUE_SIZE);
+        _fieldSent[f] = true;
+        _fieldPublishes++;
+    }
+    return ok;
+}
 
-    char buf[512];
-    size_t len = serializeJson(doc, buf, sizeof(buf));
-    String topic = _topicPrefix + "/state";
-    _client.publish(topic.c_str(), 0, false, buf, len);
+MQTTHandler::PubResult MQTTHandler::publishTracked(const char* t, const char* payload, size_t len,
+                                                   bool retain, uint8_t field, unsigned long changedMs) {
+    int slot = -1;
+    uint8_t used = 0;
+    portENTER_CRITICAL(&_ackMux);
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (_inflight[i].state != SLOT_FREE) {
+            used++;
+        } else if (slot < 0) {
+            slot = i;
+        }
+    }
+    if (used < _window && slot >= 0) {
+        _inflight[slot].state = SLOT_RESERVED;
+    } else {
+        slot = -1;
+    }
+    portEXIT_CRITICAL(&_ackMux);
+    if (slot < 0) {
+        _windowFull++;
+        return PUB_WINDOW_FULL;
+    }
+
+    InFlight& s = _inflight[slot];
+    s.field = field;
+    s.retain = retain;
+    s.topic = t;
+    s.changedMs = changedMs;
+    s.len = 0;
+    if (field >= FIELD_COUNT) {
+        memcpy(s.payload, payload, len);
+        s.len = len;
+    }
+    uint16_t packetId = _client.publish(t, 1, retain, payload, len);
+    if (packetId == 0) {
+        portENTER_CRITICAL(&_ackMux);
+        s.state = SLOT_FREE;
+        portEXIT_CRITICAL(&_ackMux);
+        _publishErrors++;
+        return PUB_FAILED;
+    }
+    commitSlot(slot, packetId);
+    return PUB_OK;
+}
+
+// The PUBACK may already have been handled on the async_tcp task before
+// publish() returned; then it sits in _earlyAcks. Only one slot is reserved
+// at a time (publishes come from the loop), so whatever else is stashed
+// belongs to untracked publishes and is dropped.
+void MQTTHandler::commitSlot(uint8_t slot, uint16_t packetId) {
+    InFlight& s = _inflight[slot];
+    unsigned long now = millis();
+    bool acked = false;
+    portENTER_CRITICAL(&_ackMux);
+    for (uint8_t i = 0; i < EARLY_ACKS; i++) {
+        if (_earlyAcks[i] == packetId) acked = true;
+    }
+    memset(_earlyAcks, 0, sizeof(_earlyAcks));
+    s.packetId = packetId;
+    s.sentMs = now;
+    if (acked) {
+        s.state = SLOT_FREE;
+    } else {
+        // Lost with the connection if it dropped meanwhile
+        s.state = _client.connected() ? SLOT_SENT : SLOT_RESEND;
+    }
+    portEXIT_CRITICAL(&_ackMux);
+    if (acked) recordAck(now, s.changedMs, now);
+}
+
+void MQTTHandler::recordAck(unsigned long sentMs, unsigned long changedMs, unsigned long now) {
+    uint32_t rtt = now - sentMs;
+    _rttLastMs = rtt;
+    if (rtt > _rttMaxMs) _rttMaxMs = rtt;
+    _rttSumMs += rtt;
+    _rttCount++;
+    if (!changedMs) return;
+
+    uint32_t latency = now - changedMs;
+    _latencyLastMs = latency;
+    if (latency > _latencyMaxMs) _latencyMaxMs = latency;
+    _latencySumMs += latency;
+    _acks++;
+}
+
+// After a reconnect or an ack timeout: messages go out again from their
+// copy. Field slots are released and the field marked unsent, so the next
+// pass (or the full republish on connect) sends its latest value.
+bool MQTTHandler::resendInFlight() {
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        InFlight& s = _inflight[i];
+        if (s.state != SLOT_RESEND) continue;
+        _retransmits++;
+        if (s.field < FIELD_COUNT) {
+            _fieldSent[s.field] = false;
+            if (!_changePending) {
+                _changePending = true;
+                _firstChangeMs = _lastChangeMs = millis();
+                _changedMs = 0;
+            }
+            portENTER_CRITICAL(&_ackMux);
+            s.state = SLOT_FREE;
+            portEXIT_CRITICAL(&_ackMux);
+            continue;
+        }
+        portENTER_CRITICAL(&_ackMux);
+        s.state = SLOT_RESERVED;
+        portEXIT_CRITICAL(&_ackMux);
+        uint16_t packetId = _client.publish(s.topic, 1, s.retain, s.payload, s.len);
+        if (packetId == 0) {
+            portENTER_CRITICAL(&_ackMux);
+            s.state = SLOT_RESEND;
+            portEXIT_CRITICAL(&_ackMux);
+            _retransmits--;
+            _publishErrors++;
+            return false;
+        }
+        commitSlot(i, packetId);
+    }
+    return true;
+}
+
+void MQTTHandler::expireInFlight(unsigned long now) {
+    uint32_t timeout = ACK_TIMEOUT_RTTS * getRttAvgMs();
+    if (timeout < ACK_TIMEOUT_MIN_MS) timeout = ACK_TIMEOUT_MIN_MS;
+    bool expired = false;
+    portENTER_CRITICAL(&_ackMux);
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        InFlight& s = _inflight[i];
+        if (s.state == SLOT_SENT && now - s.sentMs >= timeout) {
+            s.state = SLOT_RESEND;
+            expired = true;
+        }
+    }
+    portEXIT_CRITICAL(&_ackMux);
+    if (expired) _resendPending = true;
+}
+
+void MQTTHandler::pollState() {
+    if (_thermostat == nullptr) return;
+
+    uint32_t version = _thermostat->stateVersion();
+    unsigned long now = millis();
+    if (version != _seenVersion) {
+        _seenVersion = version;
+        _lastChangeMs = now;
+        if (!_changePending) {
+            _changePending = true;
+            _firstChangeMs = now;
+            _changedMs = _thermostat->stateChangedMs();
+        }
+    }
+    bool settled = now - _lastChangeMs >= DEBOUNCE_MS || now - _firstChangeMs >= MAX_DEBOUNCE_MS;
+
+    if (!_client.connected()) {
+        // The retained fields are republished on connect; the snapshot
+        // keeps the change itself
+        if (_changePending && settled) {
+            queueSnapshot();
+            _changePending = false;
+        }
+        return;
+    }
+
+    expireInFlight(now);
+    if (_resendPending) {
+        if (!resendInFlight()) return;
+        _resendPending = false;
+    }
+
+    if (_discoveryPending) {
+        if (!publishDiscovery()) return;
+        _discoveryPending = false;
+    }
+
+    if (_forceAll) {
+        // (Re)connected: retained values may be stale or missing
+        _forceAll = false;
+        _syncing = true;
+        memset(_fieldSent, 0, sizeof(_fieldSent));
+    }
+    if (_syncing) {
+        // Spread over several polls when the window fills up
+        if (publishFields(0)) {
+            _syncing = false;
+            _changePending = false;
+            _publishedVersion = version;
+            publishState();
+        }
+        return;
+    }
+
+    if (_snapshotPending && publishSnapshot()) _snapshotPending = false;
+
+    if (_changePending && settled && publishFields(_changedMs)) {
+        _changePending = false;
+        _publishedVersion = version;
+        _changePublishes++;
+    }
+
+    replayQueue(now);
+}
+
+// Token bucket: _replayRate messages a second, at most a second's worth at
+// once. Replays are QoS 0 like the live publishes they stand in for.
+void MQTTHandler::replayQueue(unsigned long now) {
+    unsigned long elapsed = now - _replayLastMs;
+    _replayLastMs = now;
+    if (_queue.empty()) {
+        if (_replaying) {
+            _replaying = false;
+            Log.info("MQTT", "Replay done: %u messages", _replaySent);
+        }
+        _replayCredit = 0;
+        return;
+    }
+    if (!_replaying) {
+        _replaying = true;
+        _replayCredit = 0;
+        elapsed = 0;
+        Log.info("MQTT", "Replaying %u queued messages at %u/s", _queue.getDepth(), _replayRate);
+    }
+
+    uint32_t cap = (uint32_t)_replayRate * 1000;
+    if (elapsed > 1000) elapsed = 1000;
+    _replayCredit += elapsed * _replayRate;
+    if (_replayCredit > cap) _replayCredit = cap;
+
+    while (_replayCredit >= 1000) {
+        const char* t;
+        const char* payload;
+        size_t len;
+        uint32_t epoch;
+        if (!_queue.peek(t, payload, len, epoch)) break;
+        PubResult r;
+        if (_eventQos) {
+            r = publishTracked(t, payload, len, false, FIELD_COUNT, 0);
+        } else {
+            r = _client.publish(t, 0, false, payload, len) ? PUB_OK : PUB_FAILED;
+            if (r == PUB_FAILED) _publishErrors++;
+        }
+        // Window or TCP buffer full; the entry stays first in line
+        if (r != PUB_OK) break;
+        _queue.pop();
+        _replayCredit -= 1000;
+        _replaySent++;
+        time_t nowEpoch = time(nullptr);
+        _replayLagS = (epoch && nowEpoch > (time_t)epoch) ? (uint32_t)(nowEpoch - epoch) : 0;
+    }
+}
+
+bool MQTTHandler::publishDiscovery() {
+    char uid[32];
+    snprintf(uid, sizeof(uid), "athermostat_%012llx", (unsigned long long)ESP.getEfuseMac());
+    char topic[128];
+    char buf[1024];
+    bool ok = true;
+
+    // Climate: HA mode and action names are the Thermostat string names
+    {
+        JsonDocument doc;
+        doc["~"] = _topicPrefix;
+        doc["name"] = nullptr;      // entity takes the device name
+        doc["unique_id"] = String(uid) + "_climate";
+        doc["availability_topic"] = "~/status";
+        JsonArray modes = doc["modes"].to<JsonArray>();
+        modes.add("off");
+        modes.add("heat");
+        modes.add("cool");
+        modes.add("heat_cool");
+        modes.add("fan_only");
+        doc["mode_command_topic"] = "~/set/mode";
+        doc["mode_state_topic"] = "~/state/mode";
+        doc["action_topic"] = "~/state/action";
+        doc["current_temperature_topic"] = "~/state/current_temp";
+        doc["temperature_low_command_topic"] = "~/set/heat_setpoint";
+        doc["temperature_low_state_topic"] = "~/state/heat_setpoint";
+        doc["temperature_high_command_topic"] = "~/set/cool_setpoint";
+        doc["temperature_high_state_topic"] = "~/state/cool_setpoint";
+        doc["temperature_unit"] = "F";
+        doc["min_temp"] = Thermostat::HEAT_SETPOINT_MIN;
+        doc["max_temp"] = Thermostat::COOL_SETPOINT_MAX;
+        doc["temp_step"] = 0.5;
+        doc["precision"] = 0.1;
+        JsonObject dev = doc["device"].to<JsonObject>();
+        dev["identifiers"].to<JsonArray>().add(uid);
+        dev["name"] = _deviceName;
+        dev["manufacturer"] = "alpauna";
+        dev["model"] = "AThermostat ESP32-S3";
+        dev["sw_version"] = compile_date;
+
+        size_t len = serializeJson(doc, buf, sizeof(buf));
+        snprintf(topic, sizeof(topic), "%s/climate/%s/thermostat/config", DISCOVERY_PREFIX, uid);
+        if (len >= sizeof(buf) || _client.publish(topic, 1, true, buf, len) == 0) {
+            _publishErrors++;
+            ok = false;
+        } else {
+            _discoveryPublishes++;
+        }
+    }
+
+    for (const DiscoveryEntity& e : DISCOVERY_ENTITIES) {
+        JsonDocument doc;
+        doc["~"] = _topicPrefix;
+        doc["name"] = e.name;
+        doc["unique_id"] = String(uid) + "_" + e.object;
+        doc["availability_topic"] = "~/status";
+        doc["state_topic"] = String("~/state/") + FIELD_NAMES[e.field];
+        if (e.command) doc["command_topic"] = String("~/set/") + FIELD_NAMES[e.field];
+        if (e.deviceClass) doc["device_class"] = e.deviceClass;
+        if (e.unit) doc["unit_of_measurement"] = e.unit;
+        if (strcmp(e.component, "sensor") == 0 && e.field >= F_PRESSURE1) {
+            doc["state_class"] = "measurement";
+        }
+        doc["device"]["identifiers"].to<JsonArray>().add(uid);
+
+        size_t len = serializeJson(doc, buf, sizeof(buf));
+        snprintf(topic, sizeof(topic), "%s/%s/%s/%s/config", DISCOVERY_PREFIX, e.component, uid, e.object);
+        if (len >= sizeof(buf) || _client.publish(topic, 1, true, buf, len) == 0) {
+            _publishErrors++;
+            ok = false;
+        } else {
+            _discoveryPublishes++;
+        }
+    }
+    return ok;
+}
+
+static bool parseSwitch(const char* value, bool& on) {
+    if (strcmp(value, "ON") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+        on = true;
+        return true;
+    }
+    if (strcmp(value, "OFF") == 0 || strcmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+        on = false;
+        return true;
+    }
+    return false;
+}
+
+// MQTT client task: the thermostat is only changed from the loop
+void MQTTHandler::queueCommand(const char* name, const char* value) {
+    const char* err = nullptr;
+    if (strlen(name) >= sizeof(Command::name)) {
+        err = "unknown command";
+    } else if (strlen(value) >= sizeof(Command::value)) {
+        err = "value too long";
+    }
+    if (!err) {
+        portENTER_CRITICAL(&_commandMux);
+        if (_commandCount < COMMAND_QUEUE) {
+            Command& c = _commandQueue[(_commandHead + _commandCount++) % COMMAND_QUEUE];
+            strcpy(c.name, name);
+            strcpy(c.value, value);
+        } else {
+            err = "too many pending commands";
+        }
+        portEXIT_CRITICAL(&_commandMux);
+    }
+    if (err) {
+        _commandErrors++;
+        _forceAll = true;
+        Log.warn("MQTT", "Command %.31s=%.31s rejected: %s", name, value, err);
+    }
+}
+
+void MQTTHandler::applyCommands() {
+    for (;;) {
+        Command c;
+        portENTER_CRITICAL(&_commandMux);
+        bool any = _commandCount > 0;
+        if (any) {
+            c = _commandQueue[_commandHead];
+            _commandHead = (_commandHead + 1) % COMMAND_QUEUE;
+            _commandCount--;
+        }
+        portEXIT_CRITICAL(&_commandMux);
+        if (!any) return;
+        handleCommand(c.name, c.value);
+    }
+}
+
+void MQTTHandler::handleCommand(const char* name, const char* value) {
+    const char* err = nullptr;
+    bool on;
+    if (strcmp(name, "mode") == 0) {
+        err = _thermostat->commandMode(value, CommandSource::MQTT);
+    } else if (strcmp(name, "heat_setpoint") == 0 || strcmp(name, "cool_setpoint") == 0) {
+        char* end;
+        float sp = strtof(value, &end);
+        if (end == value || *end != '\0' || isnan(sp)) {
+            err = "not a number";
+        } else if (name[0] == 'h') {
+            err = _thermostat->commandSetpoints(sp, NAN, CommandSource::MQTT);
+        } else {
+            err = _thermostat->commandSetpoints(NAN, sp, CommandSource::MQTT);
+        }
+    } else if (strcmp(name, "force_furnace") == 0) {
+        if (parseSwitch(value, on)) _thermostat->commandForceFurnace(on, CommandSource::MQTT);
+        else err = "expected ON or OFF";
+    } else if (strcmp(name, "force_no_hp") == 0) {
+        if (parseSwitch(value, on)) _thermostat->commandForceNoHP(on, CommandSource::MQTT);
+        else err = "expected ON or OFF";
+    } else {
+        err = "unknown command";
+    }
+
+    if (err) {
+        _commandErrors++;
+        // Republish so an optimistic UI falls back to the real state
+        _forceAll = true;
+        Log.warn("MQTT", "Command %s=%s rejected: %s", name, value, err);
+    } else {
+        _commands++;
+        Log.info("MQTT", "Command %s=%s", name, value);
+    }
+}
+
+// Runs on the MQTT client task, like /api/config/save on the web server's
+void MQTTHandler::handleConfig(const char* payload, size_t len) {
+    _configRequests++;
+    JsonDocument doc;
+    JsonDocument result;
+    String error;
+    bool needsReboot = false;
+
+    DeserializationError de = deserializeJson(doc, payload, len);
+    if (de) {
+        error = String("bad JSON: ") + de.c_str();
+    } else if (!doc.is<JsonObject>()) {
+        error = "not a JSON object";
+    } else if (doc.containsKey("id")) {
+        JsonVariant id = doc["id"];
+        if (id.is<long>() || (id.is<const char*>() && strlen(id.as<const char*>()) <= 64)) {
+            result["id"] = id;
+        } else {
+            error = "id: expected a number or a string of up to 64 chars";
+        }
+        doc.remove("id");
+    }
+    if (error.length() == 0) {
+        if (!_configEnabled) {
+            error = "remote config is disabled";
+        } else if (!_configFn) {
+            error = "not ready";
+        } else {
+            _configFn(doc, needsReboot, error);
+        }
+    }
+
+    result["ok"] = error.length() == 0;
+    if (error.length()) {
+        result["error"] = error;
+        _configErrors++;
+        Log.warn("MQTT", "Remote config rejected: %s", error.c_str());
+    } else {
+        result["needsReboot"] = needsReboot;
+        Log.info("MQTT", "Remote config applied (%u keys%s)", doc.size(),
+                 needsReboot ? ", reboot needed" : "");
+    }
+    char out[256];
+    size_t n = serializeJson(result, out, sizeof(out));
+    _client.publish(topic(_configResultTopic), 1, false, out, n);
 }
 
 void MQTTHandler::onConnect(bool sessionPresent) {
@@ -131,16 +1081,29 @@ void MQTTHandler::onConnect(bool sessionPresent) {
     if (_tReconnect) {
         _tReconnect->disable();
     }
+    _backoff.up(millis());
+    _forceAll = true;
+    _discoveryPending = true;
+    _replaySent = 0;
+    _resendPending = true;
+    _client.publish(topic(_statusTopic), 1, true, "online");
 
-    // Subscribe to HA temperature topic
-    if (_tempTopic.length() > 0) {
-        _client.subscribe(_tempTopic.c_str(), 0);
-        Log.info("MQTT", "Subscribed to temp topic: %s", _tempTopic.c_str());
-    }
+    _router.subscribeAll(_client);
+    Log.info("MQTT", "Subscribed to %u topic filters", _router.getFilterCount());
 }
 
 void MQTTHandler::onDisconnect(AsyncMqttClientDisconnectReason reason) {
     Log.warn("MQTT", "Disconnected from MQTT (reason: %d)", (int)reason);
+    _backoff.lost(millis());
+
+    // Acks for publishes still in flight will not arrive; they go out again
+    // after the reconnect
+    portENTER_CRITICAL(&_ackMux);
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (_inflight[i].state == SLOT_SENT) _inflight[i].state = SLOT_RESEND;
+    }
+    memset(_earlyAcks, 0, sizeof(_earlyAcks));
+    portEXIT_CRITICAL(&_ackMux);
 
     if (reason == AsyncMqttClientDisconnectReason::TLS_BAD_FINGERPRINT) {
         Log.error("MQTT", "Bad server fingerprint");
@@ -162,26 +1125,34 @@ void MQTTHandler::onUnsubscribe(uint16_t packetId) {
 void MQTTHandler::onMessage(char* topic, char* payload,
                              AsyncMqttClientMessageProperties properties,
                              size_t len, size_t index, size_t total) {
-    // Check if this is the temperature topic
-    if (_thermostat && _tempTopic.length() > 0 && strcmp(topic, _tempTopic.c_str()) == 0) {
-        char buf[32];
-        size_t copyLen = len < sizeof(buf) - 1 ? len : sizeof(buf) - 1;
-        memcpy(buf, payload, copyLen);
-        buf[copyLen] = '\0';
-
-        float temp = atof(buf);
-        if (temp > -50.0f && temp < 150.0f) {
-            _thermostat->setCurrentTemperature(temp);
-            Log.debug("MQTT", "Temperature update: %.1f°F", temp);
-        } else {
-            Log.warn("MQTT", "Invalid temperature value: %s", buf);
-        }
-        return;
-    }
-
-    Log.debug("MQTT", "Message on topic: %s (len=%u)", topic, len);
+    _router.route(topic, payload, len, index, total);
 }
 
 void MQTTHandler::onPublish(uint16_t packetId) {
-    // Publish acknowledged — no action needed
+    unsigned long now = millis();
+    unsigned long sentMs = 0;
+    unsigned long changedMs = 0;
+    bool found = false;
+    portENTER_CRITICAL(&_ackMux);
+    for (uint8_t i = 0; i < MAX_INFLIGHT; i++) {
+        InFlight& s = _inflight[i];
+        if (s.state == SLOT_SENT && s.packetId == packetId) {
+            sentMs = s.sentMs;
+            changedMs = s.changedMs;
+            s.state = SLOT_FREE;
+            found = true;
+            break;
+        }
+    }
+    // Untracked (discovery, status, config result), or publish() has not
+    // returned yet: only the latter can be claimed, by the reserved slot
+    for (uint8_t i = 0; i < MAX_INFLIGHT && !found; i++) {
+        if (_inflight[i].state == SLOT_RESERVED) {
+            _earlyAcks[_earlyAckNext] = packetId;
+            _earlyAckNext = (_earlyAckNext + 1) % EARLY_ACKS;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_ackMux);
+    if (found) recordAck(sentMs, changedMs, now);
 }
@@ -0,0 +1,256 @@
+#include "MqttQueue.h"
+#include <LittleFS.h>
+#include <time.h>
+
+MqttQueue::MqttQueue()
+    : _ring(nullptr)
+    , _head(0)
+    , _tail(0)
+    , _used(0)
+    , _ramEntries(0)
+    , _fileSize(0)
+    , _fileRead(0)
+    , _fileEntries(0)
+    , _topicCount(0)
+    , _buf(nullptr)
+    , _peeked(false)
+    , _peekedFile(false)
+    , _peekedSize(0)
+    , _lock(nullptr)
+    , _queued(0)
+    , _replayed(0)
+    , _dropped(0)
+    , _bytesSpilled(0)
+    , _spillErrors(0)
+{
+    memset(_topics, 0, sizeof(_topics));
+}
+
+MqttQueue::~MqttQueue() {
+    free(_ring);
+    free(_buf);
+    if (_lock) vSemaphoreDelete(_lock);
+}
+
+bool MqttQueue::begin(const char* spillPath) {
+    if (_ring) return true;
+    _path = spillPath;
+    _lock = xSemaphoreCreateMutex();
+    _ring = (uint8_t*)ps_malloc(RAM_BYTES);
+    _buf = (char*)ps_malloc(sizeof(EntryHeader) + MAX_PAYLOAD + 1);
+    if (!_lock || !_ring || !_buf) {
+        free(_ring);
+        free(_buf);
+        _ring = nullptr;
+        _buf = nullptr;
+        return false;
+    }
+
+    // Entries a previous boot spilled but did not replay. A torn entry at
+    // the end is left out and overwritten by the next spill.
+    File f = LittleFS.open(_path.c_str(), "r");
+    if (f) {
+        size_t size = f.size();
+        size_t off = 0;
+        EntryHeader h;
+        while (off + sizeof(h) <= size) {
+            if (!f.seek(off) || f.read((uint8_t*)&h, sizeof(h)) != sizeof(h)) break;
+            if (h.magic != ENTRY_MAGIC || h.len > MAX_PAYLOAD ||
+                off + sizeof(h) + h.len > size) {
+                break;
+            }
+            off += sizeof(h) + h.len;
+            _fileEntries++;
+        }
+        f.close();
+        _fileSize = off;
+        if (_fileEntries == 0) LittleFS.remove(_path.c_str());
+    }
+    return true;
+}
+
+int MqttQueue::addTopic(const char* topic) {
+    if (_topicCount >= MAX_TOPICS) return -1;
+    _topics[_topicCount] = topic;
+    return _topicCount++;
+}
+
+void MqttQueue::ringWrite(const void* src, size_t len) {
+    size_t first = RAM_BYTES - _head;
+    if (first > len) first = len;
+    memcpy(_ring + _head, src, first);
+    memcpy(_ring, (const uint8_t*)src + first, len - first);
+    _head = (_head + len) % RAM_BYTES;
+    _used += len;
+}
+
+void MqttQueue::ringRead(size_t offset, void* dst, size_t len) const {
+    offset %= RAM_BYTES;
+    size_t first = RAM_BYTES - offset;
+    if (first > len) first = len;
+    memcpy(dst, _ring + offset, first);
+    memcpy((uint8_t*)dst + first, _ring, len - first);
+}
+
+bool MqttQueue::push(uint8_t topic, const char* payload, size_t len) {
+    if (!_ring || topic >= _topicCount || len > MAX_PAYLOAD) {
+        _dropped++;
+        return false;
+    }
+    EntryHeader h;
+    h.len = len;
+    h.topic = topic;
+    h.magic = ENTRY_MAGIC;
+    time_t now = time(nullptr);
+    h.epoch = now > 1600000000 ? (uint32_t)now : 0;
+    size_t size = sizeof(h) + len;
+
+    lock();
+    while (RAM_BYTES - _used < size) {
+        if (!spill()) dropOldest();
+    }
+    ringWrite(&h, sizeof(h));
+    ringWrite(payload, len);
+    _ramEntries++;
+    _queued++;
+    unlock();
+    return true;
+}
+
+// Moves up to SPILL_CHUNK bytes of the oldest RAM entries to the end of the
+// file in one write. The file is opened r+ and written at _fileSize, so a
+// short write is simply overwritten by the next spill.
+bool MqttQueue::spill() {
+    if (_fileSize + SPILL_CHUNK > SPILL_MAX_BYTES) return false;
+
+    size_t bytes = 0;
+    uint32_t entries = 0;
+    while (entries < _ramEntries && bytes < SPILL_CHUNK) {
+        EntryHeader h;
+        ringRead(_tail + bytes, &h, sizeof(h));
+        bytes += sizeof(h) + h.len;
+        entries++;
+    }
+    if (bytes == 0) return false;
+
+    File f = LittleFS.open(_path.c_str(), _fileSize ? "r+" : "w");
+    if (!f) {
+        _spillErrors++;
+        return false;
+    }
+    size_t written = 0;
+    if (f.seek(_fileSize)) {
+        size_t first = RAM_BYTES - _tail;
+        if (first > bytes) first = bytes;
+        written = f.write(_ring + _tail, first);
+        if (written == first && bytes > first) written += f.write(_ring, bytes - first);
+    }
+    f.close();
+    if (written != bytes) {
+        _spillErrors++;
+        return false;
+    }
+
+    // A ring entry being replayed is now the first unread file entry
+    if (_peeked && !_peekedFile && _fileEntries == 0) _peekedFile = true;
+
+    _tail = (_tail + bytes) % RAM_BYTES;
+    _used -= bytes;
+    _ramEntries -= entries;
+    _fileSize += bytes;
+    _fileEntries += entries;
+    _bytesSpilled += bytes;
+    return true;
+}
+
+void MqttQueue::dropOldest() {
+    EntryHeader h;
+    ringRead(_tail, &h, sizeof(h));
+    size_t size = sizeof(h) + h.len;
+    _tail = (_tail + size) % RAM_BYTES;
+    _used -= size;
+    _ramEntries--;
+    _dropped++;
+    // The entry being replayed is gone; pop() must not take the next one
+    if (_peeked && !_peekedFile) _peeked = false;
+}
+
+// Oldest file entry into _buf. A bad header means the rest of the file
+// can't be walked, so it is dropped.
+bool MqttQueue::readFileEntry() {
+    EntryHeader h;
+    bool ok = false;
+    File f = LittleFS.open(_path.c_str(), "r");
+    if (f && f.seek(_fileRead) && f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+        h.magic == ENTRY_MAGIC && h.len <= MAX_PAYLOAD && h.topic < _topicCount &&
+        _fileRead + sizeof(h) + h.len <= _fileSize) {
+        memcpy(_buf, &h, sizeof(h));
+        ok = f.read((uint8_t*)_buf + sizeof(h), h.len) == h.len;
+    }
+    if (f) f.close();
+    if (!ok) {
+        _dropped += _fileEntries;
+        resetFile();
+    }
+    return ok;
+}
+
+void MqttQueue::resetFile() {
+    LittleFS.remove(_path.c_str());
+    _fileSize = 0;
+    _fileRead = 0;
+    _fileEntries = 0;
+}
+
+bool MqttQueue::peek(const char*& topic, const char*& payload, size_t& len, uint32_t& epoch) {
+    if (!_ring) return false;
+    lock();
+    while (!_peeked) {
+        if (_fileEntries > 0) {
+            if (!readFileEntry()) continue;
+            _peekedFile = true;
+        } else if (_ramEntries > 0) {
+            EntryHeader h;
+            ringRead(_tail, &h, sizeof(h));
+            ringRead(_tail, _buf, sizeof(h) + h.len);
+            _peekedFile = false;
+        } else {
+            break;
+        }
+        EntryHeader h;
+        memcpy(&h, _buf, sizeof(h));
+        _buf[sizeof(h) + h.len] = '\0';
+        _peekedSize = sizeof(h) + h.len;
+        _peeked = true;
+    }
+    bool ok = _peeked;
+    if (ok) {
+        EntryHeader h;
+        memcpy(&h, _buf, sizeof(h));
+        topic = _topics[h.topic];
+        payload = _buf + sizeof(h);
+        len = h.len;
+        epoch = h.epoch;
+    }
+    unlock();
+    return ok;
+}
+
+void MqttQueue::pop() {
+    if (!_ring) return;
+    lock();
+    if (_peeked) {
+        if (_peekedFile) {
+            _fileRead += _peekedSize;
+            _fileEntries--;
+            if (_fileEntries == 0) resetFile();
+        } else {
+            _tail = (_tail + _peekedSize) % RAM_BYTES;
+            _used -= _peekedSize;
+            _ramEntries--;
+        }
+        _peeked = false;
+        _replayed++;
+    }
+    unlock();
+}
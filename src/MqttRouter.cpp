@@ -0,0 +1,208 @@
+#include "MqttRouter.h"
+
+MqttRouter::MqttRouter()
+    : _nodeCount(1)
+    , _handlerCount(0)
+    , _matchedCount(0)
+    , _buf(nullptr)
+    , _assembling(false)
+    , _expected(0)
+    , _messages(0)
+    , _dispatched(0)
+    , _unmatched(0)
+    , _reassembled(0)
+    , _dropped(0)
+{
+    // Node 0 is the root, above the first topic level
+    _nodes[0].hash = 0;
+    _nodes[0].child = -1;
+    _nodes[0].next = -1;
+    _nodes[0].plus = -1;
+    _nodes[0].multi = -1;
+    _nodes[0].handlers = -1;
+}
+
+MqttRouter::~MqttRouter() {
+    free(_buf);
+}
+
+bool MqttRouter::begin() {
+    if (!_buf) _buf = (char*)ps_malloc(MAX_MESSAGE + 1);
+    return _buf != nullptr;
+}
+
+// FNV-1a
+uint32_t MqttRouter::levelHash(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int8_t MqttRouter::newNode(const char* level, size_t len) {
+    if (_nodeCount >= MAX_NODES) return -1;
+    Node& n = _nodes[_nodeCount];
+    n.level = String(level).substring(0, len);
+    n.hash = levelHash(level, len);
+    n.child = -1;
+    n.next = -1;
+    n.plus = -1;
+    n.multi = -1;
+    n.handlers = -1;
+    return _nodeCount++;
+}
+
+bool MqttRouter::add(const char* filter, uint8_t qos, Handler handler) {
+    if (_handlerCount >= MAX_HANDLERS || filter == nullptr || *filter == '\0') return false;
+
+    // Check the whole filter first so a bad one leaves no nodes behind
+    uint8_t depth = 0;
+    for (const char* l = filter; l; ) {
+        const char* slash = strchr(l, '/');
+        size_t len = slash ? (size_t)(slash - l) : strlen(l);
+        bool wild = memchr(l, '+', len) || memchr(l, '#', len);
+        if (wild && len != 1) return false;
+        if (*l == '#' && slash) return false;
+        if (++depth > MAX_LEVELS) return false;
+        l = slash ? slash + 1 : nullptr;
+    }
+
+    int8_t node = 0;
+    for (const char* l = filter; l; ) {
+        const char* slash = strchr(l, '/');
+        size_t len = slash ? (size_t)(slash - l) : strlen(l);
+        Node& n = _nodes[node];
+        int8_t k;
+        if (len == 1 && *l == '+') {
+            if (n.plus < 0) n.plus = newNode(l, len);
+            k = n.plus;
+        } else if (len == 1 && *l == '#') {
+            if (n.multi < 0) n.multi = newNode(l, len);
+            k = n.multi;
+        } else {
+            uint32_t h = levelHash(l, len);
+            k = n.child;
+            while (k >= 0 && !(_nodes[k].hash == h && _nodes[k].level.length() == len &&
+                               memcmp(_nodes[k].level.c_str(), l, len) == 0)) {
+                k = _nodes[k].next;
+            }
+            if (k < 0) {
+                k = newNode(l, len);
+                if (k >= 0) {
+                    _nodes[k].next = n.child;
+                    n.child = k;
+                }
+            }
+        }
+        if (k < 0) return false;
+        node = k;
+        l = slash ? slash + 1 : nullptr;
+    }
+
+    int8_t id = _handlerCount++;
+    Entry& e = _handlers[id];
+    e.filter = filter;
+    e.qos = qos;
+    e.next = -1;
+    e.handler = handler;
+    // Append, so handlers on one filter run in registration order
+    int8_t* link = &_nodes[node].handlers;
+    while (*link >= 0) link = &_handlers[*link].next;
+    *link = id;
+    return true;
+}
+
+void MqttRouter::subscribeAll(AsyncMqttClient& client) {
+    for (uint8_t i = 0; i < _handlerCount; i++) {
+        bool seen = false;
+        for (uint8_t j = 0; j < i && !seen; j++) {
+            seen = _handlers[j].filter == _handlers[i].filter;
+        }
+        if (!seen) client.subscribe(_handlers[i].filter.c_str(), _handlers[i].qos);
+    }
+}
+
+void MqttRouter::collectHandlers(int8_t id) {
+    for (; id >= 0 && _matchedCount < MAX_HANDLERS; id = _handlers[id].next) {
+        _matched[_matchedCount++] = id;
+    }
+}
+
+// level is the rest of the topic from the current level on, nullptr once
+// every level has been consumed. A node is reached by at most one path,
+// so no handler is collected twice.
+void MqttRouter::collect(int8_t node, const char* level, uint8_t depth) {
+    const Node& n = _nodes[node];
+    if (level == nullptr) {
+        collectHandlers(n.handlers);
+        // "a/#" also matches "a"
+        if (n.multi >= 0) collectHandlers(_nodes[n.multi].handlers);
+        return;
+    }
+    if (depth >= MAX_LEVELS) return;
+
+    const char* slash = strchr(level, '/');
+    size_t len = slash ? (size_t)(slash - level) : strlen(level);
+    const char* rest = slash ? slash + 1 : nullptr;
+
+    // Wildcards in the first level don't match $SYS style topics
+    bool wild = depth > 0 || level[0] != '$';
+    if (wild && n.multi >= 0) collectHandlers(_nodes[n.multi].handlers);
+    if (wild && n.plus >= 0) collect(n.plus, rest, depth + 1);
+
+    uint32_t h = levelHash(level, len);
+    for (int8_t k = n.child; k >= 0; k = _nodes[k].next) {
+        const Node& c = _nodes[k];
+        if (c.hash == h && c.level.length() == len && memcmp(c.level.c_str(), level, len) == 0) {
+            collect(k, rest, depth + 1);
+            break;
+        }
+    }
+}
+
+void MqttRouter::dispatch(const char* topic, const char* payload, size_t len) {
+    for (uint8_t i = 0; i < _matchedCount; i++) {
+        _handlers[_matched[i]].handler(topic, payload, len);
+    }
+    _dispatched++;
+}
+
+// Fragments of one message arrive back to back, so one buffer is enough.
+// The topic is matched on the first fragment; the rest of a message nobody
+// wants is skipped without copying.
+void MqttRouter::route(const char* topic, const char* payload, size_t len,
+                       size_t index, size_t total) {
+    if (index == 0) {
+        if (_assembling) _dropped++;    // the previous message never completed
+        _assembling = false;
+        _messages++;
+        _matchedCount = 0;
+        collect(0, topic, 0);
+        if (_matchedCount == 0) {
+            _unmatched++;
+            return;
+        }
+        if (total > MAX_MESSAGE || _buf == nullptr) {
+            _dropped++;
+            return;
+        }
+        _assembling = true;
+        _expected = 0;
+    }
+    if (!_assembling) return;
+    if (index != _expected || len > total - index) {
+        _assembling = false;
+        _dropped++;
+        return;
+    }
+    if (len) memcpy(_buf + index, payload, len);
+    _expected += len;
+    if (_expected < total) return;
+
+    _assembling = false;
+    if (index > 0) _reassembled++;
+    _buf[total] = '\0';
+    dispatch(topic, _buf, total);
+}
@@ -0,0 +1,214 @@
+#include "PressureCapture.h"
+#include "HX710.h"
+#include "Logger.h"
+#include <time.h>
+
+// Sampler tick. HX710 mode 3 converts every 25ms; polling at 10ms catches
+// every conversion of both sensors, so at most one Sample per tick.
+static constexpr uint32_t SAMPLE_TICK_MS = 10;
+
+PressureCapture::PressureCapture(Scheduler* ts) : _ts(ts) {}
+
+bool PressureCapture::begin(HX710* sensor1, HX710* sensor2,
+                            uint32_t preMs, uint32_t postMs, uint8_t slots) {
+    if (_running) return true;
+    _sensor1 = sensor1;
+    _sensor2 = sensor2;
+
+    if (preMs > MAX_WINDOW_MS) preMs = MAX_WINDOW_MS;
+    if (postMs > MAX_WINDOW_MS) postMs = MAX_WINDOW_MS;
+    if (postMs < SAMPLE_TICK_MS) postMs = SAMPLE_TICK_MS;
+    if (slots < 1) slots = 1;
+    if (slots > MAX_SLOTS) slots = MAX_SLOTS;
+    _preMs = preMs;
+    _postMs = postMs;
+
+    // Upper bound of one sample per tick keeps the buffers fixed-size
+    _preCapacity = preMs / SAMPLE_TICK_MS + 4;
+    _slotCapacity = (preMs + postMs) / SAMPLE_TICK_MS + 8;
+
+    size_t preBytes = (size_t)_preCapacity * sizeof(Sample);
+    size_t slotBytes = (size_t)_slotCapacity * sizeof(Sample);
+    _pre = (Sample*)ps_malloc(preBytes);
+    Sample* pool = (Sample*)ps_malloc(slotBytes * slots);
+    if (!_pre || !pool) {
+        if (_pre) { free(_pre); _pre = nullptr; }
+        if (pool) free(pool);
+        Log.error("Capture", "Failed to allocate %u bytes", preBytes + slotBytes * slots);
+        return false;
+    }
+    _slotCount = slots;
+    for (uint8_t i = 0; i < _slotCount; i++) {
+        _slots[i] = {};
+        _slots[i].samples = pool + (size_t)i * _slotCapacity;
+    }
+    _memoryBytes = preBytes + slotBytes * slots;
+    if (!_slotLock) _slotLock = xSemaphoreCreateMutex();
+
+    _windowStart = millis();
+    _tSample = new Task(SAMPLE_TICK_MS, TASK_FOREVER, [this]() { sample(); }, _ts, true);
+    _running = true;
+
+    Log.info("Capture", "Armed: pre=%lums post=%lums slots=%u (%u samples each, %u bytes PSRAM)",
+             _preMs, _postMs, _slotCount, _slotCapacity, _memoryBytes);
+    return true;
+}
+
+void PressureCapture::trigger(const char* source, bool on) {
+    if (!_running) return;
+
+    uint32_t now = millis();
+    portENTER_CRITICAL(&_triggerMux);
+    if (_pending) {
+        if (_pendingExtra < 255) _pendingExtra++;
+    } else {
+        _pending = true;
+        _pendingMs = now;
+        strlcpy(_pendingSource, source ? source : "?", sizeof(_pendingSource));
+        _pendingOn = on;
+        _pendingExtra = 0;
+    }
+    portEXIT_CRITICAL(&_triggerMux);
+}
+
+// Sampler side of trigger(): opens the next slot, or counts the request
+// against the capture still recording
+void PressureCapture::arm() {
+    char source[sizeof(_pendingSource)];
+    portENTER_CRITICAL(&_triggerMux);
+    bool pending = _pending;
+    uint32_t triggerMs = _pendingMs;
+    bool on = _pendingOn;
+    uint8_t extra = _pendingExtra;
+    memcpy(source, _pendingSource, sizeof(source));
+    _pending = false;
+    portEXIT_CRITICAL(&_triggerMux);
+    if (!pending) return;
+
+    if (_active >= 0) {
+        Capture& cur = _slots[_active];
+        uint16_t extraTotal = cur.extraTriggers + extra + 1;
+        cur.extraTriggers = extraTotal > 255 ? 255 : extraTotal;
+        _missedTriggers += extra + 1;
+        return;
+    }
+    _missedTriggers += extra;
+
+    // A download copying the oldest slot finishes before it is reused
+    xSemaphoreTake(_slotLock, portMAX_DELAY);
+    uint8_t slot = _nextSlot;
+    _nextSlot = (_nextSlot + 1) % _slotCount;
+
+    Capture& c = _slots[slot];
+    c.id = _nextId++;
+    c.triggerMs = triggerMs;
+    time_t now = time(nullptr);
+    c.triggerEpoch = (now > 1600000000) ? (uint32_t)now : 0;
+    memcpy(c.source, source, sizeof(c.source));
+    c.sourceOn = on;
+    c.extraTriggers = extra;
+    c.complete = false;
+    c.count = 0;
+    c.preCount = 0;
+
+    // Freeze the pre-window out of the ring. Samples taken between the
+    // trigger and this tick are copied too, but count as post-trigger.
+    uint32_t cutoff = triggerMs - _preMs;
+    for (uint16_t i = 0; i < _preCount && c.count < _slotCapacity; i++) {
+        uint16_t idx = (_preHead + _preCapacity - _preCount + i) % _preCapacity;
+        if ((int32_t)(_pre[idx].ms - cutoff) >= 0) {
+            c.samples[c.count++] = _pre[idx];
+            if ((int32_t)(_pre[idx].ms - triggerMs) <= 0) c.preCount = c.count;
+        }
+    }
+    _active = slot;
+    xSemaphoreGive(_slotLock);
+
+    Log.debug("Capture", "#%lu armed by %s=%d (%u pre samples)",
+              c.id, c.source, on, c.preCount);
+}
+
+const PressureCapture::Capture* PressureCapture::getSlot(uint8_t slot) const {
+    if (slot >= _slotCount || _slots[slot].id == 0) return nullptr;
+    return &_slots[slot];
+}
+
+const PressureCapture::Capture* PressureCapture::findCapture(uint32_t id) const {
+    for (uint8_t i = 0; i < _slotCount; i++) {
+        if (_slots[i].id == id) return &_slots[i];
+    }
+    return nullptr;
+}
+
+// Samples are only appended to the recording slot, so the first count of
+// them are stable without the lock; only recycling needs excluding.
+bool PressureCapture::copyCapture(uint32_t id, Capture& copy, Sample* out, uint16_t maxSamples) {
+    if (!_slotLock) return false;
+    xSemaphoreTake(_slotLock, portMAX_DELAY);
+    const Capture* c = findCapture(id);
+    if (c) {
+        copy = *c;
+        if (copy.count > maxSamples) copy.count = maxSamples;
+        if (copy.preCount > copy.count) copy.preCount = copy.count;
+        memcpy(out, c->samples, (size_t)copy.count * sizeof(Sample));
+        copy.samples = out;
+    }
+    xSemaphoreGive(_slotLock);
+    return c != nullptr;
+}
+
+void PressureCapture::pushPre(const Sample& s) {
+    _pre[_preHead] = s;
+    _preHead = (_preHead + 1) % _preCapacity;
+    if (_preCount < _preCapacity) _preCount++;
+}
+
+void PressureCapture::sample() {
+    int64_t t0 = esp_timer_get_time();
+    arm();
+
+    bool fresh = false;
+    if (_sensor1 && _sensor1->isReady()) { _sensor1->readCalibrated(); fresh = true; }
+    if (_sensor2 && _sensor2->isReady()) { _sensor2->readCalibrated(); fresh = true; }
+
+    uint32_t now = millis();
+    bool full = false;
+    if (fresh) {
+        Sample s;
+        s.ms = now;
+        s.raw1 = _sensor1 ? _sensor1->getLastRaw() : 0;
+        s.raw2 = _sensor2 ? _sensor2->getLastRaw() : 0;
+        pushPre(s);
+        _windowSamples++;
+
+        if (_active >= 0) {
+            Capture& c = _slots[_active];
+            if (c.count < _slotCapacity) {
+                c.samples[c.count++] = s;
+            } else {
+                _truncated++;
+                full = true;
+            }
+        }
+    }
+
+    if (_active >= 0) {
+        Capture& c = _slots[_active];
+        if (full || now - c.triggerMs >= _postMs) {
+            c.complete = true;
+            _active = -1;
+            Log.info("Capture", "#%lu %s=%d complete: %u samples (%u pre, %u extra triggers)",
+                     c.id, c.source, c.sourceOn, c.count, c.preCount, c.extraTriggers);
+        }
+    }
+
+    _busyUs += (uint32_t)(esp_timer_get_time() - t0);
+    uint32_t elapsed = now - _windowStart;
+    if (elapsed >= 1000) {
+        _cpuUsPerSec = (uint32_t)((uint64_t)_busyUs * 1000 / elapsed);
+        _sampleRateHz = (uint16_t)((uint32_t)_windowSamples * 1000 / elapsed);
+        _busyUs = 0;
+        _windowSamples = 0;
+        _windowStart = now;
+    }
+}
@@ -0,0 +1,74 @@
+#include "ReconnectPolicy.h"
+#include "esp_random.h"
+
+ReconnectPolicy::ReconnectPolicy(uint32_t initialMs, uint32_t capMs, float multiplier,
+                                 uint32_t stableMs, uint32_t minMs)
+    : _initialMs(initialMs)
+    , _capMs(capMs)
+    , _multiplier(multiplier < 1.0f ? 1.0f : multiplier)
+    , _stableMs(stableMs)
+    , _minMs(minMs)
+    , _inOutage(false)
+    , _up(false)
+    , _lostAt(0)
+    , _upAt(0)
+    , _step(0)
+    , _lastDelayMs(0)
+    , _attempts(0)
+    , _outageAttempts(0)
+    , _outages(0)
+    , _reconnects(0)
+    , _flaps(0)
+    , _ttrLastMs(0)
+    , _ttrMaxMs(0)
+    , _ttrSumMs(0)
+{
+}
+
+void ReconnectPolicy::lost(uint32_t now) {
+    if (_up) {
+        _up = false;
+        if (now - _upAt >= _stableMs) {
+            _step = 0;
+        } else {
+            _flaps++;
+        }
+    }
+    if (_inOutage) return;
+    _inOutage = true;
+    _lostAt = now;
+    _outageAttempts = 0;
+    _outages++;
+}
+
+void ReconnectPolicy::up(uint32_t now) {
+    if (_up) return;
+    _up = true;
+    _upAt = now;
+    if (!_inOutage) return;
+    _inOutage = false;
+    uint32_t ttr = now - _lostAt;
+    _ttrLastMs = ttr;
+    if (ttr > _ttrMaxMs) _ttrMaxMs = ttr;
+    _ttrSumMs += ttr;
+    _reconnects++;
+}
+
+uint32_t ReconnectPolicy::nextDelay() {
+    float window = _initialMs;
+    for (uint8_t i = 0; i < _step && window < _capMs; i++) {
+        window *= _multiplier;
+    }
+    uint32_t hi = window >= _capMs ? _capMs : (uint32_t)window;
+    // Stop counting once the cap is reached
+    if (hi < _capMs && _step < 255) _step++;
+
+    uint32_t lo = _minMs < hi ? _minMs : hi;
+    _lastDelayMs = lo + (hi > lo ? esp_random() % (hi - lo + 1) : 0);
+    return _lastDelayMs;
+}
+
+void ReconnectPolicy::attempted() {
+    _attempts++;
+    _outageAttempts++;
+}
@@ -10,6 +10,7 @@ Thermostat::Thermostat(Scheduler* ts)
 void Thermostat::begin() {
     _tUpdate = new Task(1 * TASK_SECOND, TASK_FOREVER, [this]() {
         this->update();
+        this->stateVersion();
     }, _ts, true);
     _lastActionChange = millis();
     _actionStartTime = millis();
@@ -55,6 +56,96 @@ void Thermostat::setMode(ThermostatMode mode) {
     }
 }
 
+// --- State version ---
+
+void Thermostat::captureState(StateSnapshot& s) const {
+    memset(&s, 0, sizeof(s));   // padding takes part in the memcmp
+    s.mode = (uint8_t)_mode;
+    s.action = (uint8_t)_action;
+    s.heatLevel = (uint8_t)_heatLevel;
+    s.coolLevel = (uint8_t)_coolLevel;
+    s.flags = (_tempValid ? 1 : 0) | (_forceFurnace ? 2 : 0) |
+              (_forceNoHP ? 4 : 0) | (_defrostActive ? 8 : 0);
+    for (int i = 0; i < OUT_COUNT; i++) {
+        if (_outputs[i] && _outputs[i]->isPinOn()) s.outputs |= (1 << i);
+    }
+    for (int i = 0; i < IN_COUNT; i++) {
+        if (_inputs[i] && _inputs[i]->isActive()) s.inputs |= (1 << i);
+    }
+    s.temp10 = _tempValid ? (int16_t)lroundf(_currentTemp * 10.0f) : 0;
+    s.heat10 = (int16_t)lroundf(_heatSetpoint * 10.0f);
+    s.cool10 = (int16_t)lroundf(_coolSetpoint * 10.0f);
+}
+
+uint32_t Thermostat::stateVersion() {
+    StateSnapshot s;
+    captureState(s);
+    if (memcmp(&s, &_lastState, sizeof(s)) != 0) {
+        unsigned long now = millis();
+        if (_commandPending && s.outputs != _lastState.outputs) {
+            CommandStats& st = _commandStats[(uint8_t)_commandSource];
+            uint32_t latency = now - _commandMs;
+            st.relaySamples++;
+            st.relayLastMs = latency;
+            if (latency > st.relayMaxMs) st.relayMaxMs = latency;
+            st.relaySumMs += latency;
+            _commandPending = false;
+        }
+        _lastState = s;
+        _stateVersion++;
+        _stateChangedMs = now;
+    }
+    if (_commandPending && millis() - _commandMs > COMMAND_RELAY_WINDOW_MS) {
+        _commandPending = false;
+    }
+    return _stateVersion;
+}
+
+// --- Commands ---
+
+void Thermostat::noteCommand(CommandSource src) {
+    _commandStats[(uint8_t)src].commands++;
+    _commandSource = src;
+    _commandMs = millis();
+    _commandPending = true;
+}
+
+const char* Thermostat::commandMode(const char* mode, CommandSource src) {
+    ThermostatMode m;
+    if (!mode || !parseMode(mode, m)) {
+        _commandStats[(uint8_t)src].rejected++;
+        return "unknown mode";
+    }
+    noteCommand(src);
+    setMode(m);
+    return nullptr;
+}
+
+const char* Thermostat::commandSetpoints(float heat, float cool, CommandSource src) {
+    if (!isnan(heat) && !(heat >= HEAT_SETPOINT_MIN && heat <= HEAT_SETPOINT_MAX)) {
+        _commandStats[(uint8_t)src].rejected++;
+        return "heat setpoint out of range";
+    }
+    if (!isnan(cool) && !(cool >= COOL_SETPOINT_MIN && cool <= COOL_SETPOINT_MAX)) {
+        _commandStats[(uint8_t)src].rejected++;
+        return "cool setpoint out of range";
+    }
+    noteCommand(src);
+    if (!isnan(heat)) _heatSetpoint = heat;
+    if (!isnan(cool)) _coolSetpoint = cool;
+    return nullptr;
+}
+
+void Thermostat::commandForceFurnace(bool force, CommandSource src) {
+    noteCommand(src);
+    _forceFurnace = force;
+}
+
+void Thermostat::commandForceNoHP(bool noHP, CommandSource src) {
+    noteCommand(src);
+    _forceNoHP = noHP;
+}
+
 // --- Main update (called every 1s) ---
 
 void Thermostat::update() {
@@ -457,3 +548,12 @@ ThermostatMode Thermostat::stringToMode(const char* str) {
     if (strcmp(str, "fan_only") == 0)  return ThermostatMode::FAN_ONLY;
     return ThermostatMode::OFF;
 }
+
+bool Thermostat::parseMode(const char* str, ThermostatMode& mode) {
+    if (strcmp(str, "off") != 0 && strcmp(str, "heat") != 0 && strcmp(str, "cool") != 0 &&
+        strcmp(str, "heat_cool") != 0 && strcmp(str, "fan_only") != 0) {
+        return false;
+    }
+    mode = stringToMode(str);
+    return true;
+}
@@ -1,9 +1,16 @@
 #include "WebHandler.h"
 #include <LittleFS.h>
+#include <memory>
 #include "AsyncJson.h"
 #include "ArduinoJson.h"
 #include "OtaUtils.h"
 #include "HX710.h"
+#include "PressureCapture.h"
+#include "JsonStream.h"
+#include "FlashLog.h"
+#include "MQTTHandler.h"
+#include "ReconnectPolicy.h"
+#include "CANBus.h"
 #include "mbedtls/base64.h"
 #include "esp_efuse.h"
 #include "esp_efuse_table.h"
@@ -13,6 +20,293 @@ extern uint8_t getCpuLoadCore0();
 extern uint8_t getCpuLoadCore1();
 extern bool _apModeActive;
 
+static void backoffJson(JsonObject o, const ReconnectPolicy& p) {
+    o["in_outage"] = p.inOutage();
+    o["outage_ms"] = p.outageMs(millis());
+    o["step"] = p.getStep();
+    o["next_delay_ms"] = p.getLastDelayMs();
+    o["attempts"] = p.getAttempts();
+    o["outage_attempts"] = p.getOutageAttempts();
+    o["outages"] = p.getOutages();
+    o["reconnects"] = p.getReconnects();
+    o["flaps"] = p.getFlaps();
+    o["ttr_last_ms"] = p.getTtrLastMs();
+    o["ttr_avg_ms"] = p.getTtrAvgMs();
+    o["ttr_max_ms"] = p.getTtrMaxMs();
+}
+
+static void canJson(JsonObject o, const CANBus& c) {
+    o["running"] = c.isRunning();
+    o["tx"] = c.getTxCount();
+    o["rx"] = c.getRxCount();
+    o["errors"] = c.getErrorCount();
+    o["bus_off"] = c.getBusOffCount();
+    o["filter"] = c.getFilterMode();
+    o["filter_ids"] = c.getFilterIds();
+    o["delivered"] = c.getDeliveredCount();
+    o["sw_filtered"] = c.getSwFilteredCount();
+    o["rx_overruns"] = c.getRxOverruns();
+    o["wakeups"] = c.getWakeups();
+    o["busy_us"] = c.getBusyUs();
+    o["latency_avg_us"] = c.getLatencyAvgUs();
+    o["latency_max_us"] = c.getLatencyMaxUs();
+    JsonArray hist = o["latency_hist"].to<JsonArray>();
+    for (uint8_t i = 0; i < CANBus::LATENCY_BUCKETS; i++) hist.add(c.getLatencyBucket(i));
+}
+
+// Keys of /api/config/save with their type and accepted range. Every key
+// in a document is checked before anything is applied, so a document
+// with one bad value changes nothing. Unknown keys are ignored.
+//
+// remote: may be set over MQTT (<prefix>/config/set). Credentials, where
+// the device connects or sends its data, the session timeout and the
+// switch for the MQTT channel itself stay with the authenticated web UI.
+enum ConfigKind : uint8_t { CK_STRING, CK_BOOL, CK_UINT, CK_FLOAT };
+struct ConfigKey {
+    const char* name;
+    ConfigKind kind;
+    double min;
+    double max;
+    bool remote;
+};
+static const ConfigKey CONFIG_KEYS[] = {
+    {"wifi_ssid",            CK_STRING, 0, 0,                              false},
+    {"wifi_password",        CK_STRING, 0, 0,                              false},
+    {"mqtt_host",            CK_STRING, 0, 0,                              false},
+    {"mqtt_port",            CK_UINT,   1, 65535,                          false},
+    {"mqtt_user",            CK_STRING, 0, 0,                              false},
+    {"mqtt_password",        CK_STRING, 0, 0,                              false},
+    {"mqtt_temp_topic",      CK_STRING, 0, 0,                              true},
+    {"mqtt_replay_rate",     CK_UINT,   1, 1000,                           true},
+    {"mqtt_inflight_window", CK_UINT,   1, MQTTHandler::MAX_INFLIGHT,      true},
+    {"mqtt_event_qos",       CK_UINT,   0, 1,                              true},
+    {"mqtt_telemetry_ms",    CK_UINT,   0, 60000,                          true},
+    {"mqtt_config_enabled",  CK_BOOL,   0, 0,                              false},
+    {"min_on_ms",            CK_UINT,   0, 86400000,                       true},
+    {"min_off_ms",           CK_UINT,   0, 86400000,                       true},
+    {"max_run_ms",           CK_UINT,   0, 86400000,                       true},
+    {"escalation_ms",        CK_UINT,   0, 86400000,                       true},
+    {"heat_deadband",        CK_FLOAT,  0, 10,                             true},
+    {"cool_deadband",        CK_FLOAT,  0, 10,                             true},
+    {"heat_overrun",         CK_FLOAT,  0, 10,                             true},
+    {"cool_overrun",         CK_FLOAT,  0, 10,                             true},
+    {"fan_idle_enabled",     CK_BOOL,   0, 0,                              true},
+    {"fan_idle_wait",        CK_UINT,   0, 1440,                           true},
+    {"fan_idle_run",         CK_UINT,   0, 1440,                           true},
+    {"theme",                CK_STRING, 0, 0,                              true},
+    {"poll_interval",        CK_UINT,   1, 10,                             true},
+    {"system_name",          CK_STRING, 0, 0,                              true},
+    {"mqtt_prefix",          CK_STRING, 0, 0,                              false},
+    {"timezone",             CK_STRING, 0, 0,                              true},
+    {"ap_fallback_sec",      CK_UINT,   0, 86400,                          true},
+    {"ap_password",          CK_STRING, 0, 0,                              false},
+    {"session_timeout",      CK_UINT,   0, 10080,                          false},
+    {"capture_enabled",      CK_BOOL,   0, 0,                              true},
+    {"capture_pre_ms",       CK_UINT,   0, PressureCapture::MAX_WINDOW_MS, true},
+    {"capture_post_ms",      CK_UINT,   0, PressureCapture::MAX_WINDOW_MS, true},
+    {"capture_slots",        CK_UINT,   1, PressureCapture::MAX_SLOTS,     true},
+    {"capture_triggers",     CK_STRING, 0, 0,                              true},
+    {"log_history_bytes",    CK_UINT,   0, 4 * 1024 * 1024,                true},
+    {"syslog_host",          CK_STRING, 0, 0,                              false},
+    {"syslog_port",          CK_UINT,   0, 65535,                          false},
+    {"syslog_rate",          CK_UINT,   0, 65535,                          true},
+    {"admin_password",       CK_STRING, 0, 0,                              false},
+    {"ftpPassword",          CK_STRING, 0, 0,                              false},
+};
+
+// Numbers may come as strings (form selects send their value as one); they
+// are replaced by the number before the type check. A null (empty form
+// field) is dropped and leaves the setting as it is.
+static void normalizeConfig(JsonDocument& doc) {
+    for (const ConfigKey& k : CONFIG_KEYS) {
+        if (!doc.containsKey(k.name)) continue;
+        JsonVariant v = doc[k.name];
+        if (v.isNull()) {
+            doc.remove(k.name);
+        } else if (k.kind == CK_UINT && v.is<const char*>()) {
+            const char* s = v.as<const char*>();
+            char* end;
+            long n = strtol(s, &end, 10);
+            if (end != s && *end == '\0') doc[k.name] = n;
+        } else if (k.kind == CK_FLOAT && v.is<const char*>()) {
+            const char* s = v.as<const char*>();
+            char* end;
+            double n = strtod(s, &end);
+            if (end != s && *end == '\0') doc[k.name] = n;
+        }
+    }
+}
+
+static bool validateConfig(const JsonDocument& doc, bool remote, String& error) {
+    for (const ConfigKey& k : CONFIG_KEYS) {
+        if (!doc.containsKey(k.name)) continue;
+        if (remote && !k.remote) {
+            error = String(k.name) + ": not allowed over MQTT";
+            return false;
+        }
+        JsonVariantConst v = doc[k.name];
+        bool typeOk = false;
+        double n = 0;
+        switch (k.kind) {
+            case CK_STRING: typeOk = v.is<const char*>(); break;
+            case CK_BOOL:   typeOk = v.is<bool>(); break;
+            case CK_UINT:   typeOk = v.is<long>(); n = v.as<long>(); break;
+            case CK_FLOAT:  typeOk = v.is<float>(); n = v.as<float>(); break;
+        }
+        if (!typeOk) {
+            static const char* const TYPE_NAMES[] = {"a string", "true/false", "an integer", "a number"};
+            error = String(k.name) + ": expected " + TYPE_NAMES[k.kind];
+            return false;
+        }
+        if ((k.kind == CK_UINT || k.kind == CK_FLOAT) && (n < k.min || n > k.max)) {
+            error = String(k.name) + ": out of range " + String(k.min, 0) + "-" + String(k.max, 0);
+            return false;
+        }
+    }
+    IPAddress ip;
+    if (doc["mqtt_host"].is<const char*>() && !ip.fromString(doc["mqtt_host"].as<const char*>())) {
+        error = "mqtt_host: not an IP address";
+        return false;
+    }
+    return true;
+}
+
+bool WebHandler::applyConfig(JsonDocument& doc, bool remote, bool& needsReboot, String& error) {
+    ProjectInfo* p = _config->getProjectInfo();
+    if (!p) {
+        error = "no config";
+        return false;
+    }
+    normalizeConfig(doc);
+    if (!validateConfig(doc, remote, error)) return false;
+
+    needsReboot = false;
+
+    // WiFi
+    if (doc.containsKey("wifi_ssid")) {
+        String newSSID = doc["wifi_ssid"].as<String>();
+        if (newSSID != _config->getWifiSSID()) needsReboot = true;
+        _config->setWifiSSID(newSSID);
+    }
+    if (doc.containsKey("wifi_password") && doc["wifi_password"].as<String>().length() > 0) {
+        _config->setWifiPassword(doc["wifi_password"].as<String>());
+        needsReboot = true;
+    }
+
+    // MQTT
+    if (doc.containsKey("mqtt_host")) {
+        IPAddress ip;
+        ip.fromString(doc["mqtt_host"].as<String>());
+        _config->setMqttHost(ip);
+        needsReboot = true;
+    }
+    if (doc.containsKey("mqtt_port")) { _config->setMqttPort(doc["mqtt_port"]); needsReboot = true; }
+    if (doc.containsKey("mqtt_user")) { _config->setMqttUser(doc["mqtt_user"].as<String>()); needsReboot = true; }
+    if (doc.containsKey("mqtt_password") && doc["mqtt_password"].as<String>().length() > 0) {
+        _config->setMqttPassword(doc["mqtt_password"].as<String>());
+        needsReboot = true;
+    }
+    if (doc.containsKey("mqtt_temp_topic")) { p->mqttTempTopic = doc["mqtt_temp_topic"].as<String>(); needsReboot = true; }
+    if (doc.containsKey("mqtt_replay_rate")) {
+        uint16_t v = doc["mqtt_replay_rate"];
+        if (v > 0) {
+            p->mqttReplayRate = v;
+            if (_mqtt) _mqtt->setReplayRate(v);
+        }
+    }
+    if (doc.containsKey("mqtt_inflight_window")) {
+        p->mqttInflightWindow = constrain(doc["mqtt_inflight_window"].as<int>(), 1, (int)MQTTHandler::MAX_INFLIGHT);
+        if (_mqtt) _mqtt->setInflightWindow(p->mqttInflightWindow);
+    }
+    if (doc.containsKey("mqtt_event_qos")) {
+        p->mqttEventQos = doc["mqtt_event_qos"].as<int>() ? 1 : 0;
+        if (_mqtt) _mqtt->setEventQos(p->mqttEventQos);
+    }
+    if (doc.containsKey("mqtt_telemetry_ms")) {
+        int v = doc["mqtt_telemetry_ms"].as<int>();
+        p->mqttTelemetryMs = v <= 0 ? 0 : constrain(v, (int)MQTTHandler::TELEMETRY_MIN_MS, 60000);
+        if (_mqtt) _mqtt->setTelemetryInterval(p->mqttTelemetryMs);
+    }
+    if (doc.containsKey("mqtt_config_enabled")) {
+        p->mqttConfigEnabled = doc["mqtt_config_enabled"];
+        if (_mqtt) _mqtt->setConfigEnabled(p->mqttConfigEnabled);
+    }
+
+    // Thermostat timing
+    if (doc.containsKey("min_on_ms")) { p->minOnTimeMs = doc["min_on_ms"]; _thermostat->config().minOnTimeMs = p->minOnTimeMs; }
+    if (doc.containsKey("min_off_ms")) { p->minOffTimeMs = doc["min_off_ms"]; _thermostat->config().minOffTimeMs = p->minOffTimeMs; }
+    if (doc.containsKey("max_run_ms")) { p->maxRunTimeMs = doc["max_run_ms"]; _thermostat->config().maxRunTimeMs = p->maxRunTimeMs; }
+    if (doc.containsKey("escalation_ms")) { p->escalationDelayMs = doc["escalation_ms"]; _thermostat->config().escalationDelayMs = p->escalationDelayMs; }
+
+    // Deadbands
+    if (doc.containsKey("heat_deadband")) { p->heatDeadband = doc["heat_deadband"]; _thermostat->config().heatDeadband = p->heatDeadband; }
+    if (doc.containsKey("cool_deadband")) { p->coolDeadband = doc["cool_deadband"]; _thermostat->config().coolDeadband = p->coolDeadband; }
+    if (doc.containsKey("heat_overrun")) { p->heatOverrun = doc["heat_overrun"]; _thermostat->config().heatOverrun = p->heatOverrun; }
+    if (doc.containsKey("cool_overrun")) { p->coolOverrun = doc["cool_overrun"]; _thermostat->config().coolOverrun = p->coolOverrun; }
+
+    // Fan idle
+    if (doc.containsKey("fan_idle_enabled")) { p->fanIdleEnabled = doc["fan_idle_enabled"]; _thermostat->config().fanIdleEnabled = p->fanIdleEnabled; }
+    if (doc.containsKey("fan_idle_wait")) { p->fanIdleWaitMin = doc["fan_idle_wait"]; _thermostat->config().fanIdleWaitMin = p->fanIdleWaitMin; }
+    if (doc.containsKey("fan_idle_run")) { p->fanIdleRunMin = doc["fan_idle_run"]; _thermostat->config().fanIdleRunMin = p->fanIdleRunMin; }
+
+    // UI
+    if (doc.containsKey("theme")) p->theme = doc["theme"].as<String>();
+    if (doc.containsKey("poll_interval")) {
+        p->pollIntervalSec = doc["poll_interval"];
+        if (p->pollIntervalSec < 1) p->pollIntervalSec = 1;
+        if (p->pollIntervalSec > 10) p->pollIntervalSec = 10;
+    }
+
+    // System
+    if (doc.containsKey("system_name")) { p->systemName = doc["system_name"].as<String>(); }
+    if (doc.containsKey("mqtt_prefix")) { p->mqttPrefix = doc["mqtt_prefix"].as<String>(); needsReboot = true; }
+    if (doc.containsKey("timezone")) { p->timezone = doc["timezone"].as<String>(); setTimezone(p->timezone); syncNtpTime(); }
+    if (doc.containsKey("ap_fallback_sec")) { p->apFallbackSeconds = doc["ap_fallback_sec"]; }
+    if (doc.containsKey("ap_password") && doc["ap_password"].as<String>().length() >= 8) {
+        p->apPassword = doc["ap_password"].as<String>();
+    }
+    if (doc.containsKey("session_timeout")) { p->sessionTimeoutMinutes = doc["session_timeout"]; _sessionMgr.setTimeoutMinutes(p->sessionTimeoutMinutes); }
+
+    // Pressure capture (buffers sized at boot)
+    if (doc.containsKey("capture_enabled")) { p->captureEnabled = doc["capture_enabled"]; needsReboot = true; }
+    if (doc.containsKey("capture_pre_ms")) { p->capturePreMs = doc["capture_pre_ms"]; needsReboot = true; }
+    if (doc.containsKey("capture_post_ms")) { p->capturePostMs = doc["capture_post_ms"]; needsReboot = true; }
+    if (doc.containsKey("capture_slots")) { p->captureSlots = doc["capture_slots"]; needsReboot = true; }
+    if (doc.containsKey("capture_triggers")) { p->captureTriggers = doc["capture_triggers"].as<String>(); needsReboot = true; }
+
+    // Log history (resized live)
+    if (doc.containsKey("log_history_bytes")) {
+        uint32_t v = doc["log_history_bytes"];
+        if (v != p->logHistoryBytes) { p->logHistoryBytes = v; Log.setHistorySize(v); }
+    }
+
+    // Remote syslog (live)
+    if (doc.containsKey("syslog_host") || doc.containsKey("syslog_port") || doc.containsKey("syslog_rate")) {
+        String host = doc["syslog_host"] | p->syslogHost;
+        uint16_t port = doc["syslog_port"] | p->syslogPort;
+        uint16_t rate = doc["syslog_rate"] | p->syslogRate;
+        if (host != p->syslogHost || port != p->syslogPort || rate != p->syslogRate) {
+            p->syslogHost = host;
+            p->syslogPort = port ? port : 514;
+            p->syslogRate = rate;
+            Log.setSyslog(host.c_str(), p->syslogPort, rate, p->systemName.c_str());
+        }
+    }
+
+    // Admin password
+    if (doc.containsKey("admin_password") && doc["admin_password"].as<String>().length() >= 4) {
+        _config->setAdminPassword(doc["admin_password"].as<String>());
+    }
+
+    // FTP password (live — takes effect on next FTP enable)
+    if (doc["ftpPassword"].is<const char*>()) {
+        p->ftpPassword = doc["ftpPassword"] | String("");
+    }
+
+    _config->updateConfig("/config.txt", *p);
+    return true;
+}
+
 WebHandler::WebHandler(uint16_t port, Scheduler* ts, Thermostat* thermostat)
     : _server(port), _ws("/ws"), _ts(ts), _thermostat(thermostat),
       _config(nullptr), _shouldReboot(false), _tDelayedReboot(nullptr),
@@ -124,6 +418,7 @@ void WebHandler::begin() {
     }
 
     setupRoutes();
+    setupCaptureRoutes();
     _server.begin();
     Log.info("HTTP", "HTTP server started");
 }
@@ -137,6 +432,9 @@ bool WebHandler::beginSecure(const uint8_t* cert, size_t certLen, const uint8_t*
     _httpsCtx.timezone = &_timezone;
     _httpsCtx.pressure1 = _pressure1;
     _httpsCtx.pressure2 = _pressure2;
+    _httpsCtx.mqtt = _mqtt;
+    _httpsCtx.wifiBackoff = _wifiBackoff;
+    _httpsCtx.can = _can;
     _httpsCtx.wifiTestState = &_wifiTestState;
     _httpsCtx.wifiTestMessage = &_wifiTestMessage;
     _httpsCtx.wifiTestNewSSID = &_wifiTestNewSSID;
@@ -220,12 +518,38 @@ void WebHandler::serveFile(AsyncWebServerRequest* request, const String& path) {
     }
 }
 
+// Content-length response serialized straight into the TCP send buffer,
+// one window per call; the document itself is the only copy.
+void WebHandler::sendJson(AsyncWebServerRequest* request, JsonDocument& doc) {
+    auto shared = std::make_shared<JsonDocument>(std::move(doc));
+    AsyncWebServerResponse* response = request->beginResponse("application/json", measureJson(*shared),
+        [shared](uint8_t* buf, size_t maxLen, size_t index) -> size_t {
+            JsonStream out((char*)buf, maxLen, index);
+            serializeJson(*shared, out);
+            return out.length();
+        });
+    request->send(response);
+}
+
 void WebHandler::onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
                            AwsEventType type, void* arg, uint8_t* data, size_t len) {
     if (type == WS_EVT_CONNECT) {
         Log.debug("WS", "Client connected: %u", client->id());
+        Log.openWebSocket(client->id());
+        // Next seq, so a client can ask for the lines it already missed
+        client->printf("{\"type\":\"hello\",\"seq\":%lu}", (unsigned long)Log.getRecordCount());
     } else if (type == WS_EVT_DISCONNECT) {
         Log.debug("WS", "Client disconnected: %u", client->id());
+        Log.closeWebSocket(client->id());
+    } else if (type == WS_EVT_DATA) {
+        // {"type":"resume","since":N} replays history from seq N
+        AwsFrameInfo* info = (AwsFrameInfo*)arg;
+        if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_TEXT) return;
+        JsonDocument doc;
+        if (deserializeJson(doc, data, len) != DeserializationError::Ok) return;
+        if (doc["type"] == "resume" && doc["since"].is<uint32_t>()) {
+            Log.resumeWebSocket(client->id(), doc["since"].as<uint32_t>());
+        }
     }
 }
 
@@ -386,6 +710,88 @@ void WebHandler::setupRoutes() {
         doc["cpu_temp_f"] = serialized(String(temperatureRead() * 9.0 / 5.0 + 32.0, 1));
         doc["safe_mode"] = _safeMode ? *_safeMode : false;
 
+        if (_mqtt) {
+            JsonObject mqtt = doc["mqtt"].to<JsonObject>();
+            mqtt["connected"] = _mqtt->connected();
+            mqtt["published_version"] = _mqtt->getPublishedVersion();
+            mqtt["change_publishes"] = _mqtt->getChangePublishes();
+            mqtt["field_publishes"] = _mqtt->getFieldPublishes();
+            mqtt["heartbeats"] = _mqtt->getHeartbeats();
+            mqtt["publish_errors"] = _mqtt->getPublishErrors();
+            mqtt["acks"] = _mqtt->getAcks();
+            mqtt["latency_last_ms"] = _mqtt->getLatencyLastMs();
+            mqtt["latency_avg_ms"] = _mqtt->getLatencyAvgMs();
+            mqtt["latency_max_ms"] = _mqtt->getLatencyMaxMs();
+            mqtt["discovery_publishes"] = _mqtt->getDiscoveryPublishes();
+            mqtt["commands"] = _mqtt->getCommands();
+            mqtt["command_errors"] = _mqtt->getCommandErrors();
+            mqtt["event_qos"] = _mqtt->getEventQos();
+            mqtt["inflight"] = _mqtt->getInFlight();
+            mqtt["inflight_window"] = _mqtt->getInflightWindow();
+            mqtt["window_full"] = _mqtt->getWindowFull();
+            mqtt["retransmits"] = _mqtt->getRetransmits();
+            mqtt["snapshots_coalesced"] = _mqtt->getSnapshotsCoalesced();
+            mqtt["ack_rtt_last_ms"] = _mqtt->getRttLastMs();
+            mqtt["ack_rtt_avg_ms"] = _mqtt->getRttAvgMs();
+            mqtt["ack_rtt_max_ms"] = _mqtt->getRttMaxMs();
+            mqtt["telemetry_ms"] = _mqtt->getTelemetryInterval();
+            mqtt["telemetry_frames"] = _mqtt->getTelemetryFrames();
+            mqtt["telemetry_bytes"] = MQTTHandler::getTelemetryBytes();
+            mqtt["state_json_bytes"] = _mqtt->getStateJsonBytes();
+            mqtt["config_requests"] = _mqtt->getConfigRequests();
+            mqtt["config_errors"] = _mqtt->getConfigErrors();
+
+            const MqttQueue* q = _mqtt->getQueue();
+            JsonObject queue = mqtt["queue"].to<JsonObject>();
+            queue["depth"] = q->getDepth();
+            queue["ram_entries"] = q->getRamEntries();
+            queue["ram_bytes"] = q->getRamBytes();
+            queue["file_entries"] = q->getFileEntries();
+            queue["file_bytes"] = q->getFileBytes();
+            queue["bytes_spilled"] = q->getBytesSpilled();
+            queue["spill_errors"] = q->getSpillErrors();
+            queue["queued"] = q->getQueued();
+            queue["dropped"] = q->getDropped();
+            queue["snapshots_queued"] = _mqtt->getSnapshotsQueued();
+            queue["replaying"] = _mqtt->isReplaying();
+            queue["replay_rate"] = _mqtt->getReplayRate();
+            queue["replay_sent"] = _mqtt->getReplaySent();
+            queue["replay_lag_s"] = _mqtt->getReplayLagS();
+            queue["replayed_total"] = q->getReplayed();
+
+            const MqttRouter& r = _mqtt->getRouter();
+            JsonObject router = mqtt["router"].to<JsonObject>();
+            router["filters"] = r.getFilterCount();
+            router["nodes"] = r.getNodeCount();
+            router["messages"] = r.getMessages();
+            router["dispatched"] = r.getDispatched();
+            router["unmatched"] = r.getUnmatched();
+            router["reassembled"] = r.getReassembled();
+            router["dropped"] = r.getDropped();
+        }
+
+        // Reconnect backoff and time to reconnect
+        JsonObject reconnect = doc["reconnect"].to<JsonObject>();
+        if (_wifiBackoff) backoffJson(reconnect["wifi"].to<JsonObject>(), *_wifiBackoff);
+        if (_mqtt) backoffJson(reconnect["mqtt"].to<JsonObject>(), _mqtt->getBackoff());
+
+        // CAN receive task
+        if (_can) canJson(doc["can"].to<JsonObject>(), *_can);
+
+        // Command to relay change, per path
+        JsonObject commands = doc["commands"].to<JsonObject>();
+        static const char* srcNames[] = {"rest", "mqtt"};
+        for (uint8_t i = 0; i < (uint8_t)CommandSource::COUNT; i++) {
+            const Thermostat::CommandStats& st = _thermostat->commandStats((CommandSource)i);
+            JsonObject o = commands[srcNames[i]].to<JsonObject>();
+            o["commands"] = st.commands;
+            o["rejected"] = st.rejected;
+            o["relay_samples"] = st.relaySamples;
+            o["relay_last_ms"] = st.relayLastMs;
+            o["relay_avg_ms"] = st.relaySamples ? (uint32_t)(st.relaySumMs / st.relaySamples) : 0;
+            o["relay_max_ms"] = st.relayMaxMs;
+        }
+
         String response;
         serializeJson(doc, response);
         request->send(200, "application/json", response);
@@ -400,7 +806,8 @@ void WebHandler::setupRoutes() {
         if (deserializeJson(doc, data, len)) { request->send(400); return; }
         const char* mode = doc["mode"];
         if (!mode) { request->send(400, "application/json", "{\"error\":\"missing mode\"}"); return; }
-        _thermostat->setMode(Thermostat::stringToMode(mode));
+        const char* err = _thermostat->commandMode(mode, CommandSource::REST);
+        if (err) { request->send(400, "application/json", String("{\"error\":\"") + err + "\"}"); return; }
         request->send(200, "application/json", "{\"ok\":true}");
     });
 
@@ -411,8 +818,10 @@ void WebHandler::setupRoutes() {
         if (index + len != total) return;
         JsonDocument doc;
         if (deserializeJson(doc, data, len)) { request->send(400); return; }
-        if (doc.containsKey("heat")) _thermostat->setHeatSetpoint(doc["heat"].as<float>());
-        if (doc.containsKey("cool")) _thermostat->setCoolSetpoint(doc["cool"].as<float>());
+        float heat = doc.containsKey("heat") ? doc["heat"].as<float>() : NAN;
+        float cool = doc.containsKey("cool") ? doc["cool"].as<float>() : NAN;
+        const char* err = _thermostat->commandSetpoints(heat, cool, CommandSource::REST);
+        if (err) { request->send(400, "application/json", String("{\"error\":\"") + err + "\"}"); return; }
         request->send(200, "application/json", "{\"ok\":true}");
     });
 
@@ -437,7 +846,7 @@ void WebHandler::setupRoutes() {
         if (index + len != total) return;
         JsonDocument doc;
         if (deserializeJson(doc, data, len)) { request->send(400); return; }
-        if (doc.containsKey("enabled")) _thermostat->setForceNoHP(doc["enabled"].as<bool>());
+        if (doc.containsKey("enabled")) _thermostat->commandForceNoHP(doc["enabled"].as<bool>(), CommandSource::REST);
         request->send(200, "application/json", "{\"ok\":true}");
     });
 
@@ -448,7 +857,7 @@ void WebHandler::setupRoutes() {
         if (index + len != total) return;
         JsonDocument doc;
         if (deserializeJson(doc, data, len)) { request->send(400); return; }
-        if (doc.containsKey("enabled")) _thermostat->setForceFurnace(doc["enabled"].as<bool>());
+        if (doc.containsKey("enabled")) _thermostat->commandForceFurnace(doc["enabled"].as<bool>(), CommandSource::REST);
         request->send(200, "application/json", "{\"ok\":true}");
     });
 
@@ -476,28 +885,261 @@ void WebHandler::setupRoutes() {
         if (limit < 1) limit = 1;
         if (limit > 500) limit = 500;
 
-        const auto& ringBuf = Log.getRingBuffer();
-        size_t count = Log.getRingBufferCount();
-        size_t head = Log.getRingBufferHead();
-        size_t max = ringBuf.size();
-
-        JsonDocument doc;
-        JsonArray entries = doc["entries"].to<JsonArray>();
-
-        size_t start = 0;
-        if (count > (size_t)limit) start = count - limit;
+        // since=<seq> returns only newer lines plus the next cursor;
+        // level, tags and contains filter on the device
+        Logger::HistoryQuery q;
+        bool incremental = request->hasParam("since");
+        if (incremental) {
+            q.since = strtoul(request->getParam("since")->value().c_str(), nullptr, 10);
+            q.limit = limit;
+        } else {
+            q.tail = limit;
+        }
+        if (request->hasParam("level")) {
+            q.level = (Logger::Level)constrain(request->getParam("level")->value().toInt(), 0, 3);
+        }
+        if (request->hasParam("tags")) {
+            q.tagMask = Log.tagMask(request->getParam("tags")->value().c_str());
+        }
+        String contains;
+        if (request->hasParam("contains")) {
+            contains = request->getParam("contains")->value();
+        }
+        // source=flash reads the flash log partition (earlier boots too);
+        // its seq numbers are the flash line numbers
+        bool flash = Log.getFlashLog() && request->hasParam("source") &&
+                     request->getParam("source")->value() == "flash";
+
+        // Entries are rendered from the ring a TCP window at a time; the
+        // members after them are built once the cursor is known
+        auto src = std::make_shared<LogJsonSource>(q, contains, [incremental, flash](const Logger::HistoryCursor& cur) {
+            JsonDocument doc;
+            doc["next"] = cur.next;
+            if (flash) {
+                doc["source"] = "flash";
+                doc["more"] = cur.more;
+                doc["lost"] = cur.lost;
+                doc["reset"] = cur.reset;
+            } else if (incremental) {
+                // Deltas carry no stats, so a quiet poll is a few dozen bytes
+                doc["more"] = cur.more;
+                doc["lost"] = cur.lost;
+                doc["reset"] = cur.reset;
+            } else {
+                doc["count"] = Log.getHistoryCount();
+                JsonObject dropped = doc["dropped"].to<JsonObject>();
+                for (int s = 0; s < Logger::SINK_COUNT; s++) {
+                    dropped[Log.getSinkName((Logger::Sink)s)] = Log.getDropped((Logger::Sink)s);
+                }
+                JsonObject stats = doc["stats"].to<JsonObject>();
+                stats["binary"] = Log.isBinaryMode();
+                stats["records_per_sec"] = Log.getRecordsPerSec();
+                for (int b = 0; b < 2; b++) {
+                    JsonObject mode = stats[b ? "binary_capture" : "text_capture"].to<JsonObject>();
+                    uint32_t n = Log.getCaptureRecords(b);
+                    mode["records"] = n;
+                    mode["bytes_per_record"] = n ? (float)Log.getCaptureBytes(b) / n : 0.0f;
+                    mode["us_per_record"] = n ? (float)Log.getCaptureUs(b) / n : 0.0f;
+                }
+                JsonObject history = stats["history"].to<JsonObject>();
+                history["capacity_bytes"] = Log.getHistoryCapacity();
+                history["used_bytes"] = Log.getHistoryBytesUsed();
+                history["entries"] = Log.getHistoryCount();
+                JsonObject file = stats["file"].to<JsonObject>();
+                file["flash_bytes"] = Log.getFlashBytes();
+                file["flushes"] = Log.getFileFlushes();
+                file["flush_us_avg"] = Log.getFlushUsAvg();
+                file["flush_us_max"] = Log.getFlushUsMax();
+                JsonObject poll = stats["poll"].to<JsonObject>();
+                poll["full_polls"] = Log.getPollCount(false);
+                poll["full_bytes_avg"] = Log.getPollBytesAvg(false);
+                poll["incremental_polls"] = Log.getPollCount(true);
+                poll["incremental_bytes_avg"] = Log.getPollBytesAvg(true);
+                JsonObject crash = stats["crash"].to<JsonObject>();
+                crash["capacity_bytes"] = (uint32_t)Logger::CRASH_LOG_BYTES;
+                crash["used_bytes"] = Log.getCrashBytesUsed();
+                crash["recovered_lines"] = Log.getCrashLinesRecovered();
+                crash["reset_reason"] = Logger::getResetReasonName(esp_reset_reason());
+                JsonObject ws = stats["websocket"].to<JsonObject>();
+                ws["frames"] = Log.getWsFrames();
+                ws["bytes"] = Log.getWsBytes();
+                ws["skipped_lines"] = Log.getWsSkipped();
+                JsonObject syslog = stats["syslog"].to<JsonObject>();
+                syslog["enabled"] = Log.isSyslogEnabled();
+                syslog["resolved"] = Log.isSyslogResolved();
+                syslog["datagrams"] = Log.getSyslogDatagrams();
+                syslog["bytes"] = Log.getSyslogBytes();
+                syslog["lines"] = Log.getSyslogLines();
+                syslog["rate_dropped"] = Log.getSyslogRateDropped();
+                syslog["send_errors"] = Log.getSyslogSendErrors();
+                syslog["sequence_id"] = Log.getSyslogSeq();
+                if (FlashLog* fl = Log.getFlashLog()) {
+                    JsonObject part = stats["flash_log"].to<JsonObject>();
+                    part["capacity_bytes"] = fl->getCapacity();
+                    part["sectors"] = fl->getSectors();
+                    part["head_sector"] = fl->getHeadSector();
+                    part["head_offset"] = fl->getHeadOffset();
+                    part["oldest_line"] = fl->getOldestLine();
+                    part["next_line"] = fl->getNextLine();
+                    part["records"] = fl->getRecords();
+                    part["bytes_written"] = fl->getBytesWritten();
+                    part["erases"] = fl->getErases();
+                    part["crc_errors"] = fl->getCrcErrors();
+                    part["write_errors"] = fl->getWriteErrors();
+                    part["recover_probes"] = fl->getRecoverProbes();
+                    part["recover_us"] = fl->getRecoverUs();
+                }
+            }
+            String members;
+            serializeJson(doc, members);
+            return members.substring(1, members.length() - 1);
+        }, flash);
+        AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+            [src, incremental](uint8_t* buf, size_t maxLen, size_t) -> size_t {
+                size_t n = src->fill((char*)buf, maxLen);
+                if (n == 0) Log.countPoll(src->total(), incremental);
+                return n;
+            });
+        request->send(response);
+    });
 
-        for (size_t i = start; i < count; i++) {
-            size_t idx = (head + max - count + i) % max;
-            entries.add(ringBuf[idx]);
+    // --- Log download: whole flash log partition, or the current log file ---
+    _server.on("/api/log_download", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        Log.flush();
+        if (FlashLog* fl = Log.getFlashLog()) {
+            auto reader = std::make_shared<FlashLog::Reader>(*fl);
+            AsyncWebServerResponse* response = request->beginChunkedResponse("text/plain",
+                [reader](uint8_t* buf, size_t maxLen, size_t) -> size_t {
+                    return reader->fill((char*)buf, maxLen);
+                });
+            response->addHeader("Content-Disposition", "attachment; filename=\"log.txt\"");
+            request->send(response);
+            return;
         }
-        doc["count"] = count;
+        if (!LittleFS.exists(Log.getLogFilename())) {
+            request->send(404, "application/json", "{\"error\":\"no log file\"}");
+            return;
+        }
+        AsyncWebServerResponse* response = request->beginResponse(LittleFS, Log.getLogFilename(), "text/plain", true);
+        request->send(response);
+    });
 
+    // --- Log levels: global + per-tag overrides ---
+    _server.on("/api/log_level", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        JsonDocument doc;
+        doc["level"] = (int)Log.getLevel();
+        doc["compile_level"] = LOG_COMPILE_LEVEL;
+        JsonObject tags = doc["tags"].to<JsonObject>();
+        for (uint8_t i = 0; i < Log.getTagCount(); i++) {
+            tags[Log.getTagName(i)] = Log.getTagLevelById(i);
+        }
+        // Lines held back by repeat suppression and per-tag rate limits
+        doc["repeat_window_ms"] = Log.getRepeatWindow();
+        JsonObject suppressed = doc["suppressed"].to<JsonObject>();
+        for (uint8_t i = 0; i < Log.getTagCount(); i++) {
+            if (!Log.getTagRepeatsById(i) && !Log.getTagRateLimitedById(i) && !Log.getTagRateById(i)) continue;
+            JsonObject t = suppressed[Log.getTagName(i)].to<JsonObject>();
+            t["repeats"] = Log.getTagRepeatsById(i);
+            t["rate_limited"] = Log.getTagRateLimitedById(i);
+            t["rate"] = Log.getTagRateById(i);
+            t["burst"] = Log.getTagBurstById(i);
+        }
         String response;
         serializeJson(doc, response);
         request->send(200, "application/json", response);
     });
 
+    _server.on("/api/log_level", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        if (request->hasParam("repeat_window")) {
+            Log.setRepeatWindow(request->getParam("repeat_window")->value().toInt());
+        }
+        if (request->hasParam("rate")) {
+            // Per-tag token bucket; rate=0 removes it
+            String tag = request->hasParam("tag") ? request->getParam("tag")->value() : String();
+            long rate = request->getParam("rate")->value().toInt();
+            long burst = request->hasParam("burst") ? request->getParam("burst")->value().toInt() : 0;
+            if (tag.length() == 0 || rate < 0 || rate > 65535 || burst < 0 || burst > 65535) {
+                request->send(400, "application/json", "{\"error\":\"invalid tag or rate\"}");
+                return;
+            }
+            if (!Log.setTagRate(tag.c_str(), rate, burst)) {
+                request->send(400, "application/json", "{\"error\":\"tag table full\"}");
+                return;
+            }
+            Log.info("HTTP", "Rate limit for %s set to %ld/s", tag.c_str(), rate);
+        }
+        if (!request->hasParam("level")) {
+            if (request->hasParam("rate") || request->hasParam("repeat_window")) {
+                request->send(200, "application/json", "{\"ok\":true}");
+            } else {
+                request->send(400, "application/json", "{\"error\":\"missing level\"}");
+            }
+            return;
+        }
+        int level = request->getParam("level")->value().toInt();
+        if (request->hasParam("tag")) {
+            // Per-tag override; -1 returns the tag to the global level
+            String tag = request->getParam("tag")->value();
+            if (level < Logger::TAG_LEVEL_GLOBAL || level > Logger::LOG_DEBUG || tag.length() == 0) {
+                request->send(400, "application/json", "{\"error\":\"invalid tag or level\"}");
+                return;
+            }
+            if (!Log.setTagLevel(tag.c_str(), level)) {
+                request->send(400, "application/json", "{\"error\":\"tag table full\"}");
+                return;
+            }
+            Log.info("HTTP", "Log level for %s changed to %d", tag.c_str(), level);
+        } else {
+            if (level < Logger::LOG_ERROR || level > Logger::LOG_DEBUG) {
+                request->send(400, "application/json", "{\"error\":\"level must be 0-3\"}");
+                return;
+            }
+            Log.setLevel((Logger::Level)level);
+            Log.info("HTTP", "Log level changed to %d", level);
+        }
+        request->send(200, "application/json", "{\"ok\":true}");
+    });
+
+    // --- Log archives: list, or ?index=N serves one .gz ---
+    _server.on("/api/log_archive", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        uint32_t index = 0;
+        if (request->hasParam("index")) {
+            index = request->getParam("index")->value().toInt();
+        }
+        if (index == 0) {
+            JsonDocument doc;
+            doc["budget_bytes"] = Log.getArchiveBudget();
+            doc["compressed"] = Log.getArchivedFiles();
+            doc["failures"] = Log.getArchiveFailures();
+            doc["ratio"] = Log.getArchiveRatio();
+            doc["ms_avg"] = Log.getArchiveMsAvg();
+            doc["ms_last"] = Log.getArchiveMsLast();
+            JsonArray files = doc["files"].to<JsonArray>();
+            Log.listArchives([&files](uint32_t idx, size_t bytes, bool compressed) {
+                JsonObject f = files.add<JsonObject>();
+                f["index"] = idx;
+                f["bytes"] = bytes;
+                f["gz"] = compressed;
+            });
+            String response;
+            serializeJson(doc, response);
+            request->send(200, "application/json", response);
+            return;
+        }
+        String path = Log.getArchiveFilename(index, true);
+        if (!LittleFS.exists(path)) {
+            request->send(404, "application/json", "{\"error\":\"archive not found\"}");
+            return;
+        }
+        AsyncWebServerResponse* response = request->beginResponse(LittleFS, path, "text/plain");
+        response->addHeader("Content-Encoding", "gzip");
+        request->send(response);
+    });
+
     // --- Pins API ---
     _server.on("/api/pins", HTTP_GET, [this](AsyncWebServerRequest *request) {
         if (!checkAuth(request)) return;
@@ -561,9 +1203,7 @@ void WebHandler::setupRoutes() {
 
         doc["PIN_POWER_SELECTION"] = esp_efuse_read_field_bit(ESP_EFUSE_PIN_POWER_SELECTION);
 
-        String response;
-        serializeJson(doc, response);
-        request->send(200, "application/json", response);
+        sendJson(request, doc);
     });
 
     // --- Config save ---
@@ -574,90 +1214,18 @@ void WebHandler::setupRoutes() {
         JsonDocument doc;
         if (deserializeJson(doc, data, len)) { request->send(400); return; }
 
-        ProjectInfo* p = _config->getProjectInfo();
-        if (!p) { request->send(500); return; }
-
         bool needsReboot = false;
-
-        // WiFi
-        if (doc.containsKey("wifi_ssid")) {
-            String newSSID = doc["wifi_ssid"].as<String>();
-            if (newSSID != _config->getWifiSSID()) needsReboot = true;
-            _config->setWifiSSID(newSSID);
-        }
-        if (doc.containsKey("wifi_password") && doc["wifi_password"].as<String>().length() > 0) {
-            _config->setWifiPassword(doc["wifi_password"].as<String>());
-            needsReboot = true;
-        }
-
-        // MQTT
-        if (doc.containsKey("mqtt_host")) {
-            IPAddress ip;
-            ip.fromString(doc["mqtt_host"].as<String>());
-            _config->setMqttHost(ip);
-            needsReboot = true;
-        }
-        if (doc.containsKey("mqtt_port")) { _config->setMqttPort(doc["mqtt_port"]); needsReboot = true; }
-        if (doc.containsKey("mqtt_user")) { _config->setMqttUser(doc["mqtt_user"].as<String>()); needsReboot = true; }
-        if (doc.containsKey("mqtt_password") && doc["mqtt_password"].as<String>().length() > 0) {
-            _config->setMqttPassword(doc["mqtt_password"].as<String>());
-            needsReboot = true;
-        }
-        if (doc.containsKey("mqtt_temp_topic")) { p->mqttTempTopic = doc["mqtt_temp_topic"].as<String>(); needsReboot = true; }
-
-        // Thermostat timing
-        if (doc.containsKey("min_on_ms")) { p->minOnTimeMs = doc["min_on_ms"]; _thermostat->config().minOnTimeMs = p->minOnTimeMs; }
-        if (doc.containsKey("min_off_ms")) { p->minOffTimeMs = doc["min_off_ms"]; _thermostat->config().minOffTimeMs = p->minOffTimeMs; }
-        if (doc.containsKey("max_run_ms")) { p->maxRunTimeMs = doc["max_run_ms"]; _thermostat->config().maxRunTimeMs = p->maxRunTimeMs; }
-        if (doc.containsKey("escalation_ms")) { p->escalationDelayMs = doc["escalation_ms"]; _thermostat->config().escalationDelayMs = p->escalationDelayMs; }
-
-        // Deadbands
-        if (doc.containsKey("heat_deadband")) { p->heatDeadband = doc["heat_deadband"]; _thermostat->config().heatDeadband = p->heatDeadband; }
-        if (doc.containsKey("cool_deadband")) { p->coolDeadband = doc["cool_deadband"]; _thermostat->config().coolDeadband = p->coolDeadband; }
-        if (doc.containsKey("heat_overrun")) { p->heatOverrun = doc["heat_overrun"]; _thermostat->config().heatOverrun = p->heatOverrun; }
-        if (doc.containsKey("cool_overrun")) { p->coolOverrun = doc["cool_overrun"]; _thermostat->config().coolOverrun = p->coolOverrun; }
-
-        // Fan idle
-        if (doc.containsKey("fan_idle_enabled")) { p->fanIdleEnabled = doc["fan_idle_enabled"]; _thermostat->config().fanIdleEnabled = p->fanIdleEnabled; }
-        if (doc.containsKey("fan_idle_wait")) { p->fanIdleWaitMin = doc["fan_idle_wait"]; _thermostat->config().fanIdleWaitMin = p->fanIdleWaitMin; }
-        if (doc.containsKey("fan_idle_run")) { p->fanIdleRunMin = doc["fan_idle_run"]; _thermostat->config().fanIdleRunMin = p->fanIdleRunMin; }
-
-        // UI
-        if (doc.containsKey("theme")) p->theme = doc["theme"].as<String>();
-        if (doc.containsKey("poll_interval")) {
-            p->pollIntervalSec = doc["poll_interval"];
-            if (p->pollIntervalSec < 1) p->pollIntervalSec = 1;
-            if (p->pollIntervalSec > 10) p->pollIntervalSec = 10;
-        }
-
-        // System
-        if (doc.containsKey("system_name")) { p->systemName = doc["system_name"].as<String>(); }
-        if (doc.containsKey("mqtt_prefix")) { p->mqttPrefix = doc["mqtt_prefix"].as<String>(); needsReboot = true; }
-        if (doc.containsKey("timezone")) { p->timezone = doc["timezone"].as<String>(); setTimezone(p->timezone); syncNtpTime(); }
-        if (doc.containsKey("ap_fallback_sec")) { p->apFallbackSeconds = doc["ap_fallback_sec"]; }
-        if (doc.containsKey("ap_password") && doc["ap_password"].as<String>().length() >= 8) {
-            p->apPassword = doc["ap_password"].as<String>();
-        }
-        if (doc.containsKey("session_timeout")) { p->sessionTimeoutMinutes = doc["session_timeout"]; _sessionMgr.setTimeoutMinutes(p->sessionTimeoutMinutes); }
-
-        // Admin password
-        if (doc.containsKey("admin_password") && doc["admin_password"].as<String>().length() >= 4) {
-            _config->setAdminPassword(doc["admin_password"].as<String>());
-        }
-
-        // FTP password (live — takes effect on next FTP enable)
-        if (doc["ftpPassword"].is<const char*>()) {
-            p->ftpPassword = doc["ftpPassword"] | String("");
-        }
-
-        _config->updateConfig("/config.txt", *p);
-
+        String error;
         JsonDocument resp;
-        resp["ok"] = true;
-        resp["needsReboot"] = needsReboot;
+        if (applyConfig(doc, false, needsReboot, error)) {
+            resp["ok"] = true;
+            resp["needsReboot"] = needsReboot;
+        } else {
+            resp["error"] = error;
+        }
         String response;
         serializeJson(resp, response);
-        request->send(200, "application/json", response);
+        request->send(error.length() ? 400 : 200, "application/json", response);
     });
 
     // --- Config load ---
@@ -673,6 +1241,11 @@ void WebHandler::setupRoutes() {
         doc["mqtt_port"] = _config->getMqttPort();
         doc["mqtt_user"] = _config->getMqttUser();
         doc["mqtt_temp_topic"] = p->mqttTempTopic;
+        doc["mqtt_replay_rate"] = p->mqttReplayRate;
+        doc["mqtt_inflight_window"] = p->mqttInflightWindow;
+        doc["mqtt_event_qos"] = p->mqttEventQos;
+        doc["mqtt_telemetry_ms"] = p->mqttTelemetryMs;
+        doc["mqtt_config_enabled"] = p->mqttConfigEnabled;
         doc["system_name"] = p->systemName;
         doc["mqtt_prefix"] = p->mqttPrefix;
         doc["timezone"] = p->timezone;
@@ -702,12 +1275,21 @@ void WebHandler::setupRoutes() {
 
         // Log settings
         doc["max_log_size"] = p->maxLogSize;
-        doc["max_old_log_count"] = p->maxOldLogCount;
-
-        String response;
-        serializeJson(doc, response);
-        Serial.printf("config/load: %u bytes, ssid='%s'\n", response.length(), _config->getWifiSSID().c_str());
-        request->send(200, "application/json", response);
+        doc["log_archive_bytes"] = p->logArchiveBytes;
+        doc["log_history_bytes"] = p->logHistoryBytes;
+        doc["syslog_host"] = p->syslogHost;
+        doc["syslog_port"] = p->syslogPort;
+        doc["syslog_rate"] = p->syslogRate;
+
+        // Pressure capture
+        doc["capture_enabled"] = p->captureEnabled;
+        doc["capture_pre_ms"] = p->capturePreMs;
+        doc["capture_post_ms"] = p->capturePostMs;
+        doc["capture_slots"] = p->captureSlots;
+        doc["capture_triggers"] = p->captureTriggers;
+
+        Serial.printf("config/load: %u bytes, ssid='%s'\n", measureJson(doc), _config->getWifiSSID().c_str());
+        sendJson(request, doc);
     });
 
     // --- Reboot ---
@@ -892,3 +1474,157 @@ void WebHandler::setupRoutes() {
         }
     });
 }
+
+void WebHandler::setupCaptureRoutes() {
+    // --- Pressure capture list + cost ---
+    _server.on("/api/captures", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        JsonDocument doc;
+        doc["enabled"] = _capture && _capture->isSampling();
+        if (_capture && _capture->isSampling()) {
+            doc["pre_ms"] = _capture->getPreMs();
+            doc["post_ms"] = _capture->getPostMs();
+            doc["slots"] = _capture->getSlotCount();
+            doc["slot_samples"] = _capture->getSlotCapacity();
+            doc["memory_bytes"] = _capture->getMemoryBytes();
+            doc["cpu_us_per_sec"] = _capture->getCpuUsPerSec();
+            doc["sample_rate_hz"] = _capture->getSampleRateHz();
+            doc["missed_triggers"] = _capture->getMissedTriggers();
+            doc["truncated"] = _capture->getTruncatedCaptures();
+
+            JsonArray list = doc["captures"].to<JsonArray>();
+            for (uint8_t i = 0; i < _capture->getSlotCount(); i++) {
+                const PressureCapture::Capture* c = _capture->getSlot(i);
+                if (!c) continue;
+                JsonObject o = list.add<JsonObject>();
+                o["id"] = c->id;
+                o["source"] = c->source;
+                o["on"] = c->sourceOn;
+                o["trigger_ms"] = c->triggerMs;
+                o["epoch"] = c->triggerEpoch;
+                o["pre"] = c->preCount;
+                o["count"] = c->count;
+                o["extra_triggers"] = c->extraTriggers;
+                o["complete"] = c->complete;
+            }
+        }
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+
+    // --- Capture download: ?id=N&format=csv|bin ---
+    _server.on("/api/capture/data", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        if (!_capture || !request->hasParam("id")) {
+            request->send(400, "application/json", "{\"error\":\"missing id\"}");
+            return;
+        }
+        uint32_t id = request->getParam("id")->value().toInt();
+        const PressureCapture::Capture* slot = _capture->findCapture(id);
+        // Served from a copy: a trigger may recycle the slot while the
+        // response is still going out, after its length has been sent
+        uint16_t room = slot ? slot->count : 0;
+        std::shared_ptr<PressureCapture::Sample> samples(
+            (PressureCapture::Sample*)ps_malloc((size_t)(room ? room : 1) * sizeof(PressureCapture::Sample)), free);
+        if (!samples) {
+            request->send(503, "application/json", "{\"error\":\"out of memory\"}");
+            return;
+        }
+        PressureCapture::Capture cap;
+        if (!slot || !_capture->copyCapture(id, cap, samples.get(), room)) {
+            request->send(404, "application/json", "{\"error\":\"capture not found\"}");
+            return;
+        }
+        HX710* s1 = _capture->getSensor1();
+        HX710* s2 = _capture->getSensor2();
+        uint16_t count = cap.count;
+        bool binary = request->hasParam("format") && request->getParam("format")->value() == "bin";
+
+        if (binary) {
+            PressureCapture::BinaryHeader hdr = {};
+            memcpy(hdr.magic, "HXC1", 4);
+            hdr.version = 1;
+            hdr.sampleSize = sizeof(PressureCapture::Sample);
+            hdr.preCount = cap.preCount;
+            hdr.count = count;
+            hdr.sourceOn = cap.sourceOn;
+            hdr.extraTriggers = cap.extraTriggers;
+            hdr.id = cap.id;
+            hdr.triggerMs = cap.triggerMs;
+            hdr.triggerEpoch = cap.triggerEpoch;
+            memcpy(hdr.source, cap.source, sizeof(hdr.source));
+            hdr.slope1 = s1 ? s1->getSlope() : 1.0f;
+            hdr.offset1 = s1 ? s1->getOffset() : 0.0f;
+            hdr.slope2 = s2 ? s2->getSlope() : 1.0f;
+            hdr.offset2 = s2 ? s2->getOffset() : 0.0f;
+
+            size_t total = sizeof(hdr) + (size_t)count * sizeof(PressureCapture::Sample);
+            AsyncWebServerResponse* response = request->beginResponse("application/octet-stream", total,
+                [samples, hdr](uint8_t* buf, size_t maxLen, size_t index) -> size_t {
+                    size_t written = 0;
+                    if (index < sizeof(hdr)) {
+                        written = sizeof(hdr) - index;
+                        if (written > maxLen) written = maxLen;
+                        memcpy(buf, (const uint8_t*)&hdr + index, written);
+                        index += written;
+                    }
+                    size_t total = sizeof(hdr) + (size_t)hdr.count * sizeof(PressureCapture::Sample);
+                    size_t n = total - index;
+                    if (n > maxLen - written) n = maxLen - written;
+                    memcpy(buf + written, (const uint8_t*)samples.get() + (index - sizeof(hdr)), n);
+                    return written + n;
+                });
+            response->addHeader("Content-Disposition", "attachment; filename=capture-" + String(id) + ".bin");
+            request->send(response);
+            return;
+        }
+
+        // CSV: one row per sample, time relative to the trigger
+        struct CsvCursor {
+            uint16_t row;
+            bool headerSent;
+        };
+        CsvCursor cur = {0, false};
+        AsyncWebServerResponse* response = request->beginChunkedResponse("text/csv",
+            [cap, samples, s1, s2, cur](uint8_t* buf, size_t maxLen, size_t index) mutable -> size_t {
+                size_t written = 0;
+                char line[96];
+                if (!cur.headerSent) {
+                    int n = snprintf(line, sizeof(line),
+                        "# id=%lu source=%s on=%d pre=%u epoch=%lu\nt_ms,raw1,raw2,p1,p2\n",
+                        (unsigned long)cap.id, cap.source, cap.sourceOn, cap.preCount,
+                        (unsigned long)cap.triggerEpoch);
+                    if ((size_t)n > maxLen) return RESPONSE_TRY_AGAIN;
+                    memcpy(buf, line, n);
+                    written = n;
+                    cur.headerSent = true;
+                }
+                while (cur.row < cap.count) {
+                    const PressureCapture::Sample& s = samples.get()[cur.row];
+                    int n = snprintf(line, sizeof(line), "%ld,%ld,%ld,%.3f,%.3f\n",
+                        (long)(int32_t)(s.ms - cap.triggerMs), (long)s.raw1, (long)s.raw2,
+                        s1 ? s1->toCalibrated(s.raw1) : 0.0f,
+                        s2 ? s2->toCalibrated(s.raw2) : 0.0f);
+                    if (written + n > maxLen) break;
+                    memcpy(buf + written, line, n);
+                    written += n;
+                    cur.row++;
+                }
+                if (written == 0 && cur.row < cap.count) return RESPONSE_TRY_AGAIN;
+                return written;
+            });
+        request->send(response);
+    });
+
+    // --- Manual capture trigger ---
+    _server.on("/api/capture/trigger", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (!checkAuth(request)) return;
+        if (!_capture || !_capture->isSampling()) {
+            request->send(503, "application/json", "{\"error\":\"capture disabled\"}");
+            return;
+        }
+        _capture->trigger("manual", true);
+        request->send(200, "application/json", "{\"ok\":true}");
+    });
+}
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <atomic>
 #include <esp_freertos_hooks.h>
 #include <WiFi.h>
 #include <LittleFS.h>
@@ -13,6 +14,9 @@
 #include "MQTTHandler.h"
 #include "OtaUtils.h"
 #include "CANBus.h"
+#include "PressureCapture.h"
+#include "FlashLog.h"
+#include "ReconnectPolicy.h"
 #include <SimpleFTPServer.h>
 #include <DNSServer.h>
 
@@ -73,8 +77,12 @@ static bool idleHookCore1() {
 uint8_t getCpuLoadCore0() { return _cpuLoadCore0; }
 uint8_t getCpuLoadCore1() { return _cpuLoadCore1; }
 
-// WiFi AP fallback
+// WiFi STA reconnect and AP fallback. The core's auto-reconnect is off;
+// attempts are spaced by the backoff, and AP mode starts once an outage
+// has lasted apFallbackSeconds.
 static uint32_t _wifiDisconnectCount = 0;
+ReconnectPolicy wifiBackoff(4000, 5UL * 60 * 1000, 2.0f, 60UL * 1000, 3000);
+static unsigned long _apStoppedAt = 0;     // the fallback timer restarts here
 bool _apModeActive = false;
 String _apPassword;
 DNSServer _dnsServer;
@@ -126,7 +134,7 @@ ProjectInfo proj = {
   "",                    // encrypt
   false,                 // encrypted
   512 * 1024,            // maxLogSize: 512KB (LittleFS)
-  3,                     // maxOldLogCount
+  256 * 1024,            // logArchiveBytes: 256KB of .gz logs
   "CST6CDT,M3.2.0,M11.1.0",  // timezone
   68.0f,                 // heatSetpoint
   76.0f,                 // coolSetpoint
@@ -158,7 +166,21 @@ ProjectInfo proj = {
   "thermostat",          // mqttPrefix
   "homeassistant/sensor/average_home_temperature/state", // mqttTempTopic
   0,                     // sessionTimeoutMinutes
-  false                  // forceSafeMode
+  false,                 // forceSafeMode
+  true,                  // captureEnabled
+  2000,                  // capturePreMs
+  10000,                 // capturePostMs
+  8,                     // captureSlots
+  "fan1,w1,comp1",       // captureTriggers
+  256 * 1024,            // logHistoryBytes: 256KB PSRAM
+  "",                    // syslogHost (off)
+  514,                   // syslogPort
+  50,                    // syslogRate: lines/s
+  20,                    // mqttReplayRate: messages/s
+  8,                     // mqttInflightWindow
+  1,                     // mqttEventQos
+  0,                     // mqttTelemetryMs: off
+  false                  // mqttConfigEnabled
 };
 
 // Thermostat, WebHandler, MQTTHandler, CANBus
@@ -167,10 +189,25 @@ WebHandler webHandler(80, &ts, &thermostat);
 MQTTHandler mqttHandler(&ts);
 CANBus canBus(&ts, PIN_CAN_TX, PIN_CAN_RX);
 
+// Display commands decoded on the CAN RX task. The thermostat is only
+// changed from the loop: the handlers leave the latest command here and
+// applyCanCommands() picks it up; a newer one replaces one not yet applied.
+static std::atomic<uint32_t> _canSetpoints(0);      // heat x10 << 16 | cool x10
+static std::atomic<bool> _canSetpointsPending(false);
+static std::atomic<int> _canMode(-1);               // -1 = none pending
+
 // HX710 pressure sensors
 HX710 hx710_1(PIN_HX710_1_DOUT, PIN_HX710_1_CLK);
 HX710 hx710_2(PIN_HX710_2_DOUT, PIN_HX710_2_CLK);
 
+// High-rate pressure capture armed by relay transitions
+PressureCapture pressureCapture(&ts);
+static OutPin* _captureTriggers[OUT_COUNT] = {};
+
+// Log backend in the "logs" partition (partitions_logflash.csv); without it
+// the log goes to /log.txt on LittleFS
+FlashLog flashLog;
+
 // Output pins (no activation delay — thermostat min-time handles cycling)
 void onInput(InputPin *pin);
 bool onOutpin(OutPin *pin, bool on, bool inCallback, float &newPercent, float origPercent);
@@ -198,6 +235,15 @@ void onInput(InputPin *pin) {
 
 bool onOutpin(OutPin *pin, bool on, bool inCallback, float &newPercent, float origPercent) {
   Log.info("OutPin", "%s: state=%d newPercent=%.0f", pin->getName().c_str(), on, newPercent);
+  // Only real edges arm a capture — allRelaysOff() re-sends OFF to idle pins
+  if ((newPercent > 0.0f) != (origPercent > 0.0f)) {
+    for (int i = 0; i < OUT_COUNT && _captureTriggers[i]; i++) {
+      if (_captureTriggers[i] == pin) {
+        pressureCapture.trigger(pin->getName().c_str(), on);
+        break;
+      }
+    }
+  }
   return true;
 }
 
@@ -243,8 +289,20 @@ Task tWaitOnWiFi(TASK_SECOND, 60, [](){
 
 // --- AP Fallback ---
 
-void onAPReconnect();
-Task tAPReconnect(TASK_MINUTE, TASK_FOREVER, &onAPReconnect, &ts, false);
+void onWiFiReconnect();
+Task tWiFiReconnect(TASK_SECOND, TASK_FOREVER, &onWiFiReconnect, &ts, false);
+
+void scheduleWiFiReconnect() {
+  if (tWiFiReconnect.isEnabled()) return;
+  tWiFiReconnect.setInterval(wifiBackoff.nextDelay() * TASK_MILLISECOND);
+  tWiFiReconnect.enableDelayed();
+}
+
+bool wifiFallbackDue() {
+  unsigned long now = millis();
+  unsigned long limit = proj.apFallbackSeconds * 1000UL;
+  return wifiBackoff.outageMs(now) >= limit && now - _apStoppedAt >= limit;
+}
 
 void startAPMode() {
   String apSSID = proj.systemName.length() > 0 ? proj.systemName : "AThermostat";
@@ -262,11 +320,7 @@ void startAPMode() {
   }
   Log.warn("WiFi", "AP MODE ACTIVE - SSID: %s Pass: %s IP: %s",
            apSSID.c_str(), _apPassword.c_str(), WiFi.softAPIP().toString().c_str());
-
-  if (!tAPReconnect.isEnabled()) {
-    tAPReconnect.setInterval(30 * (unsigned long)TASK_SECOND);
-    tAPReconnect.enableDelayed();
-  }
+  tWiFiReconnect.disable();
 }
 
 String startAPModeTest() {
@@ -288,20 +342,26 @@ void stopAPMode() {
   WiFi.softAPdisconnect(true);
   WiFi.mode(WIFI_STA);
   _apModeActive = false;
-  tAPReconnect.disable();
+  _apStoppedAt = millis();
   Log.info("WiFi", "AP mode stopped");
+  if (!WiFi.isConnected()) {
+    scheduleWiFiReconnect();
+  }
 }
 
-void onAPReconnect() {
-  if (WiFi.isConnected()) {
-    _wifiDisconnectCount = 0;
+void onWiFiReconnect() {
+  if (WiFi.isConnected() || _apModeActive || _WIFI_SSID.length() == 0) {
+    tWiFiReconnect.disable();
     return;
   }
-  if (_apModeActive) return;
-  if (_WIFI_SSID.length() > 0) {
-    Log.info("WiFi", "AP mode STA reconnect attempt to '%s'", _WIFI_SSID.c_str());
-    WiFi.begin(_WIFI_SSID.c_str(), _WIFI_PASSWORD.c_str());
+  if (wifiFallbackDue()) {
+    startAPMode();
+    return;
   }
+  wifiBackoff.attempted();
+  Log.info("WiFi", "Reconnect attempt %u to '%s'", wifiBackoff.getOutageAttempts(), _WIFI_SSID.c_str());
+  WiFi.begin(_WIFI_SSID.c_str(), _WIFI_PASSWORD.c_str());
+  tWiFiReconnect.setInterval(wifiBackoff.nextDelay() * TASK_MILLISECOND);
 }
 
 // --- Tasks ---
@@ -317,9 +377,10 @@ Task tSaveState(5 * TASK_MINUTE, TASK_FOREVER, &onSaveThermostatState, &ts, fals
 void onReadPressure();
 Task tReadPressure(5 * TASK_SECOND, TASK_FOREVER, &onReadPressure, &ts, false);
 
-// Publish MQTT state every 30 seconds
+// Full MQTT state snapshot every 5 minutes; changes are published by
+// MQTTHandler as they happen
 void onPublishMqttState();
-Task tMqttPublish(30 * TASK_SECOND, TASK_FOREVER, &onPublishMqttState, &ts, false);
+Task tMqttPublish(MQTTHandler::HEARTBEAT_S * TASK_SECOND, TASK_FOREVER, &onPublishMqttState, &ts, false);
 
 // CPU load calculation every 1 second
 void onCalcCpuLoad();
@@ -371,9 +432,12 @@ void onSaveThermostatState() {
 }
 
 void onReadPressure() {
-  hx710_1.readCalibrated();
-  hx710_2.readCalibrated();
-  
+  // The capture sampler already reads every conversion while it runs
+  if (!pressureCapture.isSampling()) {
+    hx710_1.readCalibrated();
+    hx710_2.readCalibrated();
+  }
+
   outFan1.checkOverride();
   outRev.checkOverride();
   outFurnCoolLow.checkOverride();
@@ -420,6 +484,8 @@ void onWiFiEvent(WiFiEvent_t event) {
     case ARDUINO_EVENT_WIFI_STA_GOT_IP:
       Log.info("WiFi", "Connected: %s", WiFi.localIP().toString().c_str());
       _wifiDisconnectCount = 0;
+      wifiBackoff.up(millis());
+      tWiFiReconnect.disable();
       mqttHandler.startReconnect();
       if (_apModeActive) {
         stopAPMode();
@@ -434,9 +500,14 @@ void onWiFiEvent(WiFiEvent_t event) {
       if (_wifiDisconnectCount <= 3 || _wifiDisconnectCount % 10 == 0) {
         Log.warn("WiFi", "Disconnected (count=%u)", _wifiDisconnectCount);
       }
+      wifiBackoff.lost(millis());
       mqttHandler.stopReconnect();
-      if (!_apModeActive && _wifiDisconnectCount >= (proj.apFallbackSeconds / 10)) {
-        startAPMode();
+      if (!_apModeActive) {
+        if (wifiFallbackDue()) {
+          startAPMode();
+        } else {
+          scheduleWiFiReconnect();
+        }
       }
       break;
     default:
@@ -507,7 +578,22 @@ void setup() {
   _WIFI_PASSWORD = config.getWifiPassword();
 
   // Set logger options
-  Log.setLogFile("/log.txt", proj.maxLogSize, proj.maxOldLogCount);
+  Log.setLogFile("/log.txt", proj.maxLogSize, proj.logArchiveBytes);
+  if (flashLog.begin("logs")) {
+    Log.setFlashLog(&flashLog);
+  }
+  Log.setHistorySize(proj.logHistoryBytes);
+  // State changes and updates are the context a crash tail needs
+  Log.setCrashTag("Thermo", true);
+  Log.setCrashTag("OTA", true);
+  Log.setCrashTag("MAIN", true);
+  Log.recoverCrashLog(resetReason);
+  Log.begin();
+  if (Log.getFlashLog()) {
+    Log.info("MAIN", "Flash log: %u KB, next line %lu, head sector %lu found in %lu us (%lu probes)",
+             flashLog.getCapacity() / 1024, flashLog.getNextLine(), flashLog.getHeadSector(),
+             flashLog.getRecoverUs(), flashLog.getRecoverProbes());
+  }
 
   // Init output pins
   outFan1.initPin();
@@ -544,6 +630,20 @@ void setup() {
   thermostat.setOutputPins(outputs);
   thermostat.setInputPins(inputs);
 
+  // Pressure capture — resolve trigger pin names once
+  if (proj.captureEnabled) {
+    int n = 0;
+    String triggers = "," + proj.captureTriggers + ",";
+    triggers.replace(" ", "");
+    for (int i = 0; i < OUT_COUNT; i++) {
+      if (triggers.indexOf("," + outputs[i]->getName() + ",") >= 0) {
+        _captureTriggers[n++] = outputs[i];
+      }
+    }
+    pressureCapture.begin(&hx710_1, &hx710_2, proj.capturePreMs,
+                          proj.capturePostMs, proj.captureSlots);
+  }
+
   // Apply config to thermostat
   thermostat.config().heatDeadband = proj.heatDeadband;
   thermostat.config().coolDeadband = proj.coolDeadband;
@@ -573,6 +673,7 @@ void setup() {
   // WiFi
   WiFi.onEvent(onWiFiEvent);
   WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
   if (_WIFI_SSID.length() > 0) {
     WiFi.begin(_WIFI_SSID.c_str(), _WIFI_PASSWORD.c_str());
     Serial.printf("Connecting to WiFi: %s\n", _WIFI_SSID.c_str());
@@ -588,6 +689,10 @@ void setup() {
   webHandler.setRebootRateLimited(&_rebootRateLimited);
   webHandler.setSafeMode(&_safeMode, &_crashBootCount);
   webHandler.setPressureSensors(&hx710_1, &hx710_2);
+  webHandler.setPressureCapture(&pressureCapture);
+  webHandler.setMqttHandler(&mqttHandler);
+  webHandler.setWifiBackoff(&wifiBackoff);
+  webHandler.setCanBus(&canBus);
   webHandler.setAPCallbacks(startAPModeTest, stopAPMode);
 
   // FTP control callbacks — LittleFS is already initialized
@@ -635,13 +740,50 @@ void setup() {
   // MQTT
   mqttHandler.setThermostat(&thermostat);
   mqttHandler.setPressureSensors(&hx710_1, &hx710_2);
+  mqttHandler.setPressureCapture(&pressureCapture);
   mqttHandler.setTopicPrefix(proj.mqttPrefix);
   mqttHandler.setTempTopic(proj.mqttTempTopic);
+  mqttHandler.setDeviceName(proj.systemName);
   mqttHandler.begin(config.getMqttHost(), config.getMqttPort(),
                     config.getMqttUser(), config.getMqttPassword());
   Log.setMqttClient(mqttHandler.getClient(), (proj.mqttPrefix + "/log").c_str());
-
-  // CAN bus
+  Log.setMqttQueue(mqttHandler.getQueue());
+  mqttHandler.setReplayRate(proj.mqttReplayRate);
+  mqttHandler.setInflightWindow(proj.mqttInflightWindow);
+  mqttHandler.setEventQos(proj.mqttEventQos);
+  mqttHandler.setTelemetryInterval(proj.mqttTelemetryMs);
+  mqttHandler.setConfigEnabled(proj.mqttConfigEnabled);
+  mqttHandler.onConfig([](JsonDocument& doc, bool& needsReboot, String& error) {
+    return webHandler.applyConfig(doc, true, needsReboot, error);
+  });
+  // Socket and lookup happen on the log sink task once lines arrive
+  Log.setSyslog(proj.syslogHost.c_str(), proj.syslogPort, proj.syslogRate, proj.systemName.c_str());
+
+  // CAN bus. Handlers run on the CAN RX task as frames arrive, so they only
+  // decode and hand commands to the loop; the hardware acceptance filter
+  // is built from them in begin().
+  canBus.onReceive(CAN_ID_DISPLAY_SETPOINT, [](uint32_t id, const uint8_t* data, uint8_t len) {
+      // [0-1] heat SP x10, [2-3] cool SP x10
+      if (len >= 4) {
+          _canSetpoints = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                          ((uint32_t)data[2] << 8) | data[3];
+          _canSetpointsPending = true;
+      }
+  });
+  canBus.onReceive(CAN_ID_DISPLAY_MODE, [](uint32_t id, const uint8_t* data, uint8_t len) {
+      // [0] mode
+      if (len >= 1) _canMode = data[0];
+  });
+  canBus.onReceive(CAN_ID_HP_STATE, [](uint32_t id, const uint8_t* data, uint8_t len) {
+      Log.debug("CAN", "HP state: %02X %02X %02X %02X",
+                len > 0 ? data[0] : 0, len > 1 ? data[1] : 0,
+                len > 2 ? data[2] : 0, len > 3 ? data[3] : 0);
+  });
+  canBus.onReceive(CAN_ID_HEARTBEAT, [](uint32_t id, const uint8_t* data, uint8_t len) {
+      if (len >= 1) {
+          Log.debug("CAN", "Heartbeat from node 0x%02X", data[0]);
+      }
+  });
   if (canBus.begin()) {
     // Publish thermostat state on CAN every 2 seconds
     static Task tCanPublish(2000, TASK_FOREVER, []() {
@@ -660,43 +802,6 @@ void setup() {
         int16_t p2 = (hx710_2.isValid()) ? (int16_t)(hx710_2.getLastValue() * 100) : -9999;
         canBus.sendSensors(temp, p1, p2);
     }, &ts, true);
-
-    // Handle incoming CAN messages
-    canBus.onReceive([](uint32_t id, const uint8_t* data, uint8_t len) {
-        switch (id) {
-            case CAN_ID_DISPLAY_SETPOINT: {
-                // [0-1] heat SP x10, [2-3] cool SP x10
-                if (len >= 4) {
-                    float heat = (int16_t)((data[0] << 8) | data[1]) / 10.0f;
-                    float cool = (int16_t)((data[2] << 8) | data[3]) / 10.0f;
-                    thermostat.setHeatSetpoint(heat);
-                    thermostat.setCoolSetpoint(cool);
-                    Log.info("CAN", "Display setpoint: heat=%.1f cool=%.1f", heat, cool);
-                }
-                break;
-            }
-            case CAN_ID_DISPLAY_MODE: {
-                // [0] mode
-                if (len >= 1) {
-                    thermostat.setMode(static_cast<ThermostatMode>(data[0]));
-                    Log.info("CAN", "Display mode: %d", data[0]);
-                }
-                break;
-            }
-            case CAN_ID_HP_STATE: {
-                Log.debug("CAN", "HP state: %02X %02X %02X %02X",
-                          len > 0 ? data[0] : 0, len > 1 ? data[1] : 0,
-                          len > 2 ? data[2] : 0, len > 3 ? data[3] : 0);
-                break;
-            }
-            case CAN_ID_HEARTBEAT: {
-                if (len >= 1) {
-                    Log.debug("CAN", "Heartbeat from node 0x%02X", data[0]);
-                }
-                break;
-            }
-        }
-    });
   } else {
     Log.warn("CAN", "CAN bus init failed — running without CAN");
   }
@@ -723,6 +828,23 @@ void setup() {
 // loop()
 // =============================================================================
 
+// Display commands left by the CAN RX task
+static void applyCanCommands() {
+  if (_canSetpointsPending.exchange(false)) {
+    uint32_t sp = _canSetpoints;
+    float heat = (int16_t)(sp >> 16) / 10.0f;
+    float cool = (int16_t)(sp & 0xFFFF) / 10.0f;
+    thermostat.setHeatSetpoint(heat);
+    thermostat.setCoolSetpoint(cool);
+    Log.info("CAN", "Display setpoint: heat=%.1f cool=%.1f", heat, cool);
+  }
+  int mode = _canMode.exchange(-1);
+  if (mode >= 0) {
+    thermostat.setMode(static_cast<ThermostatMode>(mode));
+    Log.info("CAN", "Display mode: %d", mode);
+  }
+}
+
 void loop() {
   // FTP auto-timeout
   if (ftpActive && ftpStopTime > 0 && millis() >= ftpStopTime) {
@@ -741,6 +863,9 @@ void loop() {
                            config.getKey(), config.getKeyLen());
   }
 
+  applyCanCommands();
+  mqttHandler.applyCommands();
+
   bool idle = ts.execute();
   if (idle) vTaskDelay(1);   // Yield to idle task when no scheduler work pending
 }
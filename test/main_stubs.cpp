@@ -0,0 +1,8 @@
+// Built into every host test: what main.cpp provides to the sources under
+// test on the device
+#include <Arduino.h>
+
+extern const char compile_date[] = "host test";
+
+uint8_t getCpuLoadCore0() { return 10; }
+uint8_t getCpuLoadCore1() { return 20; }
@@ -0,0 +1,171 @@
+#pragma once
+// Host stand-ins for the parts of the Arduino core and FreeRTOS the tested
+// sources use. Single threaded: locks and critical sections do nothing,
+// tasks are never started and GPIO reads back what was written.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <functional>
+#include <string>
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+inline uint32_t g_millis = 0;       // advanced by the tests
+inline uint32_t millis() { return g_millis; }
+inline uint32_t micros() { return g_millis * 1000; }
+inline void delay(uint32_t ms) { g_millis += ms; }
+inline void delayMicroseconds(uint32_t) {}
+
+inline void* ps_malloc(size_t size) { return malloc(size); }
+inline void* ps_calloc(size_t n, size_t size) { return calloc(n, size); }
+
+#if !defined(__APPLE__) && !(defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 38))
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+// GPIO
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define OUTPUT_OPEN_DRAIN 0x13
+#define LOW 0
+#define HIGH 1
+inline uint8_t g_pinLevel[64];
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) { g_pinLevel[pin & 63] = level; }
+// A test can drive a pin bit by bit (the HX710 data line)
+inline int (*g_digitalRead)(uint8_t pin) = nullptr;
+inline int digitalRead(uint8_t pin) { return g_digitalRead ? g_digitalRead(pin) : g_pinLevel[pin & 63]; }
+inline uint16_t analogRead(uint8_t) { return 0; }
+inline void analogWrite(uint8_t, int) {}
+inline void analogWriteFrequency(uint32_t) {}
+inline float temperatureRead() { return 40.0f; }
+
+// FreeRTOS
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef int portMUX_TYPE;
+#define pdPASS 1
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(ms) (ms)
+#define portMAX_DELAY 0xFFFFFFFF
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_SAFE(mux) (void)(mux)
+#define portEXIT_CRITICAL_SAFE(mux) (void)(mux)
+
+inline BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t* task) {
+    *task = nullptr;
+    return pdPASS;
+}
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t,
+                                          TaskHandle_t* task, BaseType_t) {
+    *task = nullptr;
+    return pdPASS;
+}
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline void vTaskDelay(TickType_t) {}
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+inline void vSemaphoreDelete(SemaphoreHandle_t) {}
+
+class String : public std::string {
+public:
+    String() {}
+    String(const char* s) : std::string(s ? s : "") {}
+    String(const std::string& s) : std::string(s) {}
+    explicit String(int v) : std::string(std::to_string(v)) {}
+    explicit String(unsigned v) : std::string(std::to_string(v)) {}
+    explicit String(long v) : std::string(std::to_string(v)) {}
+    explicit String(unsigned long v) : std::string(std::to_string(v)) {}
+    explicit String(float v, int decimals = 2) : String((double)v, decimals) {}
+    String(double v, int decimals) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        assign(buf);
+    }
+    int indexOf(char c) const { size_t p = find(c); return p == npos ? -1 : (int)p; }
+    int lastIndexOf(char c) const { size_t p = rfind(c); return p == npos ? -1 : (int)p; }
+    String substring(size_t from) const { return String(substr(from)); }
+    String substring(size_t from, size_t to) const { return String(substr(from, to - from)); }
+    long toInt() const { return atol(c_str()); }
+    float toFloat() const { return (float)atof(c_str()); }
+    bool startsWith(const char* p) const { return rfind(p, 0) == 0; }
+    bool endsWith(const char* p) const {
+        size_t n = strlen(p);
+        return size() >= n && compare(size() - n, n, p) == 0;
+    }
+    bool concat(const char* p, unsigned n) { append(p, n); return true; }
+    void trim() {
+        size_t b = find_first_not_of(" \t\r\n");
+        size_t e = find_last_not_of(" \t\r\n");
+        *this = b == npos ? String() : String(substr(b, e - b + 1));
+    }
+    String operator+(const String& o) const { return String(std::string(*this) + std::string(o)); }
+    String operator+(const char* o) const { return String(std::string(*this) + o); }
+    String operator+(char o) const { return String(std::string(*this) + o); }
+    String& operator+=(const String& o) { append(o); return *this; }
+    String& operator+=(const char* o) { append(o); return *this; }
+    String& operator+=(char o) { push_back(o); return *this; }
+};
+inline String operator+(const char* a, const String& b) { return String(std::string(a) + std::string(b)); }
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) {
+        for (size_t i = 0; i < len; i++) write(buf[i]);
+        return len;
+    }
+    size_t write(const char* s, size_t len) { return write((const uint8_t*)s, len); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+};
+
+struct HardwareSerial {
+    void print(const char* s) { fputs(s, stdout); }
+    void println(const char* s) { puts(s); }
+    void println(const String& s) { puts(s.c_str()); }
+    int printf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+};
+inline HardwareSerial Serial;
+
+struct EspClass {
+    void restart() {}
+    uint32_t getFreeHeap() { return 0; }
+    uint64_t getEfuseMac() { return 0x123456789ABCULL; }
+};
+inline EspClass ESP;
@@ -0,0 +1,90 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Connects at once when asked. Publishes are counted and the last one (to
+// the watched topic, if set) is kept in fixed buffers, so the stand-in
+// itself never allocates.
+enum class AsyncMqttClientDisconnectReason : int8_t {
+    TCP_DISCONNECTED = 0,
+    TLS_BAD_FINGERPRINT = 7
+};
+
+struct AsyncMqttClientMessageProperties {
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
+class AsyncMqttClient {
+public:
+    typedef std::function<void(bool)> OnConnect;
+    typedef std::function<void(AsyncMqttClientDisconnectReason)> OnDisconnect;
+    typedef std::function<void(uint16_t, uint8_t)> OnSubscribe;
+    typedef std::function<void(uint16_t)> OnUnsubscribe;
+    typedef std::function<void(char*, char*, AsyncMqttClientMessageProperties, size_t, size_t, size_t)> OnMessage;
+    typedef std::function<void(uint16_t)> OnPublish;
+
+    uint32_t published = 0;
+    const char* watch = nullptr;
+    char lastTopic[128] = "";
+    char lastPayload[2048] = "";
+    size_t lastLen = 0;
+
+    bool connected() const { return _connected; }
+    void connect() {
+        _connected = true;
+        if (_onConnect) _onConnect(false);
+    }
+    void disconnect(bool = false) {
+        _connected = false;
+        if (_onDisconnect) _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+
+    AsyncMqttClient& onConnect(OnConnect f) { _onConnect = f; return *this; }
+    AsyncMqttClient& onDisconnect(OnDisconnect f) { _onDisconnect = f; return *this; }
+    AsyncMqttClient& onSubscribe(OnSubscribe f) { _onSubscribe = f; return *this; }
+    AsyncMqttClient& onUnsubscribe(OnUnsubscribe f) { _onUnsubscribe = f; return *this; }
+    AsyncMqttClient& onMessage(OnMessage f) { _onMessage = f; return *this; }
+    AsyncMqttClient& onPublish(OnPublish f) { _onPublish = f; return *this; }
+    AsyncMqttClient& setServer(const IPAddress&, uint16_t) { return *this; }
+    AsyncMqttClient& setServer(const char*, uint16_t) { return *this; }
+    AsyncMqttClient& setCredentials(const char*, const char* = nullptr) { return *this; }
+    AsyncMqttClient& setWill(const char*, uint8_t, bool, const char* = nullptr, size_t = 0) { return *this; }
+    AsyncMqttClient& setClientId(const char*) { return *this; }
+    AsyncMqttClient& setKeepAlive(uint16_t) { return *this; }
+    AsyncMqttClient& setCleanSession(bool) { return *this; }
+
+    uint16_t subscribe(const char*, uint8_t) { return nextId(); }
+    uint16_t unsubscribe(const char*) { return nextId(); }
+    // QoS 1+ is acknowledged at once
+    uint16_t publish(const char* topic, uint8_t qos, bool, const char* payload = nullptr,
+                     size_t len = 0, bool = false, uint16_t = 0) {
+        if (!_connected) return 0;
+        if (payload && !len) len = strlen(payload);
+        if (!watch || strcmp(watch, topic) == 0) {
+            strlcpy(lastTopic, topic, sizeof(lastTopic));
+            lastLen = len < sizeof(lastPayload) - 1 ? len : sizeof(lastPayload) - 1;
+            if (payload) memcpy(lastPayload, payload, lastLen);
+            lastPayload[lastLen] = '\0';
+        }
+        published++;
+        uint16_t id = qos ? nextId() : 1;
+        if (qos && _onPublish) _onPublish(id);
+        return id;
+    }
+
+private:
+    uint16_t nextId() {
+        if (++_packetId == 0) _packetId = 1;
+        return _packetId;
+    }
+    bool _connected = false;
+    uint16_t _packetId = 0;
+    OnConnect _onConnect;
+    OnDisconnect _onDisconnect;
+    OnSubscribe _onSubscribe;
+    OnUnsubscribe _onUnsubscribe;
+    OnMessage _onMessage;
+    OnPublish _onPublish;
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <Arduino.h>
+
+// WebSocket log viewers: none connected on the host
+struct AsyncWebSocket {
+    size_t count() { return 0; }
+    bool hasClient(uint32_t) { return false; }
+    bool availableForWrite(uint32_t) { return false; }
+    bool text(uint32_t, const char*, size_t) { return false; }
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+
+// Files live under ROOT in the working directory; a missing ROOT makes
+// every open fail, as an unmounted filesystem would
+namespace fs {
+
+struct File {
+    FILE* f = nullptr;
+    operator bool() const { return f != nullptr; }
+    size_t size() {
+        long pos = ftell(f);
+        fseek(f, 0, SEEK_END);
+        long end = ftell(f);
+        fseek(f, pos, SEEK_SET);
+        return end;
+    }
+    size_t position() { return ftell(f); }
+    bool seek(size_t pos) { return fseek(f, pos, SEEK_SET) == 0; }
+    size_t read(uint8_t* buf, size_t len) { return fread(buf, 1, len, f); }
+    size_t write(const uint8_t* buf, size_t len) { return fwrite(buf, 1, len, f); }
+    void flush() { fflush(f); }
+    // No directory listing on the host
+    bool isDirectory() { return false; }
+    File openNextFile() { return File(); }
+    const char* name() { return ""; }
+    void close() {
+        if (f) fclose(f);
+        f = nullptr;
+    }
+};
+
+struct FS {
+    static constexpr const char* ROOT = "littlefs";
+    static std::string path(const char* p) { return std::string(ROOT) + p; }
+    File open(const char* p, const char* mode = FILE_READ, bool = false) {
+        File file;
+        file.f = fopen(path(p).c_str(), (std::string(mode) + "b").c_str());
+        return file;
+    }
+    bool exists(const char* p) {
+        FILE* f = fopen(path(p).c_str(), "rb");
+        if (f) fclose(f);
+        return f != nullptr;
+    }
+    bool remove(const char* p) { return ::remove(path(p).c_str()) == 0; }
+    bool rename(const char* from, const char* to) { return ::rename(path(from).c_str(), path(to).c_str()) == 0; }
+    size_t totalBytes() { return 0; }
+    size_t usedBytes() { return 0; }
+};
+
+}  // namespace fs
+
+using fs::File;
+inline fs::FS LittleFS;
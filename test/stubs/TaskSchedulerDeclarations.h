@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// Runs each enabled task once its interval has passed on millis(); a task
+// with a set number of iterations disables itself after the last one
+#define TASK_MILLISECOND 1UL
+#define TASK_SECOND 1000UL
+#define TASK_MINUTE 60000UL
+#define TASK_FOREVER (-1)
+#define TASK_ONCE 1
+#define TASK_IMMEDIATE 0
+
+class Task;
+
+class Scheduler {
+public:
+    std::vector<Task*> tasks;
+    bool execute();
+};
+
+class Task {
+public:
+    Task(unsigned long interval, long iterations, std::function<void()> cb, Scheduler* s, bool enabled)
+        : _cb(cb), _interval(interval), _iterations(iterations), _left(iterations), _enabled(enabled) {
+        if (s) s->tasks.push_back(this);
+    }
+    void enable() {
+        _enabled = true;
+        _last = millis();
+        _left = _iterations;
+    }
+    void enableDelayed(unsigned long = 0) { enable(); }
+    bool enableIfNot() {
+        if (_enabled) return false;
+        enable();
+        return true;
+    }
+    void disable() { _enabled = false; }
+    bool isEnabled() { return _enabled; }
+    void restart() { enable(); }
+    void restartDelayed(unsigned long = 0) { enable(); }
+    void forceNextIteration() { _last = millis() - _interval; }
+    void setInterval(unsigned long interval) { _interval = interval; }
+    unsigned long getInterval() { return _interval; }
+    long getRunCounter() { return 0; }
+
+private:
+    friend class Scheduler;
+    std::function<void()> _cb;
+    unsigned long _interval;
+    long _iterations;
+    long _left;
+    bool _enabled;
+    unsigned long _last = 0;
+};
+
+inline bool Scheduler::execute() {
+    for (Task* t : tasks) {
+        if (t->_enabled && millis() - t->_last >= t->_interval) {
+            t->_last = millis();
+            if (t->_left > 0 && --t->_left == 0) t->_enabled = false;
+            t->_cb();
+        }
+    }
+    return true;
+}
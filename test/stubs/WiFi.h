@@ -0,0 +1,25 @@
+#pragma once
+#include <Arduino.h>
+
+struct IPAddress {
+    uint8_t octets[4] = {0, 0, 0, 0};
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return buf;
+    }
+    bool fromString(const String& s) {
+        unsigned a, b, c, d;
+        char extra;
+        if (sscanf(s.c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4) return false;
+        octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d;
+        return true;
+    }
+    bool operator!=(const IPAddress& o) const { return memcmp(octets, o.octets, 4) != 0; }
+};
+
+struct WiFiClass {
+    bool isConnected() { return true; }
+    IPAddress localIP() { return IPAddress(); }
+};
+inline WiFiClass WiFi;
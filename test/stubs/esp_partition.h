@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// No partitions on the host: FlashLog runs on FileStorage
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef struct {
+    size_t size;
+} esp_partition_t;
+
+enum { ESP_PARTITION_TYPE_DATA = 1, ESP_PARTITION_SUBTYPE_ANY = 0xff };
+
+inline const esp_partition_t* esp_partition_find_first(int, int, const char*) { return nullptr; }
+inline esp_err_t esp_partition_read(const esp_partition_t*, size_t, void*, size_t) { return ESP_FAIL; }
+inline esp_err_t esp_partition_write(const esp_partition_t*, size_t, const void*, size_t) { return ESP_FAIL; }
+inline esp_err_t esp_partition_erase_range(const esp_partition_t*, size_t, size_t) { return ESP_FAIL; }
@@ -0,0 +1,19 @@
+#pragma once
+
+typedef void (*shutdown_handler_t)(void);
+inline int esp_register_shutdown_handler(shutdown_handler_t) { return 0; }
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO
+} esp_reset_reason_t;
+inline esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
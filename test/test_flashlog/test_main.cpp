@@ -0,0 +1,225 @@
+#include <unity.h>
+#include "FlashLog.h"
+
+// FlashLog on a flash image file: recovery at every head position, across
+// wraps, and after resets that tear a record or a sector switch.
+
+static const char* IMAGE = "flashlog_test.bin";
+static const size_t SECTORS = 8;
+static const size_t LINE_LEN = 100;
+
+// Power cut after budget written bytes: the write in progress programs only
+// its first bytes, later writes and erases fail
+class TornStorage : public FlashLog::Storage {
+public:
+    TornStorage(FlashLog::Storage* inner, size_t budget) : _inner(inner), _budget(budget) {}
+    ~TornStorage() override { delete _inner; }
+    size_t size() const override { return _inner->size(); }
+    bool read(size_t offset, void* dst, size_t len) override { return _inner->read(offset, dst, len); }
+    bool write(size_t offset, const void* src, size_t len) override {
+        size_t n = len < _budget ? len : _budget;
+        if (n > 0) _inner->write(offset, src, n);
+        _budget -= n;
+        return n == len;
+    }
+    bool erase(size_t offset, size_t len) override {
+        return _budget > 0 && _inner->erase(offset, len);
+    }
+private:
+    FlashLog::Storage* _inner;
+    size_t _budget;
+};
+
+static FlashLog::FileStorage* image() {
+    return new FlashLog::FileStorage(IMAGE, SECTORS * FlashLog::SECTOR_SIZE);
+}
+
+static void formatLine(char* out, uint32_t seq) {
+    int n = snprintf(out, LINE_LEN + 1, "line %u ", (unsigned)seq);
+    memset(out + n, 'a' + seq % 26, LINE_LEN - n);
+    out[LINE_LEN] = '\0';
+}
+
+static bool appendLine(FlashLog& log, uint32_t seq) {
+    char line[LINE_LEN + 1];
+    formatLine(line, seq);
+    return log.append(line, LINE_LEN, 1);
+}
+
+struct Lines {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    bool intact = true;         // consecutive seqs, each with its own text
+};
+
+static Lines readBack(FlashLog& log) {
+    Lines r;
+    log.readLines(0, [&r](uint32_t seq, const char* line, size_t len) {
+        char want[LINE_LEN + 1];
+        formatLine(want, seq);
+        if (r.count == 0) r.first = seq;
+        if (seq != r.first + r.count || len != LINE_LEN || strcmp(line, want) != 0) r.intact = false;
+        r.count++;
+        return true;
+    });
+    return r;
+}
+
+// Lines that fit in the first sector of a blank log
+static uint32_t linesPerSector() {
+    FlashLog log;
+    TEST_ASSERT_TRUE(log.begin(image()));
+    uint32_t n = 0;
+    while (log.getHeadSector() == 0) appendLine(log, n++);
+    remove(IMAGE);
+    return n - 1;
+}
+
+void setUp() {
+    remove(IMAGE);
+}
+
+void tearDown() {
+    remove(IMAGE);
+}
+
+void test_file_storage_is_flash_like() {
+    FlashLog::FileStorage s(IMAGE, 2 * FlashLog::SECTOR_SIZE);
+    TEST_ASSERT_TRUE(s.isOpen());
+    uint8_t b = 0;
+    TEST_ASSERT_TRUE(s.read(FlashLog::SECTOR_SIZE + 7, &b, 1));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, b);
+
+    uint8_t v = 0xF0;
+    TEST_ASSERT_TRUE(s.write(7, &v, 1));
+    v = 0x3C;
+    TEST_ASSERT_TRUE(s.write(7, &v, 1));
+    TEST_ASSERT_TRUE(s.read(7, &b, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x30, b);
+
+    TEST_ASSERT_FALSE(s.erase(1, FlashLog::SECTOR_SIZE));
+    TEST_ASSERT_FALSE(s.write(2 * FlashLog::SECTOR_SIZE - 1, &v, 2));
+    TEST_ASSERT_TRUE(s.erase(0, FlashLog::SECTOR_SIZE));
+    TEST_ASSERT_TRUE(s.read(7, &b, 1));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, b);
+}
+
+void test_blank_image() {
+    FlashLog log;
+    TEST_ASSERT_TRUE(log.begin(image()));
+    TEST_ASSERT_EQUAL_UINT32(0, log.getNextLine());
+    TEST_ASSERT_EQUAL_UINT32(0, readBack(log).count);
+}
+
+// Reopen every few lines until the ring has wrapped several times: the
+// recovered head, offset and next line match the log that wrote them
+void test_recover_after_wrap() {
+    const uint32_t end = 3 * SECTORS * linesPerSector();
+    uint32_t total = 0;
+    while (total < end) {
+        FlashLog log;
+        TEST_ASSERT_TRUE(log.begin(image()));
+        TEST_ASSERT_EQUAL_UINT32(total, log.getNextLine());
+        for (int i = 0; i < 37; i++) TEST_ASSERT_TRUE(appendLine(log, total++));
+        uint32_t head = log.getHeadSector();
+        size_t offset = log.getHeadOffset();
+
+        FlashLog again;
+        TEST_ASSERT_TRUE(again.begin(image()));
+        TEST_ASSERT_EQUAL_UINT32(head, again.getHeadSector());
+        TEST_ASSERT_EQUAL_UINT32(offset, again.getHeadOffset());
+        TEST_ASSERT_EQUAL_UINT32(total, again.getNextLine());
+        TEST_ASSERT_EQUAL_UINT32(0, again.getCrcErrors());
+
+        Lines r = readBack(again);
+        TEST_ASSERT_TRUE(r.intact);
+        TEST_ASSERT_EQUAL_UINT32(again.getOldestLine(), r.first);
+        TEST_ASSERT_EQUAL_UINT32(total, r.first + r.count);
+    }
+    FlashLog log;
+    TEST_ASSERT_TRUE(log.begin(image()));
+    TEST_ASSERT_TRUE(log.getOldestLine() > 0);
+}
+
+// A reset in the middle of a record. Torn in the header, the rest of the
+// sector is given up; torn in the payload, the record fails its CRC. The
+// lines before it survive and the next record goes after it.
+void test_torn_record_at_head() {
+    const size_t cuts[] = {2, sizeof(FlashLog::RecordHeader) + 10};
+    for (size_t cut : cuts) {
+        remove(IMAGE);
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(image()));
+            for (uint32_t i = 0; i < 50; i++) TEST_ASSERT_TRUE(appendLine(log, i));
+        }
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(new TornStorage(image(), cut)));
+            TEST_ASSERT_FALSE(appendLine(log, 50));
+        }
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(image()));
+            TEST_ASSERT_EQUAL_UINT32(50, log.getNextLine());
+            TEST_ASSERT_TRUE(appendLine(log, 50));
+        }
+        FlashLog log;
+        TEST_ASSERT_TRUE(log.begin(image()));
+        TEST_ASSERT_EQUAL_UINT32(51, log.getNextLine());
+        Lines r = readBack(log);
+        TEST_ASSERT_TRUE(r.intact);
+        TEST_ASSERT_EQUAL_UINT32(0, r.first);
+        TEST_ASSERT_EQUAL_UINT32(51, r.count);
+    }
+}
+
+// A reset while the next sector is opened: inside its header, before the
+// sector ahead is erased, or inside the first record
+void test_torn_record_at_sector_boundary() {
+    const uint32_t perSector = linesPerSector();
+    const size_t cuts[] = {
+        4,
+        sizeof(FlashLog::SectorHeader),
+        sizeof(FlashLog::SectorHeader) + 8,
+        sizeof(FlashLog::SectorHeader) + sizeof(FlashLog::RecordHeader) + 10,
+    };
+    for (size_t cut : cuts) {
+        remove(IMAGE);
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(image()));
+            for (uint32_t i = 0; i < perSector; i++) TEST_ASSERT_TRUE(appendLine(log, i));
+            TEST_ASSERT_EQUAL_UINT32(0, log.getHeadSector());
+        }
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(new TornStorage(image(), cut)));
+            TEST_ASSERT_FALSE(appendLine(log, perSector));
+        }
+        {
+            FlashLog log;
+            TEST_ASSERT_TRUE(log.begin(image()));
+            TEST_ASSERT_EQUAL_UINT32(perSector, log.getNextLine());
+            TEST_ASSERT_TRUE(appendLine(log, perSector));
+            TEST_ASSERT_TRUE(appendLine(log, perSector + 1));
+        }
+        FlashLog log;
+        TEST_ASSERT_TRUE(log.begin(image()));
+        TEST_ASSERT_EQUAL_UINT32(perSector + 2, log.getNextLine());
+        Lines r = readBack(log);
+        TEST_ASSERT_TRUE(r.intact);
+        TEST_ASSERT_EQUAL_UINT32(0, r.first);
+        TEST_ASSERT_EQUAL_UINT32(perSector + 2, r.count);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_file_storage_is_flash_like);
+    RUN_TEST(test_blank_image);
+    RUN_TEST(test_recover_after_wrap);
+    RUN_TEST(test_torn_record_at_head);
+    RUN_TEST(test_torn_record_at_sector_boundary);
+    return UNITY_END();
+}
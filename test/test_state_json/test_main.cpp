@@ -0,0 +1,136 @@
+#include <unity.h>
+#include <new>
+#include "MQTTHandler.h"
+#include "Thermostat.h"
+#include "OutPin.h"
+#include "InputPin.h"
+#include "HX710.h"
+
+// The state snapshot is rendered into a member buffer: building and
+// publishing it must not touch the heap. Every allocation made while
+// counting is on fails the test.
+
+static bool counting = false;
+static uint32_t allocs = 0;
+
+void* operator new(size_t size) {
+    if (counting) allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+#ifdef __GLIBC__
+// C allocations too (strdup, printf buffers): glibc exports its allocator
+// under these names
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void* malloc(size_t size) {
+    if (counting) allocs++;
+    return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t n, size_t size) {
+    if (counting) allocs++;
+    return __libc_calloc(n, size);
+}
+extern "C" void* realloc(void* p, size_t size) {
+    if (counting) allocs++;
+    return __libc_realloc(p, size);
+}
+#endif
+
+static Scheduler ts;
+static Thermostat thermostat(&ts);
+static MQTTHandler mqtt(&ts);
+static HX710 sensor1(8, 9);
+static HX710 sensor2(10, 11);
+static OutPin* outputs[OUT_COUNT];
+static InputPin* inputs[IN_COUNT];
+static const char* const OUTPUT_NAMES[OUT_COUNT] = {
+    "fan1", "rev", "furn_cool_low", "furn_cool_high", "w1", "w2", "comp1", "comp2"
+};
+
+// Every pin and sensor present, so the snapshot has all its fields
+static void setUpDevice() {
+    for (int i = 0; i < OUT_COUNT; i++) {
+        outputs[i] = new OutPin(&ts, 0, 20 + i, OUTPUT_NAMES[i], "GPIO", nullptr);
+    }
+    inputs[IN_OUT_TEMP_OK] = new InputPin(&ts, 4000, InputResistorType::IT_PULLDOWN,
+                                          InputPinType::IT_DIGITAL, 40, "out_temp_ok", "GPIO40", nullptr);
+    inputs[IN_DEFROST_MODE] = new InputPin(&ts, 2000, InputResistorType::IT_PULLDOWN,
+                                           InputPinType::IT_DIGITAL, 41, "defrost_mode", "GPIO41", nullptr);
+    thermostat.setOutputPins(outputs);
+    thermostat.setInputPins(inputs);
+    thermostat.begin();
+    thermostat.setCurrentTemperature(70.5f);
+    sensor1.begin();
+    sensor2.begin();
+    sensor1.readCalibrated();
+    sensor2.readCalibrated();
+
+    mqtt.setThermostat(&thermostat);
+    mqtt.setPressureSensors(&sensor1, &sensor2);
+    mqtt.setTopicPrefix("thermostat");
+    mqtt.begin(IPAddress(), 1883, "user", "password");
+    mqtt.setEventQos(1);
+    mqtt.getClient()->connect();
+    g_millis += 1000;
+    ts.execute();
+}
+
+void setUp() {}
+
+void tearDown() {
+    counting = false;
+}
+
+void test_publish_state_does_not_allocate() {
+    AsyncMqttClient* client = mqtt.getClient();
+    mqtt.publishState();        // first run sets up anything lazy
+
+    uint32_t before = client->published;
+    allocs = 0;
+    counting = true;
+    for (int i = 0; i < 200; i++) {
+        thermostat.setHeatSetpoint(60.0f + (i % 20) * 0.5f);
+        thermostat.setCurrentTemperature(-20.25f + i);
+        thermostat.setForceFurnace(i & 1);
+        mqtt.publishState();
+        g_millis += 100;
+        ts.execute();
+    }
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocs);
+    TEST_ASSERT_TRUE(client->published - before >= 200);
+}
+
+void test_snapshot_has_every_field() {
+    thermostat.setHeatSetpoint(68.5f);
+    thermostat.setCurrentTemperature(71.25f);
+    AsyncMqttClient* client = mqtt.getClient();
+    client->watch = "thermostat/state";
+    mqtt.publishState();
+    client->watch = nullptr;
+    const char* json = client->lastPayload;
+    TEST_ASSERT_EQUAL_UINT32(mqtt.getStateJsonBytes(), strlen(json));
+    TEST_ASSERT_TRUE(strstr(json, "\"heat_setpoint\":68.5") != nullptr);
+    TEST_ASSERT_TRUE(strstr(json, "\"current_temp\":71.3") != nullptr);
+    TEST_ASSERT_TRUE(strstr(json, "\"outputs\":{\"fan1\":false") != nullptr);
+    TEST_ASSERT_TRUE(strstr(json, "\"inputs\":{\"out_temp_ok\":") != nullptr);
+    TEST_ASSERT_TRUE(strstr(json, "\"pressure1\":") != nullptr);
+}
+
+int main() {
+    setUpDevice();
+    UNITY_BEGIN();
+    RUN_TEST(test_publish_state_does_not_allocate);
+    RUN_TEST(test_snapshot_has_every_field);
+    return UNITY_END();
+}
@@ -0,0 +1,226 @@
+#include <unity.h>
+#include <string>
+#include <vector>
+#include <lwip/sockets.h>
+#include "Logger.h"
+
+// The syslog sink against a UDP socket on localhost: RFC 5424 header,
+// sequenceId per datagram, lines batched up to SYSLOG_DATAGRAM bytes and
+// the dropped count of the rate limit.
+
+static int sock = -1;
+static uint16_t port;
+
+struct Datagram {
+    unsigned pri;
+    char timestamp[32];
+    char hostname[64];
+    unsigned seq;
+    unsigned first;
+    unsigned lines;
+    unsigned dropped;
+    std::string msg;
+    size_t size;
+};
+
+// Everything sent so far; the sink sends synchronously, so it has arrived
+static std::vector<std::string> receive() {
+    std::vector<std::string> out;
+    char buf[2048];
+    ssize_t n;
+    while ((n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        out.push_back(std::string(buf, n));
+    }
+    return out;
+}
+
+// Parses the header, then renders it again: any byte that differs from
+// "<PRI>1 TIMESTAMP HOSTNAME athermostat - log [meta ...][log@32473 ...] "
+// fails the match
+static Datagram parse(const std::string& text) {
+    Datagram d = {};
+    int hl = 0;
+    int n = sscanf(text.c_str(),
+                   "<%u>1 %31s %63s athermostat - log [meta sequenceId=\"%u\"]"
+                   "[log@32473 first=\"%u\" lines=\"%u\" dropped=\"%u\"] %n",
+                   &d.pri, d.timestamp, d.hostname, &d.seq, &d.first, &d.lines, &d.dropped, &hl);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(7, n, text.c_str());
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "<%u>1 %s %s athermostat - log [meta sequenceId=\"%u\"]"
+                       "[log@32473 first=\"%u\" lines=\"%u\" dropped=\"%u\"] ",
+                       d.pri, d.timestamp, d.hostname, d.seq, d.first, d.lines, d.dropped);
+    TEST_ASSERT_EQUAL_STRING(header, text.substr(0, len).c_str());
+    d.msg = text.substr(len);
+    d.size = text.size();
+    return d;
+}
+
+static std::vector<std::string> split(const std::string& msg) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    for (size_t nl; (nl = msg.find('\n', start)) != std::string::npos; start = nl + 1) {
+        lines.push_back(msg.substr(start, nl - start));
+    }
+    lines.push_back(msg.substr(start));
+    return lines;
+}
+
+// Room for the lines is what a header with every field at its widest leaves
+static size_t longestHeader(const char* hostname) {
+    char header[256];
+    return snprintf(header, sizeof(header),
+                    "<191>1 2000-01-01T00:00:00Z %s athermostat - log "
+                    "[meta sequenceId=\"2147483647\"]"
+                    "[log@32473 first=\"4294967295\" lines=\"65535\" dropped=\"4294967295\"] ",
+                    hostname);
+}
+
+static bool endsWith(const std::string& s, const char* tail) {
+    size_t n = strlen(tail);
+    return s.size() >= n && s.compare(s.size() - n, n, tail) == 0;
+}
+
+void setUp() {
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    TEST_ASSERT_TRUE(sock >= 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT_EQUAL_INT(0, bind(sock, (struct sockaddr*)&addr, sizeof(addr)));
+    socklen_t len = sizeof(addr);
+    TEST_ASSERT_EQUAL_INT(0, getsockname(sock, (struct sockaddr*)&addr, &len));
+    port = ntohs(addr.sin_port);
+}
+
+void tearDown() {
+    Log.setSyslog("");
+    close(sock);
+}
+
+void test_header_is_rfc5424() {
+    Log.setSyslog("127.0.0.1", port, 0, "test host");
+    Log.info("SYS", "first %d", 1);
+    Log.warn("SYS", "second %d", 2);
+    Log.flush();
+    TEST_ASSERT_TRUE(Log.isSyslogResolved());
+
+    std::vector<std::string> got = receive();
+    TEST_ASSERT_EQUAL_UINT32(1, got.size());
+    Datagram d = parse(got[0]);
+    TEST_ASSERT_EQUAL_UINT32(16 * 8 + 4, d.pri);     // local0, warning: the worst line
+    // RFC 3339 UTC
+    int year, mon, day, h, m, s;
+    char z = 0;
+    TEST_ASSERT_EQUAL_INT(7, sscanf(d.timestamp, "%4d-%2d-%2dT%2d:%2d:%2d%c",
+                                    &year, &mon, &day, &h, &m, &s, &z));
+    TEST_ASSERT_EQUAL_INT('Z', z);
+    TEST_ASSERT_EQUAL_UINT32(20, strlen(d.timestamp));
+    TEST_ASSERT_EQUAL_STRING("test_host", d.hostname);
+    TEST_ASSERT_EQUAL_UINT32(Log.getSyslogSeq(), d.seq);
+    TEST_ASSERT_EQUAL_UINT32(2, d.lines);
+    TEST_ASSERT_EQUAL_UINT32(0, d.dropped);
+
+    std::vector<std::string> lines = split(d.msg);
+    TEST_ASSERT_EQUAL_UINT32(2, lines.size());
+    TEST_ASSERT_TRUE_MESSAGE(endsWith(lines[0], "[INFO ] [SYS] first 1"), lines[0].c_str());
+    TEST_ASSERT_TRUE_MESSAGE(endsWith(lines[1], "[WARN ] [SYS] second 2"), lines[1].c_str());
+}
+
+void test_sequence_id_counts_datagrams() {
+    Log.setSyslog("127.0.0.1", port, 0);
+    std::vector<Datagram> sent;
+    for (int i = 0; i < 3; i++) {
+        Log.info("SYS", "datagram %d", i);
+        Log.flush();
+        std::vector<std::string> got = receive();
+        TEST_ASSERT_EQUAL_UINT32(1, got.size());
+        sent.push_back(parse(got[0]));
+    }
+    Log.flush();                                    // nothing pending: nothing sent
+    TEST_ASSERT_EQUAL_UINT32(0, receive().size());
+
+    for (size_t i = 1; i < sent.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(sent[i - 1].seq + 1, sent[i].seq);
+        TEST_ASSERT_EQUAL_UINT32(sent[i - 1].first + 1, sent[i].first);
+    }
+    TEST_ASSERT_EQUAL_UINT32(Log.getSyslogSeq(), sent.back().seq);
+}
+
+// Lines are packed until the next one would push the datagram past
+// SYSLOG_DATAGRAM; none is split or lost
+void test_lines_batched_up_to_datagram_size() {
+    Log.setSyslog("127.0.0.1", port, 0);
+    const int count = 60;
+    std::string text(90, 'x');
+    for (int i = 0; i < count; i++) {
+        Log.info("SYS", "batch %02d %s", i, text.c_str());
+    }
+    Log.flush();
+
+    std::vector<std::string> got = receive();
+    TEST_ASSERT_TRUE(got.size() >= 4);
+    unsigned total = 0;
+    unsigned first = parse(got[0]).first;
+    for (size_t i = 0; i < got.size(); i++) {
+        Datagram d = parse(got[i]);
+        TEST_ASSERT_TRUE(d.size <= Logger::SYSLOG_DATAGRAM);
+        std::vector<std::string> lines = split(d.msg);
+        TEST_ASSERT_EQUAL_UINT32(d.lines, lines.size());
+        TEST_ASSERT_EQUAL_UINT32(first + total, d.first);
+        for (size_t j = 0; j < lines.size(); j++) {
+            char want[16];
+            snprintf(want, sizeof(want), "batch %02u ", total + (unsigned)j);
+            TEST_ASSERT_TRUE_MESSAGE(lines[j].find(want) != std::string::npos, lines[j].c_str());
+            TEST_ASSERT_TRUE(endsWith(lines[j], text.c_str()));
+        }
+        // Fits with the longest header; the next line would not have
+        size_t room = Logger::SYSLOG_DATAGRAM - longestHeader(d.hostname);
+        TEST_ASSERT_TRUE(d.msg.size() <= room);
+        if (i + 1 < got.size()) {
+            size_t next = split(parse(got[i + 1]).msg)[0].size();
+            TEST_ASSERT_TRUE(d.msg.size() + 1 + next > room);
+        }
+        total += d.lines;
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, total);
+}
+
+// rate lines a second, a second's worth at once: the rest are counted and
+// reported in the next datagram sent
+void test_rate_limit_reports_dropped() {
+    const uint16_t rate = 5;
+    Log.setSyslog("127.0.0.1", port, rate);
+    uint32_t droppedBefore = Log.getSyslogRateDropped();
+    for (int i = 0; i < 12; i++) {
+        Log.info("SYS", "burst %d", i);
+    }
+    Log.flush();
+    TEST_ASSERT_EQUAL_UINT32(7, Log.getSyslogRateDropped() - droppedBefore);
+
+    std::vector<std::string> got = receive();
+    TEST_ASSERT_EQUAL_UINT32(1, got.size());
+    Datagram d = parse(got[0]);
+    TEST_ASSERT_EQUAL_UINT32(rate, d.lines);
+    TEST_ASSERT_EQUAL_UINT32(7, d.dropped);
+    TEST_ASSERT_TRUE(endsWith(split(d.msg).back(), "burst 4"));
+
+    // A second later the bucket is full again and the count starts over
+    g_millis += 1000;
+    Log.info("SYS", "after");
+    Log.flush();
+    got = receive();
+    TEST_ASSERT_EQUAL_UINT32(1, got.size());
+    d = parse(got[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, d.lines);
+    TEST_ASSERT_EQUAL_UINT32(0, d.dropped);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_header_is_rfc5424);
+    RUN_TEST(test_sequence_id_counts_datagrams);
+    RUN_TEST(test_lines_batched_up_to_datagram_size);
+    RUN_TEST(test_rate_limit_reports_dropped);
+    return UNITY_END();
+}
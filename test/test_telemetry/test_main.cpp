@@ -0,0 +1,334 @@
+#include <unity.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "MQTTHandler.h"
+#include "Thermostat.h"
+#include "OutPin.h"
+#include "InputPin.h"
+#include "HX710.h"
+
+// Telemetry frames must decode with the Python decoder in the README
+// ("### Binary telemetry"): its NAMES and struct format are read from
+// README.md, so the test fails when the frame and the spec diverge. One
+// frame is packed by hand to pin the layout; the others are what
+// publishTelemetry() sends for a known device state.
+
+#ifndef README_PATH
+#define README_PATH "README.md"
+#endif
+
+typedef MQTTHandler::TelemetryFrame Frame;
+
+struct Spec {
+    std::vector<std::string> names;
+    std::string format;
+};
+
+static std::string readFile(const char* path) {
+    std::string text;
+    FILE* f = fopen(path, "rb");
+    if (!f) return text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    fclose(f);
+    return text;
+}
+
+// NAMES = ("..." "...").split() and struct.unpack_from("<...", b) from the
+// decoder block of the Binary telemetry section
+static bool parseSpec(const std::string& readme, Spec& spec) {
+    size_t section = readme.find("### Binary telemetry");
+    if (section == std::string::npos) return false;
+    size_t names = readme.find("NAMES = (", section);
+    size_t namesEnd = readme.find(").split()", names);
+    size_t format = readme.find("struct.unpack_from(\"", section);
+    if (names == std::string::npos || namesEnd == std::string::npos || format == std::string::npos) {
+        return false;
+    }
+
+    std::string words;
+    size_t p = names;
+    while ((p = readme.find('"', p)) < namesEnd) {
+        size_t q = readme.find('"', p + 1);
+        words += readme.substr(p + 1, q - p - 1);
+        p = q + 1;
+    }
+    size_t w = 0;
+    while ((w = words.find_first_not_of(' ', w)) != std::string::npos) {
+        size_t end = words.find(' ', w);
+        if (end == std::string::npos) end = words.size();
+        spec.names.push_back(words.substr(w, end - w));
+        w = end;
+    }
+
+    format += strlen("struct.unpack_from(\"");
+    spec.format = readme.substr(format, readme.find('"', format) - format);
+    return !spec.names.empty() && !spec.format.empty();
+}
+
+struct Item {
+    size_t size;
+    bool isSigned;
+};
+
+// Little-endian standard sizes, integer codes only
+static bool parseFormat(const std::string& format, std::vector<Item>& items) {
+    if (format.empty() || format[0] != '<') return false;
+    for (size_t i = 1; i < format.size(); i++) {
+        int count = 0;
+        while (isdigit((unsigned char)format[i])) count = count * 10 + (format[i++] - '0');
+        Item item;
+        switch (format[i]) {
+            case 'B': item = {1, false}; break;
+            case 'b': item = {1, true}; break;
+            case 'H': item = {2, false}; break;
+            case 'h': item = {2, true}; break;
+            case 'I': item = {4, false}; break;
+            case 'i': item = {4, true}; break;
+            case 'Q': item = {8, false}; break;
+            case 'q': item = {8, true}; break;
+            default: return false;
+        }
+        for (int n = count ? count : 1; n > 0; n--) items.push_back(item);
+    }
+    return true;
+}
+
+static int64_t decode(const uint8_t* b, const Item& item) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < item.size; i++) v |= (uint64_t)b[i] << (8 * i);
+    if (item.isSigned && item.size < 8 && (v >> (8 * item.size - 1)) & 1) {
+        v |= ~(uint64_t)0 << (8 * item.size);
+    }
+    return (int64_t)v;
+}
+
+typedef std::map<std::string, int64_t> Decoded;
+
+static void loadSpec(Spec& spec, std::vector<Item>& items) {
+    std::string readme = readFile(README_PATH);
+    TEST_ASSERT_TRUE_MESSAGE(!readme.empty(), "README.md not found");
+    TEST_ASSERT_TRUE_MESSAGE(parseSpec(readme, spec), "no decoder in README Binary telemetry");
+    TEST_ASSERT_TRUE_MESSAGE(parseFormat(spec.format, items), spec.format.c_str());
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(spec.names.size(), items.size(), "NAMES vs struct format");
+}
+
+// decode(b) from the README: version check, then NAMES zipped with the values
+static Decoded decodeFrame(const uint8_t* b, size_t len) {
+    Spec spec;
+    std::vector<Item> items;
+    loadSpec(spec, items);
+    size_t total = 0;
+    for (const Item& item : items) total += item.size;
+    TEST_ASSERT_TRUE_MESSAGE(len >= total, "frame shorter than struct.calcsize");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, b[0], "decoder accepts version 1 only");
+
+    Decoded d;
+    size_t offset = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        d[spec.names[i]] = decode(b + offset, items[i]);
+        offset += items[i].size;
+    }
+    return d;
+}
+
+struct Field {
+    const char* name;           // as in the README's NAMES
+    int64_t value;
+};
+
+// The device publishTelemetry() reports on
+static Scheduler ts;
+static Thermostat thermostat(&ts);
+static MQTTHandler mqtt(&ts);
+static HX710 sensor1(8, 9);
+static HX710 sensor2(10, 11);
+static OutPin* outputs[OUT_COUNT];
+static InputPin* inputs[IN_COUNT];
+static const char* const OUTPUT_NAMES[OUT_COUNT] = {
+    "fan1", "rev", "furn_cool_low", "furn_cool_high", "w1", "w2", "comp1", "comp2"
+};
+
+// HX710 data lines: LOW (ready), then 24 bits MSB first, for every read
+struct Feed {
+    uint8_t pin;
+    uint32_t bits;
+    int next;                   // bit to send next, -1: the ready check
+};
+static Feed feeds[] = {{8, 0xEDCBAA, -1}, {10, 0x0A0B0C, -1}};
+static const int32_t RAW1 = -0x123456;
+static const int32_t RAW2 = 0x0A0B0C;
+
+static int feedRead(uint8_t pin) {
+    for (Feed& f : feeds) {
+        if (f.pin != pin) continue;
+        if (f.next < 0) {
+            f.next = 23;
+            return LOW;
+        }
+        return (f.bits >> f.next--) & 1;
+    }
+    return g_pinLevel[pin & 63];
+}
+
+static void setUpDevice() {
+    for (int i = 0; i < OUT_COUNT; i++) {
+        outputs[i] = new OutPin(&ts, 0, 20 + i, OUTPUT_NAMES[i], "GPIO", nullptr);
+    }
+    inputs[IN_OUT_TEMP_OK] = new InputPin(&ts, 4000, InputResistorType::IT_PULLDOWN,
+                                          InputPinType::IT_DIGITAL, 40, "out_temp_ok", "GPIO40", nullptr);
+    inputs[IN_DEFROST_MODE] = new InputPin(&ts, 2000, InputResistorType::IT_PULLDOWN,
+                                           InputPinType::IT_DIGITAL, 41, "defrost_mode", "GPIO41", nullptr);
+    thermostat.setOutputPins(outputs);
+    thermostat.setInputPins(inputs);
+    thermostat.begin();
+    g_digitalRead = feedRead;
+    sensor1.begin();
+    sensor2.begin();
+    // value = raw / 10000
+    sensor1.setCalibration(0, 0.0f, 1000000, 100.0f);
+    sensor2.setCalibration(0, 0.0f, 1000000, 100.0f);
+
+    mqtt.setThermostat(&thermostat);
+    mqtt.setPressureSensors(&sensor1, &sensor2);
+    mqtt.setTopicPrefix("thermostat");
+    mqtt.begin(IPAddress(), 1883, "user", "password");
+    mqtt.getClient()->connect();
+    mqtt.getClient()->watch = "thermostat/telemetry";
+    g_millis += 1000;
+    ts.execute();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_frame_decodes_with_readme_decoder() {
+    Spec spec;
+    std::vector<Item> items;
+    loadSpec(spec, items);
+
+    // Every byte of every field differs, so a moved or resized member shows
+    Frame f;
+    f.version = MQTTHandler::TELEMETRY_VERSION;
+    f.size = sizeof(f);
+    f.seq = 0xA1B2;
+    f.epoch = 0xC3D4E5F6;
+    f.ms = 0x0718293A;
+    f.mode = 0x11;
+    f.action = 0x12;
+    f.heatLevel = 0x13;
+    f.coolLevel = 0x14;
+    f.flags = 0x15;
+    f.outputs = 0x16;
+    f.inputs = 0x17;
+    f.cpuLoad = 0x18;
+    f.currentTemp = -0x2122;
+    f.heatSetpoint = 0x2324;
+    f.coolSetpoint = -0x2526;
+    f.cpuTemp = 0x2728;
+    f.pressure1 = -0x31323334;
+    f.pressure2 = 0x35363738;
+    f.raw1 = -0x00414243;
+    f.raw2 = 0x00444546;
+
+    const Field fields[] = {
+        {"version", f.version}, {"size", f.size}, {"seq", f.seq}, {"epoch", f.epoch}, {"ms", f.ms},
+        {"mode", f.mode}, {"action", f.action}, {"heat_level", f.heatLevel},
+        {"cool_level", f.coolLevel}, {"flags", f.flags}, {"outputs", f.outputs},
+        {"inputs", f.inputs}, {"cpu_load", f.cpuLoad}, {"current_temp", f.currentTemp},
+        {"heat_setpoint", f.heatSetpoint}, {"cool_setpoint", f.coolSetpoint},
+        {"cpu_temp", f.cpuTemp}, {"pressure1", f.pressure1}, {"pressure2", f.pressure2},
+        {"raw1", f.raw1}, {"raw2", f.raw2},
+    };
+    const size_t fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(fieldCount, spec.names.size(), "README fields vs TelemetryFrame");
+    size_t total = 0;
+    for (const Item& item : items) total += item.size;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(sizeof(Frame), total, "struct.calcsize vs sizeof(TelemetryFrame)");
+
+    uint8_t bytes[sizeof(Frame)];
+    memcpy(bytes, &f, sizeof(f));
+    Decoded d = decodeFrame(bytes, sizeof(bytes));
+    for (const Field& field : fields) {
+        TEST_ASSERT_TRUE_MESSAGE(d.count(field.name) == 1, field.name);
+        TEST_ASSERT_TRUE_MESSAGE(d[field.name] == field.value, field.name);
+    }
+}
+
+// One frame from the telemetry task, as a subscriber receives it
+static Decoded nextFrame() {
+    AsyncMqttClient* client = mqtt.getClient();
+    uint32_t frames = mqtt.getTelemetryFrames();
+    client->lastLen = 0;
+    g_millis += 100;
+    ts.execute();
+    TEST_ASSERT_EQUAL_UINT32(frames + 1, mqtt.getTelemetryFrames());
+    TEST_ASSERT_EQUAL_STRING("thermostat/telemetry", client->lastTopic);
+    TEST_ASSERT_EQUAL_UINT32(MQTTHandler::getTelemetryBytes(), client->lastLen);
+    return decodeFrame((const uint8_t*)client->lastPayload, client->lastLen);
+}
+
+void test_published_frame_decodes_with_readme_decoder() {
+    thermostat.setMode(ThermostatMode::COOL);
+    thermostat.setCurrentTemperature(-3.5f);
+    thermostat.setHeatSetpoint(66.5f);
+    thermostat.setCoolSetpoint(77.0f);
+    thermostat.setForceFurnace(true);
+    thermostat.setForceNoHP(true);
+    outputs[OUT_FAN1]->setOverride(true, true);
+    outputs[OUT_COMP2]->setOverride(true, true);
+    mqtt.setTelemetryInterval(100);
+
+    time_t before = time(nullptr);
+    Decoded d = nextFrame();
+    time_t after = time(nullptr);
+
+    TEST_ASSERT_EQUAL_INT64(1, d["version"]);
+    TEST_ASSERT_EQUAL_INT64(44, d["size"]);
+    TEST_ASSERT_TRUE(d["epoch"] >= before && d["epoch"] <= after);
+    TEST_ASSERT_EQUAL_INT64(g_millis, d["ms"]);
+    TEST_ASSERT_EQUAL_INT64((uint8_t)ThermostatMode::COOL, d["mode"]);
+    TEST_ASSERT_EQUAL_INT64((uint8_t)thermostat.getAction(), d["action"]);
+    TEST_ASSERT_EQUAL_INT64((uint8_t)thermostat.getHeatLevel(), d["heat_level"]);
+    TEST_ASSERT_EQUAL_INT64((uint8_t)thermostat.getCoolLevel(), d["cool_level"]);
+    TEST_ASSERT_EQUAL_INT64(MQTTHandler::TF_TEMP_VALID | MQTTHandler::TF_PRESSURE1_VALID |
+                            MQTTHandler::TF_PRESSURE2_VALID | MQTTHandler::TF_FORCE_FURNACE |
+                            MQTTHandler::TF_FORCE_NO_HP, d["flags"]);
+    int64_t on = 0;
+    for (int i = 0; i < OUT_COUNT; i++) {
+        if (outputs[i]->isPinOn()) on |= 1 << i;
+    }
+    TEST_ASSERT_EQUAL_INT64(on, d["outputs"]);
+    TEST_ASSERT_EQUAL_INT64(1 << OUT_FAN1 | 1 << OUT_COMP2, d["outputs"] & (1 << OUT_FAN1 | 1 << OUT_COMP2));
+    TEST_ASSERT_EQUAL_INT64(0, d["inputs"]);
+    TEST_ASSERT_EQUAL_INT64(15, d["cpu_load"]);             // main_stubs.cpp: 10 and 20 %
+
+    // x10 and x100, rounded
+    TEST_ASSERT_EQUAL_INT64(-35, d["current_temp"]);
+    TEST_ASSERT_EQUAL_INT64(665, d["heat_setpoint"]);
+    TEST_ASSERT_EQUAL_INT64(770, d["cool_setpoint"]);
+    TEST_ASSERT_EQUAL_INT64(1040, d["cpu_temp"]);           // 40 °C
+    TEST_ASSERT_EQUAL_INT64(RAW1, d["raw1"]);
+    TEST_ASSERT_EQUAL_INT64(RAW2, d["raw2"]);
+    TEST_ASSERT_EQUAL_INT64(-11930, d["pressure1"]);        // -119.3046
+    TEST_ASSERT_EQUAL_INT64(6582, d["pressure2"]);          // 65.8188
+
+    // A cleared force drops its flag; seq counts frames
+    thermostat.setForceFurnace(false);
+    Decoded next = nextFrame();
+    TEST_ASSERT_EQUAL_INT64((d["seq"] + 1) & 0xFFFF, next["seq"]);
+    TEST_ASSERT_EQUAL_INT64(d["flags"] & ~MQTTHandler::TF_FORCE_FURNACE, next["flags"]);
+    TEST_ASSERT_EQUAL_INT64(g_millis, next["ms"]);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_decodes_with_readme_decoder);
+    setUpDevice();
+    RUN_TEST(test_published_frame_decodes_with_readme_decoder);
+    return UNITY_END();
+}